@@ -1,10 +1,18 @@
 #version 120
+#extension GL_EXT_texture_array : require
 
 varying vec2 psUV;
+varying vec2 psLightMapUV;
+varying float psLayer;
 
 // Texture variables.
-uniform sampler2D texture;
+uniform sampler2DArray texture; // One layer per animation frame.
+uniform sampler2D lightMap;
+
+// Opacity of translucent surfaces.
+uniform float alpha;
 
 void main(void) {
-	gl_FragColor = texture2D(texture, psUV);
+	vec4 colour = texture2DArray(texture, vec3(psUV, psLayer));
+	gl_FragColor = vec4(colour.rgb * texture2D(lightMap, psLightMapUV).rgb, colour.a * alpha);
 }
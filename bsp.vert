@@ -1,19 +1,33 @@
 #version 120
 
 // Input and output attributes.
-attribute vec3 position;
+// Positions are in quarters of a unit and texture coordinates in eighths of a texel.
+// The fourth position component is the face's first texture animation frame.
+attribute vec4 position;
 attribute vec2 uv;
 attribute vec2 lightMapUV;
 varying vec2 psUV;
+varying vec2 psLightMapUV;
+varying float psLayer;
+
+// Fixed point scales matching the world vertex format.
+const float positionScale = 1.0 / 4.0;
+const float uvScale = 1.0 / 8.0;
 
 // Texture size uniform.
 uniform vec2 textureSize;
 
+// Texture animation; each face's frame is offset from the current one.
+uniform float frameCount;
+uniform float animationFrame;
+
 // Camera view variables.
 uniform mat4 projectionView;
 
 // Pass vertex colour to next shader.
 void main(void) {
-	gl_Position = projectionView * vec4(position, 1.f);
-	psUV = (uv / textureSize) + lightMapUV; // Lightmap is (0, 0) for now.
+	gl_Position = projectionView * vec4(position.xyz * positionScale, 1.0);
+	psUV = (uv * uvScale) / textureSize;
+	psLightMapUV = lightMapUV;
+	psLayer = mod(position.w + animationFrame, frameCount);
 }
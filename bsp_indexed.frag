@@ -0,0 +1,23 @@
+#version 120
+#extension GL_EXT_texture_array : require
+
+varying vec2 psUV;
+varying vec2 psLightMapUV;
+varying float psLayer;
+
+// Texture variables.
+uniform sampler2DArray texture; // Palette indices, one layer per animation frame.
+uniform sampler1D palette;
+uniform sampler2D lightMap;
+
+// Opacity of translucent surfaces.
+uniform float alpha;
+
+// Indices are read back normalized, so scale them to the centre of their palette entry.
+const float PaletteSize = 256.0;
+
+void main(void) {
+	float index = texture2DArray(texture, vec3(psUV, psLayer)).r;
+	vec4 colour = texture1D(palette, ((index * (PaletteSize - 1.0)) + 0.5) / PaletteSize);
+	gl_FragColor = vec4(colour.rgb * texture2D(lightMap, psLightMapUV).rgb, colour.a * alpha);
+}
@@ -75,6 +75,9 @@ public:
 	// Pass the model for rendering.
 	void Draw(Renderer::Interface *renderer);
 
+	// Get the object-space bounds over all frames.
+	void GetBounds(Vector3 *minimums, Vector3 *maximums) const;
+
 	// Model buffer functions.
 	inline EntityModelFrame *GetFrames() { return frames; }
 	inline int GetFrameCount() const { return frameCount; }
@@ -2,10 +2,13 @@
 
 #include "camera.h"
 #include "entity_model.h"
+#include <bsp_light_styles.h>
 #include <bsp_map.h>
+#include <bsp_texture_residency.h>
 #include <renderer/material_interface.h>
 #include <renderer/shared.h>
 #include <renderer/variable_interface.h>
+#include <texture_cache.h>
 #include <game_manager_listener.h>
 #include <game_manager_utilities.h>
 #include <game_module.h>
@@ -35,13 +38,17 @@ private:
 	void FreeResources();
 	bool InitializeShaders();
 
+	// Statistics reporting functions.
+	void ReportWorldStatistics() const;
+	void ReportResidencyStatistics();
+
 private:
 
 	// Reference for game manager utilities.
 	GameManager::Utilities *utilities;
 
 	// Shader parameters.
-	Renderer::Texture *modelSkin;
+	TextureCacheEntry *modelSkin;
 	Renderer::Material *modelMaterial;
 
 	// Uniform variables for rendering.
@@ -52,7 +59,16 @@ private:
 	// Model and map to render.
 	Camera camera;
 	EntityModel model;
+	Vector3 modelMinimums;
+	Vector3 modelMaximums;
 	BSP::Map map;
+	BSP::LightStyles lightStyles;
+	BSP::ViewContext view;
+	BSP::OcclusionCuller occlusionCuller;
+	BSP::TextureResidency textureResidency;
+
+	// Residency statistics as last reported.
+	BSP::ResidencyStatistics reportedResidency;
 
 private:
 
@@ -151,6 +151,32 @@ void EntityModel::Draw(Renderer::Interface *renderer)
 	renderer->UnsetMaterialLayout(layout);
 }
 
+// Get the box containing every frame's vertices.
+void EntityModel::GetBounds(Vector3 *minimums, Vector3 *maximums) const
+{
+	const EntityModelVertex *vertex = mesh.GetVertexBuffer();
+	int vertexCount = mesh.GetVertexCount();
+	if (vertexCount == 0) {
+		minimums->Clear();
+		maximums->Clear();
+		return;
+	}
+	*minimums = vertex->position;
+	*maximums = vertex->position;
+	for (int i = 1; i < vertexCount; ++i) {
+		++vertex;
+		const Vector3 *position = &vertex->position;
+		minimums->Set(
+			(position->x < minimums->x) ? position->x : minimums->x,
+			(position->y < minimums->y) ? position->y : minimums->y,
+			(position->z < minimums->z) ? position->z : minimums->z);
+		maximums->Set(
+			(position->x > maximums->x) ? position->x : maximums->x,
+			(position->y > maximums->y) ? position->y : maximums->y,
+			(position->z > maximums->z) ? position->z : maximums->z);
+	}
+}
+
 // Prepare the entity for rendering.
 bool EntityModel::LoadStaticResources(Renderer::Resources *resources, Renderer::Material *modelMaterial)
 {
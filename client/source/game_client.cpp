@@ -4,10 +4,12 @@
 #include <image.h>
 #include <math_common.h>
 #include <memory_manager.h>
+#include <mip_map_generator.h>
 #include <pcx_parser.h>
 #include <quake_file_manager.h>
 #include <stdio.h>
 #include <wal_parser.h>
+#include <worker_pool.h>
 
 // Rendering parameters.
 const char *ModelVertexShader = "md2.vert";
@@ -17,11 +19,37 @@ const float FarDistanceZ = 4096.0f;
 const float AspectRatio = 4.0f / 3.0f;
 const float FieldOfView = 90.0f;
 
+// Keep map textures as palette indices, looked up when drawn, for a quarter of the texture memory.
+const bool UseIndexedMapTextures = false;
+
+// Block compress map textures where the renderer supports it, caching the results on disk.
+const bool UseCompressedMapTextures = true;
+
+// Draw map faces with a placeholder until their textures stream in, so the first frame doesn't wait for them.
+const bool UseLazyMapTextures = false;
+
+// Bytes of map face textures kept resident; the rest stream in as the view can see them.
+const int64_t MapTextureBudget = 64 * 1024 * 1024;
+
+// Bytes of idle image buffers kept for reuse between texture loads.
+const int64_t PixelBufferPoolSize = 32 * 1024 * 1024;
+
+// Print map statistics to standard output: the world's once it loads, and texture
+// residency at most once a second while textures are streaming.
+const bool ReportStatistics = false;
+
+// Frames are assumed to run at a fixed rate until the game manager provides a clock.
+const int32_t TicksPerSecond = 60;
+const int32_t TicksPerLightStyleFrame = TicksPerSecond / BSP::LightStyles::FramesPerSecond;
+const int32_t TicksPerTextureFrame = TicksPerSecond / BSP::TextureFramesPerSecond;
+
 Client::Client()
 	: utilities(nullptr),
+	modelSkin(nullptr),
 	modelMaterial(nullptr),
 	modelObject(nullptr),
-	modelProjectionView(nullptr)
+	modelProjectionView(nullptr),
+	reportedResidency()
 {
 	camera.SetPosition(Vector3::Zero);
 }
@@ -91,6 +119,7 @@ bool Client::OnTick()
 bool Client::OnTickEnd()
 {
 	static float angle = 0.f;
+	static int32_t tick = 0;
 	Renderer::Interface *renderer = utilities->GetRenderer();
 	renderer->ClearScene();
 
@@ -110,17 +139,34 @@ bool Client::OnTickEnd()
 	obj.Product(&objectMatrix, &rotate);
 	angle += 1.f;
 
+	// Animate light styles and textures; only faces whose styles changed are uploaded.
+	lightStyles.Update(tick / TicksPerLightStyleFrame, &map);
+	map.SetTextureFrame(tick / TicksPerTextureFrame);
+	++tick;
+	if (!map.UpdateLightMaps(utilities->GetRendererResources())) {
+		return false;
+	}
+
 	// Draw map.
 	const Vector3 *cameraPosition = camera.GetPosition();
-	map.Draw(renderer, *cameraPosition, projectionView);
-
-	// Draw model.
-	renderer->SetMaterial(modelMaterial);
-	modelObject->SetMatrix4x4(&obj);
-	modelProjectionView->SetMatrix4x4(&projectionView);
-	renderer->SetTexture(modelSkin, 0);
-	model.Draw(renderer);
-	renderer->UnsetMaterial(modelMaterial);
+	map.UpdateVisibility(&view, *cameraPosition, projectionView, &occlusionCuller);
+	if (!textureResidency.Update(utilities->GetRendererResources(), view.GetVisibleCluster())) {
+		return false;
+	}
+	if (ReportStatistics && ((tick % TicksPerSecond) == 0)) {
+		ReportResidencyStatistics();
+	}
+	map.Draw(renderer, &view, projectionView);
+
+	// Draw model if not hidden behind the map.
+	if (occlusionCuller.IsBoxVisible(obj, modelMinimums, modelMaximums)) {
+		renderer->SetMaterial(modelMaterial);
+		modelObject->SetMatrix4x4(&obj);
+		modelProjectionView->SetMatrix4x4(&projectionView);
+		renderer->SetTexture(modelSkin->texture, 0);
+		model.Draw(renderer);
+		renderer->UnsetMaterial(modelMaterial);
+	}
 
 	utilities->PresentFrame();
 	return true;
@@ -159,27 +205,58 @@ bool Client::LoadResources(void)
 		return false;
 	}
 	
-	// Prepare to load game resources.
-	Renderer::Resources *resources = utilities->GetRendererResources();
+	// Start worker threads for background work.
+	if (!WorkerPool::Initialize(0)) {
+		return false;
+	}
 
-	// Initialize map painter.
-	if (!BSP::Painter::Initialize(resources)) {
+	// Share textures between the map and models.
+	if (!TextureCache::Initialize()) {
 		return false;
 	}
 
+	// Reuse image buffers between texture loads.
+	if (!PixelBufferPool::Initialize(PixelBufferPoolSize)) {
+		return false;
+	}
+	
+	// Prepare to load game resources.
+	Renderer::Resources *resources = utilities->GetRendererResources();
+
 	// Load the palette.
 	if (!WAL::Parser::LoadPalette()) {
 		return false;
 	}
 
+	// Initialize map painter.
+	if (!BSP::Painter::Initialize(resources, UseIndexedMapTextures)) {
+		return false;
+	}
+
 	// Load map.
 	BSP::FileFormat::Parser bspParser;
+	bspParser.SetMergeFaces(true);
 	if (!bspParser.Load("maps/city1.bsp", &map)) {
 		return false;
 	}
+	map.SetCompressedTextures(UseCompressedMapTextures);
+	map.SetTextureBudget(MapTextureBudget);
+	map.SetLazyTextures(UseLazyMapTextures);
 	if (!map.LoadResources(resources)) {
 		return false;
 	}
+	if (ReportStatistics) {
+		ReportWorldStatistics();
+	}
+	if (!view.Initialize(&map)) {
+		return false;
+	}
+	if (!occlusionCuller.Initialize(&map)) {
+		return false;
+	}
+	if (!textureResidency.Initialize(&map)) {
+		return false;
+	}
 
 	// Load model.
 	MD2::Parser md2Parser;
@@ -189,18 +266,36 @@ bool Client::LoadResources(void)
 	if (!model.LoadResources(resources)) {
 		return false;
 	}
+	model.GetBounds(&modelMinimums, &modelMaximums);
 
-	// Load texture.
-	Image<PixelRGBA> image;
-	PCX::Parser pcxParser;
-	if (!pcxParser.Load("models/monsters/bitch/skin.pcx", &image)) {
-		return false;
-	}
-
-	// Create a texture.
-	modelSkin = resources->CreateTexture(&image);
+	// Load texture, unless another model already has.
+	const char *skinPath = "models/monsters/bitch/skin.pcx";
+	modelSkin = TextureCache::instance->Acquire(skinPath);
 	if (modelSkin == nullptr) {
-		return false;
+		Image<PixelRGBA> image;
+		PCX::Parser pcxParser;
+		if (!pcxParser.Load(skinPath, &image)) {
+			return false;
+		}
+
+		// Skins have no precomputed mip levels, so build them before creating the texture.
+		Image<PixelRGBA> mipMappedImage;
+		if (!MipMapGenerator::Generate(&image, &mipMappedImage)) {
+			return false;
+		}
+		Renderer::Texture *skinTexture = resources->CreateTexture(&mipMappedImage);
+		if (skinTexture == nullptr) {
+			return false;
+		}
+		modelSkin = TextureCache::instance->Add(
+			skinPath,
+			skinTexture,
+			image.GetWidth(),
+			image.GetHeight(),
+			mipMappedImage.GetBufferSize());
+		if (modelSkin == nullptr) {
+			return false;
+		}
 	}
 
 	// Set up camera projection.
@@ -230,9 +325,11 @@ void Client::FreeResources(void)
     delete modelTexture;
     modelTexture = nullptr;
 
-	// Destroy textures.
-    delete modelSkin;
-    modelSkin = nullptr;
+	// Release textures.
+	if (modelSkin != nullptr) {
+		TextureCache::instance->Release(modelSkin);
+		modelSkin = nullptr;
+	}
 
 	// Destroy materials.
     delete modelMaterial;
@@ -240,12 +337,53 @@ void Client::FreeResources(void)
 
 	// Destroy model.
 	model.Destroy();
+	occlusionCuller.Destroy();
+	textureResidency.Destroy();
+	view.Destroy();
 	map.Destroy();
 
 	// Destroy static materials.
 	EntityModel::FreeStaticResources();
 	BSP::Painter::Shutdown();
 	WAL::Parser::DestroyPalette();
+	TextureCache::Shutdown();
+	PixelBufferPool::Shutdown();
+	WorkerPool::Shutdown();
+}
+
+// Print how welding and index ordering reduced the world's vertex work.
+void Client::ReportWorldStatistics() const
+{
+	const BSP::WorldStatistics *statistics = map.GetWorldStatistics();
+	printf(
+		"World: %d triangles, %d vertices welded to %d, %.3f cache misses per triangle in fan order and %.3f optimized.\n",
+		statistics->triangleCount,
+		statistics->faceVertexCount,
+		statistics->vertexCount,
+		statistics->fanCacheMissRatio,
+		statistics->optimizedCacheMissRatio);
+}
+
+// Print texture residency if any textures were loaded or released, or are still missing, since the last report.
+void Client::ReportResidencyStatistics()
+{
+	const BSP::ResidencyStatistics *statistics = textureResidency.GetStatistics();
+	if ((statistics->loadCount == reportedResidency.loadCount) &&
+		(statistics->evictionCount == reportedResidency.evictionCount) &&
+		(statistics->missingCount == reportedResidency.missingCount)) {
+		return;
+	}
+	printf(
+		"Textures: %d of %d resident in %lld of %lld bytes, %d of %d wanted missing, %d loaded and %d released.\n",
+		statistics->residentCount,
+		statistics->textureCount,
+		static_cast<long long>(statistics->residentBytes),
+		static_cast<long long>(statistics->budgetBytes),
+		statistics->missingCount,
+		statistics->wantedCount,
+		statistics->loadCount,
+		statistics->evictionCount);
+	reportedResidency = *statistics;
 }
 
 // Initialize the game's shaders for rendering.
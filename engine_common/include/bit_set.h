@@ -0,0 +1,63 @@
+#pragma once
+
+#include "allocatable.h"
+#include "common_define.h"
+#include <inttypes.h>
+
+// Dense set of bits packed into 32-bit words.
+class CommonLibrary BitSet : public Allocatable
+{
+
+public:
+
+	BitSet();
+	~BitSet();
+
+	// Allocate storage for a number of bits, all initially clear.
+	bool Initialize(int32_t bitCount);
+
+	// Free bit storage.
+	void Destroy();
+
+	// Clear all bits.
+	void Clear();
+
+	// Set, unset or check a single bit.
+	inline void Set(int32_t index) { words[index >> WordIndexShift] |= (1u << (index & BitIndexMask)); }
+	inline void Unset(int32_t index) { words[index >> WordIndexShift] &= ~(1u << (index & BitIndexMask)); }
+	inline bool IsSet(int32_t index) const { return (words[index >> WordIndexShift] & (1u << (index & BitIndexMask))) != 0; }
+
+	// Store the bits that differ between two sets of the same size.
+	void SymmetricDifference(const BitSet &a, const BitSet &b);
+
+	// Exchange storage with another set.
+	void Swap(BitSet *other);
+
+	// Write out the indices of all set bits in [start, end) in increasing order.
+	// Returns the number of indices written.
+	int32_t GetSetBits(int32_t start, int32_t end, int32_t *out) const;
+
+	inline const uint32_t *GetWords() const { return words; }
+	inline uint32_t *GetWords() { return words; }
+	inline int32_t GetWordCount() const { return wordCount; }
+	inline int32_t GetBitCount() const { return bitCount; }
+
+public:
+
+	// Get the index of the lowest set bit of a non-zero word.
+	static int32_t FindFirstSet(uint32_t word);
+
+public:
+
+	static const int32_t BitsPerWord = 32; // Number of bits in a single word.
+	static const uint32_t WordIndexShift = 5; // Bits to shift to get the word for a bit.
+	static const uint32_t BitIndexMask = 31; // Mask for retrieving bit index in a word.
+	static const int32_t WordsPerBlock = 4; // Words cleared per SIMD store; storage is padded to a whole block.
+
+private:
+
+	uint32_t *words;
+	int32_t wordCount;
+	int32_t bitCount;
+
+};
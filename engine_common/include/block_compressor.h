@@ -0,0 +1,39 @@
+#pragma once
+
+#include "common_define.h"
+#include "compressed_image.h"
+#include "image.h"
+
+// Encodes images into BC1 or BC3 blocks on the CPU.
+// Endpoints come from each block's colour bounds, inset slightly to cut the error
+// at the extremes, so encoding is fast enough to run while loading.
+class CommonLibrary BlockCompressor
+{
+
+public:
+
+	// Choose the format for an image; BC3 if any pixel isn't opaque, BC1 otherwise.
+	static CompressedFormat ChooseFormat(const Image<PixelRGBA> *image);
+
+	// Compress every level of an image into a format.
+	// Images that share a texture array have to share a format, so it's chosen by the caller.
+	static bool Compress(const Image<PixelRGBA> *image, CompressedFormat format, CompressedImage *out);
+
+	// Gather the 4x4 block at a pixel position in a level, in rows.
+	// Blocks past the edge of the level repeat its last row or column.
+	static void ReadBlock(
+		const PixelRGBA *level,
+		int width,
+		int height,
+		int x,
+		int y,
+		PixelRGBA *out);
+
+	// Encode a block's colour into 8 bytes of BC1.
+	// Fully transparent pixels don't affect the endpoints.
+	static void EncodeColourBlock(const PixelRGBA *pixels, uint8_t *out);
+
+	// Encode a block's alpha into the first 8 bytes of a BC3 block.
+	static void EncodeAlphaBlock(const PixelRGBA *pixels, uint8_t *out);
+
+};
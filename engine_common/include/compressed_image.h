@@ -0,0 +1,71 @@
+#pragma once
+
+#include "allocatable.h"
+#include "common_define.h"
+#include <inttypes.h>
+
+// Block compression formats, each encoding 4x4 pixel blocks.
+enum CompressedFormat
+{
+	BC1Format, // 8 bytes per block of opaque colour.
+	BC3Format // 16 bytes per block; BC1 colour after interpolated alpha.
+};
+
+// Block compressed image and its mip levels, stored one after another from the full size level.
+// Levels smaller than a block still take a whole block.
+class CommonLibrary CompressedImage : public Allocatable
+{
+
+public:
+
+	static const int BlockSize = 4; // Pixels along each side of a block.
+	static const int MaximumLevelCount = 16;
+
+public:
+
+	CompressedImage();
+	~CompressedImage();
+
+	// Allocate the blocks for an image and a number of smaller mip levels.
+	bool Initialize(CompressedFormat format, int width, int height, int levelCount);
+
+	// Free the block buffer.
+	void Destroy();
+
+	// Get the format and size of the full size image.
+	inline CompressedFormat GetFormat() const { return format; }
+	inline int GetWidth() const { return width; }
+	inline int GetHeight() const { return height; }
+
+	// Get every level's blocks together.
+	inline uint8_t *GetBuffer() { return blocks; }
+	inline const uint8_t *GetBuffer() const { return blocks; }
+	inline int32_t GetBufferSize() const { return GetLevelOffset(levelCount); }
+
+	// Get the mip levels, where level zero is the full size image.
+	inline int GetLevelCount() const { return levelCount; }
+	inline int GetLevelWidth(int level) const { return GetLevelSize(width, level); }
+	inline int GetLevelHeight(int level) const { return GetLevelSize(height, level); }
+	inline uint8_t *GetLevelBuffer(int level) { return blocks + GetLevelOffset(level); }
+	inline const uint8_t *GetLevelBuffer(int level) const { return blocks + GetLevelOffset(level); }
+	int32_t GetLevelBufferSize(int level) const;
+
+	// Get the bytes in one block of a format.
+	static int32_t GetBlockBytes(CompressedFormat format);
+
+private:
+
+	// Size of a dimension at a level, never less than one.
+	static inline int GetLevelSize(int size, int level) { return ((size >> level) > 1) ? (size >> level) : 1; }
+
+	// Bytes before a level's blocks.
+	int32_t GetLevelOffset(int level) const;
+
+private:
+
+	uint8_t *blocks;
+	CompressedFormat format;
+	int width, height;
+	int levelCount;
+
+};
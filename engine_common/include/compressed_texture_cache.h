@@ -0,0 +1,38 @@
+#pragma once
+
+#include "common_define.h"
+#include "compressed_image.h"
+#include <inttypes.h>
+
+// Keeps compressed images on disk, keyed by a hash of the file they were decoded
+// from, so later loads can skip decoding and compressing.
+// Each image is a file in the cache directory; different hashes may be used from
+// several threads at once.
+class CommonLibrary CompressedTextureCache
+{
+
+public:
+
+	// Hash a source file's contents.
+	static uint64_t HashSource(const uint8_t *data, int32_t size);
+
+	// Continue a hash with more source data, such as a palette the file is decoded with.
+	static uint64_t HashSource(const uint8_t *data, int32_t size, uint64_t hash);
+
+	// Load an image from the cache.
+	// Returns false without logging if it isn't cached or the cached file is unusable.
+	static bool Load(const char *directory, uint64_t hash, CompressedImage *out);
+
+	// Write an image to the cache, creating the directory if needed.
+	static bool Store(const char *directory, uint64_t hash, const CompressedImage *image);
+
+private:
+
+	// Build the file name for a hash.
+	static void GetPath(const char *directory, uint64_t hash, char *out);
+
+public:
+
+	static const int MaximumPathLength = 256;
+
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "allocatable.h"
+#include "common_define.h"
+#include "matrix4x4.h"
+#include "vector3.h"
+#include "vector4.h"
+#include <inttypes.h>
+
+// Low resolution CPU depth buffer for software occlusion culling.
+// Stores clip-space W (view depth) per pixel; smaller is nearer.
+// Occluders are written with their farthest depth and queries compare against
+// their nearest depth, so results are conservative without interpolation.
+class CommonLibrary DepthBuffer : public Allocatable
+{
+
+public:
+
+	DepthBuffer();
+	~DepthBuffer();
+
+	// Allocate the buffer; width is rounded up to a whole SIMD block.
+	bool Initialize(int32_t width, int32_t height);
+	void Destroy();
+
+	// Reset a range of rows to the far depth.
+	void Clear(int32_t rowStart, int32_t rowEnd);
+
+	// Rasterize a clip-space triangle into a range of rows.
+	// Triangles crossing the near plane are skipped, which only under-occludes.
+	void DrawTriangle(
+		const Vector4 &a,
+		const Vector4 &b,
+		const Vector4 &c,
+		int32_t rowStart,
+		int32_t rowEnd);
+
+	// Check whether any part of a box might be visible.
+	// The box is given by two opposite corners and transformed to clip space.
+	bool IsBoxVisible(
+		const Matrix4x4 &transform,
+		const Vector3 &corner,
+		const Vector3 &oppositeCorner) const;
+
+	inline int32_t GetWidth() const { return width; }
+	inline int32_t GetHeight() const { return height; }
+
+private:
+
+	// Check whether any pixel in a screen rectangle is at least as far as a depth.
+	bool IsRectangleVisible(
+		int32_t left,
+		int32_t top,
+		int32_t right,
+		int32_t bottom,
+		float depth) const;
+
+public:
+
+	// Pixels processed per SIMD operation.
+	static const int32_t PixelsPerBlock = 4;
+
+	// Minimum clip-space W accepted as in front of the viewer.
+	static const float NearDepth;
+
+private:
+
+	float *depths;
+	int32_t width;
+	int32_t height;
+
+};
@@ -51,6 +51,7 @@ public:
 	{
 		ReadMode = 0,
 		BinaryReadMode = 1,
+		BinaryWriteMode = 2, // Replaces the file if it exists.
 		OpenModeCount
 	};
 
@@ -74,6 +75,17 @@ public:
 	// Read the whole file into memory.
 	bool Read(FileData *out);
 
+	// Write an amount of data to the file.
+	bool Write(const void *data, int32_t size);
+
+public:
+
+	// Check whether a file exists and can be read, without logging an error if not.
+	static bool Exists(const char *filename);
+
+	// Create a directory if it doesn't already exist.
+	static bool MakeDirectory(const char *path);
+
 private:
 
 	// Implementing file handle.
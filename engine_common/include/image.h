@@ -3,7 +3,7 @@
 #include "error_stack.h"
 #include <allocatable.h>
 #include <inttypes.h>
-#include <memory_manager.h>
+#include <pixel_buffer_pool.h>
 
 // 24-bit colour pixel.
 struct PixelRGB
@@ -23,18 +23,37 @@ struct PixelRGBA
 };
 
 // Class for storing and loading image data.
+// An image may hold a mip chain; each level halves the last, down to one pixel,
+// and the levels are stored one after another from the full size image.
+// The buffer starts on a PixelBufferPool::BufferAlignment boundary and comes from
+// the pool when there is one. Only the start is aligned: rows and levels are
+// tightly packed with no pitch, which the renderers and decoders rely on.
 template <typename PixelType>
 class Image : public Allocatable
 {
 
+public:
+
+	static const int MaximumLevelCount = 16;
+
 public:
 
 	Image();
 	~Image();
 
+	// Images own their buffer, so they can be moved but not copied.
+	Image(Image &&other);
+	Image &operator=(Image &&other);
+	Image(const Image &other) = delete;
+	Image &operator=(const Image &other) = delete;
+
 	// Initialie the buffer for a number of pixels and channels.
 	bool Initialize(int width, int height);
 
+	// Initialize the buffer for a full size image and a number of smaller mip levels.
+	// The current buffer is kept if it's large enough.
+	bool Initialize(int width, int height, int levelCount);
+
 	// Destroy the image buffer.
 	void Destroy();
 
@@ -44,16 +63,37 @@ public:
 	inline int GetWidth() const { return width; }
 	inline int GetHeight() const { return height; }
 	inline int GetPixelSize() const { return sizeof(PixelType); }
+	inline int GetBufferSize() const { return GetLevelOffset(levelCount) * GetPixelSize(); }
+
+	// Get the mip levels, where level zero is the full size image.
+	inline int GetLevelCount() const { return levelCount; }
+	inline int GetLevelWidth(int level) const { return GetLevelSize(width, level); }
+	inline int GetLevelHeight(int level) const { return GetLevelSize(height, level); }
+	inline PixelType *GetLevelBuffer(int level) { return pixels + GetLevelOffset(level); }
+	inline const PixelType *GetLevelBuffer(int level) const { return pixels + GetLevelOffset(level); }
+
+	// Get the number of levels in a full mip chain for a size.
+	static int GetFullLevelCount(int width, int height);
+
+private:
+
+	// Size of a dimension at a level, never less than one.
+	static inline int GetLevelSize(int size, int level) { return ((size >> level) > 1) ? (size >> level) : 1; }
+
+	// Pixels before a level's buffer.
+	int GetLevelOffset(int level) const;
 
 private:
 
 	PixelType *pixels;
+	unsigned int capacity; // Bytes the buffer can hold.
 	int width, height;
+	int levelCount;
 
 };
 
 template <typename PixelType>
-Image<PixelType>::Image() : pixels(nullptr), width(0), height(0)
+Image<PixelType>::Image() : pixels(nullptr), capacity(0), width(0), height(0), levelCount(0)
 {
 }
 
@@ -63,26 +103,94 @@ Image<PixelType>::~Image()
 	Destroy();
 }
 
+// Take the other image's buffer, leaving it empty.
+template <typename PixelType>
+Image<PixelType>::Image(Image &&other)
+	: pixels(other.pixels),
+	capacity(other.capacity),
+	width(other.width),
+	height(other.height),
+	levelCount(other.levelCount)
+{
+	other.pixels = nullptr;
+	other.capacity = 0;
+	other.levelCount = 0;
+}
+
+// Free this image's buffer and take the other's.
+template <typename PixelType>
+Image<PixelType> &Image<PixelType>::operator=(Image &&other)
+{
+	if (this != &other) {
+		Destroy();
+		pixels = other.pixels;
+		capacity = other.capacity;
+		width = other.width;
+		height = other.height;
+		levelCount = other.levelCount;
+		other.pixels = nullptr;
+		other.capacity = 0;
+		other.levelCount = 0;
+	}
+	return *this;
+}
+
 // Allocate space for the image.
 template <typename PixelType>
 bool Image<PixelType>::Initialize(int width, int height)
 {
-	int bufferSize = (width * height) * GetPixelSize();
-	pixels = reinterpret_cast<PixelType*>(MemoryManager::Allocate(bufferSize));
+	return Initialize(width, height, 1);
+}
+
+// Allocate space for the image and its mip levels.
+template <typename PixelType>
+bool Image<PixelType>::Initialize(int width, int height, int levelCount)
+{
+	this->width = width;
+	this->height = height;
+	this->levelCount = levelCount;
+	unsigned int bufferSize = static_cast<unsigned int>(GetLevelOffset(levelCount) * GetPixelSize());
+	if ((pixels != nullptr) && (bufferSize <= capacity)) {
+		return true;
+	}
+	Destroy();
+	pixels = reinterpret_cast<PixelType*>(PixelBufferPool::AllocateBuffer(bufferSize, &capacity));
 	if (pixels == nullptr) {
 		ErrorStack::Log("Failed to allocate %d by %d image with %d bytes/pixels.", width, height, GetPixelSize());
+		this->levelCount = 0;
 		return false;
 	}
-	this->width = width;
-	this->height = height;
 	return true;
 }
 
+// Count halvings until both dimensions reach one pixel.
+template <typename PixelType>
+int Image<PixelType>::GetFullLevelCount(int width, int height)
+{
+	int levelCount = 1;
+	while (((width >> levelCount) > 0) || ((height >> levelCount) > 0)) {
+		++levelCount;
+	}
+	return (levelCount < MaximumLevelCount) ? levelCount : MaximumLevelCount;
+}
+
+// Sum the sizes of the levels before this one.
+template <typename PixelType>
+int Image<PixelType>::GetLevelOffset(int level) const
+{
+	int offset = 0;
+	for (int i = 0; i < level; ++i) {
+		offset += GetLevelWidth(i) * GetLevelHeight(i);
+	}
+	return offset;
+}
+
 template <typename PixelType>
 void Image<PixelType>::Destroy()
 {
 	if (pixels != nullptr) {
-		MemoryManager::Free(pixels);
+		PixelBufferPool::FreeBuffer(pixels, capacity);
 		pixels = nullptr;
+		capacity = 0;
 	}
 }
@@ -53,7 +53,7 @@ public:
 		float zFar);
 
 	// Transform a vector by this matrix.
-	void Transform(const Vector4 *vector, Vector4 *out);
+	void Transform(const Vector4 *vector, Vector4 *out) const;
 
 private:
 
@@ -36,6 +36,12 @@ public:
 	// Free a buffer.
 	static void Free(void *buffer);
 
+	// Allocate a buffer starting at a multiple of a power of two alignment.
+	static void *AllocateAligned(unsigned int size, unsigned int alignment);
+
+	// Free a buffer from an aligned allocation.
+	static void FreeAligned(void *buffer);
+
 #if defined(_DEBUG)
 	// Set which allocation to break on.
 	static void SetBreakAllocation(int allocationIndex);
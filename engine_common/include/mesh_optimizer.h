@@ -0,0 +1,46 @@
+#pragma once
+
+#include "common_define.h"
+#include <inttypes.h>
+
+// Load-time helpers for indexed triangle lists.
+class CommonLibrary MeshOptimizer
+{
+
+public:
+
+	// Merge vertices with identical contents, compacting unique vertices to the
+	// front of the buffer in their original order and rewriting indices to match.
+	// Returns the number of unique vertices, or -1 if scratch allocation fails.
+	static int32_t WeldVertices(
+		void *vertices,
+		int32_t vertexCount,
+		int32_t vertexSize,
+		uint32_t *indices,
+		int32_t indexCount);
+
+	// Find a triangle order with good post-transform vertex cache reuse.
+	// Writes the original triangle index for each output position to the order.
+	// Uses Tom Forsyth's linear-speed vertex cache optimization.
+	static bool OptimizeVertexCache(
+		const uint32_t *indices,
+		int32_t indexCount,
+		int32_t vertexCount,
+		int32_t *triangleOrder);
+
+	// Count vertex transforms for a triangle list through a FIFO vertex cache.
+	// Dividing by the triangle count gives the average cache miss ratio (ACMR).
+	static int32_t CountCacheMisses(
+		const uint32_t *indices,
+		int32_t indexCount,
+		int32_t vertexCount);
+
+public:
+
+	// Cache size modelled when scoring vertices during optimization.
+	static const int32_t ScoredCacheSize = 32;
+
+	// Cache size used when counting cache misses.
+	static const int32_t SimulatedCacheSize = 16;
+
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "common_define.h"
+#include "image.h"
+
+// Builds mip chains for images that don't come with their own.
+class CommonLibrary MipMapGenerator
+{
+
+public:
+
+	// Copy an image into a full mip chain, box filtering each level from the one above it.
+	// A side already one pixel long is reused for both rows or columns of each block.
+	static bool Generate(const Image<PixelRGBA> *source, Image<PixelRGBA> *out);
+
+	// Box filter one level into the half size level below it.
+	static void FilterLevel(
+		const PixelRGBA *source,
+		int sourceWidth,
+		int sourceHeight,
+		PixelRGBA *out,
+		int outWidth,
+		int outHeight);
+
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "common_define.h"
+#include "image.h"
+#include <inttypes.h>
+
+// Expands 8-bit palette indices to 32-bit colour.
+class CommonLibrary PaletteExpander
+{
+
+public:
+
+	// Look up each index in a 256 colour palette.
+	// Uses AVX2 gathers when the build targets AVX2, or SSE2 stores of four colours otherwise.
+	static void Expand(
+		const uint8_t *indices,
+		int count,
+		const PixelRGBA *palette,
+		PixelRGBA *out);
+
+	// Look up each index one at a time, as a reference for the vector version.
+	static void ExpandScalar(
+		const uint8_t *indices,
+		int count,
+		const PixelRGBA *palette,
+		PixelRGBA *out);
+
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "allocatable.h"
+#include "common_define.h"
+#include <inttypes.h>
+#include <mutex>
+
+// Singleton pool of image pixel buffers, kept in power of two size classes so
+// buffers freed after one load are reused by the next instead of reallocated.
+// Every buffer is aligned for SIMD access. Images are decoded on worker threads,
+// so the pool is locked.
+class CommonLibrary PixelBufferPool : public Allocatable
+{
+
+public:
+
+	// Alignment of every pixel buffer, pooled or not.
+	static const unsigned int BufferAlignment = 64;
+
+	// Smallest and largest size classes, as powers of two; larger buffers aren't pooled.
+	static const int MinimumClassShift = 8;
+	static const int MaximumClassShift = 24;
+	static const int ClassCount = (MaximumClassShift - MinimumClassShift) + 1;
+
+public:
+
+	// Create and destroy the pool, which keeps at most a number of bytes of idle buffers.
+	static bool Initialize(int64_t idleByteLimit);
+	static void Shutdown();
+
+	// Allocate an aligned buffer of at least a size, or reuse an idle one.
+	// Writes out the buffer's capacity, which it must be freed with.
+	void *Allocate(unsigned int size, unsigned int *capacity);
+
+	// Keep a buffer for reuse, or free it if the pool is full.
+	// Buffers from aligned allocations outside the pool may be given too.
+	void Free(void *buffer, unsigned int capacity);
+
+	// Allocate a buffer through the pool if there is one, otherwise from the heap.
+	static void *AllocateBuffer(unsigned int size, unsigned int *capacity);
+	static void FreeBuffer(void *buffer, unsigned int capacity);
+
+private:
+
+	PixelBufferPool(int64_t idleByteLimit);
+	~PixelBufferPool();
+
+private:
+
+	// Idle buffers link through their own first bytes.
+	struct IdleBuffer
+	{
+		IdleBuffer *next;
+	};
+
+public:
+
+	static PixelBufferPool *instance;
+
+private:
+
+	std::mutex lock;
+	IdleBuffer *idleBuffers[ClassCount];
+	int64_t idleByteLimit;
+	int64_t idleBytes;
+
+};
@@ -5,6 +5,7 @@
 #include "renderer/material_interface.h"
 #include "renderer/material_layout_interface.h"
 #include "renderer/texture_interface.h"
+#include <inttypes.h>
 
 namespace Renderer
 {
@@ -24,6 +25,12 @@ namespace Renderer
 		// Set wireframe setting.
 		virtual void SetWireframe(bool wireframeEnabled) = 0;
 
+		// Set whether drawing blends with the scene by source alpha.
+		virtual void SetBlending(bool blendingEnabled) = 0;
+
+		// Set whether drawing writes to the depth buffer.
+		virtual void SetDepthWrite(bool depthWriteEnabled) = 0;
+
 		// Clear the scene for a new frame.
 		virtual void ClearScene() = 0;
 
@@ -54,6 +61,17 @@ namespace Renderer
 		// Draw primitive with indices.
 		virtual void DrawIndexed(PrimitiveType type, unsigned int indexCount) = 0;
 
+		// Draw primitive with a range of indices, starting at a given index.
+		virtual void DrawIndexedRange(PrimitiveType type, unsigned int firstIndex, unsigned int indexCount) = 0;
+
+		// Draw several ranges of indices in one call.
+		// Range offsets are in bytes from the start of the index buffer.
+		virtual void DrawIndexedRanges(
+			PrimitiveType type,
+			const uintptr_t *indexOffsets,
+			const int *indexCounts,
+			int rangeCount) = 0;
+
 	};
 
 }
@@ -5,6 +5,7 @@
 #include "renderer/material_interface.h"
 #include "renderer/shared.h"
 #include "renderer/texture_interface.h"
+#include <compressed_image.h>
 #include <image.h>
 
 namespace Renderer
@@ -30,9 +31,37 @@ namespace Renderer
 			unsigned int bufferSize,
 			Renderer::DataType indexType) = 0; 
 
-		// Create texture from image data.
+		// Create texture from image data, with a mip level for each of the image's levels.
 		virtual Texture *CreateTexture(const Image<PixelRGBA> *image) = 0;
 
+		// Create a texture array with one layer per image.
+		// Every image must be the same size, with the same number of mip levels.
+		virtual Texture *CreateTextureArray(const Image<PixelRGBA> *images, int layerCount) = 0;
+
+		// Create a texture array of palette indices, with one layer per image.
+		// Indices are sampled unfiltered, for the shader to look up in a palette texture.
+		virtual Texture *CreateIndexedTextureArray(const Image<uint8_t> *images, int layerCount) = 0;
+
+		// Create a one dimensional, unfiltered texture of palette colours.
+		virtual Texture *CreatePaletteTexture(const PixelRGBA *colours, int colourCount) = 0;
+
+		// Check whether block compressed textures can be created.
+		virtual bool IsCompressionSupported() = 0;
+
+		// Create a texture array from block compressed images, one layer per image.
+		// Every image must be the same size and format, with the same number of mip levels.
+		virtual Texture *CreateCompressedTextureArray(const CompressedImage *images, int layerCount) = 0;
+
+		// Replace a rectangle of a texture with the same rectangle of an image.
+		// The image must be the size of the texture.
+		virtual bool UpdateTexture(
+			Texture *texture,
+			const Image<PixelRGBA> *image,
+			int x,
+			int y,
+			int width,
+			int height) = 0;
+
 	};
 
 }
@@ -19,6 +19,22 @@ namespace Renderer
 		Matrix2x2Type,
 		Matrix3x3Type,
 		Matrix4x4Type,
+
+		// Packed vertex attribute types.
+		// Normalized types map integers to [-1, 1] if signed or [0, 1] if unsigned;
+		// the others are converted to float as-is.
+		Byte4NormalizedType,
+		UnsignedByte4NormalizedType,
+		Short2Type,
+		Short4Type,
+		Short2NormalizedType,
+		Short4NormalizedType,
+		UnsignedShort2NormalizedType,
+		UnsignedShort4NormalizedType,
+		Half2Type,
+		Half4Type,
+		Int1010102NormalizedType,
+		UnsignedInt1010102NormalizedType,
 	};
 
 	// Geometry rendering type.
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "allocatable.h"
+#include "common_define.h"
+#include <inttypes.h>
+
+// Packs rectangles into a fixed size area by tracking the top edge of
+// everything placed so far as a list of horizontal segments.
+// Rectangles go where their top edge ends up lowest, so inserting tallest
+// first packs tightly.
+class CommonLibrary SkylinePacker : public Allocatable
+{
+
+public:
+
+	SkylinePacker();
+	~SkylinePacker();
+
+	// Allocate segment storage for an area.
+	bool Initialize(int32_t width, int32_t height);
+	void Destroy();
+
+	// Remove all rectangles.
+	void Clear();
+
+	// Find a place for a rectangle and add it.
+	// Returns false if the rectangle doesn't fit anywhere.
+	bool Insert(int32_t width, int32_t height, int32_t *x, int32_t *y);
+
+	inline int32_t GetWidth() const { return width; }
+	inline int32_t GetHeight() const { return height; }
+	inline int32_t GetUsedArea() const { return usedArea; }
+
+private:
+
+	// Get the lowest top a rectangle can have when placed at a segment.
+	// Returns -1 if it runs off the right or top of the area.
+	int32_t GetFitTop(int32_t segmentIndex, int32_t width, int32_t height) const;
+
+private:
+
+	// Horizontal piece of the skyline, at the top of what's below it.
+	struct Segment
+	{
+		int32_t x;
+		int32_t y;
+		int32_t width;
+	};
+
+	Segment *segments;
+	int32_t segmentCount;
+	int32_t width;
+	int32_t height;
+	int32_t usedArea;
+
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "allocatable.h"
+#include "common_define.h"
+#include "renderer/texture_interface.h"
+#include <inttypes.h>
+
+// Shared texture and the asset path it was loaded from.
+struct TextureCacheEntry
+{
+	char *key;
+	Renderer::Texture *texture;
+	int width;
+	int height;
+	int32_t memorySize; // Bytes of texture data uploaded, as an estimate of video memory used.
+	int32_t references;
+	TextureCacheEntry *next; // Next entry in the same bucket.
+};
+
+// Singleton registry of renderer textures by asset path, so maps and models
+// loading the same image share one texture. Keys ignore case, like the packs.
+// Only the thread creating textures may use the cache.
+class CommonLibrary TextureCache : public Allocatable
+{
+
+public:
+
+	// Create and destroy the registry.
+	// Shutting down deletes any textures still referenced.
+	static bool Initialize();
+	static void Shutdown();
+
+public:
+
+	// Find a texture by key and add a reference to it.
+	// Returns null if nothing has been added under the key.
+	TextureCacheEntry *Acquire(const char *key);
+
+	// Register a new texture under a key with one reference; the cache owns it from here.
+	// On failure the texture is deleted and null is returned.
+	TextureCacheEntry *Add(
+		const char *key,
+		Renderer::Texture *texture,
+		int width,
+		int height,
+		int32_t memorySize);
+
+	// Drop a reference, deleting the texture when none are left.
+	void Release(TextureCacheEntry *entry);
+
+	inline int32_t GetEntryCount() const { return entryCount; }
+
+private:
+
+	TextureCache();
+	~TextureCache();
+
+	// Hash a key, ignoring case.
+	static uint32_t HashKey(const char *key);
+
+	// Compare keys, ignoring case.
+	static bool IsKeyEqual(const char *a, const char *b);
+
+public:
+
+	static TextureCache *instance;
+
+	static const int32_t BucketCount = 256;
+
+private:
+
+	TextureCacheEntry *buckets[BucketCount];
+	int32_t entryCount;
+
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "common_define.h"
+#include <inttypes.h>
+
+// Conversions from float to the packed vertex attribute types.
+// All conversions round to nearest and clamp to the range of the output.
+class CommonLibrary VertexPacking
+{
+
+public:
+
+	// Convert to a fixed point short, with the value multiplied by a scale.
+	static int16_t ToFixedShort(float value, float scale);
+
+	// Check whether a value converts to a fixed point short without clamping.
+	static bool FitsFixedShort(float value, float scale);
+
+	// Convert to a normalized short, from the range [-1, 1].
+	static int16_t ToShortNormalized(float value);
+
+	// Convert to a normalized unsigned short, from the range [0, 1].
+	static uint16_t ToUnsignedShortNormalized(float value);
+
+	// Convert to a normalized byte, from the range [-1, 1].
+	static int8_t ToByteNormalized(float value);
+
+	// Convert to a normalized unsigned byte, from the range [0, 1].
+	static uint8_t ToUnsignedByteNormalized(float value);
+
+	// Convert to a half precision float.
+	static uint16_t ToHalf(float value);
+
+	// Pack a normalized vector from the range [-1, 1] into 10:10:10:2 bits, X lowest.
+	static uint32_t ToInt1010102Normalized(float x, float y, float z, float w);
+
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "allocatable.h"
+#include "common_define.h"
+#include <atomic>
+#include <condition_variable>
+#include <inttypes.h>
+#include <mutex>
+#include <thread>
+
+class WorkerCounter;
+
+// Unit of work that can be run on a worker thread.
+// Jobs are linked intrusively, so submitting never allocates.
+class CommonLibrary WorkerJob
+{
+
+public:
+
+	WorkerJob();
+	virtual ~WorkerJob();
+
+	// Run the job's work.
+	virtual void Run() = 0;
+
+private:
+
+	friend class WorkerPool;
+
+	WorkerJob *next;
+	WorkerCounter *counter;
+
+};
+
+// Counter tracking the number of unfinished jobs in a group.
+class CommonLibrary WorkerCounter
+{
+
+public:
+
+	WorkerCounter();
+
+	// Check whether all jobs in the group have completed.
+	inline bool IsDone() const { return pending.load() == 0; }
+
+private:
+
+	friend class WorkerPool;
+
+	std::atomic<int32_t> pending;
+
+};
+
+// Singleton pool of worker threads pulling jobs from a shared queue.
+class CommonLibrary WorkerPool : public Allocatable
+{
+
+public:
+
+	// Start the pool with a number of worker threads.
+	// Passing zero uses one worker per hardware thread besides the caller's.
+	static bool Initialize(int32_t workerCount);
+	static void Shutdown();
+
+public:
+
+	// Queue a job to run, adding it to a completion counter.
+	// The job must stay alive until the counter reports it done.
+	void Submit(WorkerJob *job, WorkerCounter *counter);
+
+	// Block until all jobs in a counter have completed.
+	// The calling thread runs queued jobs while it waits.
+	void Wait(WorkerCounter *counter);
+
+	// Run one queued job on the calling thread, if there is one.
+	// Returns false if the queue was empty.
+	bool RunQueuedJob();
+
+	inline int32_t GetWorkerCount() const { return workerCount; }
+
+private:
+
+	WorkerPool();
+	~WorkerPool();
+
+	// Start and stop worker threads.
+	bool StartWorkers(int32_t workerCount);
+	void StopWorkers();
+
+	// Worker thread loop.
+	void WorkerLoop();
+
+	// Pop the next queued job; must hold the queue lock.
+	WorkerJob *PopJob();
+
+	// Run a job and signal its counter.
+	void RunJob(WorkerJob *job);
+
+public:
+
+	static WorkerPool *instance;
+
+private:
+
+	std::thread *workers;
+	int32_t workerCount;
+
+	// Job queue.
+	std::mutex queueLock;
+	std::condition_variable queueSignal;
+	std::condition_variable doneSignal;
+	WorkerJob *queueHead;
+	WorkerJob *queueTail;
+	bool stopping;
+
+};
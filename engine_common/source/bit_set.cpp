@@ -0,0 +1,127 @@
+#include "bit_set.h"
+#include "error_stack.h"
+#include "memory_manager.h"
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+BitSet::BitSet()
+	: words(nullptr),
+	wordCount(0),
+	bitCount(0)
+{
+}
+
+BitSet::~BitSet()
+{
+	Destroy();
+}
+
+// Allocate storage for a number of bits, rounded up to a whole SIMD block.
+bool BitSet::Initialize(int32_t bitCount)
+{
+	Destroy();
+
+	int32_t wordCount = (bitCount + (BitsPerWord - 1)) >> WordIndexShift;
+	wordCount = (wordCount + (WordsPerBlock - 1)) & ~(WordsPerBlock - 1);
+	if (wordCount == 0) {
+		wordCount = WordsPerBlock;
+	}
+	words = reinterpret_cast<uint32_t*>(MemoryManager::Allocate(wordCount * sizeof(uint32_t)));
+	if (words == nullptr) {
+		ErrorStack::Log("Failed to allocate %d words for bit set of %d bits.", wordCount, bitCount);
+		return false;
+	}
+	this->wordCount = wordCount;
+	this->bitCount = bitCount;
+	Clear();
+	return true;
+}
+
+// Free bit storage.
+void BitSet::Destroy()
+{
+	if (words != nullptr) {
+		MemoryManager::Free(words);
+		words = nullptr;
+	}
+	wordCount = 0;
+	bitCount = 0;
+}
+
+// Clear all bits a block of words at a time.
+void BitSet::Clear()
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i *block = reinterpret_cast<__m128i*>(words);
+	int32_t blockCount = wordCount / WordsPerBlock;
+	for (int32_t i = 0; i < blockCount; ++i, ++block) {
+		_mm_storeu_si128(block, zero);
+	}
+}
+
+// Exclusive-or two sets a block of words at a time.
+void BitSet::SymmetricDifference(const BitSet &a, const BitSet &b)
+{
+	const __m128i *blockA = reinterpret_cast<const __m128i*>(a.words);
+	const __m128i *blockB = reinterpret_cast<const __m128i*>(b.words);
+	__m128i *out = reinterpret_cast<__m128i*>(words);
+	int32_t blockCount = wordCount / WordsPerBlock;
+	for (int32_t i = 0; i < blockCount; ++i, ++blockA, ++blockB, ++out) {
+		__m128i difference = _mm_xor_si128(_mm_loadu_si128(blockA), _mm_loadu_si128(blockB));
+		_mm_storeu_si128(out, difference);
+	}
+}
+
+// Exchange storage with another set.
+void BitSet::Swap(BitSet *other)
+{
+	uint32_t *words = this->words;
+	int32_t wordCount = this->wordCount;
+	int32_t bitCount = this->bitCount;
+	this->words = other->words;
+	this->wordCount = other->wordCount;
+	this->bitCount = other->bitCount;
+	other->words = words;
+	other->wordCount = wordCount;
+	other->bitCount = bitCount;
+}
+
+// Write out the indices of all set bits in a range, skipping empty words.
+int32_t BitSet::GetSetBits(int32_t start, int32_t end, int32_t *out) const
+{
+	int32_t outCount = 0;
+	int32_t index = start;
+	while (index < end) {
+		int32_t wordIndex = index >> WordIndexShift;
+		int32_t wordStart = wordIndex << WordIndexShift;
+		int32_t wordEnd = wordStart + BitsPerWord;
+
+		// Mask out bits outside of the range.
+		uint32_t word = words[wordIndex] & (~0u << (index & BitIndexMask));
+		if (end < wordEnd) {
+			word &= ~(~0u << (end & BitIndexMask));
+		}
+
+		// Pop each set bit from lowest to highest.
+		while (word != 0) {
+			out[outCount++] = wordStart + FindFirstSet(word);
+			word &= (word - 1);
+		}
+		index = wordEnd;
+	}
+	return outCount;
+}
+
+// Get the index of the lowest set bit of a non-zero word.
+int32_t BitSet::FindFirstSet(uint32_t word)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, word);
+	return static_cast<int32_t>(index);
+#else
+	return __builtin_ctz(word);
+#endif
+}
@@ -0,0 +1,312 @@
+#include "block_compressor.h"
+#include <string.h>
+
+static const int BlockPixelCount = CompressedImage::BlockSize * CompressedImage::BlockSize;
+
+// Write a 16-bit value, low byte first.
+static void WriteShort(uint16_t value, uint8_t *out)
+{
+	out[0] = static_cast<uint8_t>(value);
+	out[1] = static_cast<uint8_t>(value >> 8);
+}
+
+// Round a channel to the nearest whole value in range.
+static int ClampChannel(float value)
+{
+	if (value <= 0.0f) {
+		return 0;
+	}
+	if (value >= 255.0f) {
+		return 255;
+	}
+	return static_cast<int>(value + 0.5f);
+}
+
+// Round a colour to 5:6:5 bits.
+static uint16_t ToColour565(int r, int g, int b)
+{
+	return static_cast<uint16_t>((((r * 31) + 127) / 255) << 11) |
+		static_cast<uint16_t>((((g * 63) + 127) / 255) << 5) |
+		static_cast<uint16_t>(((b * 31) + 127) / 255);
+}
+
+// Expand a 5:6:5 colour the way the hardware does, replicating the high bits.
+static void FromColour565(uint16_t colour, int *out)
+{
+	int r = (colour >> 11) & 0x1F;
+	int g = (colour >> 5) & 0x3F;
+	int b = colour & 0x1F;
+	out[0] = (r << 3) | (r >> 2);
+	out[1] = (g << 2) | (g >> 4);
+	out[2] = (b << 3) | (b >> 2);
+}
+
+// Order the endpoints for the four colour mode, then give each pixel the nearest palette colour.
+// Returns the squared error over the pixels that aren't fully transparent.
+static int FitColourIndices(const PixelRGBA *pixels, uint16_t *colour0, uint16_t *colour1, uint32_t *indices)
+{
+	// The first endpoint must be greater; equal endpoints leave every index at zero.
+	if (*colour0 < *colour1) {
+		uint16_t swap = *colour0;
+		*colour0 = *colour1;
+		*colour1 = swap;
+	}
+	int palette[4][3];
+	FromColour565(*colour0, palette[0]);
+	FromColour565(*colour1, palette[1]);
+	int paletteCount = (*colour0 == *colour1) ? 1 : 4;
+	for (int j = 0; j < 3; ++j) {
+		palette[2][j] = ((2 * palette[0][j]) + palette[1][j]) / 3;
+		palette[3][j] = (palette[0][j] + (2 * palette[1][j])) / 3;
+	}
+
+	int error = 0;
+	*indices = 0;
+	for (int i = 0; i < BlockPixelCount; ++i) {
+		const uint8_t *channels = &pixels[i].r;
+		int bestIndex = 0;
+		int bestDistance = 0x7FFFFFFF;
+		for (int k = 0; k < paletteCount; ++k) {
+			int distance = 0;
+			for (int j = 0; j < 3; ++j) {
+				int difference = channels[j] - palette[k][j];
+				distance += difference * difference;
+			}
+			if (distance < bestDistance) {
+				bestDistance = distance;
+				bestIndex = k;
+			}
+		}
+		*indices |= static_cast<uint32_t>(bestIndex) << (i * 2);
+		if (pixels[i].a != 0) {
+			error += bestDistance;
+		}
+	}
+	return error;
+}
+
+// Solve for the endpoints that best reproduce the pixels through their current indices.
+// Returns false if the indices don't separate the endpoints.
+static bool RefineColourEndpoints(const PixelRGBA *pixels, uint32_t indices, uint16_t *colour0, uint16_t *colour1)
+{
+	// Weight of the first endpoint for each index.
+	static const float IndexWeights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+	float weightSquares = 0.0f;
+	float crossWeights = 0.0f;
+	float otherSquares = 0.0f;
+	float weighted[3] = { 0.0f, 0.0f, 0.0f };
+	float otherWeighted[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < BlockPixelCount; ++i) {
+		if (pixels[i].a == 0) {
+			continue;
+		}
+		float weight = IndexWeights[(indices >> (i * 2)) & 0x3];
+		float other = 1.0f - weight;
+		weightSquares += weight * weight;
+		crossWeights += weight * other;
+		otherSquares += other * other;
+		const uint8_t *channels = &pixels[i].r;
+		for (int j = 0; j < 3; ++j) {
+			weighted[j] += weight * static_cast<float>(channels[j]);
+			otherWeighted[j] += other * static_cast<float>(channels[j]);
+		}
+	}
+	float determinant = (weightSquares * otherSquares) - (crossWeights * crossWeights);
+	if (determinant < 1e-4f) {
+		return false;
+	}
+	int endpoints[2][3];
+	for (int j = 0; j < 3; ++j) {
+		float first = ((otherSquares * weighted[j]) - (crossWeights * otherWeighted[j])) / determinant;
+		float second = ((weightSquares * otherWeighted[j]) - (crossWeights * weighted[j])) / determinant;
+		endpoints[0][j] = ClampChannel(first);
+		endpoints[1][j] = ClampChannel(second);
+	}
+	*colour0 = ToColour565(endpoints[0][0], endpoints[0][1], endpoints[0][2]);
+	*colour1 = ToColour565(endpoints[1][0], endpoints[1][1], endpoints[1][2]);
+	return true;
+}
+
+// Check every pixel of every level for transparency.
+CompressedFormat BlockCompressor::ChooseFormat(const Image<PixelRGBA> *image)
+{
+	for (int i = 0; i < image->GetLevelCount(); ++i) {
+		const PixelRGBA *pixels = image->GetLevelBuffer(i);
+		int pixelCount = image->GetLevelWidth(i) * image->GetLevelHeight(i);
+		for (int j = 0; j < pixelCount; ++j) {
+			if (pixels[j].a != 255) {
+				return BC3Format;
+			}
+		}
+	}
+	return BC1Format;
+}
+
+// Encode each level's blocks in rows.
+bool BlockCompressor::Compress(const Image<PixelRGBA> *image, CompressedFormat format, CompressedImage *out)
+{
+	if (!out->Initialize(format, image->GetWidth(), image->GetHeight(), image->GetLevelCount())) {
+		return false;
+	}
+	for (int i = 0; i < image->GetLevelCount(); ++i) {
+		const PixelRGBA *level = image->GetLevelBuffer(i);
+		int width = image->GetLevelWidth(i);
+		int height = image->GetLevelHeight(i);
+		uint8_t *block = out->GetLevelBuffer(i);
+		for (int y = 0; y < height; y += CompressedImage::BlockSize) {
+			for (int x = 0; x < width; x += CompressedImage::BlockSize) {
+				PixelRGBA pixels[BlockPixelCount];
+				ReadBlock(level, width, height, x, y, pixels);
+				if (format == BC3Format) {
+					EncodeAlphaBlock(pixels, block);
+					block += 8;
+				}
+				EncodeColourBlock(pixels, block);
+				block += 8;
+			}
+		}
+	}
+	return true;
+}
+
+// Clamp each row and column to the level.
+void BlockCompressor::ReadBlock(
+	const PixelRGBA *level,
+	int width,
+	int height,
+	int x,
+	int y,
+	PixelRGBA *out)
+{
+	for (int i = 0; i < CompressedImage::BlockSize; ++i) {
+		int row = ((y + i) < height) ? (y + i) : (height - 1);
+		const PixelRGBA *in = &level[row * width];
+		if ((x + CompressedImage::BlockSize) <= width) {
+			memcpy(out, &in[x], CompressedImage::BlockSize * sizeof(PixelRGBA));
+		}
+		else {
+			for (int j = 0; j < CompressedImage::BlockSize; ++j) {
+				out[j] = in[((x + j) < width) ? (x + j) : (width - 1)];
+			}
+		}
+		out += CompressedImage::BlockSize;
+	}
+}
+
+// Endpoints start at opposite corners of the bounding box, picking the diagonal
+// along which the other channels vary with the widest one, then get one pass of
+// least squares refinement.
+void BlockCompressor::EncodeColourBlock(const PixelRGBA *pixels, uint8_t *out)
+{
+	int minimum[3] = { 255, 255, 255 };
+	int maximum[3] = { 0, 0, 0 };
+	int sum[3] = { 0, 0, 0 };
+	int count = 0;
+	for (int i = 0; i < BlockPixelCount; ++i) {
+		if (pixels[i].a == 0) {
+			continue;
+		}
+		const uint8_t *channels = &pixels[i].r;
+		for (int j = 0; j < 3; ++j) {
+			minimum[j] = (channels[j] < minimum[j]) ? channels[j] : minimum[j];
+			maximum[j] = (channels[j] > maximum[j]) ? channels[j] : maximum[j];
+			sum[j] += channels[j];
+		}
+		++count;
+	}
+	if (count == 0) {
+		memset(out, 0, 8);
+		return;
+	}
+
+	// Flip the channels that fall as the widest one rises.
+	int widest = 0;
+	for (int j = 1; j < 3; ++j) {
+		if ((maximum[j] - minimum[j]) > (maximum[widest] - minimum[widest])) {
+			widest = j;
+		}
+	}
+	int covariance[3] = { 0, 0, 0 };
+	for (int i = 0; i < BlockPixelCount; ++i) {
+		if (pixels[i].a == 0) {
+			continue;
+		}
+		const uint8_t *channels = &pixels[i].r;
+		int widestOffset = (channels[widest] * count) - sum[widest];
+		for (int j = 0; j < 3; ++j) {
+			covariance[j] += widestOffset * ((channels[j] * count) - sum[j]);
+		}
+	}
+	int start[3];
+	int end[3];
+	for (int j = 0; j < 3; ++j) {
+		int inset = (maximum[j] - minimum[j]) >> 4;
+		int low = minimum[j] + inset;
+		int high = maximum[j] - inset;
+		start[j] = (covariance[j] < 0) ? low : high;
+		end[j] = (covariance[j] < 0) ? high : low;
+	}
+
+	uint16_t colour0 = ToColour565(start[0], start[1], start[2]);
+	uint16_t colour1 = ToColour565(end[0], end[1], end[2]);
+	uint32_t indices;
+	int error = FitColourIndices(pixels, &colour0, &colour1, &indices);
+
+	// One least squares pass over the chosen indices usually brings the endpoints closer.
+	uint16_t refinedColour0;
+	uint16_t refinedColour1;
+	if ((error != 0) && RefineColourEndpoints(pixels, indices, &refinedColour0, &refinedColour1)) {
+		uint32_t refinedIndices;
+		int refinedError = FitColourIndices(pixels, &refinedColour0, &refinedColour1, &refinedIndices);
+		if (refinedError < error) {
+			colour0 = refinedColour0;
+			colour1 = refinedColour1;
+			indices = refinedIndices;
+		}
+	}
+	WriteShort(colour0, &out[0]);
+	WriteShort(colour1, &out[2]);
+	out[4] = static_cast<uint8_t>(indices);
+	out[5] = static_cast<uint8_t>(indices >> 8);
+	out[6] = static_cast<uint8_t>(indices >> 16);
+	out[7] = static_cast<uint8_t>(indices >> 24);
+}
+
+// Use the eight value mode between the block's extremes, so fully opaque and
+// fully transparent pixels stay exact; each pixel takes the nearest step.
+void BlockCompressor::EncodeAlphaBlock(const PixelRGBA *pixels, uint8_t *out)
+{
+	int minimum = 255;
+	int maximum = 0;
+	for (int i = 0; i < BlockPixelCount; ++i) {
+		minimum = (pixels[i].a < minimum) ? pixels[i].a : minimum;
+		maximum = (pixels[i].a > maximum) ? pixels[i].a : maximum;
+	}
+	out[0] = static_cast<uint8_t>(maximum);
+	out[1] = static_cast<uint8_t>(minimum);
+	int range = maximum - minimum;
+	if (range == 0) {
+		memset(&out[2], 0, 6);
+		return;
+	}
+
+	// Steps from the minimum map to indices 1, 7, 6, ..., 2, then 0 at the maximum.
+	uint64_t indices = 0;
+	for (int i = 0; i < BlockPixelCount; ++i) {
+		int step = (((pixels[i].a - minimum) * 7) + (range >> 1)) / range;
+		int index;
+		if (step == 0) {
+			index = 1;
+		}
+		else if (step == 7) {
+			index = 0;
+		}
+		else {
+			index = 8 - step;
+		}
+		indices |= static_cast<uint64_t>(index) << (i * 3);
+	}
+	for (int i = 0; i < 6; ++i) {
+		out[2 + i] = static_cast<uint8_t>(indices >> (i * 8));
+	}
+}
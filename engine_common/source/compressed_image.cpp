@@ -0,0 +1,68 @@
+#include "compressed_image.h"
+#include "error_stack.h"
+#include "memory_manager.h"
+
+CompressedImage::CompressedImage()
+	: blocks(nullptr),
+	format(BC1Format),
+	width(0),
+	height(0),
+	levelCount(0)
+{
+}
+
+CompressedImage::~CompressedImage()
+{
+	Destroy();
+}
+
+// Allocate space for the blocks of every level.
+bool CompressedImage::Initialize(CompressedFormat format, int width, int height, int levelCount)
+{
+	Destroy();
+	this->format = format;
+	this->width = width;
+	this->height = height;
+	this->levelCount = levelCount;
+	int32_t bufferSize = GetBufferSize();
+	blocks = reinterpret_cast<uint8_t*>(MemoryManager::Allocate(bufferSize));
+	if (blocks == nullptr) {
+		ErrorStack::Log("Failed to allocate %d bytes of blocks for %d by %d image.", bufferSize, width, height);
+		this->levelCount = 0;
+		return false;
+	}
+	return true;
+}
+
+// Free the blocks.
+void CompressedImage::Destroy()
+{
+	if (blocks != nullptr) {
+		MemoryManager::Free(blocks);
+		blocks = nullptr;
+	}
+}
+
+// Partial blocks at the edges round up to whole ones.
+int32_t CompressedImage::GetLevelBufferSize(int level) const
+{
+	int32_t blocksAcross = (GetLevelWidth(level) + BlockSize - 1) / BlockSize;
+	int32_t blocksDown = (GetLevelHeight(level) + BlockSize - 1) / BlockSize;
+	return blocksAcross * blocksDown * GetBlockBytes(format);
+}
+
+// BC3 adds a block of alpha before each block of colour.
+int32_t CompressedImage::GetBlockBytes(CompressedFormat format)
+{
+	return (format == BC3Format) ? 16 : 8;
+}
+
+// Sum the sizes of the levels before this one.
+int32_t CompressedImage::GetLevelOffset(int level) const
+{
+	int32_t offset = 0;
+	for (int i = 0; i < level; ++i) {
+		offset += GetLevelBufferSize(i);
+	}
+	return offset;
+}
@@ -0,0 +1,119 @@
+#include "compressed_texture_cache.h"
+#include "error_stack.h"
+#include "file.h"
+#include <stdio.h>
+#include <string.h>
+
+// FNV-1a hashing constants for source files.
+static const uint64_t HashOffsetBasis = 14695981039346656037ull;
+static const uint64_t HashPrime = 1099511628211ull;
+
+// Cache file constants; the version changes whenever the encoder's output does.
+static const uint32_t CacheIdentifier = 0x54434342; // "BCCT"
+static const uint32_t CacheVersion = 1;
+static const char CacheExtension[] = ".bct";
+
+// Cache file header, followed by every level's blocks.
+struct CacheHeader
+{
+	uint32_t identifier;
+	uint32_t version;
+	uint32_t format;
+	int32_t width;
+	int32_t height;
+	int32_t levelCount;
+	int32_t dataSize;
+};
+
+// Hash every byte of the file.
+uint64_t CompressedTextureCache::HashSource(const uint8_t *data, int32_t size)
+{
+	return HashSource(data, size, HashOffsetBasis);
+}
+
+// Fold every byte into the hash so far.
+uint64_t CompressedTextureCache::HashSource(const uint8_t *data, int32_t size, uint64_t hash)
+{
+	for (int32_t i = 0; i < size; ++i) {
+		hash = (hash ^ data[i]) * HashPrime;
+	}
+	return hash;
+}
+
+// A file that doesn't match its header, such as one cut short, is treated as a miss.
+bool CompressedTextureCache::Load(const char *directory, uint64_t hash, CompressedImage *out)
+{
+	char path[MaximumPathLength];
+	GetPath(directory, hash, path);
+	if (!File::Exists(path)) {
+		return false;
+	}
+	File file;
+	FileData fileData;
+	if (!file.Open(path, File::BinaryReadMode) || !file.Read(&fileData)) {
+		return false;
+	}
+	if (fileData.GetSize() < static_cast<int32_t>(sizeof(CacheHeader))) {
+		return false;
+	}
+	CacheHeader header;
+	memcpy(&header, fileData.GetData(), sizeof(header));
+	if ((header.identifier != CacheIdentifier) ||
+		(header.version != CacheVersion) ||
+		(header.format > BC3Format) ||
+		(header.width <= 0) ||
+		(header.height <= 0) ||
+		(header.levelCount <= 0) ||
+		(header.levelCount > CompressedImage::MaximumLevelCount) ||
+		(header.dataSize != (fileData.GetSize() - static_cast<int32_t>(sizeof(CacheHeader))))) {
+		return false;
+	}
+	if (!out->Initialize(static_cast<CompressedFormat>(header.format), header.width, header.height, header.levelCount)) {
+		return false;
+	}
+	if (out->GetBufferSize() != header.dataSize) {
+		out->Destroy();
+		return false;
+	}
+	memcpy(out->GetBuffer(), fileData.GetData() + sizeof(CacheHeader), header.dataSize);
+	return true;
+}
+
+// Write the header, then the blocks.
+bool CompressedTextureCache::Store(const char *directory, uint64_t hash, const CompressedImage *image)
+{
+	if (!File::MakeDirectory(directory)) {
+		return false;
+	}
+	CacheHeader header;
+	header.identifier = CacheIdentifier;
+	header.version = CacheVersion;
+	header.format = static_cast<uint32_t>(image->GetFormat());
+	header.width = image->GetWidth();
+	header.height = image->GetHeight();
+	header.levelCount = image->GetLevelCount();
+	header.dataSize = image->GetBufferSize();
+	char path[MaximumPathLength];
+	GetPath(directory, hash, path);
+	File file;
+	if (!file.Open(path, File::BinaryWriteMode) ||
+		!file.Write(&header, sizeof(header)) ||
+		!file.Write(image->GetBuffer(), header.dataSize)) {
+		ErrorStack::Log("Failed to write compressed texture to cache: %s", path);
+		return false;
+	}
+	return true;
+}
+
+// Name the file by the hash in hexadecimal.
+void CompressedTextureCache::GetPath(const char *directory, uint64_t hash, char *out)
+{
+	snprintf(
+		out,
+		MaximumPathLength,
+		"%s/%08x%08x%s",
+		directory,
+		static_cast<uint32_t>(hash >> 32),
+		static_cast<uint32_t>(hash),
+		CacheExtension);
+}
@@ -0,0 +1,236 @@
+#include "depth_buffer.h"
+#include "error_stack.h"
+#include "memory_manager.h"
+#include <emmintrin.h>
+#include <float.h>
+#include <math.h>
+
+// Depth constants.
+const float DepthBuffer::NearDepth = 1.0f / 1024.0f;
+static const float FarDepth = FLT_MAX;
+
+// Relative bias pulling query depths nearer, so occluders never hide their own boxes.
+static const float QueryDepthBias = 1.0f / 4096.0f;
+
+// Smallest screen-space area worth rasterizing.
+static const float MinimumTriangleArea = 1.0f / 256.0f;
+
+DepthBuffer::DepthBuffer()
+	: depths(nullptr),
+	width(0),
+	height(0)
+{
+}
+
+DepthBuffer::~DepthBuffer()
+{
+	Destroy();
+}
+
+// Allocate depth storage and clear it.
+bool DepthBuffer::Initialize(int32_t width, int32_t height)
+{
+	Destroy();
+
+	width = (width + (PixelsPerBlock - 1)) & ~(PixelsPerBlock - 1);
+	unsigned int bufferSize = width * height * sizeof(float);
+	depths = reinterpret_cast<float*>(MemoryManager::Allocate(bufferSize));
+	if (depths == nullptr) {
+		ErrorStack::Log("Failed to allocate %dx%d depth buffer.", width, height);
+		return false;
+	}
+	this->width = width;
+	this->height = height;
+	Clear(0, height);
+	return true;
+}
+
+// Free depth storage.
+void DepthBuffer::Destroy()
+{
+	if (depths != nullptr) {
+		MemoryManager::Free(depths);
+		depths = nullptr;
+	}
+	width = 0;
+	height = 0;
+}
+
+// Reset rows to the far depth a block at a time.
+void DepthBuffer::Clear(int32_t rowStart, int32_t rowEnd)
+{
+	const __m128 far = _mm_set1_ps(FarDepth);
+	float *depth = &depths[rowStart * width];
+	float *end = &depths[rowEnd * width];
+	for (; depth != end; depth += PixelsPerBlock) {
+		_mm_storeu_ps(depth, far);
+	}
+}
+
+// Rasterize a triangle with its farthest depth, four pixels at a time.
+void DepthBuffer::DrawTriangle(
+	const Vector4 &a,
+	const Vector4 &b,
+	const Vector4 &c,
+	int32_t rowStart,
+	int32_t rowEnd)
+{
+	if ((a.w < NearDepth) || (b.w < NearDepth) || (c.w < NearDepth)) {
+		return;
+	}
+
+	// Project to screen space with Y going down.
+	const Vector4 *vertices[3] = { &a, &b, &c };
+	float x[3];
+	float y[3];
+	float maximumDepth = a.w;
+	for (int i = 0; i < 3; ++i) {
+		const Vector4 *vertex = vertices[i];
+		float inverseW = 1.0f / vertex->w;
+		x[i] = ((vertex->x * inverseW) * 0.5f + 0.5f) * static_cast<float>(width);
+		y[i] = (0.5f - (vertex->y * inverseW) * 0.5f) * static_cast<float>(height);
+		if (vertex->w > maximumDepth) {
+			maximumDepth = vertex->w;
+		}
+	}
+
+	// Skip degenerate triangles; winding sign makes edges positive inside.
+	float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (fabsf(area) < MinimumTriangleArea) {
+		return;
+	}
+	float sign = (area < 0.0f) ? 1.0f : -1.0f;
+
+	// Clip the bounding rectangle to the buffer and row range.
+	float minimumX = fminf(x[0], fminf(x[1], x[2]));
+	float maximumX = fmaxf(x[0], fmaxf(x[1], x[2]));
+	float minimumY = fminf(y[0], fminf(y[1], y[2]));
+	float maximumY = fmaxf(y[0], fmaxf(y[1], y[2]));
+	if ((maximumX < 0.0f) || (minimumX >= static_cast<float>(width)) ||
+		(maximumY < static_cast<float>(rowStart)) || (minimumY >= static_cast<float>(rowEnd))) {
+		return;
+	}
+	int32_t left = (minimumX > 0.0f) ? static_cast<int32_t>(minimumX) : 0;
+	int32_t right = (maximumX < static_cast<float>(width - 1)) ? static_cast<int32_t>(maximumX) : (width - 1);
+	int32_t top = (minimumY > static_cast<float>(rowStart)) ? static_cast<int32_t>(minimumY) : rowStart;
+	int32_t bottom = (maximumY < static_cast<float>(rowEnd - 1)) ? static_cast<int32_t>(maximumY) : (rowEnd - 1);
+	left &= ~(PixelsPerBlock - 1);
+
+	// Edge functions E(p) = A * px + B * py + C, non-negative inside.
+	__m128 edgeA[3];
+	float edgeB[3];
+	float edgeC[3];
+	for (int i = 0; i < 3; ++i) {
+		int j = (i + 1) % 3;
+		float deltaX = x[j] - x[i];
+		float deltaY = y[j] - y[i];
+		edgeA[i] = _mm_set1_ps(deltaY * sign);
+		edgeB[i] = -deltaX * sign;
+		edgeC[i] = ((y[i] * deltaX) - (x[i] * deltaY)) * sign;
+	}
+
+	// Sample at pixel centers.
+	const __m128 laneOffsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 triangleDepth = _mm_set1_ps(maximumDepth);
+	for (int32_t row = top; row <= bottom; ++row) {
+		float centerY = static_cast<float>(row) + 0.5f;
+		__m128 rowEdge0 = _mm_set1_ps(edgeB[0] * centerY + edgeC[0]);
+		__m128 rowEdge1 = _mm_set1_ps(edgeB[1] * centerY + edgeC[1]);
+		__m128 rowEdge2 = _mm_set1_ps(edgeB[2] * centerY + edgeC[2]);
+		float *depthRow = &depths[row * width];
+		for (int32_t column = left; column <= right; column += PixelsPerBlock) {
+			__m128 centerX = _mm_add_ps(_mm_set1_ps(static_cast<float>(column)), laneOffsets);
+			__m128 edge0 = _mm_add_ps(_mm_mul_ps(edgeA[0], centerX), rowEdge0);
+			__m128 edge1 = _mm_add_ps(_mm_mul_ps(edgeA[1], centerX), rowEdge1);
+			__m128 edge2 = _mm_add_ps(_mm_mul_ps(edgeA[2], centerX), rowEdge2);
+			__m128 inside = _mm_and_ps(
+				_mm_and_ps(_mm_cmpge_ps(edge0, zero), _mm_cmpge_ps(edge1, zero)),
+				_mm_cmpge_ps(edge2, zero));
+			if (_mm_movemask_ps(inside) == 0) {
+				continue;
+			}
+
+			// Keep the nearer depth for covered pixels.
+			float *depth = &depthRow[column];
+			__m128 current = _mm_loadu_ps(depth);
+			__m128 nearest = _mm_min_ps(current, triangleDepth);
+			__m128 result = _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current));
+			_mm_storeu_ps(depth, result);
+		}
+	}
+}
+
+// Project a box and test its screen rectangle at its nearest depth.
+bool DepthBuffer::IsBoxVisible(
+	const Matrix4x4 &transform,
+	const Vector3 &corner,
+	const Vector3 &oppositeCorner) const
+{
+	float minimumX = FarDepth;
+	float maximumX = -FarDepth;
+	float minimumY = FarDepth;
+	float maximumY = -FarDepth;
+	float minimumDepth = FarDepth;
+	for (int i = 0; i < 8; ++i) {
+		Vector4 point(
+			(i & 1) ? oppositeCorner.x : corner.x,
+			(i & 2) ? oppositeCorner.y : corner.y,
+			(i & 4) ? oppositeCorner.z : corner.z,
+			1.0f);
+		Vector4 clip;
+		transform.Transform(&point, &clip);
+
+		// Boxes reaching behind the viewer can't be bounded on screen.
+		if (clip.w < NearDepth) {
+			return true;
+		}
+		float inverseW = 1.0f / clip.w;
+		float screenX = ((clip.x * inverseW) * 0.5f + 0.5f) * static_cast<float>(width);
+		float screenY = (0.5f - (clip.y * inverseW) * 0.5f) * static_cast<float>(height);
+		minimumX = fminf(minimumX, screenX);
+		maximumX = fmaxf(maximumX, screenX);
+		minimumY = fminf(minimumY, screenY);
+		maximumY = fmaxf(maximumY, screenY);
+		minimumDepth = fminf(minimumDepth, clip.w);
+	}
+
+	// Boxes entirely off screen are not visible.
+	if ((maximumX < 0.0f) || (minimumX >= static_cast<float>(width)) ||
+		(maximumY < 0.0f) || (minimumY >= static_cast<float>(height))) {
+		return false;
+	}
+	int32_t left = (minimumX > 0.0f) ? static_cast<int32_t>(minimumX) : 0;
+	int32_t right = (maximumX < static_cast<float>(width - 1)) ? static_cast<int32_t>(maximumX) : (width - 1);
+	int32_t top = (minimumY > 0.0f) ? static_cast<int32_t>(minimumY) : 0;
+	int32_t bottom = (maximumY < static_cast<float>(height - 1)) ? static_cast<int32_t>(maximumY) : (height - 1);
+	return IsRectangleVisible(left, top, right, bottom, minimumDepth * (1.0f - QueryDepthBias));
+}
+
+// Check four pixels at a time for any at least as far as the query depth.
+bool DepthBuffer::IsRectangleVisible(
+	int32_t left,
+	int32_t top,
+	int32_t right,
+	int32_t bottom,
+	float depth) const
+{
+	const __m128 queryDepth = _mm_set1_ps(depth);
+	const __m128i laneOffsets = _mm_set_epi32(3, 2, 1, 0);
+	const __m128i rangeStart = _mm_set1_epi32(left - 1);
+	const __m128i rangeEnd = _mm_set1_epi32(right + 1);
+	int32_t start = left & ~(PixelsPerBlock - 1);
+	for (int32_t row = top; row <= bottom; ++row) {
+		const float *depthRow = &depths[row * width];
+		for (int32_t column = start; column <= right; column += PixelsPerBlock) {
+			// Mask lanes outside of the rectangle.
+			__m128i lanes = _mm_add_epi32(_mm_set1_epi32(column), laneOffsets);
+			__m128i inRange = _mm_and_si128(_mm_cmpgt_epi32(lanes, rangeStart), _mm_cmplt_epi32(lanes, rangeEnd));
+			__m128 farther = _mm_cmpge_ps(_mm_loadu_ps(&depthRow[column]), queryDepth);
+			if (_mm_movemask_ps(_mm_and_ps(farther, _mm_castsi128_ps(inRange))) != 0) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
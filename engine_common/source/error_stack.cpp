@@ -1,11 +1,15 @@
 #include "error_stack.h"
 #include "memory_manager.h"
+#include <mutex>
 #include <stdarg.h>
 #include <stdio.h>
 
 // Error stack head.
 ErrorStackNode *ErrorStack::head;
 
+// Guards the stack so worker threads can log errors.
+static std::mutex stackLock;
+
 // Set up error stack node.
 ErrorStackNode::ErrorStackNode(char *message, ErrorStackNode *next)
 	: message(message), next(next)
@@ -59,6 +63,7 @@ void ErrorStack::Log(const char *format, ...)
 	buffer[length] = '\0';
 
 	// Allocate a stack node.
+	std::lock_guard<std::mutex> lock(stackLock);
 	ErrorStackNode *node = new ErrorStackNode(buffer, head);
 	if (node == NULL) {
 		MemoryManager::Free(buffer);
@@ -72,9 +77,12 @@ void ErrorStack::Log(const char *format, ...)
 // Dump all errors.
 void ErrorStack::Dump()
 {
-	int index = 1;
-	for (ErrorStackNode *node = head; node != nullptr; node = node->GetNext(), ++index) {
-		fprintf(stderr, "#%d: %s\n", index, node->GetMessage());
+	{
+		std::lock_guard<std::mutex> lock(stackLock);
+		int index = 1;
+		for (ErrorStackNode *node = head; node != nullptr; node = node->GetNext(), ++index) {
+			fprintf(stderr, "#%d: %s\n", index, node->GetMessage());
+		}
 	}
 	Clear();
 }
@@ -82,10 +90,12 @@ void ErrorStack::Dump()
 // Clear all errors in the stack.
 void ErrorStack::Clear()
 {
+	std::lock_guard<std::mutex> lock(stackLock);
 	ErrorStackNode *node = head;
 	while (node != nullptr) {
 		ErrorStackNode *next = node->GetNext();
 		delete node;
 		node = next;
 	}
+	head = nullptr;
 }
@@ -1,7 +1,13 @@
 #include "error_stack.h"
 #include "file.h"
 #include "memory_manager.h"
+#include <errno.h>
 #include <stdio.h>
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 
 // Start with no buffer/data.
 FileData::FileData() : data(nullptr), size(0)
@@ -36,7 +42,8 @@ uint8_t *FileData::AllocateData(int32_t size)
 // Mode string table.
 static const char *ModeStrings[File::OpenModeCount] = {
 	"r",
-	"rb"
+	"rb",
+	"wb"
 };
 
 File::File() : handle(nullptr)
@@ -167,3 +174,40 @@ bool File::Read(FileData *out)
 	}
 	return true;
 }
+
+// Write an amount of data to the file.
+bool File::Write(const void *data, int32_t size)
+{
+	size_t count = fwrite(data, 1, size, handle);
+	if (count != static_cast<size_t>(size)) {
+		ErrorStack::Log("Failed to write %d bytes to file.", size);
+		return false;
+	}
+	return true;
+}
+
+// Try opening the file for reading.
+bool File::Exists(const char *filename)
+{
+	FILE *file = fopen(filename, ModeStrings[BinaryReadMode]);
+	if (file == nullptr) {
+		return false;
+	}
+	fclose(file);
+	return true;
+}
+
+// An existing directory isn't an error.
+bool File::MakeDirectory(const char *path)
+{
+#if defined(_WIN32)
+	int result = _mkdir(path);
+#else
+	int result = mkdir(path, 0755);
+#endif
+	if ((result != 0) && (errno != EEXIST)) {
+		ErrorStack::Log("Failed to create directory: %s\n", path);
+		return false;
+	}
+	return true;
+}
@@ -224,7 +224,7 @@ void Matrix4x4::PerspectiveProjection(
 }
 
 // Multiply a matrix by a vector.
-void Matrix4x4::Transform(const Vector4 *vector, Vector4 *out)
+void Matrix4x4::Transform(const Vector4 *vector, Vector4 *out) const
 {
 	out->x = (vector->x * matrixArray[0][0]) + (vector->y * matrixArray[0][1]) + (vector->z * matrixArray[0][2]) + (vector->w * matrixArray[0][3]);
 	out->y = (vector->x * matrixArray[1][0]) + (vector->y * matrixArray[1][1]) + (vector->z * matrixArray[1][2]) + (vector->w * matrixArray[1][3]);
@@ -1,5 +1,7 @@
 #include "memory_manager.h"
+#include <mutex>
 #include <new>
+#include <stdint.h>
 #include <stdio.h>
 
 // Allocation count static.
@@ -12,6 +14,9 @@ int MemoryManager::breakAllocation = -1;
 int MemoryManager::usedStart = MaximumAllocations;
 int MemoryManager::freeStart = 0;
 Allocation MemoryManager::allocations[MaximumAllocations];
+
+// Guards allocation bookkeeping against worker threads.
+static std::mutex allocationLock;
 #endif
 
 // Initialize memory management.
@@ -49,6 +54,8 @@ void *MemoryManager::Allocate(unsigned int size)
 {
 	void *result = new (std::nothrow) char[size];
 #if defined(_DEBUG)
+	std::lock_guard<std::mutex> lock(allocationLock);
+
 	// Check if break allocation.
 	int currentIndex = allocationIndex++;
 	if (currentIndex == breakAllocation) {
@@ -91,6 +98,10 @@ void *MemoryManager::Allocate(unsigned int size)
 // Free memory chunk.
 void MemoryManager::Free(void* buffer)
 {
+#if defined(_DEBUG)
+	// Hold the lock across the free so the address can't be handed out again before it's unlisted.
+	std::lock_guard<std::mutex> lock(allocationLock);
+#endif
 	delete[] reinterpret_cast<char*>(buffer);
 
 #if defined(_DEBUG)
@@ -125,6 +136,28 @@ void MemoryManager::Free(void* buffer)
 #endif
 }
 
+// Over-allocate and keep the real address just before the aligned one.
+void *MemoryManager::AllocateAligned(unsigned int size, unsigned int alignment)
+{
+	unsigned int padding = (alignment - 1) + sizeof(void*);
+	char *buffer = reinterpret_cast<char*>(Allocate(size + padding));
+	if (buffer == nullptr) {
+		return nullptr;
+	}
+	uintptr_t address = (reinterpret_cast<uintptr_t>(buffer) + padding) & ~static_cast<uintptr_t>(alignment - 1);
+	void **aligned = reinterpret_cast<void**>(address);
+	aligned[-1] = buffer;
+	return aligned;
+}
+
+// Free the real address stored before the buffer.
+void MemoryManager::FreeAligned(void *buffer)
+{
+	if (buffer != nullptr) {
+		Free(reinterpret_cast<void**>(buffer)[-1]);
+	}
+}
+
 #if defined(_DEBUG)
 // Set which allocation to trigger a debug breakpoint on.
 void MemoryManager::SetBreakAllocation(int allocationIndex)
@@ -0,0 +1,302 @@
+#include "error_stack.h"
+#include "memory_manager.h"
+#include "mesh_optimizer.h"
+#include <math.h>
+#include <string.h>
+
+// Vertex scoring parameters from Forsyth's reference implementation.
+static const float CacheDecayPower = 1.5f;
+static const float LastTriangleScore = 0.75f;
+static const float ValenceBoostScale = 2.0f;
+static const float ValenceBoostPower = 0.5f;
+
+// FNV-1a hashing constants for welding.
+static const uint32_t HashOffsetBasis = 2166136261u;
+static const uint32_t HashPrime = 16777619u;
+
+// Per-vertex state while optimizing.
+struct OptimizerVertex
+{
+	float score;
+	int32_t cachePosition; // Position in the modelled cache, or -1 if not cached.
+	int32_t activeTriangles; // Triangles using this vertex not yet output.
+	int32_t firstTriangle; // Start of this vertex's triangles in the adjacency table.
+};
+
+// Score a vertex by its cache position and remaining triangles.
+// Vertices with few triangles left are boosted so isolated triangles aren't left behind.
+static float GetVertexScore(int32_t cachePosition, int32_t activeTriangles)
+{
+	if (activeTriangles == 0) {
+		return -1.0f;
+	}
+
+	float score = 0.0f;
+	if (cachePosition >= 0) {
+		if (cachePosition < 3) {
+			// Vertices from the last triangle get a fixed score so the next
+			// triangle doesn't strongly prefer sharing an edge with it.
+			score = LastTriangleScore;
+		}
+		else {
+			const float scaler = 1.0f / static_cast<float>(MeshOptimizer::ScoredCacheSize - 3);
+			score = 1.0f - static_cast<float>(cachePosition - 3) * scaler;
+			score = powf(score, CacheDecayPower);
+		}
+	}
+	score += ValenceBoostScale * powf(static_cast<float>(activeTriangles), -ValenceBoostPower);
+	return score;
+}
+
+// Hash a vertex's bytes.
+static uint32_t HashVertex(const uint8_t *vertex, int32_t vertexSize)
+{
+	uint32_t hash = HashOffsetBasis;
+	for (int32_t i = 0; i < vertexSize; ++i) {
+		hash = (hash ^ vertex[i]) * HashPrime;
+	}
+	return hash;
+}
+
+// Weld identical vertices through an open-addressed hash table of unique vertices.
+int32_t MeshOptimizer::WeldVertices(
+	void *vertices,
+	int32_t vertexCount,
+	int32_t vertexSize,
+	uint32_t *indices,
+	int32_t indexCount)
+{
+	// Keep the table at most half full.
+	int32_t tableSize = 1;
+	while (tableSize < (vertexCount << 1)) {
+		tableSize <<= 1;
+	}
+	int32_t tableMask = tableSize - 1;
+	int32_t *table = reinterpret_cast<int32_t*>(MemoryManager::Allocate(tableSize * sizeof(int32_t)));
+	uint32_t *remap = reinterpret_cast<uint32_t*>(MemoryManager::Allocate(vertexCount * sizeof(uint32_t)));
+	if ((table == nullptr) || (remap == nullptr)) {
+		ErrorStack::Log("Failed to allocate welding tables for %d vertices.", vertexCount);
+		if (table != nullptr) {
+			MemoryManager::Free(table);
+		}
+		if (remap != nullptr) {
+			MemoryManager::Free(remap);
+		}
+		return -1;
+	}
+	memset(table, 0xFF, tableSize * sizeof(int32_t));
+
+	// Unique vertices are moved down as they're found; they never pass the vertex being read.
+	uint8_t *bytes = reinterpret_cast<uint8_t*>(vertices);
+	int32_t uniqueCount = 0;
+	for (int32_t i = 0; i < vertexCount; ++i) {
+		const uint8_t *vertex = bytes + (i * vertexSize);
+		int32_t slot = static_cast<int32_t>(HashVertex(vertex, vertexSize)) & tableMask;
+		while (table[slot] != -1) {
+			if (memcmp(bytes + (table[slot] * vertexSize), vertex, vertexSize) == 0) {
+				break;
+			}
+			slot = (slot + 1) & tableMask;
+		}
+		if (table[slot] == -1) {
+			if (uniqueCount != i) {
+				memmove(bytes + (uniqueCount * vertexSize), vertex, vertexSize);
+			}
+			table[slot] = uniqueCount++;
+		}
+		remap[i] = static_cast<uint32_t>(table[slot]);
+	}
+
+	for (int32_t i = 0; i < indexCount; ++i) {
+		indices[i] = remap[indices[i]];
+	}
+	MemoryManager::Free(table);
+	MemoryManager::Free(remap);
+	return uniqueCount;
+}
+
+// Greedily output the best scored triangle, rescoring only vertices in the cache.
+bool MeshOptimizer::OptimizeVertexCache(
+	const uint32_t *indices,
+	int32_t indexCount,
+	int32_t vertexCount,
+	int32_t *triangleOrder)
+{
+	int32_t triangleCount = indexCount / 3;
+	OptimizerVertex *optimizerVertices = reinterpret_cast<OptimizerVertex*>(MemoryManager::Allocate(vertexCount * sizeof(OptimizerVertex)));
+	int32_t *adjacency = reinterpret_cast<int32_t*>(MemoryManager::Allocate(indexCount * sizeof(int32_t)));
+	float *triangleScores = reinterpret_cast<float*>(MemoryManager::Allocate(triangleCount * sizeof(float)));
+	uint8_t *isAdded = reinterpret_cast<uint8_t*>(MemoryManager::Allocate(triangleCount * sizeof(uint8_t)));
+	if ((optimizerVertices == nullptr) || (adjacency == nullptr) || (triangleScores == nullptr) || (isAdded == nullptr)) {
+		ErrorStack::Log("Failed to allocate vertex cache optimizer state for %d triangles.", triangleCount);
+		if (optimizerVertices != nullptr) {
+			MemoryManager::Free(optimizerVertices);
+		}
+		if (adjacency != nullptr) {
+			MemoryManager::Free(adjacency);
+		}
+		if (triangleScores != nullptr) {
+			MemoryManager::Free(triangleScores);
+		}
+		if (isAdded != nullptr) {
+			MemoryManager::Free(isAdded);
+		}
+		return false;
+	}
+
+	// Count triangles per vertex and build the adjacency table.
+	for (int32_t i = 0; i < vertexCount; ++i) {
+		optimizerVertices[i].cachePosition = -1;
+		optimizerVertices[i].activeTriangles = 0;
+	}
+	for (int32_t i = 0; i < indexCount; ++i) {
+		++optimizerVertices[indices[i]].activeTriangles;
+	}
+	int32_t firstTriangle = 0;
+	for (int32_t i = 0; i < vertexCount; ++i) {
+		OptimizerVertex *vertex = &optimizerVertices[i];
+		vertex->firstTriangle = firstTriangle;
+		firstTriangle += vertex->activeTriangles;
+		vertex->activeTriangles = 0;
+	}
+	for (int32_t i = 0; i < indexCount; ++i) {
+		OptimizerVertex *vertex = &optimizerVertices[indices[i]];
+		adjacency[vertex->firstTriangle + vertex->activeTriangles++] = i / 3;
+	}
+
+	// Initial scores, starting from the best triangle.
+	for (int32_t i = 0; i < vertexCount; ++i) {
+		OptimizerVertex *vertex = &optimizerVertices[i];
+		vertex->score = GetVertexScore(vertex->cachePosition, vertex->activeTriangles);
+	}
+	int32_t bestTriangle = -1;
+	float bestScore = -1.0f;
+	for (int32_t i = 0; i < triangleCount; ++i) {
+		const uint32_t *triangle = &indices[i * 3];
+		float score = optimizerVertices[triangle[0]].score +
+			optimizerVertices[triangle[1]].score +
+			optimizerVertices[triangle[2]].score;
+		triangleScores[i] = score;
+		isAdded[i] = 0;
+		if (score > bestScore) {
+			bestScore = score;
+			bestTriangle = i;
+		}
+	}
+
+	int32_t cache[ScoredCacheSize + 3];
+	int32_t cacheCount = 0;
+	int32_t scanCursor = 0;
+	for (int32_t i = 0; i < triangleCount; ++i) {
+		// Nothing in the cache has triangles left, so continue from the next unused one.
+		if (bestTriangle == -1) {
+			while (isAdded[scanCursor] != 0) {
+				++scanCursor;
+			}
+			bestTriangle = scanCursor;
+		}
+		triangleOrder[i] = bestTriangle;
+		isAdded[bestTriangle] = 1;
+
+		// Remove the triangle from its vertices' active lists.
+		const uint32_t *triangle = &indices[bestTriangle * 3];
+		for (int32_t j = 0; j < 3; ++j) {
+			OptimizerVertex *vertex = &optimizerVertices[triangle[j]];
+			int32_t *triangles = &adjacency[vertex->firstTriangle];
+			int32_t last = vertex->activeTriangles - 1;
+			for (int32_t k = 0; k <= last; ++k) {
+				if (triangles[k] == bestTriangle) {
+					triangles[k] = triangles[last];
+					triangles[last] = bestTriangle;
+					--vertex->activeTriangles;
+					break;
+				}
+			}
+		}
+
+		// Move the triangle's vertices to the front of the cache.
+		int32_t newCache[ScoredCacheSize + 3];
+		int32_t newCacheCount = 0;
+		for (int32_t j = 0; j < 3; ++j) {
+			int32_t vertexIndex = static_cast<int32_t>(triangle[j]);
+			bool isCached = false;
+			for (int32_t k = 0; k < newCacheCount; ++k) {
+				isCached = isCached || (newCache[k] == vertexIndex);
+			}
+			if (!isCached) {
+				newCache[newCacheCount++] = vertexIndex;
+			}
+		}
+		for (int32_t j = 0; j < cacheCount; ++j) {
+			int32_t vertexIndex = cache[j];
+			if ((vertexIndex != static_cast<int32_t>(triangle[0])) &&
+				(vertexIndex != static_cast<int32_t>(triangle[1])) &&
+				(vertexIndex != static_cast<int32_t>(triangle[2]))) {
+				newCache[newCacheCount++] = vertexIndex;
+			}
+		}
+
+		// Rescore cached vertices, including those just pushed out.
+		for (int32_t j = 0; j < newCacheCount; ++j) {
+			OptimizerVertex *vertex = &optimizerVertices[newCache[j]];
+			vertex->cachePosition = (j < ScoredCacheSize) ? j : -1;
+			vertex->score = GetVertexScore(vertex->cachePosition, vertex->activeTriangles);
+		}
+
+		// Rescore their remaining triangles and pick the best for the next step.
+		bestTriangle = -1;
+		bestScore = -1.0f;
+		for (int32_t j = 0; j < newCacheCount; ++j) {
+			const OptimizerVertex *vertex = &optimizerVertices[newCache[j]];
+			const int32_t *triangles = &adjacency[vertex->firstTriangle];
+			for (int32_t k = 0; k < vertex->activeTriangles; ++k) {
+				int32_t triangleIndex = triangles[k];
+				const uint32_t *candidate = &indices[triangleIndex * 3];
+				float score = optimizerVertices[candidate[0]].score +
+					optimizerVertices[candidate[1]].score +
+					optimizerVertices[candidate[2]].score;
+				triangleScores[triangleIndex] = score;
+				if (score > bestScore) {
+					bestScore = score;
+					bestTriangle = triangleIndex;
+				}
+			}
+		}
+
+		cacheCount = (newCacheCount < ScoredCacheSize) ? newCacheCount : ScoredCacheSize;
+		memcpy(cache, newCache, cacheCount * sizeof(int32_t));
+	}
+
+	MemoryManager::Free(optimizerVertices);
+	MemoryManager::Free(adjacency);
+	MemoryManager::Free(triangleScores);
+	MemoryManager::Free(isAdded);
+	return true;
+}
+
+// Count misses through a FIFO cache by stamping each vertex with its insertion time.
+int32_t MeshOptimizer::CountCacheMisses(
+	const uint32_t *indices,
+	int32_t indexCount,
+	int32_t vertexCount)
+{
+	int32_t *insertionTimes = reinterpret_cast<int32_t*>(MemoryManager::Allocate(vertexCount * sizeof(int32_t)));
+	if (insertionTimes == nullptr) {
+		ErrorStack::Log("Failed to allocate cache simulation for %d vertices.", vertexCount);
+		return indexCount;
+	}
+	for (int32_t i = 0; i < vertexCount; ++i) {
+		insertionTimes[i] = -SimulatedCacheSize;
+	}
+
+	// A vertex is cached until the cache has taken in as many newer vertices as it holds.
+	int32_t insertionCount = 0;
+	for (int32_t i = 0; i < indexCount; ++i) {
+		int32_t *insertionTime = &insertionTimes[indices[i]];
+		if ((insertionCount - *insertionTime) >= SimulatedCacheSize) {
+			*insertionTime = insertionCount++;
+		}
+	}
+	MemoryManager::Free(insertionTimes);
+	return insertionCount;
+}
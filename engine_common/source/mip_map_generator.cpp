@@ -0,0 +1,78 @@
+#include "mip_map_generator.h"
+#include <emmintrin.h>
+#include <string.h>
+
+// Copy the source into the first level and filter each level from the last.
+bool MipMapGenerator::Generate(const Image<PixelRGBA> *source, Image<PixelRGBA> *out)
+{
+	int width = source->GetWidth();
+	int height = source->GetHeight();
+	int levelCount = Image<PixelRGBA>::GetFullLevelCount(width, height);
+	if (!out->Initialize(width, height, levelCount)) {
+		ErrorStack::Log("Failed to allocate %d mip levels for %d by %d image.", levelCount, width, height);
+		return false;
+	}
+	memcpy(out->GetBuffer(), source->GetBuffer(), (width * height) * sizeof(PixelRGBA));
+	for (int i = 1; i < levelCount; ++i) {
+		FilterLevel(
+			out->GetLevelBuffer(i - 1),
+			out->GetLevelWidth(i - 1),
+			out->GetLevelHeight(i - 1),
+			out->GetLevelBuffer(i),
+			out->GetLevelWidth(i),
+			out->GetLevelHeight(i));
+	}
+	return true;
+}
+
+// Average each 2x2 block, rounding to nearest.
+// Four source pixels from each row make two output pixels per step; channels are
+// widened to 16 bits, the rows summed, then each pixel pair summed across halves.
+void MipMapGenerator::FilterLevel(
+	const PixelRGBA *source,
+	int sourceWidth,
+	int sourceHeight,
+	PixelRGBA *out,
+	int outWidth,
+	int outHeight)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i rounding = _mm_set1_epi16(2);
+	int pairedWidth = (sourceWidth >> 1) & ~1; // Output pixels with both source columns in the SIMD path.
+	if (pairedWidth > outWidth) {
+		pairedWidth = outWidth;
+	}
+	for (int y = 0; y < outHeight; ++y) {
+		int topRow = y << 1;
+		int bottomRow = (topRow + 1 < sourceHeight) ? (topRow + 1) : topRow;
+		const PixelRGBA *top = &source[topRow * sourceWidth];
+		const PixelRGBA *bottom = &source[bottomRow * sourceWidth];
+		PixelRGBA *outRow = &out[y * outWidth];
+
+		int x = 0;
+		for (; x < pairedWidth; x += 2) {
+			__m128i topPixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&top[x << 1]));
+			__m128i bottomPixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&bottom[x << 1]));
+			__m128i low = _mm_add_epi16(_mm_unpacklo_epi8(topPixels, zero), _mm_unpacklo_epi8(bottomPixels, zero));
+			__m128i high = _mm_add_epi16(_mm_unpackhi_epi8(topPixels, zero), _mm_unpackhi_epi8(bottomPixels, zero));
+			low = _mm_add_epi16(low, _mm_srli_si128(low, 8));
+			high = _mm_add_epi16(high, _mm_srli_si128(high, 8));
+			__m128i sums = _mm_unpacklo_epi64(low, high);
+			sums = _mm_srli_epi16(_mm_add_epi16(sums, rounding), 2);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(&outRow[x]), _mm_packus_epi16(sums, zero));
+		}
+		for (; x < outWidth; ++x) {
+			int left = x << 1;
+			int right = (left + 1 < sourceWidth) ? (left + 1) : left;
+			const PixelRGBA *a = &top[left];
+			const PixelRGBA *b = &top[right];
+			const PixelRGBA *c = &bottom[left];
+			const PixelRGBA *d = &bottom[right];
+			PixelRGBA *pixel = &outRow[x];
+			pixel->r = static_cast<uint8_t>((a->r + b->r + c->r + d->r + 2) >> 2);
+			pixel->g = static_cast<uint8_t>((a->g + b->g + c->g + d->g + 2) >> 2);
+			pixel->b = static_cast<uint8_t>((a->b + b->b + c->b + d->b + 2) >> 2);
+			pixel->a = static_cast<uint8_t>((a->a + b->a + c->a + d->a + 2) >> 2);
+		}
+	}
+}
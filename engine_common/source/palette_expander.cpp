@@ -0,0 +1,57 @@
+#include "palette_expander.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#else
+#include <emmintrin.h>
+#endif
+#include <string.h>
+
+// Vector lookups for whole blocks, then single lookups for the rest.
+void PaletteExpander::Expand(
+	const uint8_t *indices,
+	int count,
+	const PixelRGBA *palette,
+	PixelRGBA *out)
+{
+	const int32_t *colours = reinterpret_cast<const int32_t*>(palette);
+	int i = 0;
+#if defined(__AVX2__)
+	// Widen eight indices to 32 bits and gather their colours.
+	for (; (i + 8) <= count; i += 8) {
+		__m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(&indices[i]));
+		__m256i gathered = _mm256_i32gather_epi32(colours, _mm256_cvtepu8_epi32(bytes), sizeof(int32_t));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(&out[i]), gathered);
+	}
+#else
+	// Without gathers, read eight indices in one load and write four colours per store.
+	for (; (i + 8) <= count; i += 8) {
+		uint64_t octet;
+		memcpy(&octet, &indices[i], sizeof(octet));
+		__m128i low = _mm_setr_epi32(
+			colours[octet & 0xFF],
+			colours[(octet >> 8) & 0xFF],
+			colours[(octet >> 16) & 0xFF],
+			colours[(octet >> 24) & 0xFF]);
+		__m128i high = _mm_setr_epi32(
+			colours[(octet >> 32) & 0xFF],
+			colours[(octet >> 40) & 0xFF],
+			colours[(octet >> 48) & 0xFF],
+			colours[octet >> 56]);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&out[i]), low);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&out[i + 4]), high);
+	}
+#endif
+	ExpandScalar(&indices[i], count - i, palette, &out[i]);
+}
+
+// Copy each index's colour.
+void PaletteExpander::ExpandScalar(
+	const uint8_t *indices,
+	int count,
+	const PixelRGBA *palette,
+	PixelRGBA *out)
+{
+	for (int i = 0; i < count; ++i) {
+		out[i] = palette[indices[i]];
+	}
+}
@@ -0,0 +1,120 @@
+#include "error_stack.h"
+#include "memory_manager.h"
+#include "pixel_buffer_pool.h"
+
+// Singleton instance reference.
+PixelBufferPool *PixelBufferPool::instance = nullptr;
+
+// Initialize pool singleton instance.
+bool PixelBufferPool::Initialize(int64_t idleByteLimit)
+{
+	instance = new PixelBufferPool(idleByteLimit);
+	if (instance == nullptr) {
+		ErrorStack::Log("Failed to allocate pixel buffer pool instance.");
+		return false;
+	}
+	return true;
+}
+
+// Destroy the pool and its idle buffers; buffers still in use are freed by their images.
+void PixelBufferPool::Shutdown()
+{
+	delete instance;
+	instance = nullptr;
+}
+
+PixelBufferPool::PixelBufferPool(int64_t idleByteLimit)
+	: idleByteLimit(idleByteLimit),
+	idleBytes(0)
+{
+	for (int i = 0; i < ClassCount; ++i) {
+		idleBuffers[i] = nullptr;
+	}
+}
+
+PixelBufferPool::~PixelBufferPool()
+{
+	for (int i = 0; i < ClassCount; ++i) {
+		IdleBuffer *buffer = idleBuffers[i];
+		while (buffer != nullptr) {
+			IdleBuffer *next = buffer->next;
+			MemoryManager::FreeAligned(buffer);
+			buffer = next;
+		}
+	}
+}
+
+// Round the size up to its class; sizes past the largest class are allocated exactly.
+void *PixelBufferPool::Allocate(unsigned int size, unsigned int *capacity)
+{
+	int shift = MinimumClassShift;
+	while ((shift <= MaximumClassShift) && ((1u << shift) < size)) {
+		++shift;
+	}
+	if (shift > MaximumClassShift) {
+		*capacity = size;
+		return MemoryManager::AllocateAligned(size, BufferAlignment);
+	}
+
+	int sizeClass = shift - MinimumClassShift;
+	unsigned int classSize = 1u << shift;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		IdleBuffer *buffer = idleBuffers[sizeClass];
+		if (buffer != nullptr) {
+			idleBuffers[sizeClass] = buffer->next;
+			idleBytes -= classSize;
+			*capacity = classSize;
+			return buffer;
+		}
+	}
+	*capacity = classSize;
+	return MemoryManager::AllocateAligned(classSize, BufferAlignment);
+}
+
+// A buffer goes in the largest class it can hold, so buffers sized exactly can be kept too.
+void PixelBufferPool::Free(void *buffer, unsigned int capacity)
+{
+	int shift = MaximumClassShift;
+	while ((shift >= MinimumClassShift) && ((1u << shift) > capacity)) {
+		--shift;
+	}
+	if ((shift < MinimumClassShift) || (capacity > (1u << MaximumClassShift))) {
+		MemoryManager::FreeAligned(buffer);
+		return;
+	}
+
+	unsigned int classSize = 1u << shift;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if ((idleBytes + classSize) <= idleByteLimit) {
+			IdleBuffer *idle = reinterpret_cast<IdleBuffer*>(buffer);
+			idle->next = idleBuffers[shift - MinimumClassShift];
+			idleBuffers[shift - MinimumClassShift] = idle;
+			idleBytes += classSize;
+			return;
+		}
+	}
+	MemoryManager::FreeAligned(buffer);
+}
+
+// Without a pool, buffers are still aligned so they can be given to one later.
+void *PixelBufferPool::AllocateBuffer(unsigned int size, unsigned int *capacity)
+{
+	if (instance != nullptr) {
+		return instance->Allocate(size, capacity);
+	}
+	*capacity = size;
+	return MemoryManager::AllocateAligned(size, BufferAlignment);
+}
+
+// Free through the pool if there is one.
+void PixelBufferPool::FreeBuffer(void *buffer, unsigned int capacity)
+{
+	if (instance != nullptr) {
+		instance->Free(buffer, capacity);
+	}
+	else {
+		MemoryManager::FreeAligned(buffer);
+	}
+}
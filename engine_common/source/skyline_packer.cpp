@@ -0,0 +1,146 @@
+#include "error_stack.h"
+#include "memory_manager.h"
+#include "skyline_packer.h"
+#include <string.h>
+
+SkylinePacker::SkylinePacker()
+	: segments(nullptr),
+	segmentCount(0),
+	width(0),
+	height(0),
+	usedArea(0)
+{
+}
+
+SkylinePacker::~SkylinePacker()
+{
+	Destroy();
+}
+
+// Every segment is at least one unit wide, so the width bounds the segment count.
+// One more is needed while an insert is splitting segments.
+bool SkylinePacker::Initialize(int32_t width, int32_t height)
+{
+	Destroy();
+	segments = reinterpret_cast<Segment*>(MemoryManager::Allocate((width + 1) * sizeof(Segment)));
+	if (segments == nullptr) {
+		ErrorStack::Log("Failed to allocate skyline of %d segments.", width);
+		return false;
+	}
+	this->width = width;
+	this->height = height;
+	Clear();
+	return true;
+}
+
+// Free segment storage.
+void SkylinePacker::Destroy()
+{
+	if (segments != nullptr) {
+		MemoryManager::Free(segments);
+		segments = nullptr;
+	}
+	segmentCount = 0;
+	width = 0;
+	height = 0;
+	usedArea = 0;
+}
+
+// Reset to a single segment along the bottom.
+void SkylinePacker::Clear()
+{
+	segments[0].x = 0;
+	segments[0].y = 0;
+	segments[0].width = width;
+	segmentCount = 1;
+	usedArea = 0;
+}
+
+// Pick the placement with the lowest top, preferring narrower segments on ties to leave wide ones open.
+bool SkylinePacker::Insert(int32_t width, int32_t height, int32_t *x, int32_t *y)
+{
+	int32_t bestIndex = -1;
+	int32_t bestTop = 0;
+	int32_t bestWidth = 0;
+	for (int32_t i = 0; i < segmentCount; ++i) {
+		int32_t top = GetFitTop(i, width, height);
+		if (top == -1) {
+			continue;
+		}
+		if ((bestIndex == -1) || (top < bestTop) || ((top == bestTop) && (segments[i].width < bestWidth))) {
+			bestIndex = i;
+			bestTop = top;
+			bestWidth = segments[i].width;
+		}
+	}
+	if (bestIndex == -1) {
+		return false;
+	}
+
+	// Add a segment for the rectangle's top edge.
+	int32_t left = segments[bestIndex].x;
+	int32_t right = left + width;
+	memmove(&segments[bestIndex + 1], &segments[bestIndex], (segmentCount - bestIndex) * sizeof(Segment));
+	++segmentCount;
+	Segment *added = &segments[bestIndex];
+	added->x = left;
+	added->y = bestTop;
+	added->width = width;
+
+	// Trim or remove the segments it now covers.
+	int32_t next = bestIndex + 1;
+	while (next < segmentCount) {
+		Segment *segment = &segments[next];
+		if (segment->x >= right) {
+			break;
+		}
+		int32_t segmentRight = segment->x + segment->width;
+		if (segmentRight > right) {
+			segment->width = segmentRight - right;
+			segment->x = right;
+			break;
+		}
+		memmove(segment, segment + 1, (segmentCount - next - 1) * sizeof(Segment));
+		--segmentCount;
+	}
+
+	// Join neighbours at the same height.
+	for (int32_t i = 0; i < segmentCount - 1;) {
+		if (segments[i].y == segments[i + 1].y) {
+			segments[i].width += segments[i + 1].width;
+			memmove(&segments[i + 1], &segments[i + 2], (segmentCount - i - 2) * sizeof(Segment));
+			--segmentCount;
+		}
+		else {
+			++i;
+		}
+	}
+
+	*x = left;
+	*y = bestTop - height;
+	usedArea += width * height;
+	return true;
+}
+
+// The rectangle rests on the highest segment under it.
+int32_t SkylinePacker::GetFitTop(int32_t segmentIndex, int32_t width, int32_t height) const
+{
+	int32_t left = segments[segmentIndex].x;
+	if (left + width > this->width) {
+		return -1;
+	}
+	int32_t bottom = 0;
+	int32_t remaining = width;
+	for (int32_t i = segmentIndex; remaining > 0; ++i) {
+		const Segment *segment = &segments[i];
+		if (segment->y > bottom) {
+			bottom = segment->y;
+		}
+		remaining -= segment->width;
+	}
+	int32_t top = bottom + height;
+	if (top > this->height) {
+		return -1;
+	}
+	return top;
+}
@@ -0,0 +1,138 @@
+#include "error_stack.h"
+#include "memory_manager.h"
+#include "texture_cache.h"
+#include <ctype.h>
+#include <string.h>
+
+// FNV-1a hashing constants for keys.
+static const uint32_t HashOffsetBasis = 2166136261u;
+static const uint32_t HashPrime = 16777619u;
+
+// Singleton instance reference.
+TextureCache *TextureCache::instance = nullptr;
+
+// Initialize texture cache singleton instance.
+bool TextureCache::Initialize()
+{
+	instance = new TextureCache();
+	if (instance == nullptr) {
+		ErrorStack::Log("Failed to allocate texture cache instance.");
+		return false;
+	}
+	return true;
+}
+
+// Destroy the cache and its remaining textures.
+void TextureCache::Shutdown()
+{
+	delete instance;
+	instance = nullptr;
+}
+
+TextureCache::TextureCache() : entryCount(0)
+{
+	for (int32_t i = 0; i < BucketCount; ++i) {
+		buckets[i] = nullptr;
+	}
+}
+
+TextureCache::~TextureCache()
+{
+	for (int32_t i = 0; i < BucketCount; ++i) {
+		TextureCacheEntry *entry = buckets[i];
+		while (entry != nullptr) {
+			TextureCacheEntry *next = entry->next;
+			delete entry->texture;
+			MemoryManager::Free(entry->key);
+			MemoryManager::Free(entry);
+			entry = next;
+		}
+	}
+}
+
+// Search the key's bucket.
+TextureCacheEntry *TextureCache::Acquire(const char *key)
+{
+	TextureCacheEntry *entry = buckets[HashKey(key) % BucketCount];
+	for (; entry != nullptr; entry = entry->next) {
+		if (IsKeyEqual(entry->key, key)) {
+			++entry->references;
+			return entry;
+		}
+	}
+	return nullptr;
+}
+
+// Copy the key and link a new entry at the front of its bucket.
+TextureCacheEntry *TextureCache::Add(
+	const char *key,
+	Renderer::Texture *texture,
+	int width,
+	int height,
+	int32_t memorySize)
+{
+	size_t keySize = strlen(key) + 1;
+	TextureCacheEntry *entry = reinterpret_cast<TextureCacheEntry*>(MemoryManager::Allocate(sizeof(TextureCacheEntry)));
+	char *keyCopy = reinterpret_cast<char*>(MemoryManager::Allocate(keySize));
+	if ((entry == nullptr) || (keyCopy == nullptr)) {
+		ErrorStack::Log("Failed to allocate texture cache entry for %s.", key);
+		if (entry != nullptr) {
+			MemoryManager::Free(entry);
+		}
+		if (keyCopy != nullptr) {
+			MemoryManager::Free(keyCopy);
+		}
+		delete texture;
+		return nullptr;
+	}
+	memcpy(keyCopy, key, keySize);
+	TextureCacheEntry **bucket = &buckets[HashKey(key) % BucketCount];
+	entry->key = keyCopy;
+	entry->texture = texture;
+	entry->width = width;
+	entry->height = height;
+	entry->memorySize = memorySize;
+	entry->references = 1;
+	entry->next = *bucket;
+	*bucket = entry;
+	++entryCount;
+	return entry;
+}
+
+// Unlink and free the entry once its last reference goes.
+void TextureCache::Release(TextureCacheEntry *entry)
+{
+	if (--entry->references != 0) {
+		return;
+	}
+	TextureCacheEntry **link = &buckets[HashKey(entry->key) % BucketCount];
+	while (*link != entry) {
+		link = &(*link)->next;
+	}
+	*link = entry->next;
+	delete entry->texture;
+	MemoryManager::Free(entry->key);
+	MemoryManager::Free(entry);
+	--entryCount;
+}
+
+// Hash the lowercase key.
+uint32_t TextureCache::HashKey(const char *key)
+{
+	uint32_t hash = HashOffsetBasis;
+	for (; *key != '\0'; ++key) {
+		hash = (hash ^ static_cast<uint8_t>(tolower(static_cast<uint8_t>(*key)))) * HashPrime;
+	}
+	return hash;
+}
+
+// Compare the keys a character at a time.
+bool TextureCache::IsKeyEqual(const char *a, const char *b)
+{
+	for (; (*a != '\0') && (*b != '\0'); ++a, ++b) {
+		if (tolower(static_cast<uint8_t>(*a)) != tolower(static_cast<uint8_t>(*b))) {
+			return false;
+		}
+	}
+	return (*a == *b);
+}
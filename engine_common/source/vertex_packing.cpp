@@ -0,0 +1,107 @@
+#include "vertex_packing.h"
+#include <math.h>
+#include <string.h>
+
+// Clamp a value to a range and round it to the nearest whole number.
+static float ClampRound(float value, float minimum, float maximum)
+{
+	if (value < minimum) {
+		value = minimum;
+	}
+	else if (value > maximum) {
+		value = maximum;
+	}
+	return floorf(value + 0.5f);
+}
+
+// Convert to fixed point.
+int16_t VertexPacking::ToFixedShort(float value, float scale)
+{
+	return static_cast<int16_t>(ClampRound(value * scale, -32768.0f, 32767.0f));
+}
+
+// Round the same way as the conversion, then compare against the short's range.
+bool VertexPacking::FitsFixedShort(float value, float scale)
+{
+	float rounded = floorf((value * scale) + 0.5f);
+	return (rounded >= -32768.0f) && (rounded <= 32767.0f);
+}
+
+// Convert to a normalized short.
+int16_t VertexPacking::ToShortNormalized(float value)
+{
+	return static_cast<int16_t>(ClampRound(value * 32767.0f, -32767.0f, 32767.0f));
+}
+
+// Convert to a normalized unsigned short.
+uint16_t VertexPacking::ToUnsignedShortNormalized(float value)
+{
+	return static_cast<uint16_t>(ClampRound(value * 65535.0f, 0.0f, 65535.0f));
+}
+
+// Convert to a normalized byte.
+int8_t VertexPacking::ToByteNormalized(float value)
+{
+	return static_cast<int8_t>(ClampRound(value * 127.0f, -127.0f, 127.0f));
+}
+
+// Convert to a normalized unsigned byte.
+uint8_t VertexPacking::ToUnsignedByteNormalized(float value)
+{
+	return static_cast<uint8_t>(ClampRound(value * 255.0f, 0.0f, 255.0f));
+}
+
+// Convert to half precision, rounding the dropped mantissa bits to nearest even.
+uint16_t VertexPacking::ToHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	uint32_t floatExponent = (bits >> 23) & 0xFF;
+	uint32_t mantissa = bits & 0x7FFFFF;
+
+	// Infinity stays infinity and NaN stays NaN.
+	if (floatExponent == 0xFF) {
+		return static_cast<uint16_t>(sign | 0x7C00 | ((mantissa != 0) ? 0x200 : 0));
+	}
+
+	// Overflow becomes infinity.
+	int32_t exponent = static_cast<int32_t>(floatExponent) - 127 + 15;
+	if (exponent >= 31) {
+		return static_cast<uint16_t>(sign | 0x7C00);
+	}
+
+	// Small values become subnormal, or zero if too small to represent.
+	uint32_t half;
+	int32_t shift;
+	if (exponent <= 0) {
+		if (exponent < -10) {
+			return static_cast<uint16_t>(sign);
+		}
+		mantissa |= 0x800000;
+		shift = 14 - exponent;
+		half = mantissa >> shift;
+	}
+	else {
+		shift = 13;
+		half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> shift);
+	}
+
+	// A carry out of the mantissa correctly moves into the exponent.
+	uint32_t remainder = mantissa & ((1u << shift) - 1);
+	uint32_t halfway = 1u << (shift - 1);
+	if ((remainder > halfway) || ((remainder == halfway) && ((half & 1) != 0))) {
+		++half;
+	}
+	return static_cast<uint16_t>(sign | half);
+}
+
+// Pack a signed normalized vector into 10:10:10:2 bits.
+uint32_t VertexPacking::ToInt1010102Normalized(float x, float y, float z, float w)
+{
+	uint32_t packedX = static_cast<uint32_t>(static_cast<int32_t>(ClampRound(x * 511.0f, -511.0f, 511.0f))) & 0x3FF;
+	uint32_t packedY = static_cast<uint32_t>(static_cast<int32_t>(ClampRound(y * 511.0f, -511.0f, 511.0f))) & 0x3FF;
+	uint32_t packedZ = static_cast<uint32_t>(static_cast<int32_t>(ClampRound(z * 511.0f, -511.0f, 511.0f))) & 0x3FF;
+	uint32_t packedW = static_cast<uint32_t>(static_cast<int32_t>(ClampRound(w, -1.0f, 1.0f))) & 0x3;
+	return packedX | (packedY << 10) | (packedZ << 20) | (packedW << 30);
+}
@@ -0,0 +1,189 @@
+#include "error_stack.h"
+#include "worker_pool.h"
+#include <new>
+
+WorkerJob::WorkerJob() : next(nullptr), counter(nullptr)
+{
+}
+
+WorkerJob::~WorkerJob()
+{
+}
+
+WorkerCounter::WorkerCounter() : pending(0)
+{
+}
+
+// Singleton instance reference.
+WorkerPool *WorkerPool::instance = nullptr;
+
+// Initialize worker pool singleton instance.
+bool WorkerPool::Initialize(int32_t workerCount)
+{
+	instance = new WorkerPool();
+	if (instance == nullptr) {
+		ErrorStack::Log("Failed to allocate worker pool instance.");
+		return false;
+	}
+
+	// Leave a hardware thread for the caller.
+	if (workerCount <= 0) {
+		workerCount = static_cast<int32_t>(std::thread::hardware_concurrency()) - 1;
+		if (workerCount < 1) {
+			workerCount = 1;
+		}
+	}
+	if (!instance->StartWorkers(workerCount)) {
+		Shutdown();
+		return false;
+	}
+	return true;
+}
+
+// Stop all workers and destroy the pool.
+void WorkerPool::Shutdown()
+{
+	delete instance;
+	instance = nullptr;
+}
+
+WorkerPool::WorkerPool()
+	: workers(nullptr),
+	workerCount(0),
+	queueHead(nullptr),
+	queueTail(nullptr),
+	stopping(false)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+	StopWorkers();
+}
+
+// Launch worker threads.
+bool WorkerPool::StartWorkers(int32_t workerCount)
+{
+	workers = new (std::nothrow) std::thread[workerCount];
+	if (workers == nullptr) {
+		ErrorStack::Log("Failed to allocate %d worker threads.", workerCount);
+		return false;
+	}
+	for (int32_t i = 0; i < workerCount; ++i) {
+		workers[i] = std::thread(&WorkerPool::WorkerLoop, this);
+	}
+	this->workerCount = workerCount;
+	return true;
+}
+
+// Signal workers to stop and wait for them to exit.
+void WorkerPool::StopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock(queueLock);
+		stopping = true;
+	}
+	queueSignal.notify_all();
+	for (int32_t i = 0; i < workerCount; ++i) {
+		workers[i].join();
+	}
+	delete[] workers;
+	workers = nullptr;
+	workerCount = 0;
+}
+
+// Append a job to the queue and wake a worker.
+void WorkerPool::Submit(WorkerJob *job, WorkerCounter *counter)
+{
+	counter->pending.fetch_add(1);
+	job->counter = counter;
+	job->next = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(queueLock);
+		if (queueTail != nullptr) {
+			queueTail->next = job;
+		}
+		else {
+			queueHead = job;
+		}
+		queueTail = job;
+	}
+	queueSignal.notify_one();
+}
+
+// Help run queued jobs until the counter drains.
+void WorkerPool::Wait(WorkerCounter *counter)
+{
+	std::unique_lock<std::mutex> lock(queueLock);
+	while (!counter->IsDone()) {
+		WorkerJob *job = PopJob();
+		if (job != nullptr) {
+			lock.unlock();
+			RunJob(job);
+			lock.lock();
+		}
+		else {
+			doneSignal.wait(lock);
+		}
+	}
+}
+
+// Take a job from the front of the queue and run it here.
+bool WorkerPool::RunQueuedJob()
+{
+	WorkerJob *job;
+	{
+		std::lock_guard<std::mutex> lock(queueLock);
+		job = PopJob();
+	}
+	if (job == nullptr) {
+		return false;
+	}
+	RunJob(job);
+	return true;
+}
+
+// Pull jobs until the pool is stopped.
+void WorkerPool::WorkerLoop()
+{
+	std::unique_lock<std::mutex> lock(queueLock);
+	while (true) {
+		WorkerJob *job = PopJob();
+		if (job != nullptr) {
+			lock.unlock();
+			RunJob(job);
+			lock.lock();
+		}
+		else if (stopping) {
+			break;
+		}
+		else {
+			queueSignal.wait(lock);
+		}
+	}
+}
+
+// Pop the job at the front of the queue.
+WorkerJob *WorkerPool::PopJob()
+{
+	WorkerJob *job = queueHead;
+	if (job != nullptr) {
+		queueHead = job->next;
+		if (queueHead == nullptr) {
+			queueTail = nullptr;
+		}
+	}
+	return job;
+}
+
+// Run a job and wake any waiters once its group finishes.
+void WorkerPool::RunJob(WorkerJob *job)
+{
+	WorkerCounter *counter = job->counter;
+	job->Run();
+	if (counter->pending.fetch_sub(1) == 1) {
+		// Lock so a waiter can't miss the signal between its check and wait.
+		std::lock_guard<std::mutex> lock(queueLock);
+		doneSignal.notify_all();
+	}
+}
@@ -28,6 +28,9 @@ namespace OpenGL
 		// Get size of base element type for a data type (size of float for vector).
 		static GLsizei GetElementSize(Renderer::DataType type);
 
+		// Get size of a whole attribute of a data type, accounting for packed types.
+		static GLsizei GetTypeSize(Renderer::DataType type);
+
 	private:
 
 		// Convert data type from renderer type to its base OpenGL data type (vector to GL_FLOAT).
@@ -36,11 +39,15 @@ namespace OpenGL
 		// Get number of base data elements in a type (e.g. 3 floats in a 3-D vector).
 		static GLsizei GetElementCount(Renderer::DataType type);
 
+		// Check whether integer elements of a type are normalized when converted to float.
+		static GLboolean IsNormalized(Renderer::DataType type);
+
 	private:
 
 		GLint location;
 		GLenum elementType;
 		GLint elementCount;
+		GLboolean normalized;
 		GLchar* offset;
 
 	};
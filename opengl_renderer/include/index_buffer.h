@@ -34,6 +34,9 @@ namespace OpenGL
 		// Get index type for this buffer.
 		inline GLenum GetIndexType() const { return type; }
 
+		// Get size of a single index in bytes.
+		unsigned int GetIndexSize() const;
+
 	private:
 
 		// Convert data type to OpenGL enum.
@@ -22,6 +22,12 @@ namespace OpenGL
 		// Set wireframe setting.
 		virtual void SetWireframe(bool wireframeEnabled);
 
+		// Set alpha blending setting.
+		virtual void SetBlending(bool blendingEnabled);
+
+		// Set depth writing setting.
+		virtual void SetDepthWrite(bool depthWriteEnabled);
+
 		// Clear scene for a new frame.
 		virtual void ClearScene();
 
@@ -52,6 +58,16 @@ namespace OpenGL
 		// Draw indexed primitive.
 		virtual void DrawIndexed(Renderer::PrimitiveType type, unsigned int indexCount);
 
+		// Draw indexed primitive from a range of indices.
+		virtual void DrawIndexedRange(Renderer::PrimitiveType type, unsigned int firstIndex, unsigned int indexCount);
+
+		// Draw several ranges of indices with one call.
+		virtual void DrawIndexedRanges(
+			Renderer::PrimitiveType type,
+			const uintptr_t *indexOffsets,
+			const int *indexCounts,
+			int rangeCount);
+
 	public:
 
 		// Singleton retriever.
@@ -65,8 +81,9 @@ namespace OpenGL
 
 	private:
 
-		// Index type for bound index buffer.
+		// Index type and size for bound index buffer.
 		GLenum indexType;
+		unsigned int indexSize;
 
 	private:
 
@@ -33,6 +33,30 @@ namespace OpenGL
 		// Create a texture from an image.
 		virtual Renderer::Texture *CreateTexture(const Image<PixelRGBA> *image);
 
+		// Create a texture array from images of the same size.
+		virtual Renderer::Texture *CreateTextureArray(const Image<PixelRGBA> *images, int layerCount);
+
+		// Create a texture array of palette indices.
+		virtual Renderer::Texture *CreateIndexedTextureArray(const Image<uint8_t> *images, int layerCount);
+
+		// Create a palette texture from colours.
+		virtual Renderer::Texture *CreatePaletteTexture(const PixelRGBA *colours, int colourCount);
+
+		// Check for S3TC support.
+		virtual bool IsCompressionSupported();
+
+		// Create a texture array from block compressed images.
+		virtual Renderer::Texture *CreateCompressedTextureArray(const CompressedImage *images, int layerCount);
+
+		// Replace a rectangle of a texture from an image.
+		virtual bool UpdateTexture(
+			Renderer::Texture *texture,
+			const Image<PixelRGBA> *image,
+			int x,
+			int y,
+			int width,
+			int height);
+
 	public:
 
 		// Singleton getter.
@@ -1,6 +1,7 @@
 #include "common.h"
 
 #include <allocatable.h>
+#include <compressed_image.h>
 #include <image.h>
 #include <renderer/texture_interface.h>
 
@@ -25,10 +26,43 @@ namespace OpenGL
 		// Load the texture data from an image.
 		bool Load(const Image<PixelRGBA> *image);
 
+		// Load the texture as an array, one layer per image.
+		bool LoadArray(const Image<PixelRGBA> *images, int layerCount);
+
+		// Load the texture as an array of single channel palette indices, one layer per image.
+		bool LoadIndexedArray(const Image<uint8_t> *images, int layerCount);
+
+		// Load the texture as an array of block compressed images, one layer per image.
+		bool LoadCompressedArray(const CompressedImage *images, int layerCount);
+
+		// Load the texture as a one dimensional list of palette colours.
+		bool LoadPalette(const PixelRGBA *colours, int colourCount);
+
+		// Replace a rectangle of the texture with the same rectangle of an image.
+		bool Update(const Image<PixelRGBA> *image, int x, int y, int width, int height);
+
+	private:
+
+		// Load an array of images with the given pixel format, one layer per image.
+		template <typename PixelType>
+		bool LoadLayers(
+			const Image<PixelType> *images,
+			int layerCount,
+			GLint internalFormat,
+			GLenum format,
+			bool isFiltered);
+
+		// Set the bound texture's filtering for a number of mip levels.
+		// Unfiltered textures take the nearest texel from the nearest level.
+		void SetFilter(int levelCount, bool isFiltered);
+
 	private:
 
 		// Handle to OpenGL texture.
 		GLuint handle;
+
+		// Binding target; 2D unless loaded as an array.
+		GLenum target;
 	
 	};
 
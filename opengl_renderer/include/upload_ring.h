@@ -0,0 +1,94 @@
+#pragma once
+
+#include "common.h"
+#include <allocatable.h>
+
+namespace OpenGL
+{
+
+	// Singleton ring of persistently mapped pixel unpack buffer memory that texture
+	// uploads are copied into, so the driver reads them asynchronously instead of
+	// copying client memory before the call returns. Each upload's room is fenced
+	// and only written again once the GPU has passed the fence.
+	// Only created where buffer storage and sync objects are supported; uploads use
+	// client memory otherwise, or when they don't fit.
+	class UploadRing : public Allocatable
+	{
+
+	public:
+
+		// Alignment of every staged block in the ring.
+		static const unsigned int StageAlignment = 64;
+
+		// Largest number of uploads in flight before the oldest is waited for.
+		static const int MaximumFences = 256;
+
+	public:
+
+		// Create the ring with a size in bytes, if supported; there's no ring otherwise.
+		// Returns false only if a supported ring couldn't be created.
+		static bool Initialize(unsigned int size);
+		static void Shutdown();
+
+		// Get the room a block of data takes in the ring.
+		static inline unsigned int GetStageSize(unsigned int size) { return (size + (StageAlignment - 1)) & ~(StageAlignment - 1); }
+
+	public:
+
+		// Reserve room for an upload and bind the ring as the unpack buffer.
+		// Returns false if the upload can't fit, in which case nothing is bound.
+		bool Begin(unsigned int size);
+
+		// Copy rows of data into the reserved room, tightly packed.
+		// Returns the offset to pass to GL in place of the data.
+		const void *Stage(const void *data, unsigned int rowSize, unsigned int rowPitch, unsigned int rowCount);
+		inline const void *Stage(const void *data, unsigned int size) { return Stage(data, size, size, 1); }
+
+		// Fence the upload's room once its GL calls are issued and unbind the ring.
+		void End();
+
+	private:
+
+		UploadRing();
+		~UploadRing();
+
+		// Create and map the buffer.
+		bool Create(unsigned int size);
+
+		// Wait for the oldest upload and release its room.
+		void WaitOldest();
+
+	private:
+
+		// Room of an upload the GPU may still be reading.
+		struct FencedRange
+		{
+			GLsync fence;
+			unsigned int start;
+			unsigned int end;
+		};
+
+	public:
+
+		static UploadRing *instance;
+
+	private:
+
+		GLuint handle;
+		uint8_t *mapped;
+		unsigned int size;
+		unsigned int head; // Start of the next reservation.
+
+		// Current reservation.
+		unsigned int reservedStart;
+		unsigned int reservedEnd;
+		unsigned int stagedEnd;
+
+		// Fenced uploads, oldest first, in a circular list.
+		FencedRange fences[MaximumFences];
+		int firstFence;
+		int fenceCount;
+
+	};
+
+}
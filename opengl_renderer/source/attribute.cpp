@@ -24,20 +24,25 @@ namespace OpenGL
 		this->offset = offset;
 		elementType = GetElementType(type);
 		elementCount = GetElementCount(type);
+		normalized = IsNormalized(type);
 
 		// Increment offset by this attribute size.
-		return (elementCount * GetElementSize(type));
+		return GetTypeSize(type);
 	}
 
 	// Activate this shader attribute for rendering.
+	// Attributes without a location aren't read by the program.
 	void Attribute::Activate(int stride) const
 	{
+		if (location == -1) {
+			return;
+		}
 		glEnableVertexAttribArray(location);
 		glVertexAttribPointer(
 			location,
 			elementCount,
 			elementType,
-			GL_FALSE,
+			normalized,
 			static_cast<GLsizei>(stride),
 			offset);
 	}
@@ -45,6 +50,9 @@ namespace OpenGL
 	// Deactivate this shader attribute from rendering.
 	void Attribute::Deactivate() const
 	{
+		if (location == -1) {
+			return;
+		}
 		glDisableVertexAttribArray(location);
 	}
 
@@ -54,10 +62,21 @@ namespace OpenGL
 		switch (type) {
 		case Renderer::ByteType:
 		case Renderer::UnsignedByteType:
+		case Renderer::Byte4NormalizedType:
+		case Renderer::UnsignedByte4NormalizedType:
 			return sizeof(char);
 		case Renderer::ShortType:
 		case Renderer::UnsignedShortType:
+		case Renderer::Short2Type:
+		case Renderer::Short4Type:
+		case Renderer::Short2NormalizedType:
+		case Renderer::Short4NormalizedType:
+		case Renderer::UnsignedShort2NormalizedType:
+		case Renderer::UnsignedShort4NormalizedType:
 			return sizeof(short);
+		case Renderer::Half2Type:
+		case Renderer::Half4Type:
+			return sizeof(GLhalf);
 		case Renderer::IntType:
 		case Renderer::UnsignedIntType:
 			return sizeof(int);
@@ -74,18 +93,45 @@ namespace OpenGL
 		}
 	}
 
+	// Get size of a whole attribute; packed types hold all elements in one word.
+	GLsizei Attribute::GetTypeSize(Renderer::DataType type)
+	{
+		switch (type) {
+		case Renderer::Int1010102NormalizedType:
+		case Renderer::UnsignedInt1010102NormalizedType:
+			return sizeof(GLuint);
+		default:
+			return GetElementCount(type) * GetElementSize(type);
+		}
+	}
+
 	// Get the GL enumeration type for the base attribute element type.
 	GLenum Attribute::GetElementType(Renderer::DataType type)
 	{
 		switch (type) {
 		case Renderer::ByteType:
+		case Renderer::Byte4NormalizedType:
 			return GL_BYTE;
 		case Renderer::UnsignedByteType:
+		case Renderer::UnsignedByte4NormalizedType:
 			return GL_UNSIGNED_BYTE;
 		case Renderer::ShortType:
+		case Renderer::Short2Type:
+		case Renderer::Short4Type:
+		case Renderer::Short2NormalizedType:
+		case Renderer::Short4NormalizedType:
 			return GL_SHORT;
 		case Renderer::UnsignedShortType:
+		case Renderer::UnsignedShort2NormalizedType:
+		case Renderer::UnsignedShort4NormalizedType:
 			return GL_UNSIGNED_SHORT;
+		case Renderer::Half2Type:
+		case Renderer::Half4Type:
+			return GL_HALF_FLOAT;
+		case Renderer::Int1010102NormalizedType:
+			return GL_INT_2_10_10_10_REV;
+		case Renderer::UnsignedInt1010102NormalizedType:
+			return GL_UNSIGNED_INT_2_10_10_10_REV;
 		case Renderer::IntType:
 			return GL_INT;
 		case Renderer::UnsignedIntType:
@@ -109,10 +155,22 @@ namespace OpenGL
 	{
 		switch (type) {
 		case Renderer::Vector2Type:
+		case Renderer::Short2Type:
+		case Renderer::Short2NormalizedType:
+		case Renderer::UnsignedShort2NormalizedType:
+		case Renderer::Half2Type:
 			return 2;
 		case Renderer::Vector3Type:
 			return 3;
 		case Renderer::Vector4Type:
+		case Renderer::Byte4NormalizedType:
+		case Renderer::UnsignedByte4NormalizedType:
+		case Renderer::Short4Type:
+		case Renderer::Short4NormalizedType:
+		case Renderer::UnsignedShort4NormalizedType:
+		case Renderer::Half4Type:
+		case Renderer::Int1010102NormalizedType:
+		case Renderer::UnsignedInt1010102NormalizedType:
 			return 4;
 		case Renderer::Matrix2x2Type:
 			return (2 * 2);
@@ -126,4 +184,22 @@ namespace OpenGL
 		}
 	}
 
+	// Check whether a data type's integer elements are normalized.
+	GLboolean Attribute::IsNormalized(Renderer::DataType type)
+	{
+		switch (type) {
+		case Renderer::Byte4NormalizedType:
+		case Renderer::UnsignedByte4NormalizedType:
+		case Renderer::Short2NormalizedType:
+		case Renderer::Short4NormalizedType:
+		case Renderer::UnsignedShort2NormalizedType:
+		case Renderer::UnsignedShort4NormalizedType:
+		case Renderer::Int1010102NormalizedType:
+		case Renderer::UnsignedInt1010102NormalizedType:
+			return GL_TRUE;
+		default:
+			return GL_FALSE;
+		}
+	}
+
 }
\ No newline at end of file
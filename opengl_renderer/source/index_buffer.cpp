@@ -60,6 +60,21 @@ namespace OpenGL
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	}
 
+	// Get index size in bytes from the buffer's index type.
+	unsigned int IndexBuffer::GetIndexSize() const
+	{
+		switch (type) {
+		case GL_UNSIGNED_BYTE:
+			return sizeof(GLubyte);
+		case GL_UNSIGNED_SHORT:
+			return sizeof(GLushort);
+		case GL_UNSIGNED_INT:
+			return sizeof(GLuint);
+		default:
+			return 0;
+		}
+	}
+
 	// Translate index type to OpenGL type.
 	// Assumes data type is an integral type.
 	GLenum IndexBuffer::TranslateIndexType(Renderer::DataType indexType)
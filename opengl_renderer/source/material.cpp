@@ -149,12 +149,8 @@ namespace OpenGL
 				Renderer::DataType dataType = current->GetDataType();
 
 				// Get the location of the attribute.
+				// Attributes the program doesn't read have no location, but still take up space in the buffer.
 				GLint location = glGetAttribLocation(handle, name);
-				if (location == -1) {
-                    delete layout;
-					ErrorStack::Log("Failed to get location of attribute '%s'.", name);
-					return nullptr;
-				}
 
 				// Assign the parameters.
 				int attributeSize = attributes->SetParameters(location, offset, dataType);
@@ -2,13 +2,18 @@
 #include "material_layout.h"
 #include "renderer.h"
 #include "texture.h"
+#include "upload_ring.h"
 #include <error_stack.h>
 #include <file.h>
+#include <inttypes.h>
 #include <memory_manager.h>
 
 namespace OpenGL
 {
 
+	// Size of the ring texture uploads are staged in.
+	static const unsigned int UploadRingSize = 16 * 1024 * 1024;
+
 	// Singleton instance instantiation.
 	Implementation Implementation::instance;
 
@@ -39,12 +44,19 @@ namespace OpenGL
 
 		// Enable depth testing.
 		glEnable(GL_DEPTH_TEST);
+
+		// Stage texture uploads in a pixel buffer ring where supported.
+		if (!UploadRing::Initialize(UploadRingSize)) {
+			ErrorStack::Log("Failed to create texture upload ring.");
+			return 0;
+		}
 		return 1;
 	}
 
 	// Deallocate OpenGL.
 	void Implementation::Destroy()
 	{
+		UploadRing::Shutdown();
 	}
 
 	// Configure wireframe setting.
@@ -53,6 +65,24 @@ namespace OpenGL
 		glPolygonMode(GL_FRONT_AND_BACK, setting);
 	}
 
+	// Configure alpha blending setting.
+	void Implementation::SetBlending(bool blendingEnabled)
+	{
+		if (blendingEnabled) {
+			glEnable(GL_BLEND);
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		}
+		else {
+			glDisable(GL_BLEND);
+		}
+	}
+
+	// Configure depth writing setting.
+	void Implementation::SetDepthWrite(bool depthWriteEnabled)
+	{
+		glDepthMask(depthWriteEnabled ? GL_TRUE : GL_FALSE);
+	}
+
 	// Clear scene for next frame.
 	void Implementation::ClearScene()
 	{
@@ -96,6 +126,7 @@ namespace OpenGL
 
 		// Set index type.
 		indexType = glIndices->GetIndexType();
+		indexSize = glIndices->GetIndexSize();
 	}
 
 	// Unset index buffer from rendering.
@@ -106,6 +137,7 @@ namespace OpenGL
 
 		// Unset index type.
 		indexType = 0;
+		indexSize = 0;
 	}
 
 	// Bind a texture to a given texture slot.
@@ -129,6 +161,33 @@ namespace OpenGL
 		glDrawElements(primitive, indexCount, indexType, nullptr);
 	}
 
+	// Draw indexed primitive from a range of indices.
+	// The first index is counted in indices and scaled by the index size into a byte offset.
+	void Implementation::DrawIndexedRange(Renderer::PrimitiveType type, unsigned int firstIndex, unsigned int indexCount)
+	{
+		GLenum primitive = Common::TranslatePrimitiveType(type);
+		uintptr_t offset = static_cast<uintptr_t>(firstIndex) * indexSize;
+		glDrawElements(primitive, indexCount, indexType, reinterpret_cast<const void*>(offset));
+	}
+
+	// Draw indexed primitives from several ranges of indices.
+	// Byte offsets are passed straight through as the index pointers of a multi-draw.
+	void Implementation::DrawIndexedRanges(
+		Renderer::PrimitiveType type,
+		const uintptr_t *indexOffsets,
+		const int *indexCounts,
+		int rangeCount)
+	{
+		static_assert(sizeof(uintptr_t) == sizeof(const void*), "Index offsets must be pointer sized.");
+		GLenum primitive = Common::TranslatePrimitiveType(type);
+		glMultiDrawElements(
+			primitive,
+			indexCounts,
+			indexType,
+			reinterpret_cast<const void *const*>(indexOffsets),
+			rangeCount);
+	}
+
 	// Get singleton instance of renderer.
 	Implementation *Implementation::GetInstance()
 	{
@@ -124,6 +124,104 @@ namespace OpenGL
 		return static_cast<Renderer::Texture*>(texture);
 	}
 
+	// Create a texture array from a set of images, one per layer.
+	Renderer::Texture *Resources::CreateTextureArray(const Image<PixelRGBA> *images, int layerCount)
+	{
+		Texture *texture = new Texture();
+		if (texture == nullptr) {
+			ErrorStack::Log("Failed to allocate OpenGL texture array object.");
+			return nullptr;
+		}
+		if (!texture->Initialize()) {
+            delete texture;
+			ErrorStack::Log("Failed to initialize OpenGL texture array object.");
+			return nullptr;
+		}
+		if (!texture->LoadArray(images, layerCount)) {
+            delete texture;
+			return nullptr;
+		}
+		return static_cast<Renderer::Texture*>(texture);
+	}
+
+	// Create a texture array of palette indices, one image per layer.
+	Renderer::Texture *Resources::CreateIndexedTextureArray(const Image<uint8_t> *images, int layerCount)
+	{
+		Texture *texture = new Texture();
+		if (texture == nullptr) {
+			ErrorStack::Log("Failed to allocate OpenGL indexed texture array object.");
+			return nullptr;
+		}
+		if (!texture->Initialize()) {
+            delete texture;
+			ErrorStack::Log("Failed to initialize OpenGL indexed texture array object.");
+			return nullptr;
+		}
+		if (!texture->LoadIndexedArray(images, layerCount)) {
+            delete texture;
+			return nullptr;
+		}
+		return static_cast<Renderer::Texture*>(texture);
+	}
+
+	// Create a palette texture from a list of colours.
+	Renderer::Texture *Resources::CreatePaletteTexture(const PixelRGBA *colours, int colourCount)
+	{
+		Texture *texture = new Texture();
+		if (texture == nullptr) {
+			ErrorStack::Log("Failed to allocate OpenGL palette texture object.");
+			return nullptr;
+		}
+		if (!texture->Initialize()) {
+            delete texture;
+			ErrorStack::Log("Failed to initialize OpenGL palette texture object.");
+			return nullptr;
+		}
+		if (!texture->LoadPalette(colours, colourCount)) {
+            delete texture;
+			return nullptr;
+		}
+		return static_cast<Renderer::Texture*>(texture);
+	}
+
+	// BC1 and BC3 are the S3TC DXT1 and DXT5 formats.
+	bool Resources::IsCompressionSupported()
+	{
+		return GLEW_EXT_texture_compression_s3tc != GL_FALSE;
+	}
+
+	// Create a texture array of compressed images, one image per layer.
+	Renderer::Texture *Resources::CreateCompressedTextureArray(const CompressedImage *images, int layerCount)
+	{
+		Texture *texture = new Texture();
+		if (texture == nullptr) {
+			ErrorStack::Log("Failed to allocate OpenGL compressed texture array object.");
+			return nullptr;
+		}
+		if (!texture->Initialize()) {
+            delete texture;
+			ErrorStack::Log("Failed to initialize OpenGL compressed texture array object.");
+			return nullptr;
+		}
+		if (!texture->LoadCompressedArray(images, layerCount)) {
+            delete texture;
+			return nullptr;
+		}
+		return static_cast<Renderer::Texture*>(texture);
+	}
+
+	// Update part of a texture from an image.
+	bool Resources::UpdateTexture(
+		Renderer::Texture *texture,
+		const Image<PixelRGBA> *image,
+		int x,
+		int y,
+		int width,
+		int height)
+	{
+		return static_cast<Texture*>(texture)->Update(image, x, y, width, height);
+	}
+
 	// Get singleton instance of resource loader.
 	Resources *Resources::GetInstance()
 	{
@@ -1,10 +1,32 @@
 #include "texture.h"
+#include "upload_ring.h"
 #include <error_stack.h>
 
 namespace OpenGL
 {
 
-	Texture::Texture() : handle(0)
+	// Reserve room in the upload ring for an upload's staged blocks, if there's a ring and they fit.
+	static bool BeginUpload(unsigned int stageSize)
+	{
+		UploadRing *ring = UploadRing::instance;
+		return (ring != nullptr) && ring->Begin(stageSize);
+	}
+
+	// Copy data into the upload ring if the upload is staged, otherwise upload it from client memory.
+	static const void *StagePixels(bool isStaged, const void *data, unsigned int size)
+	{
+		return isStaged ? UploadRing::instance->Stage(data, size) : data;
+	}
+
+	// Fence a staged upload once its calls are issued.
+	static void EndUpload(bool isStaged)
+	{
+		if (isStaged) {
+			UploadRing::instance->End();
+		}
+	}
+
+	Texture::Texture() : handle(0), target(GL_TEXTURE_2D)
 	{
 	}
 
@@ -30,10 +52,10 @@ namespace OpenGL
 	void Texture::Bind(unsigned int textureSlot)
 	{
 		glActiveTexture(GL_TEXTURE0 + textureSlot);
-		glBindTexture(GL_TEXTURE_2D, handle);
+		glBindTexture(target, handle);
 	}
 
-	// Load the texture data from an image.
+	// Load the texture data from an image, with a level for each of the image's mip levels.
 	bool Texture::Load(const Image<PixelRGBA> *image)
 	{
 		glBindTexture(GL_TEXTURE_2D, handle);
@@ -45,22 +67,272 @@ namespace OpenGL
 		// Set up texture parameters.
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		SetFilter(image->GetLevelCount(), true);
 
 		// Pass in the data from the image.
-		glTexImage2D(
-			GL_TEXTURE_2D,
+		unsigned int stageSize = 0;
+		for (int i = 0; i < image->GetLevelCount(); ++i) {
+			stageSize += UploadRing::GetStageSize(image->GetLevelWidth(i) * image->GetLevelHeight(i) * image->GetPixelSize());
+		}
+		bool isStaged = BeginUpload(stageSize);
+		for (int i = 0; i < image->GetLevelCount(); ++i) {
+			unsigned int levelSize = image->GetLevelWidth(i) * image->GetLevelHeight(i) * image->GetPixelSize();
+			glTexImage2D(
+				GL_TEXTURE_2D,
+				i, // Level-of-detail number.
+				GL_RGBA,
+				image->GetLevelWidth(i),
+				image->GetLevelHeight(i),
+				0, // Border.
+				GL_RGBA,
+				GL_UNSIGNED_BYTE,
+				StagePixels(isStaged, image->GetLevelBuffer(i), levelSize));
+		}
+		EndUpload(isStaged);
+		if (glGetError() != GL_NO_ERROR) {
+			ErrorStack::Log("Failed to load image data into texture.");
+			return false;
+		}
+		return true;
+	}
+
+	// Load RGBA layers.
+	bool Texture::LoadArray(const Image<PixelRGBA> *images, int layerCount)
+	{
+		return LoadLayers(images, layerCount, GL_RGBA, GL_RGBA, true);
+	}
+
+	// Load single byte layers; blending indices would give unrelated colours, so they're unfiltered.
+	bool Texture::LoadIndexedArray(const Image<uint8_t> *images, int layerCount)
+	{
+		return LoadLayers(images, layerCount, GL_R8, GL_RED, false);
+	}
+
+	// Allocate every compressed layer, then fill them one image at a time.
+	bool Texture::LoadCompressedArray(const CompressedImage *images, int layerCount)
+	{
+		target = GL_TEXTURE_2D_ARRAY;
+		glBindTexture(target, handle);
+		if (glGetError() != GL_NO_ERROR) {
+			ErrorStack::Log("Failed to bind texture array to load compressed images.");
+			return false;
+		}
+
+		// Set up texture parameters.
+		int levelCount = images[0].GetLevelCount();
+		glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		SetFilter(levelCount, true);
+
+		CompressedFormat format = images[0].GetFormat();
+		GLenum internalFormat = (format == BC3Format) ?
+			GL_COMPRESSED_RGBA_S3TC_DXT5_EXT :
+			GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		int width = images[0].GetWidth();
+		int height = images[0].GetHeight();
+		for (int i = 0; i < levelCount; ++i) {
+			glCompressedTexImage3D(
+				target,
+				i, // Level-of-detail number.
+				internalFormat,
+				images[0].GetLevelWidth(i),
+				images[0].GetLevelHeight(i),
+				layerCount,
+				0, // Border.
+				images[0].GetLevelBufferSize(i) * layerCount,
+				nullptr);
+		}
+		unsigned int stageSize = 0;
+		for (int i = 0; i < layerCount; ++i) {
+			const CompressedImage *image = &images[i];
+			if ((image->GetWidth() != width) ||
+				(image->GetHeight() != height) ||
+				(image->GetLevelCount() != levelCount) ||
+				(image->GetFormat() != format)) {
+				ErrorStack::Log("Compressed texture array layer %d doesn't match the first.", i);
+				return false;
+			}
+			for (int j = 0; j < levelCount; ++j) {
+				stageSize += UploadRing::GetStageSize(image->GetLevelBufferSize(j));
+			}
+		}
+		bool isStaged = BeginUpload(stageSize);
+		for (int i = 0; i < layerCount; ++i) {
+			const CompressedImage *image = &images[i];
+			for (int j = 0; j < levelCount; ++j) {
+				glCompressedTexSubImage3D(
+					target,
+					j, // Level-of-detail number.
+					0,
+					0,
+					i,
+					image->GetLevelWidth(j),
+					image->GetLevelHeight(j),
+					1,
+					internalFormat,
+					image->GetLevelBufferSize(j),
+					StagePixels(isStaged, image->GetLevelBuffer(j), image->GetLevelBufferSize(j)));
+			}
+		}
+		EndUpload(isStaged);
+		if (glGetError() != GL_NO_ERROR) {
+			ErrorStack::Log("Failed to load %d compressed layers into texture array.", layerCount);
+			return false;
+		}
+		return true;
+	}
+
+	// Load the colours as a row, clamped so indices at either end don't wrap.
+	bool Texture::LoadPalette(const PixelRGBA *colours, int colourCount)
+	{
+		target = GL_TEXTURE_1D;
+		glBindTexture(target, handle);
+		if (glGetError() != GL_NO_ERROR) {
+			ErrorStack::Log("Failed to bind texture to load palette.");
+			return false;
+		}
+		glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		SetFilter(1, false);
+		glTexImage1D(
+			target,
 			0, // Level-of-detail number.
 			GL_RGBA,
-			image->GetWidth(),
-			image->GetHeight(),
+			colourCount,
 			0, // Border.
 			GL_RGBA,
 			GL_UNSIGNED_BYTE,
-			image->GetBuffer());
+			colours);
 		if (glGetError() != GL_NO_ERROR) {
-			ErrorStack::Log("Failed to load image data into texture.");
+			ErrorStack::Log("Failed to load %d colours into palette texture.", colourCount);
+			return false;
+		}
+		return true;
+	}
+
+	// Allocate every layer, then fill them one image at a time.
+	// Rows are unpacked tightly, since single byte levels can be any width.
+	template <typename PixelType>
+	bool Texture::LoadLayers(
+		const Image<PixelType> *images,
+		int layerCount,
+		GLint internalFormat,
+		GLenum format,
+		bool isFiltered)
+	{
+		target = GL_TEXTURE_2D_ARRAY;
+		glBindTexture(target, handle);
+		if (glGetError() != GL_NO_ERROR) {
+			ErrorStack::Log("Failed to bind texture array to load images.");
+			return false;
+		}
+
+		// Set up texture parameters.
+		int levelCount = images[0].GetLevelCount();
+		glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		SetFilter(levelCount, isFiltered);
+
+		int width = images[0].GetWidth();
+		int height = images[0].GetHeight();
+		for (int i = 0; i < levelCount; ++i) {
+			glTexImage3D(
+				target,
+				i, // Level-of-detail number.
+				internalFormat,
+				images[0].GetLevelWidth(i),
+				images[0].GetLevelHeight(i),
+				layerCount,
+				0, // Border.
+				format,
+				GL_UNSIGNED_BYTE,
+				nullptr);
+		}
+		unsigned int stageSize = 0;
+		for (int i = 0; i < layerCount; ++i) {
+			const Image<PixelType> *image = &images[i];
+			if ((image->GetWidth() != width) || (image->GetHeight() != height) || (image->GetLevelCount() != levelCount)) {
+				ErrorStack::Log("Texture array layer %d doesn't match the size of the first.", i);
+				return false;
+			}
+			for (int j = 0; j < levelCount; ++j) {
+				stageSize += UploadRing::GetStageSize(image->GetLevelWidth(j) * image->GetLevelHeight(j) * image->GetPixelSize());
+			}
+		}
+		bool isStaged = BeginUpload(stageSize);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (int i = 0; i < layerCount; ++i) {
+			const Image<PixelType> *image = &images[i];
+			for (int j = 0; j < levelCount; ++j) {
+				unsigned int levelSize = image->GetLevelWidth(j) * image->GetLevelHeight(j) * image->GetPixelSize();
+				glTexSubImage3D(
+					target,
+					j, // Level-of-detail number.
+					0,
+					0,
+					i,
+					image->GetLevelWidth(j),
+					image->GetLevelHeight(j),
+					1,
+					format,
+					GL_UNSIGNED_BYTE,
+					StagePixels(isStaged, image->GetLevelBuffer(j), levelSize));
+			}
+		}
+		EndUpload(isStaged);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		if (glGetError() != GL_NO_ERROR) {
+			ErrorStack::Log("Failed to load %d image layers into texture array.", layerCount);
+			return false;
+		}
+		return true;
+	}
+
+	// Filter between mip levels when there are any, and limit sampling to the levels given.
+	void Texture::SetFilter(int levelCount, bool isFiltered)
+	{
+		GLint minifyFilter;
+		if (isFiltered) {
+			minifyFilter = (levelCount > 1) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR;
+		}
+		else {
+			minifyFilter = (levelCount > 1) ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST;
+		}
+		glTexParameteri(target, GL_TEXTURE_MIN_FILTER, minifyFilter);
+		glTexParameteri(target, GL_TEXTURE_MAG_FILTER, isFiltered ? GL_LINEAR : GL_NEAREST);
+		glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+	}
+
+	// Upload only the rectangle. Staged rows are packed tightly; from client memory
+	// they're read at the image's full width.
+	bool Texture::Update(const Image<PixelRGBA> *image, int x, int y, int width, int height)
+	{
+		glBindTexture(GL_TEXTURE_2D, handle);
+		const PixelRGBA *pixels = image->GetBuffer() + (y * image->GetWidth()) + x;
+		unsigned int rowSize = width * image->GetPixelSize();
+		unsigned int rowPitch = image->GetWidth() * image->GetPixelSize();
+		bool isStaged = BeginUpload(UploadRing::GetStageSize(rowSize * height));
+		const void *source;
+		if (isStaged) {
+			source = UploadRing::instance->Stage(pixels, rowSize, rowPitch, height);
+		}
+		else {
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, image->GetWidth());
+			source = pixels;
+		}
+		glTexSubImage2D(
+			GL_TEXTURE_2D,
+			0, // Level-of-detail number.
+			x,
+			y,
+			width,
+			height,
+			GL_RGBA,
+			GL_UNSIGNED_BYTE,
+			source);
+		EndUpload(isStaged);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		if (glGetError() != GL_NO_ERROR) {
+			ErrorStack::Log("Failed to update %d by %d texture rectangle.", width, height);
 			return false;
 		}
 		return true;
@@ -0,0 +1,162 @@
+#include "upload_ring.h"
+#include <error_stack.h>
+#include <string.h>
+
+namespace OpenGL
+{
+
+	// Time to wait on a fence before checking again, in nanoseconds.
+	static const GLuint64 FenceWaitTimeout = 1000000000;
+
+	// Singleton instance reference.
+	UploadRing *UploadRing::instance = nullptr;
+
+	// Persistent mapping needs buffer storage; fences need sync objects.
+	bool UploadRing::Initialize(unsigned int size)
+	{
+		if ((GLEW_ARB_buffer_storage == GL_FALSE) || (GLEW_ARB_sync == GL_FALSE)) {
+			return true;
+		}
+		instance = new UploadRing();
+		if (instance == nullptr) {
+			ErrorStack::Log("Failed to allocate texture upload ring instance.");
+			return false;
+		}
+		if (!instance->Create(size)) {
+			Shutdown();
+			return false;
+		}
+		return true;
+	}
+
+	// Destroy the ring; the buffer isn't deleted until the GPU is done with it.
+	void UploadRing::Shutdown()
+	{
+		delete instance;
+		instance = nullptr;
+	}
+
+	UploadRing::UploadRing()
+		: handle(0),
+		mapped(nullptr),
+		size(0),
+		head(0),
+		reservedStart(0),
+		reservedEnd(0),
+		stagedEnd(0),
+		firstFence(0),
+		fenceCount(0)
+	{
+	}
+
+	UploadRing::~UploadRing()
+	{
+		while (fenceCount != 0) {
+			glDeleteSync(fences[firstFence].fence);
+			firstFence = (firstFence + 1) % MaximumFences;
+			--fenceCount;
+		}
+		if (handle != 0) {
+			if (mapped != nullptr) {
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, handle);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			}
+			glDeleteBuffers(1, &handle);
+		}
+	}
+
+	// Coherent mapping makes copies visible to later GL calls without flushing.
+	bool UploadRing::Create(unsigned int size)
+	{
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glGenBuffers(1, &handle);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, handle);
+		glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+		mapped = reinterpret_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags));
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		if ((glGetError() != GL_NO_ERROR) || (mapped == nullptr)) {
+			ErrorStack::Log("Failed to create %u byte texture upload ring.", size);
+			return false;
+		}
+		this->size = size;
+		return true;
+	}
+
+	// Reservations run on from the last, wrapping to the start when they'd pass the end.
+	// Uploads still being read from the room are waited for, oldest first.
+	bool UploadRing::Begin(unsigned int size)
+	{
+		if (size > this->size) {
+			return false;
+		}
+		unsigned int start = head;
+		if ((start + size) > this->size) {
+			start = 0;
+		}
+		unsigned int end = start + size;
+		bool isOverlapped = true;
+		while (isOverlapped) {
+			isOverlapped = (fenceCount == MaximumFences);
+			for (int i = 0; (i < fenceCount) && !isOverlapped; ++i) {
+				const FencedRange *range = &fences[(firstFence + i) % MaximumFences];
+				isOverlapped = (range->start < end) && (start < range->end);
+			}
+			if (isOverlapped) {
+				WaitOldest();
+			}
+		}
+		reservedStart = start;
+		reservedEnd = end;
+		stagedEnd = start;
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, handle);
+		return true;
+	}
+
+	// Rows are copied one after another, so uploads read them with the default row length.
+	const void *UploadRing::Stage(const void *data, unsigned int rowSize, unsigned int rowPitch, unsigned int rowCount)
+	{
+		unsigned int offset = stagedEnd;
+		uint8_t *out = mapped + offset;
+		const uint8_t *in = reinterpret_cast<const uint8_t*>(data);
+		for (unsigned int i = 0; i < rowCount; ++i, out += rowSize, in += rowPitch) {
+			memcpy(out, in, rowSize);
+		}
+		stagedEnd += GetStageSize(rowSize * rowCount);
+		return reinterpret_cast<const void*>(static_cast<uintptr_t>(offset));
+	}
+
+	// The fence follows the upload calls, so it signals once they've read the ring.
+	void UploadRing::End()
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		if (fenceCount == MaximumFences) {
+			WaitOldest();
+		}
+		FencedRange *range = &fences[(firstFence + fenceCount) % MaximumFences];
+		range->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		range->start = reservedStart;
+		range->end = reservedEnd;
+		++fenceCount;
+		head = reservedEnd;
+	}
+
+	// Flush on the first wait so the fence is sure to be reached.
+	void UploadRing::WaitOldest()
+	{
+		FencedRange *range = &fences[firstFence];
+		GLbitfield waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+		GLenum result;
+		do {
+			result = glClientWaitSync(range->fence, waitFlags, FenceWaitTimeout);
+			waitFlags = 0;
+		} while (result == GL_TIMEOUT_EXPIRED);
+		if (result == GL_WAIT_FAILED) {
+			ErrorStack::Log("Failed to wait for texture upload fence.");
+		}
+		glDeleteSync(range->fence);
+		firstFence = (firstFence + 1) % MaximumFences;
+		--fenceCount;
+	}
+
+}
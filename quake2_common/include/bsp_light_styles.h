@@ -0,0 +1,40 @@
+#pragma once
+
+#include "bsp_map.h"
+#include "quake2_common_define.h"
+#include <inttypes.h>
+
+namespace BSP
+{
+
+	// Animated light style patterns, stepped at a fixed rate.
+	// Each pattern is a string of brightness letters, where 'a' is dark, 'm' is
+	// normal and 'z' is double brightness, as in the game's configuration strings.
+	class Quake2CommonLibrary LightStyles
+	{
+
+	public:
+
+		LightStyles();
+		~LightStyles();
+
+		// Set a style's pattern, or null to leave the style at its current brightness.
+		// The string must outlive this object.
+		void SetPattern(int32_t style, const char *pattern);
+
+		// Set every style's brightness on the map for a pattern frame.
+		void Update(int32_t frame, BSP::Map *map) const;
+
+	public:
+
+		// Pattern letters advance at this rate.
+		static const int32_t FramesPerSecond = 10;
+
+	private:
+
+		const char *patterns[LightStyleCount];
+		int32_t patternLengths[LightStyleCount];
+
+	};
+
+}
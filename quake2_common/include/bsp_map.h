@@ -1,13 +1,19 @@
 #pragma once
 
+#include "bsp_occlusion_culler.h"
 #include "bsp_painter.h"
+#include "bsp_view_context.h"
 #include "mesh.h"
 #include "plane.h"
 #include "quake2_common_define.h"
+#include "texture_loader.h"
 #include <allocatable.h>
+#include <bit_set.h>
+#include <image.h>
 #include <renderer/buffer_interface.h>
 #include <renderer/index_buffer_interface.h>
 #include <renderer/renderer_interface.h>
+#include <texture_cache.h>
 #include <renderer/resources_interface.h>
 #include <inttypes.h>
 #include <vector2.h>
@@ -16,6 +22,58 @@
 namespace BSP
 {
 
+	// Surface flags from the texture information.
+	enum SurfaceFlags
+	{
+		LightSurface = 0x1,
+		SlickSurface = 0x2,
+		SkySurface = 0x4,
+		WarpSurface = 0x8,
+		Translucent33Surface = 0x10,
+		Translucent66Surface = 0x20,
+		FlowingSurface = 0x40,
+		NoDrawSurface = 0x80,
+		HintSurface = 0x100,
+		SkipSurface = 0x200
+	};
+
+	// Surfaces used only by the compiler or for effects; they're never drawn.
+	const int32_t UndrawnSurfaceFlags = NoDrawSurface | HintSurface | SkipSurface;
+
+	// World passes, drawn in this order.
+	enum FacePass
+	{
+		OpaquePass = 0,
+		SkyPass,
+		TranslucentPass,
+		FacePassCount
+	};
+
+	// Light map constants.
+	const int32_t LightMapLuxelSize = 16; // Texture space units per light map sample.
+	const int32_t MaximumLightStyles = 4;
+	const uint8_t NoLightStyle = 255;
+	const int32_t LightStyleCount = 256;
+
+	// Light map of a face, measured in luxels.
+	// Samples are RGB, one block per style, starting from the face's sample offset.
+	struct FaceLightMap
+	{
+		int32_t sampleOffset; // Offset into the map's light map samples, or -1 if the face is unlit.
+		int32_t width;
+		int32_t height;
+		int32_t styleCount;
+		uint8_t styles[MaximumLightStyles];
+
+		// Atlas page and position of the first sample.
+		int32_t page;
+		int32_t x;
+		int32_t y;
+	};
+
+	// Rate that animated textures step through their frames.
+	const int32_t TextureFramesPerSecond = 2;
+
 	// Face texture information structure.
 	class FaceTexture : public Allocatable
 	{
@@ -23,6 +81,8 @@ namespace BSP
 	public:
 
 		static const int TextureNameLength = 32;
+		static const int32_t MaximumAnimationFrames = 16;
+		static const int CacheKeyLength = MaximumAnimationFrames * (TextureNameLength + 16); // Frame paths joined by '+'.
 
 	public:
 
@@ -32,18 +92,69 @@ namespace BSP
 		// Copy name of texture to store in this entry.
 		void SetName(const char name[TextureNameLength]);
 
-		// Load this entry's texture resource.
-		bool LoadResources(Renderer::Resources *resources);
+		// Set the entry showing the next frame of this entry's animation, or null if it's static.
+		inline void SetNextTexture(const FaceTexture *nextTexture) { this->nextTexture = nextTexture; }
 
-		// Get the texture resource and size.
-		inline Renderer::Texture *GetTexture() const { return texture; }
+		// Set the length of this entry's animation and which of its frames this entry shows first.
+		inline void SetAnimation(int32_t frameOffset, int32_t frameCount)
+		{
+			this->frameOffset = frameOffset;
+			this->frameCount = frameCount;
+		}
+
+		// Share the texture for this entry's frames if it's already in the cache.
+		// Returns false if it has to be loaded.
+		bool AcquireResources();
+
+		// Add this entry's animation frames to a job, in layer order, for decoding.
+		bool QueueResources(TextureLoadJob *job) const;
+
+		// Create one texture array from the decoded frames, a layer per frame, and add it to the cache.
+		// The texture's format follows the job's storage.
+		bool CreateResources(Renderer::Resources *resources, const TextureLoadJob *job);
+
+		// Take the size and memory cost from the decoded frames without creating the texture.
+		bool MeasureResources(const TextureLoadJob *job);
+
+		// Take the size from the first frame's file header, leaving the frames to be loaded later.
+		bool ReadSize();
+
+		// Drop this entry's reference to its texture; the size is kept for packing and reloading.
+		void ReleaseResources();
+
+		// Get the texture name, resource and size.
+		inline const char *GetName() const { return name; }
+		inline Renderer::Texture *GetTexture() const { return (cacheEntry != nullptr) ? cacheEntry->texture : nullptr; }
 		inline const Vector2 *GetSize() const { return &textureSize; }
 
+		// Check whether the texture is loaded, and get the bytes it takes when it is.
+		inline bool IsResident() const { return cacheEntry != nullptr; }
+		inline int32_t GetMemorySize() const { return memorySize; }
+
+		// Get the animation chain and this entry's place in it.
+		inline const FaceTexture *GetNextTexture() const { return nextTexture; }
+		inline int32_t GetFrameOffset() const { return frameOffset; }
+		inline int32_t GetFrameCount() const { return frameCount; }
+
+	private:
+
+		// Build the cache key from the names of this entry's frames.
+		void GetCacheKey(char key[CacheKeyLength]) const;
+
+		// Take the cache's texture and its size.
+		void SetCacheEntry(TextureCacheEntry *cacheEntry);
+
 	private:
 
 		char name[TextureNameLength];
-		Renderer::Texture *texture;
+		TextureCacheEntry *cacheEntry;
 		Vector2 textureSize;
+		int32_t memorySize;
+
+		// Animation chain, which loops back to this entry.
+		const FaceTexture *nextTexture;
+		int32_t frameOffset;
+		int32_t frameCount;
 
 	};
 
@@ -60,28 +171,77 @@ namespace BSP
 		bool Initialize(int vertexCount);
 
 		inline void SetTexture(const FaceTexture *texture) { this->texture = texture; }
-		inline void SetVisibilityFrame(int32_t visibilityFrame) { this->visibilityFrame = visibilityFrame; }
 
-		inline FaceMesh *GetMesh() { return &mesh; }
-		inline bool IsVisible(int32_t currentVisibilityFrame) const { return (currentVisibilityFrame == visibilityFrame); }
+		// Set the entry whose texture the face is drawn with, shared by its batch.
+		inline void SetBatchTexture(const FaceTexture *batchTexture) { this->batchTexture = batchTexture; }
+		inline void SetFlags(int32_t flags) { this->flags = flags; }
 
-		// Load renderer resources for this face.
-		bool LoadResources(Renderer::Resources *resources);
+		// Set the plane the face lies on, and whether it faces the plane's back.
+		inline void SetPlane(const Geometry::Plane *plane, bool isBackSide)
+		{
+			this->plane = plane;
+			this->isBackSide = isBackSide;
+		}
+
+		// Set the average of the face's vertices, used to sort translucent faces.
+		inline void SetCentre(const Vector3 &centre) { this->centre = centre; }
+
+		// Set where this face's triangles are in the world index buffer.
+		inline void SetIndexRange(uint32_t firstIndex, uint32_t indexCount)
+		{
+			this->firstIndex = firstIndex;
+			this->indexCount = indexCount;
+		}
 
-		// Draw this face.
-		void Draw(Renderer::Interface *renderer, Renderer::MaterialLayout *layout) const;
+		inline FaceMesh *GetMesh() { return &mesh; }
+		inline const FaceMesh *GetMesh() const { return &mesh; }
+		inline BSP::FaceLightMap *GetLightMap() { return &lightMap; }
+		inline const BSP::FaceLightMap *GetLightMap() const { return &lightMap; }
+		inline const FaceTexture *GetTexture() const { return texture; }
+		inline const FaceTexture *GetBatchTexture() const { return batchTexture; }
+		inline int32_t GetFlags() const { return flags; }
+		inline const Geometry::Plane *GetPlane() const { return plane; }
+		inline bool IsBackSide() const { return isBackSide; }
+		inline const Vector3 *GetCentre() const { return &centre; }
+		inline uint32_t GetFirstIndex() const { return firstIndex; }
+		inline uint32_t GetIndexCount() const { return indexCount; }
 
 	private:
 
 		FaceMesh mesh;
+		BSP::FaceLightMap lightMap;
 		const FaceTexture *texture;
+		const FaceTexture *batchTexture;
+		int32_t flags;
+		const Geometry::Plane *plane;
+		bool isBackSide;
+		Vector3 centre;
 
-		// Renderer resources.
-		Renderer::Buffer *vertexBuffer;
-		
-		// Visibility frame that this face is allowed to be drawn on.
-		int32_t visibilityFrame;
+		// Triangle range in the world index buffer.
+		uint32_t firstIndex;
+		uint32_t indexCount;
+
+	};
+
+	// Group of faces drawn in the same pass with the same texture and light map page.
+	// A batch's faces are contiguous in the world index buffer, in face order.
+	struct FaceBatch
+	{
+		const BSP::FaceTexture *texture;
+		int32_t pass;
+		int32_t lightMapPage;
+		int32_t firstFace; // Start in the map's batch face table.
+		int32_t faceCount;
+	};
 
+	// Statistics from building the world vertex and index buffers.
+	struct WorldStatistics
+	{
+		int32_t triangleCount;
+		int32_t faceVertexCount; // Vertices before welding.
+		int32_t vertexCount; // Vertices after welding.
+		float fanCacheMissRatio; // Average cache misses per triangle in fan order.
+		float optimizedCacheMissRatio; // Average cache misses per triangle after optimization.
 	};
 
 	// Class representing a non-leaf BSP node.
@@ -99,23 +259,19 @@ namespace BSP
 			int32_t backChild,
 			const Vector3 &minimums,
 			const Vector3 &maximums,
-			const BSP::Face *firstFace,
+			uint16_t firstFace,
 			uint16_t faceCount);
 
 		inline void SetParent(BSP::Node *parent) { this->parent = parent; }
-		inline void SetVisibilityFrame(int32_t visibilityFrame) { this->visibilityFrame = visibilityFrame; }
 
 		inline const Geometry::Plane *GetPlane() const { return plane; }
 		inline int32_t GetFrontChild() const { return frontChild; }
 		inline int32_t GetBackChild() const { return backChild; }
 		inline const Vector3 *GetMinimums() const { return &minimums; }
 		inline const Vector3 *GetMaximums() const { return &maximums; }
-		inline const BSP::Face *GetFirstFace() const { return firstFace; }
+		inline uint16_t GetFirstFace() const { return firstFace; }
 		inline uint16_t GetFaceCount() const { return faceCount; }
 		inline BSP::Node *GetParent() const { return parent; }
-		inline int32_t GetVisibilityFrame() const { return visibilityFrame; }
-
-		inline bool IsVisible(int32_t visibilityFrame) const { return (visibilityFrame == this->visibilityFrame); }
 
 	private:
 
@@ -125,12 +281,11 @@ namespace BSP
 		int32_t backChild;
 		Vector3 minimums;
 		Vector3 maximums;
-		const Face *firstFace;
+		uint16_t firstFace;
 		uint16_t faceCount;
 
 		// Additional parameters for visibliity traversal.
 		BSP::Node *parent;
-		int32_t visibilityFrame;
 
 	};
 
@@ -197,6 +352,18 @@ namespace BSP
 
 		inline void SetStart(const uint8_t *start) { this->start = start; }
 
+	public:
+
+		// Get number of 32-bit words needed to hold a decompressed set.
+		static inline int32_t GetWordCount(int32_t clusterCount) { return (clusterCount + (ClustersPerWord - 1)) >> WordIndexShift; }
+
+		// Check whether a cluster is set in a decompressed set viewed as words.
+		// Decompressed sets are little-endian, so byte and word bit order match.
+		static inline bool IsClusterSet(const uint32_t *set, int32_t clusterIndex)
+		{
+			return (set[clusterIndex >> WordIndexShift] & (1u << (clusterIndex & WordBitIndexMask))) != 0;
+		}
+
 	private:
 
 		const uint8_t *start;
@@ -206,6 +373,9 @@ namespace BSP
 		static const int32_t ClustersPerElement = 8; // Number of clusters in a single byte.
 		static const uint32_t ElementIndexShift = 3; // Bits to shift to get decompressed element for a cluster.
 		static const uint32_t BitIndexMask = 7; // Mask for retrieving bit index in an element.
+		static const int32_t ClustersPerWord = 32; // Number of clusters in a 32-bit word.
+		static const uint32_t WordIndexShift = 5; // Bits to shift to get decompressed word for a cluster.
+		static const uint32_t WordBitIndexMask = 31; // Mask for retrieving bit index in a word.
 
 	};
 
@@ -248,16 +418,16 @@ namespace BSP
 			int16_t areaIndex,
 			const Vector3 &minimums,
 			const Vector3 &maximums,
-			BSP::Face **faceTableStart,
+			const uint16_t *faceTableStart,
 			uint16_t faceCount,
 			BSP::Brush **firstBrush,
 			uint16_t brushCount);
 
-		void SetFacesVisible(int32_t currentVisibilityFrame);
-
 		inline void SetParent(BSP::Node *parent) { this->parent = parent; }
 
 		inline int16_t GetClusterIndex() const { return clusterIndex; }
+		inline const uint16_t *GetFirstFace() const { return firstFace; }
+		inline uint16_t GetFaceCount() const { return faceCount; }
 		inline const BSP::Brush *GetLeafBrush(uint16_t index) const { return firstBrush[index]; }
 		inline uint16_t GetBrushCount() const { return brushCount; }
 		inline BSP::Node *GetParent() const { return parent; }
@@ -270,7 +440,7 @@ namespace BSP
 		int16_t areaIndex;
 		Vector3 minimums;
 		Vector3 maximums;
-		BSP::Face **firstFace;
+		const uint16_t *firstFace; // Face indices in the leaf face table.
 		uint16_t faceCount;
 		BSP::Brush **firstBrush;
 		uint16_t brushCount;
@@ -303,49 +473,199 @@ namespace BSP
 		bool InitializeLeafFaces(int32_t leafFaceCount);
 		bool InitializeLeafBrushes(int32_t leafBrushCount);
 		bool InitializeLeaves(int32_t leafCount);
+		bool InitializeLightMapSamples(int32_t sampleSize);
 
 		// Populate the tree's ancestry information.
 		void BuildParentGraph();
 
+		// Decompress every cluster's audibility set for sound queries.
+		bool BuildAudibilitySets();
+
+		// Build the table of leaves belonging to each cluster.
+		bool BuildClusterLeaves();
+
+		// Copy face planes into component arrays for backface tests and find face centres.
+		bool BuildFacePlanes();
+
 		// Map buffer functions.
 		inline Geometry::Plane *GetPlanes() { return planes; }
 		inline BSP::FaceTexture *GetTextures() { return textures; }
 		inline BSP::Node *GetNodes() { return nodes; }
 		inline BSP::Face *GetFaces() { return faces; }
+		inline const BSP::Face *GetFaces() const { return faces; }
 		inline BSP::BrushSide *GetBrushSides() { return brushSides; }
 		inline BSP::Brush *GetBrushes() { return brushes; }
 		inline BSP::LeafCluster *GetClusters() { return clusters; }
 		inline uint8_t *GetClusterData() { return clusterData; }
-		inline BSP::Face **GetLeafFaces() { return leafFaces; }
+		inline uint16_t *GetLeafFaces() { return leafFaces; }
 		inline BSP::Brush **GetLeafBrushes() { return leafBrushes; }
 		inline BSP::Leaf *GetLeaves() { return leaves; }
-
-		// Load renderer resources for the map.
+		inline uint8_t *GetLightMapSamples() { return lightMapSamples; }
+		inline const BSP::FaceBatch *GetBatches() const { return batches; }
+
+		// Map component counts.
+		inline int32_t GetNodeCount() const { return nodeCount; }
+		inline int32_t GetFaceCount() const { return faceCount; }
+		inline int32_t GetLeafCount() const { return leafCount; }
+		inline int32_t GetBatchCount() const { return batchCount; }
+		inline int32_t GetTextureCount() const { return textureCount; }
+		inline int32_t GetLightMapPageCount() const { return lightMapPageCount; }
+		inline int32_t GetDirtyLightMapCount() const { return dirtyLightMapCount; }
+		inline int32_t GetTranslucentFaceCount() const { return translucentFaceCount; }
+
+		// Set the name of the sky box images, from the world's settings.
+		void SetSkyName(const char *skyName);
+		inline const char *GetSkyName() const { return skyName; }
+
+		// Get statistics about the world geometry built by loading resources.
+		inline const BSP::WorldStatistics *GetWorldStatistics() const { return &worldStatistics; }
+
+		// Group faces by texture and load renderer resources for the map.
 		bool LoadResources(Renderer::Resources *resources);
-		
-		// Draw the map.
+
+		// Block compress face textures when loading, if the renderer supports it and they aren't indexed.
+		inline void SetCompressedTextures(bool isCompressed) { this->isCompressed = isCompressed; }
+
+		// Limit the bytes of face textures created when loading, or 0 for no limit.
+		// Textures past the budget are measured but left for the residency manager to stream in.
+		inline void SetTextureBudget(int64_t textureBudget) { this->textureBudget = textureBudget; }
+		inline int64_t GetTextureBudget() const { return textureBudget; }
+
+		// Get how face textures were stored when loading, so they're streamed in the same way.
+		inline TextureStorage GetTextureStorage() const { return textureStorage; }
+
+		// Only read face texture sizes when loading, drawing faces with the placeholder until
+		// the residency manager streams their textures in. The sky is still loaded.
+		inline void SetLazyTextures(bool isLazy) { this->isLazy = isLazy; }
+
+		// Set the brightness of a light style, where 1 is the light map at full strength.
+		// Faces using the style are marked for update only if the brightness changes.
+		void SetLightStyle(int32_t style, float value);
+
+		// Recombine the light maps of faces whose styles changed and upload them.
+		bool UpdateLightMaps(Renderer::Resources *resources);
+
+		// Set the frame animated textures show; each chain wraps it to its own length.
+		inline void SetTextureFrame(int32_t textureFrame) { this->textureFrame = textureFrame; }
+
+		// Update the visible set and draw list of a view from its view point.
+		// Only the view is written to, so separate views may be updated concurrently.
+		void UpdateVisibility(BSP::ViewContext *view, const Vector3 &viewPoint) const;
+
+		// Update visibility, also skipping nodes hidden behind the culler's occluders.
+		// The culler renders the view's occluders before the draw list is built.
+		void UpdateVisibility(
+			BSP::ViewContext *view,
+			const Vector3 &viewPoint,
+			const Matrix4x4 &projectionView,
+			BSP::OcclusionCuller *culler) const;
+
+		// Draw the map as seen from a view: opaque faces, then sky, then
+		// translucent faces back to front.
 		void Draw(
 			Renderer::Interface *renderer,
-			const Vector3 &viewPoint,
-			const Matrix4x4 &projectionViewTransform);
+			const BSP::ViewContext *view,
+			const Matrix4x4 &projectionViewTransform) const;
 
 		// Trace a line through the map.
 		bool TraceLine(const Vector3 &start, const Vector3 &end, float *timeOut);
 
+		// Get the cluster that a point is in.
+		int32_t GetClusterByPoint(const Vector3 &point) const;
+
+		// Check whether a listener can potentially hear a source.
+		// Invalid clusters have no audibility information and are treated as audible.
+		bool IsClusterAudible(int32_t sourceCluster, int32_t listenerCluster) const;
+		bool IsPointAudible(const Vector3 &source, const Vector3 &listener) const;
+
+		// Get the decompressed audibility set for a cluster, one bit per cluster in 32-bit words.
+		// Invalid clusters return a set with every bit on, so the result is never null.
+		const uint32_t *GetAudibleClusters(int32_t clusterIndex) const;
+
+		// Get the number of clusters and the number of words in a decompressed cluster set.
+		inline int32_t GetClusterCount() const { return clusterCount; }
+		inline int32_t GetClusterSetWordCount() const { return clusterSetWordCount; }
+
+		// Get the leaves of each cluster, as offsets into the grouped leaf indices.
+		inline const int32_t *GetClusterLeafStarts() const { return clusterLeafStarts; }
+		inline const int32_t *GetClusterLeaves() const { return clusterLeaves; }
+
 	private:
 
 		// Helper for building the ancestry graph.
 		void BuildParentGraph(int32_t nodeIndex, BSP::Node *parent);
 
 		// Find the leaf that a point is in.
-		const BSP::Leaf *GetLeafByPoint(const Vector3 &point); // TODO: we can probably use referencePoint instead of passing.
+		const BSP::Leaf *GetLeafByPoint(const Vector3 &point) const;
+
+		// Update a view's visible leaves for a move between clusters.
+		void MarkVisibleCluster(BSP::ViewContext *view, int32_t previousCluster, int32_t clusterIndex) const;
+
+		// Add or remove the leaves of a cluster from a view.
+		int32_t SetClusterVisible(BSP::ViewContext *view, int32_t clusterIndex, bool isVisible) const;
 
-		// Mark all leaves in a certain cluster as visible for the frame.
-		void MarkVisibleCluster(int32_t clusterIndex);
-		void SetParentsVisible(BSP::Leaf *leaf);
+		// Add or remove a leaf's references to its faces and ancestors.
+		void AddVisibleLeaf(BSP::ViewContext *view, const BSP::Leaf *leaf) const;
+		void RemoveVisibleLeaf(BSP::ViewContext *view, const BSP::Leaf *leaf) const;
 
-		// BSP tree draw helpers.
-		void DrawNode(int32_t nodeIndex) const;
+		// Mark the view's visible faces that face the view point.
+		void MarkFrontFaces(BSP::ViewContext *view) const;
+
+		// Build the view's draw list from the given node, front to back.
+		void GatherNode(
+			BSP::ViewContext *view,
+			const BSP::OcclusionCuller *culler,
+			int32_t nodeIndex) const;
+
+		// Pack face light maps into atlas pages and point face vertices at them.
+		bool BuildLightMapAtlas(Renderer::Resources *resources);
+
+		// Build the table of faces using each light style.
+		bool BuildLightStyleFaces();
+
+		// Combine a face's light styles at their current brightness into RGB luxels.
+		void BlendLightStyles(const BSP::FaceLightMap *lightMap, uint8_t *out) const;
+
+		// Write blended luxels into their place on an atlas page, with borders.
+		static void WriteLightMap(const BSP::FaceLightMap *lightMap, const uint8_t *luxels, PixelRGBA *pagePixels);
+
+		// Group faces sharing a pass, texture and light map page into batches.
+		bool BuildBatches();
+
+		// Decode textures for every batch and the sky on worker threads,
+		// creating renderer textures as each finishes.
+		bool LoadTextures(Renderer::Resources *resources);
+
+		// Create the flat texture drawn in place of face textures that aren't resident.
+		bool CreateMissingTexture(Renderer::Resources *resources);
+
+		// Get the texture to bind for a face texture, falling back to the placeholder.
+		inline Renderer::Texture *GetDrawTexture(const BSP::FaceTexture *texture) const
+		{
+			return texture->IsResident() ? texture->GetTexture() : missingTexture;
+		}
+
+		// Share the sky box texture if it's already in the cache.
+		// Otherwise add the six sky box images to a job, then join them into one texture once decoded.
+		bool AcquireSky();
+		bool QueueSky(TextureLoadJob *job) const;
+		bool CreateSky(Renderer::Resources *resources, const Image<PixelRGBA> *sides);
+
+		// Pack all face triangles into the world vertex and index buffers.
+		bool LoadWorldBuffers(Renderer::Resources *resources);
+		static bool PackFaceVertices(
+			const BSP::FaceMesh *mesh,
+			const Vector2 &textureSize,
+			int32_t frameOffset,
+			BSP::WorldVertex *out);
+		static void FreeWorldScratch(BSP::WorldVertex *vertices, uint32_t *indices, int32_t *scratch);
+
+		// Collect the view's drawn faces into index ranges per batch, and its
+		// translucent faces back to front.
+		void BuildDrawRanges(BSP::ViewContext *view) const;
+
+		// Draw the view's translucent faces one at a time with blending.
+		void DrawTranslucentFaces(Renderer::Interface *renderer, const BSP::ViewContext *view) const;
 
 		// Trace a line within a certain node.
 		bool TraceLine(int32_t nodeIndex, const Vector3 &start, const Vector3 &end, float *timeOut);
@@ -355,6 +675,20 @@ namespace BSP
 		// Convert negative index to leaf index.
 		static inline int32_t GetLeafIndex(int32_t index) { return (-1) - index; }
 
+		// Get the number of triangle list indices for a fan.
+		static inline int32_t GetFanIndexCount(int32_t vertexCount) { return (vertexCount >= 3) ? ((vertexCount - 2) * 3) : 0; }
+
+		// Get the pass a face with the given surface flags is drawn in, or -1 if it isn't drawn.
+		static int32_t GetFacePass(int32_t flags);
+
+		// Get the opacity of a translucent face from its surface flags.
+		static float GetFaceAlpha(int32_t flags);
+
+	public:
+
+		// Longest sky name, including the terminator.
+		static const int32_t SkyNameLength = 64;
+
 	private:
 
 		// Map component arrays/lengths.
@@ -369,20 +703,59 @@ namespace BSP
 		BSP::Brush *brushes;
 		BSP::LeafCluster *clusters;
 		uint8_t *clusterData; // Compressed cluster data for all clusters.
-		uint8_t *decompressedCluster; // Buffer for decompressed cluster data.
 		int32_t clusterCount;
-		BSP::Face **leafFaces;
+		uint32_t *audibleSets; // Decompressed audibility sets, with an all-audible set at the end.
+		int32_t clusterSetWordCount;
+		int32_t *clusterLeafStarts; // Start of each cluster's leaves, with the total at the end.
+		int32_t *clusterLeaves; // Leaf indices grouped by cluster.
+		float *facePlaneX; // Face plane components, flipped to each face's side.
+		float *facePlaneY;
+		float *facePlaneZ;
+		float *facePlaneDistances;
+		uint16_t *leafFaces;
 		BSP::Brush **leafBrushes;
 		BSP::Leaf *leaves;
 		int32_t leafCount;
 
-		// Variables to use for drawing and leaf traversing (to avoid having to pass as parameters repeatedly).
-		Vector3 referencePoint;
-		Renderer::Interface *renderer;
-
-		// Visibility information.
-		int32_t visibleCluster;
-		int32_t visibilityFrame;
+		// Light map samples of every face and the atlas pages they're packed into.
+		// Page images are kept so changed light maps can be recombined in place.
+		uint8_t *lightMapSamples;
+		Renderer::Texture **lightMapPages;
+		Image<PixelRGBA> *lightMapImages;
+		int32_t lightMapPageCount;
+		uint8_t *lightMapBlend; // Scratch for the largest face's blended luxels.
+
+		// Light style brightness and the faces that use each style.
+		uint16_t lightStyleScales[LightStyleCount];
+		int32_t *lightStyleFaceStarts; // Start of each style's faces, with the total at the end.
+		int32_t *lightStyleFaces;
+		BitSet dirtyLightMapFaces;
+		int32_t *dirtyLightMaps; // Faces waiting for their light map to be recombined.
+		int32_t dirtyLightMapCount;
+
+		// Texture batches and face indices grouped by batch.
+		// Batches are ordered by pass, so each pass's batches are contiguous.
+		BSP::FaceBatch *batches;
+		int32_t batchCount;
+		int32_t *batchFaces;
+		int32_t passBatchStarts[FacePassCount + 1];
+		int32_t translucentFaceCount;
+		int32_t textureFrame;
+		bool isCompressed;
+		bool isLazy;
+		TextureStorage textureStorage;
+		int64_t textureBudget;
+		Renderer::Texture *missingTexture;
+
+		// Sky box sides packed into one texture, three across and two down.
+		char skyName[SkyNameLength];
+		TextureCacheEntry *skyEntry;
+		float skyTexelInset; // Half a texel of a side, to keep filtering off its neighbours.
+
+		// World geometry shared by all faces.
+		Renderer::Buffer *vertexBuffer;
+		Renderer::IndexBuffer *indexBuffer;
+		BSP::WorldStatistics worldStatistics;
 
 	private:
 
@@ -396,6 +769,19 @@ namespace BSP
 		// Map-generic material layout.
 		static Renderer::MaterialLayout *layout;
 
+		// Sky box constants.
+		static const int32_t SkySideCount = 6;
+
+		// Light map atlas constants.
+		static const int32_t LightMapPageSize = 1024;
+		static const int32_t MaximumLightMapPages = 16;
+		static const int32_t LightMapBorder = 1; // Luxels repeated around each light map for filtering.
+
+		// Light style brightness is fixed point with this many fraction bits.
+		static const int32_t LightStyleScaleShift = 6;
+		static const int32_t LightStyleScaleOne = 1 << LightStyleScaleShift;
+		static const int32_t MaximumLightStyleScale = 256; // Keeps a scaled sample within 16 bits.
+
 	};
 
 }
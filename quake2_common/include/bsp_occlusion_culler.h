@@ -0,0 +1,112 @@
+#pragma once
+
+#include "quake2_common_define.h"
+#include <allocatable.h>
+#include <depth_buffer.h>
+#include <inttypes.h>
+#include <matrix4x4.h>
+#include <vector3.h>
+#include <vector4.h>
+#include <worker_pool.h>
+
+namespace BSP
+{
+
+	class Map;
+	class ViewContext;
+
+	// Software occlusion culler for a single view.
+	// Large opaque map faces are rasterized into a low resolution depth buffer,
+	// split into row bands across the worker pool, and boxes are tested against it.
+	class Quake2CommonLibrary OcclusionCuller : public Allocatable
+	{
+
+	public:
+
+		OcclusionCuller();
+		~OcclusionCuller();
+
+		// Select occluder faces from a map and allocate the depth buffer.
+		bool Initialize(const BSP::Map *map);
+		void Destroy();
+
+		// Rasterize the largest potentially visible occluders for a view.
+		void Render(const BSP::ViewContext *view, const Matrix4x4 &projectionView);
+
+		// Check whether a world-space box may be visible after the last render.
+		// Boxes are given by two opposite corners.
+		bool IsBoxVisible(const Vector3 &corner, const Vector3 &oppositeCorner) const;
+
+		// Check whether an object-space box may be visible, given its object transform.
+		bool IsBoxVisible(
+			const Matrix4x4 &objectTransform,
+			const Vector3 &corner,
+			const Vector3 &oppositeCorner) const;
+
+		// Statistics from the last render.
+		inline int32_t GetOccluderCount() const { return frameOccluderCount; }
+		inline int32_t GetTriangleCount() const { return triangleCount; }
+
+	private:
+
+		// Clear and rasterize all occluder triangles into a band of rows.
+		void RasterizeBand(int32_t rowStart, int32_t rowEnd);
+
+	private:
+
+		// Worker job rasterizing a single band.
+		class BandJob : public WorkerJob
+		{
+
+		public:
+
+			BandJob();
+			virtual void Run();
+
+		public:
+
+			OcclusionCuller *culler;
+			int32_t rowStart;
+			int32_t rowEnd;
+
+		};
+
+	public:
+
+		// Depth buffer resolution.
+		static const int32_t BufferWidth = 256;
+		static const int32_t BufferHeight = 128;
+
+		// Smallest face area, in square world units, worth using as an occluder.
+		static const float MinimumOccluderArea;
+
+		// Largest number of occluders rasterized per frame.
+		static const int32_t MaximumOccluders = 128;
+
+		// Largest number of bands the buffer is split into.
+		static const int32_t MaximumBands = 16;
+
+	private:
+
+		const BSP::Map *map;
+		DepthBuffer depthBuffer;
+		Matrix4x4 projectionView;
+
+		// Occluder face indices, sorted by decreasing area.
+		int32_t *occluderFaces;
+		int32_t occluderCount;
+
+		// Clip-space occluder triangles for the current frame.
+		Vector4 *clipVertices;
+		int32_t clipVertexCapacity;
+		int32_t triangleCount;
+		int32_t frameOccluderCount;
+
+		// Band jobs and their completion counter.
+		BandJob bands[MaximumBands];
+		int32_t bandCount;
+		WorkerCounter bandCounter;
+
+	};
+
+}
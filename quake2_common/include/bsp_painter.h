@@ -3,6 +3,8 @@
 #include "mesh.h"
 #include "quake2_common_define.h"
 #include <allocatable.h>
+#include <renderer/buffer_interface.h>
+#include <renderer/index_buffer_interface.h>
 #include <renderer/renderer_interface.h>
 #include <renderer/resources_interface.h>
 
@@ -18,6 +20,23 @@ namespace BSP
 	};
 	typedef Mesh<FaceVertex> FaceMesh;
 
+	// Packed vertex type for the world buffer.
+	// Positions and texture coordinates are fixed point; light map coordinates are normalized.
+	struct WorldVertex
+	{
+		int16_t position[4]; // Fourth component is the face's first texture animation frame.
+		int16_t uv[2];
+		uint16_t lightMap[2];
+	};
+
+	// Fixed point scales for world vertices; these must match the map vertex shader.
+	// Quarter units cover positions out to 8192 in either direction, twice the map bounds.
+	const float WorldPositionScale = 4.0f;
+	const float WorldUVScale = 8.0f;
+
+	// World indices are 32-bit; draw range offsets are measured in bytes.
+	const uintptr_t WorldIndexSize = sizeof(uint32_t);
+
 	// Singleton that handles rendering for a BSP map.
 	class Painter : public Allocatable
 	{
@@ -25,34 +44,89 @@ namespace BSP
 	public:
 
 		// Initialize rendering parameters.
-		static bool Quake2CommonLibrary Initialize(Renderer::Resources *resources);
+		// Indexed textures are looked up in the WAL palette, which must already be loaded.
+		static bool Quake2CommonLibrary Initialize(Renderer::Resources *resources, bool isIndexed);
 		static void Quake2CommonLibrary Shutdown();
 
 	public:
 
 		// Set up the renderer for drawing from a given perspective.
+		// Animated textures show the given frame, wrapped to each chain's length.
 		void PrepareRenderer(
 			Renderer::Interface *renderer,
-			const Matrix4x4 &projectionView); 
+			const Matrix4x4 &projectionView,
+			int32_t animationFrame);
 
 		// Clear the renderer from drawing the map.
 		void ClearRenderer(Renderer::Interface *renderer);
 
-		// Set the face texture to use for drawing.
+		// Set the face texture array to use for drawing, with a layer per animation frame.
 		void SetTexture(
 			Renderer::Interface *renderer,
 			Renderer::Texture *texture,
-			const Vector2 &textureSize);
+			const Vector2 &textureSize,
+			int32_t frameCount);
+
+		// Set the light map atlas page to use for drawing.
+		void SetLightMap(
+			Renderer::Interface *renderer,
+			Renderer::Texture *lightMap);
+
+		// Set the opacity of faces drawn next; preparing the renderer resets it to opaque.
+		void SetAlpha(float alpha);
+
+		// Bind the world vertex and index buffers to draw face ranges from.
+		void BindWorld(
+			Renderer::Interface *renderer,
+			Renderer::Buffer *vertexBuffer,
+			Renderer::IndexBuffer *indexBuffer);
+
+		// Unbind the world buffers after drawing.
+		void UnbindWorld(
+			Renderer::Interface *renderer,
+			Renderer::IndexBuffer *indexBuffer);
+
+		// Set up the renderer for drawing sky faces with a sky box texture.
+		// The texture holds the six sides, three across and two down.
+		void PrepareSky(
+			Renderer::Interface *renderer,
+			const Matrix4x4 &projectionView,
+			const Vector3 &viewPoint,
+			Renderer::Texture *skyTexture,
+			float texelInset);
+
+		// Clear the renderer from drawing sky faces.
+		void ClearSky(Renderer::Interface *renderer);
+
+		// Bind and unbind the world buffers for drawing sky faces.
+		void BindSky(
+			Renderer::Interface *renderer,
+			Renderer::Buffer *vertexBuffer,
+			Renderer::IndexBuffer *indexBuffer);
+		void UnbindSky(
+			Renderer::Interface *renderer,
+			Renderer::IndexBuffer *indexBuffer);
+
+		// Check whether face textures should be created as palette indices.
+		inline bool IsIndexed() const { return isIndexed; }
+
+		// Make a draw call for a range of world triangles.
+		void DrawRange(
+			Renderer::Interface *renderer,
+			unsigned int firstIndex,
+			unsigned int indexCount);
 
-		// Make a draw call for a certain set of face triangles.
-		void DrawFace(
+		// Make one draw call for several ranges of world triangles.
+		// Offsets are in bytes into the world index buffer.
+		void DrawRanges(
 			Renderer::Interface *renderer,
-			Renderer::Buffer *buffer,
-			unsigned int vertexCount);
+			const uintptr_t *indexOffsets,
+			const int32_t *indexCounts,
+			int32_t rangeCount);
 
 	private:
 
-		Painter();
+		Painter(bool isIndexed);
 		~Painter();
 
 		// Initialize the renderer paramaters for drawing.
@@ -69,6 +143,23 @@ namespace BSP
 		Renderer::Variable *projectionViewVariable;
 		Renderer::Variable *textureSlotVariable;
 		Renderer::Variable *textureSizeVariable;
+		Renderer::Variable *lightMapSlotVariable;
+		Renderer::Variable *alphaVariable;
+		Renderer::Variable *frameCountVariable;
+		Renderer::Variable *animationFrameVariable;
+
+		// Palette for indexed face textures.
+		bool isIndexed;
+		Renderer::Texture *paletteTexture;
+		Renderer::Variable *paletteSlotVariable;
+
+		// Sky material, reading only positions from the world buffer.
+		Renderer::Material *skyMaterial;
+		Renderer::MaterialLayout *skyLayout;
+		Renderer::Variable *skyProjectionViewVariable;
+		Renderer::Variable *skyViewPointVariable;
+		Renderer::Variable *skyTextureSlotVariable;
+		Renderer::Variable *skyTexelInsetVariable;
 
 	};
 
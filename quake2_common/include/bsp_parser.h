@@ -17,6 +17,13 @@ namespace BSP
 		static const uint32_t Version = 38;
 		static const uint32_t LightMapStyleCount = 4;
 
+		// Face merging limits.
+		static const int32_t MaximumMergedEdges = 64;
+		static const float MaximumMergedExtent = 1024.0f; // Texture space size of a merged face.
+
+		// Sky used when the world entity doesn't name one.
+		static const char DefaultSkyName[] = "unit1_";
+
 		// Short vector type.
 		struct ShortVector3
 		{
@@ -116,7 +123,7 @@ namespace BSP
 		struct Face
 		{
 			uint16_t planeIndex;
-			int16_t planeType; // Which axis is normal aligned to, if any.
+			int16_t side; // Non-zero if the face is on the back side of its plane.
 			int32_t firstEdge;
 			int16_t edgeCount;
 			int16_t textureIndex;
@@ -178,15 +185,41 @@ namespace BSP
 			// Load and fill a map.
 			bool Load(const char *filename, BSP::Map *out);
 
+			// Merge adjacent coplanar faces with the same texture info into larger
+			// convex faces for rendering. Brushes are unaffected. Off by default.
+			void SetMergeFaces(bool mergeFaces);
+
 		private:
 
 			// Get the addresses to each lump and verify them.
 			bool PrepareLumps();
 
+			// Read the world's sky name from the entity lump.
+			void LoadSkyName();
+
+			// Group faces for merging and build the merged vertex loops.
+			bool BuildMergedFaces();
+			void FreeMergeTables();
+
+			// Get the vertex index a surface edge starts from.
+			int32_t GetEdgeVertex(int32_t surfaceEdgeIndex) const;
+
+			// Get the luxel bounds of a file face's light map, with the last row and column inclusive.
+			void GetLuxelBounds(const FileFormat::Face *face, int32_t *left, int32_t *top, int32_t *right, int32_t *bottom) const;
+
+			// Get the file faces making up a loaded face as a range of the merged source table,
+			// or of the file faces themselves if faces weren't merged.
+			void GetFaceSources(int32_t loadedFace, int32_t *sourceStart, int32_t *sourceEnd) const;
+			inline int32_t GetSourceFace(int32_t sourceIndex) const { return mergeFaces ? mergedFaceSources[sourceIndex] : sourceIndex; }
+
+			// Get the luxel bounds covering all of a loaded face's file faces.
+			void GetLoadedLuxelBounds(int32_t loadedFace, int32_t *left, int32_t *top, int32_t *right, int32_t *bottom) const;
+
 			// Load each segment into the map.
 			bool LoadPlanes();
 			bool LoadTextures();
 			bool LoadFaces();
+			bool LoadLightMaps();
 			bool LoadNodes();
 			bool LoadBrushSides();
 			bool LoadBrushes();
@@ -207,11 +240,15 @@ namespace BSP
 			const Header *header;
 
 			// Lump pointers and counts.
+			const char *entities;
+			int32_t entitiesLength;
 			const FileFormat::Plane *planes;
 			int32_t planeCount;
 			const Vector3 *vertices;
 			const uint8_t *visibilityStart;
 			int32_t visibilityLength;
+			const uint8_t *lightMapData;
+			int32_t lightMapDataLength;
 			const FileFormat::Texture *textures;
 			int32_t textureCount;
 			const FileFormat::Face *faces;
@@ -231,6 +268,18 @@ namespace BSP
 			const FileFormat::Leaf *leaves;
 			int32_t leafCount;
 
+			// Face merging tables, all in one block.
+			// Loops are indexed by the file face leading each merged face.
+			bool mergeFaces;
+			int32_t *mergeTables;
+			int32_t *faceRemap; // Loaded face index for each file face.
+			int32_t *loopStarts;
+			int32_t *loopCounts;
+			int32_t *loopVertices;
+			int32_t *mergedFaceSources; // File faces of each loaded face, leader first.
+			int32_t *mergedSourceStarts; // Start of each loaded face's sources, plus the end.
+			int32_t loadedFaceCount;
+
 		};
 
 	}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "quake2_common_define.h"
+#include "texture_loader.h"
+#include <allocatable.h>
+#include <bit_set.h>
+#include <inttypes.h>
+#include <renderer/resources_interface.h>
+
+namespace BSP
+{
+
+	class FaceTexture;
+	class Map;
+
+	// Texture memory and streaming counts from the last update.
+	struct ResidencyStatistics
+	{
+		int32_t textureCount; // Face textures managed.
+		int32_t residentCount;
+		int64_t residentBytes;
+		int64_t budgetBytes; // 0 if unlimited.
+		int32_t wantedCount; // Textures on faces the view cluster can see.
+		int32_t missingCount; // Wanted textures still drawn with the placeholder.
+		int32_t loadCount; // Textures streamed in since initializing.
+		int32_t evictionCount; // Textures released since initializing.
+	};
+
+	// Keeps the face textures the view can see resident within the map's texture budget.
+	// Textures on faces in the view cluster's potentially visible set are wanted; they're
+	// decoded on the worker pool and created here, the view cluster's own first.
+	// Textures a lazy map load skipped are streamed in the same way.
+	// Once over budget, the least recently wanted textures are released until usage
+	// falls to a lower mark, so moving back and forth between clusters doesn't thrash.
+	class Quake2CommonLibrary TextureResidency : public Allocatable
+	{
+
+	public:
+
+		TextureResidency();
+		~TextureResidency();
+
+		// Build the table of face textures each cluster can see.
+		// The map's resources must be loaded first.
+		bool Initialize(BSP::Map *map);
+		void Destroy();
+
+		// Stream textures in and out for the cluster the view is in.
+		// Returns false if a decoded texture couldn't be created.
+		bool Update(Renderer::Resources *resources, int32_t viewCluster);
+
+		// Get statistics from the last update.
+		inline const BSP::ResidencyStatistics *GetStatistics() const { return &statistics; }
+
+	public:
+
+		// Largest number of textures decoded at once.
+		static const int32_t StreamJobCount = 16;
+
+		// Updates a texture has to go unwanted before it can be released.
+		static const int32_t EvictionDelayFrames = 120;
+
+		// Eviction brings usage down to this fraction of the budget.
+		static const int64_t LowWaterNumerator = 7;
+		static const int64_t LowWaterDenominator = 8;
+
+	private:
+
+		// Mark the textures seen from a cluster as wanted, or all of them for an invalid cluster.
+		void SetWantedCluster(int32_t clusterIndex);
+
+		// Create textures for decoded jobs, without waiting for the rest.
+		bool CreateCompleted(Renderer::Resources *resources);
+
+		// Queue wanted textures that aren't resident, once the last batch has finished.
+		bool QueueMissing();
+
+		// Add a texture to the next batch and count it, unless it's resident, loading or shared from the cache.
+		bool QueueSlot(int32_t slot, int32_t *queuedCount);
+
+		// Release the least recently wanted textures until usage is under the low mark.
+		void Evict();
+
+		// Count resident and wanted textures.
+		void UpdateStatistics();
+
+	private:
+
+		BSP::Map *map;
+		TextureLoader *loader;
+
+		// Managed textures and the slot of each map texture, or -1 if it isn't managed.
+		BSP::FaceTexture **textures;
+		int32_t textureCount;
+		int32_t *textureSlots;
+
+		// Slots seen from each cluster, with the total at the end.
+		int32_t *clusterSlotStarts;
+		int32_t *clusterSlots;
+		int32_t clusterCount;
+
+		// Streaming state for each slot.
+		int32_t *lastWantedFrames;
+		BitSet wantedSlots;
+		BitSet loadingSlots;
+		uint32_t *visibleClusters; // Scratch for decompressing a visibility set.
+		int32_t wantedCluster;
+		int32_t frame;
+
+		BSP::ResidencyStatistics statistics;
+
+	};
+
+}
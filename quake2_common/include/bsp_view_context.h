@@ -0,0 +1,175 @@
+#pragma once
+
+#include "quake2_common_define.h"
+#include <allocatable.h>
+#include <bit_set.h>
+#include <inttypes.h>
+#include <vector3.h>
+
+namespace BSP
+{
+
+	class Map;
+
+	// Face with its distance from the view point, for sorting.
+	struct SortedFace
+	{
+		float depth; // Squared distance to the face's centre.
+		int32_t faceIndex;
+	};
+
+	// Visibility state for a single view of a map.
+	// The map itself is never written during traversal, so separate contexts
+	// can update their visibility concurrently against the same map.
+	//
+	// Visibility is reference counted: a node counts its visible children and a
+	// face counts the visible leaves that contain it. This lets a cluster change
+	// apply only the difference between the old and new potentially visible sets.
+	class Quake2CommonLibrary ViewContext : public Allocatable
+	{
+
+	public:
+
+		ViewContext();
+		~ViewContext();
+
+		// Allocate visibility storage sized for a map.
+		bool Initialize(const BSP::Map *map);
+
+		// Free visibility storage.
+		void Destroy();
+
+		// Choose whether cluster changes apply a difference or rebuild from scratch.
+		inline void SetIncrementalUpdates(bool incrementalUpdates) { this->incrementalUpdates = incrementalUpdates; }
+		inline bool IsIncremental() const { return incrementalUpdates; }
+
+		// View parameters from the last visibility update.
+		inline const Vector3 *GetViewPoint() const { return &viewPoint; }
+		inline int32_t GetVisibleCluster() const { return visibleCluster; }
+
+		// Node and face visibility for the current cluster.
+		inline bool IsNodeVisible(int32_t nodeIndex) const { return (nodeCounts[nodeIndex] != 0); }
+		inline bool IsFaceVisible(int32_t faceIndex) const { return visibleFaces.IsSet(faceIndex); }
+
+		// Visible, front facing faces in front-to-back order from the last update.
+		inline const int32_t *GetDrawFaces() const { return drawFaces; }
+		inline int32_t GetDrawFaceCount() const { return drawFaceCount; }
+		inline bool IsFaceDrawn(int32_t faceIndex) const { return drawnFaces.IsSet(faceIndex); }
+
+		// Index ranges of drawn faces grouped by texture batch, as parallel arrays of
+		// byte offsets into the world index buffer and index counts for multi-draws.
+		// A batch's ranges run from its start up to the start of the next batch.
+		inline const uintptr_t *GetDrawRangeOffsets() const { return drawRangeOffsets; }
+		inline const int32_t *GetDrawRangeCounts() const { return drawRangeCounts; }
+		inline const int32_t *GetBatchRangeStarts() const { return batchRangeStarts; }
+
+		// Drawn translucent faces, farthest first.
+		inline const BSP::SortedFace *GetTranslucentFaces() const { return translucentFaces; }
+		inline int32_t GetTranslucentFaceCount() const { return translucentFaceCount; }
+
+		// Number of leaves added or removed by the last cluster change.
+		inline int32_t GetChangedLeafCount() const { return changedLeafCount; }
+
+	private:
+
+		// Only the map updates visibility state.
+		friend class Map;
+
+		// Update view point and cluster, returning the previous cluster.
+		int32_t SetView(const Vector3 &viewPoint, int32_t viewCluster);
+
+		// Clear all references and visible sets.
+		void ResetVisibility();
+
+		// Count a visible child of a node.
+		// Returns true if the node's visibility changed, so its parent needs updating.
+		inline bool AddNodeReference(int32_t nodeIndex) { return (nodeCounts[nodeIndex]++ == 0); }
+		inline bool RemoveNodeReference(int32_t nodeIndex) { return (--nodeCounts[nodeIndex] == 0); }
+
+		// Count a visible leaf containing a face.
+		inline void AddFaceReference(int32_t faceIndex)
+		{
+			if (faceCounts[faceIndex]++ == 0) {
+				visibleFaces.Set(faceIndex);
+			}
+		}
+		inline void RemoveFaceReference(int32_t faceIndex)
+		{
+			if (--faceCounts[faceIndex] == 0) {
+				visibleFaces.Unset(faceIndex);
+			}
+		}
+
+		// Visible faces, and the subset facing the view point.
+		inline const BitSet *GetVisibleFaces() const { return &visibleFaces; }
+		inline BitSet *GetDrawableFaces() { return &drawableFaces; }
+
+		// Cluster sets for the current row, the incoming row and their difference.
+		inline BitSet *GetVisibleClusters() { return &visibleClusters; }
+		inline BitSet *GetNextClusters() { return &nextClusters; }
+		inline BitSet *GetChangedClusters() { return &changedClusters; }
+
+		inline void SetChangedLeafCount(int32_t changedLeafCount) { this->changedLeafCount = changedLeafCount; }
+
+		// Draw list building.
+		inline void ClearDrawFaces()
+		{
+			drawFaceCount = 0;
+			drawnFaces.Clear();
+		}
+		inline void AddVisibleFaces(int32_t firstFace, int32_t faceCount)
+		{
+			int32_t *out = &drawFaces[drawFaceCount];
+			int32_t addedCount = drawableFaces.GetSetBits(firstFace, firstFace + faceCount, out);
+			for (int32_t i = 0; i < addedCount; ++i) {
+				drawnFaces.Set(out[i]);
+			}
+			drawFaceCount += addedCount;
+		}
+
+		// Writable batch range storage for the map.
+		inline uintptr_t *GetDrawRangeOffsets() { return drawRangeOffsets; }
+		inline int32_t *GetDrawRangeCounts() { return drawRangeCounts; }
+		inline int32_t *GetBatchRangeStarts() { return batchRangeStarts; }
+		inline BSP::SortedFace *GetTranslucentFaces() { return translucentFaces; }
+		inline void SetTranslucentFaceCount(int32_t translucentFaceCount) { this->translucentFaceCount = translucentFaceCount; }
+
+	private:
+
+		// View parameters.
+		Vector3 viewPoint;
+		int32_t visibleCluster;
+		bool incrementalUpdates;
+		int32_t changedLeafCount;
+
+		// Per-node visible child counts and per-face visible leaf counts.
+		uint8_t *nodeCounts;
+		int32_t nodeCount;
+		uint16_t *faceCounts;
+		int32_t faceCount;
+
+		// Visible faces and clusters, indexed by face and cluster number.
+		BitSet visibleFaces;
+		BitSet drawableFaces;
+		BitSet visibleClusters;
+		BitSet nextClusters;
+		BitSet changedClusters;
+
+		// Face draw list, large enough to hold every face.
+		int32_t *drawFaces;
+		int32_t drawFaceCount;
+		BitSet drawnFaces;
+
+		// Drawn index ranges, at most one per face, and each batch's first range.
+		uintptr_t *drawRangeOffsets;
+		int32_t *drawRangeCounts;
+		int32_t *batchRangeStarts;
+		int32_t batchCount;
+
+		// Sorted translucent faces, large enough to hold all of the map's.
+		BSP::SortedFace *translucentFaces;
+		int32_t translucentFaceCount;
+
+	};
+
+}
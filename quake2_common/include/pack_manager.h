@@ -4,6 +4,7 @@
 #include <allocatable.h>
 #include <file.h>
 #include <inttypes.h>
+#include <mutex>
 
 namespace Pack
 {
@@ -42,7 +43,11 @@ namespace Pack
 		const Entry *FindEntry(const char *filename) const;
 
 		// Load a file from the pack by its header.
+		// Reads are serialized, so threads may load files concurrently.
 		bool Read(const Entry *entry, FileData *out);
+
+		// Load up to a number of bytes from the start of a file in the pack.
+		bool Read(const Entry *entry, int32_t size, FileData *out);
 		
 		// Intrusive list functions.
 		inline Directory *GetNext() { return next; }
@@ -50,6 +55,7 @@ namespace Pack
 	private:
 
 		File file; // Package file being managed.
+		std::mutex fileLock; // Guards the file position between seek and read.
 		FileData directoryData; // Package directory buffer.
 
 		// Pack directory members.
@@ -77,6 +83,9 @@ namespace Pack
 		// Fills out a file data handle to the file data from the pack.
 		bool Read(const char *filename, FileData *out);
 
+		// Read up to a number of bytes from the start of a file, such as just its header.
+		bool Read(const char *filename, int32_t size, FileData *out);
+
 	private:
 
 		Directory *head;
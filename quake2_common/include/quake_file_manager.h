@@ -21,6 +21,9 @@ public:
 	// Read a file from the pack archive.
 	bool Read(const char *filename, FileData *out);
 
+	// Read up to a number of bytes from the start of a file in the pack archive.
+	bool Read(const char *filename, int32_t size, FileData *out);
+
 private:
 
 	// Private constructor and destructor for singleton.
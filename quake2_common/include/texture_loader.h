@@ -0,0 +1,163 @@
+#pragma once
+
+#include "quake2_common_define.h"
+#include <allocatable.h>
+#include <compressed_image.h>
+#include <condition_variable>
+#include <image.h>
+#include <inttypes.h>
+#include <mutex>
+#include <worker_pool.h>
+
+class TextureLoader;
+
+// Image file formats a texture can be decoded from.
+enum TextureFormat
+{
+	WalFormat, // Name is relative to the texture directory, without extension.
+	PcxFormat // Name is a full path.
+};
+
+// How a job's images are kept once decoded.
+enum TextureStorage
+{
+	RgbaStorage, // Expanded to 32-bit colour.
+	IndexedStorage, // WAL palette indices, for the shader to look up.
+	CompressedStorage // BC1 or BC3 blocks with full mip chains, through the disk cache.
+};
+
+// Images for one texture, decoded together on a worker thread.
+class Quake2CommonLibrary TextureLoadJob : public WorkerJob
+{
+
+public:
+
+	static const int32_t MaximumImages = 16;
+	static const int32_t NameLength = 80;
+
+public:
+
+	TextureLoadJob();
+	virtual ~TextureLoadJob();
+
+	// Add an image to decode; returns false if the job is full.
+	bool AddImage(TextureFormat format, const char *name);
+
+	// Choose how images are kept; only WAL images can be indexed.
+	inline void SetStorage(TextureStorage storage) { this->storage = storage; }
+	inline TextureStorage GetStorage() const { return storage; }
+
+	// Decode every image into staging memory.
+	virtual void Run();
+
+	// Attach the object the texture is created for.
+	inline void SetOwner(void *owner) { this->owner = owner; }
+	inline void *GetOwner() const { return owner; }
+
+	// Decoded images, valid once the loader hands the job back.
+	// Only the images for the job's storage are filled.
+	inline const Image<PixelRGBA> *GetImages() const { return images; }
+	inline const Image<uint8_t> *GetIndexedImages() const { return indexedImages; }
+	inline const CompressedImage *GetCompressedImages() const { return compressedImages; }
+	inline int32_t GetImageCount() const { return imageCount; }
+	inline bool IsDecoded() const { return isDecoded; }
+
+private:
+
+	// Free the images and forget the job's contents so it can be added again.
+	void Clear();
+
+	// Decode an image, expanding it to RGBA.
+	bool DecodeImage(int32_t index);
+
+	// Decode an image with a full mip chain for compressing.
+	bool DecodeMipMapped(int32_t index);
+
+	// Hash an image's source file for its disk cache key.
+	bool HashSource(int32_t index, uint64_t *out);
+
+	// Load every image's blocks from the disk cache, or decode and compress them and cache the results.
+	bool CompressImages();
+
+private:
+
+	friend class TextureLoader;
+
+	TextureLoader *loader;
+	TextureLoadJob *nextCompleted;
+	void *owner;
+	TextureFormat formats[MaximumImages];
+	char names[MaximumImages][NameLength];
+	Image<PixelRGBA> images[MaximumImages];
+	Image<uint8_t> indexedImages[MaximumImages];
+	CompressedImage compressedImages[MaximumImages];
+	int32_t imageCount;
+	TextureStorage storage;
+	bool isDecoded;
+
+};
+
+// Decodes texture images on the worker pool while the calling thread creates
+// renderer textures from them as they complete.
+// Only the thread that starts the loader may take completed jobs.
+class Quake2CommonLibrary TextureLoader : public Allocatable
+{
+
+public:
+
+	TextureLoader();
+	~TextureLoader();
+
+	// Allocate room for a number of jobs.
+	bool Initialize(int32_t jobCapacity);
+
+	// Get a new job to add images to, or null if the loader is full.
+	TextureLoadJob *AddJob();
+
+	// Queue every job added so far for decoding; waiting starts any that aren't.
+	// Without a worker pool, jobs are decoded when they're waited for.
+	void Start();
+
+	// Wait for the next decoded job, in completion order, running queued jobs while
+	// waiting. Returns null once every job has been handed back.
+	TextureLoadJob *WaitNext();
+
+	// Take the next decoded job if one is ready, without waiting.
+	// Without a worker pool, one queued job is decoded first.
+	TextureLoadJob *TakeCompleted();
+
+	// Check whether every job added has been handed back.
+	inline bool IsIdle() const { return returnedCount == jobCount; }
+
+	// Wait for every remaining job, discarding them.
+	void Finish();
+
+	// Finish, then free every job's images so the loader can be filled again.
+	void Reset();
+
+private:
+
+	// Append a decoded job to the completed list and wake the waiting thread.
+	void Complete(TextureLoadJob *job);
+
+	// Unlink the oldest completed job; the completed lock must be held.
+	TextureLoadJob *PopCompleted();
+
+private:
+
+	friend class TextureLoadJob;
+
+	TextureLoadJob *jobs;
+	int32_t jobCapacity;
+	int32_t jobCount;
+	int32_t startedCount; // Jobs queued for decoding.
+	int32_t returnedCount; // Jobs handed back by waiting.
+	WorkerCounter counter;
+
+	// Decoded jobs not yet handed back.
+	std::mutex completedLock;
+	std::condition_variable completedSignal;
+	TextureLoadJob *completedHead;
+	TextureLoadJob *completedTail;
+
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "quake2_common_define.h"
+#include <file.h>
 #include <image.h>
 #include <inttypes.h>
 
@@ -10,6 +11,7 @@ namespace WAL
 	// File header structure.
 	static const int NameLength = 32;
 	static const int MipMapLevelCount = 4;
+	static const int FullPathLength = NameLength + 16; // Name with the texture directory and extension.
 	struct Header
 	{
 		char name[NameLength];
@@ -32,14 +34,34 @@ namespace WAL
 		static bool LoadPalette();
 		static void DestroyPalette();
 
+		// Get the loaded palette's colours; the last colour is transparent.
+		static const PixelRGBA *GetPalette();
+		static int GetPaletteSize();
+
 	public:
 
 		Parser();
 		~Parser();
 
+		// Get the path of a texture in the Quake files from its name.
+		static void GetFullPath(const char *filename, char fullPath[FullPathLength]);
+
 		// Parse a file into an RGBA image using a specific palette.
 		bool Read(const char *filename, Image<PixelRGBA> *out);
 
+		// Parse a file into an image of palette indices, left for the renderer to look up.
+		bool ReadIndexed(const char *filename, Image<uint8_t> *out);
+
+		// Read only the size of a file's full resolution image.
+		bool ReadSize(const char *filename, int *width, int *height);
+
+	private:
+
+		// Read a file and size an image for its precomputed mip levels.
+		// Returns the level data, or null if the file is missing or its levels lie outside it.
+		template <typename PixelType>
+		static const uint8_t *ReadLevels(const char *filename, FileData *walData, Image<PixelType> *out);
+
 	};
 
 }
\ No newline at end of file
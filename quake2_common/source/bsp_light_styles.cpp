@@ -0,0 +1,67 @@
+#include "bsp_light_styles.h"
+#include <string.h>
+
+namespace BSP
+{
+
+	// Default patterns for the standard light styles.
+	struct DefaultLightStyle
+	{
+		int32_t style;
+		const char *pattern;
+	};
+	static const DefaultLightStyle DefaultLightStyles[] = {
+		{ 0, "m" }, // Normal.
+		{ 1, "mmnmmommommnonmmonqnmmo" }, // Flicker.
+		{ 2, "abcdefghijklmnopqrstuvwxyzyxwvutsrqponmlkjihgfedcba" }, // Slow strong pulse.
+		{ 3, "mmmmmaaaaammmmmaaaaaabcdefgabcdefg" }, // Candle.
+		{ 4, "mamamamamama" }, // Fast strobe.
+		{ 5, "jklmnopqrstuvwxyzyxwvutsrqponmlkj" }, // Gentle pulse.
+		{ 6, "nmonqnmomnmomomno" }, // Flicker.
+		{ 7, "mmmaaaabcdefgmmmmaaaammmaamm" }, // Candle.
+		{ 8, "mmmaaammmaaammmabcdefaaaammmmabcdefmmmaaaa" }, // Candle.
+		{ 9, "aaaaaaaazzzzzzzz" }, // Slow strobe.
+		{ 10, "mmamammmmammamamaaamammma" }, // Fluorescent flicker.
+		{ 11, "abcdefghijklmnopqrrqponmlkjihgfedcba" }, // Slow pulse, not fading to black.
+		{ 63, "a" } // Testing.
+	};
+
+	LightStyles::LightStyles()
+	{
+		for (int32_t i = 0; i < LightStyleCount; ++i) {
+			patterns[i] = nullptr;
+			patternLengths[i] = 0;
+		}
+		int32_t defaultCount = sizeof(DefaultLightStyles) / sizeof(DefaultLightStyles[0]);
+		for (int32_t i = 0; i < defaultCount; ++i) {
+			SetPattern(DefaultLightStyles[i].style, DefaultLightStyles[i].pattern);
+		}
+	}
+
+	LightStyles::~LightStyles()
+	{
+	}
+
+	// Store the pattern and its length.
+	void LightStyles::SetPattern(int32_t style, const char *pattern)
+	{
+		patterns[style] = pattern;
+		patternLengths[style] = (pattern != nullptr) ? static_cast<int32_t>(strlen(pattern)) : 0;
+	}
+
+	// The map only queues faces for styles whose brightness changed, so setting
+	// every style each frame is cheap.
+	void LightStyles::Update(int32_t frame, BSP::Map *map) const
+	{
+		for (int32_t i = 0; i < LightStyleCount; ++i) {
+			int32_t length = patternLengths[i];
+			if (length == 0) {
+				continue;
+			}
+			char letter = patterns[i][frame % length];
+			float value = static_cast<float>(letter - 'a') / static_cast<float>('m' - 'a');
+			map->SetLightStyle(i, value);
+		}
+	}
+
+}
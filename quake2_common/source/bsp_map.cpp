@@ -2,18 +2,101 @@
 #include "quake_file_manager.h"
 #include "wal_parser.h"
 #include <error_stack.h>
+#include <math.h>
+#include <mesh_optimizer.h>
+#include <skyline_packer.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <vertex_packing.h>
+#include <emmintrin.h>
+#include <xmmintrin.h>
 
 namespace BSP
 {
 
-	FaceTexture::FaceTexture() : texture(nullptr)
+	// Sky box side suffixes, in the order of the +X, -X, +Y, -Y, +Z and -Z Quake axes.
+	// The sky shader reads the sides in this order.
+	static const char *SkySideSuffixes[] = { "rt", "lf", "bk", "ft", "up", "dn" };
+	static const int SkySuffixLength = 2;
+	static const int32_t SkyColumnCount = 3; // Sides across the joined sky texture.
+
+	// Sky string constants.
+	static const char SkyDirectory[] = "env/";
+	static const char SkyExtension[] = ".pcx";
+	static const int SkyPathLength =
+		Map::SkyNameLength + (sizeof(SkyDirectory) - 1) + SkySuffixLength + (sizeof(SkyExtension) - 1);
+
+	// Texture cache key constants, matching the WAL paths.
+	static const char TextureDirectory[] = "textures/";
+	static const char TextureExtension[] = ".wal";
+
+	// Placeholder shown for face textures that aren't resident.
+	// Quake's palette starts with a ramp from black to white, so the index is grey too.
+	static const uint8_t MissingTextureGrey = 128;
+	static const uint8_t MissingTextureIndex = 8;
+
+	// Opacity of translucent surfaces.
+	static const float Translucent33Alpha = 0.33f;
+	static const float Translucent66Alpha = 0.66f;
+
+	// Sort translucent faces farthest first.
+	static int CompareSortedFaces(const void *a, const void *b)
+	{
+		float depthA = reinterpret_cast<const SortedFace*>(a)->depth;
+		float depthB = reinterpret_cast<const SortedFace*>(b)->depth;
+		if (depthA > depthB) {
+			return -1;
+		}
+		return (depthA < depthB) ? 1 : 0;
+	}
+
+	// Light map entry for sorting by size before packing.
+	struct LightMapEntry
+	{
+		int32_t width;
+		int32_t height;
+		int32_t faceIndex;
+	};
+
+	// Sort light maps by decreasing height, then width.
+	static int CompareLightMaps(const void *a, const void *b)
+	{
+		const LightMapEntry *entryA = reinterpret_cast<const LightMapEntry*>(a);
+		const LightMapEntry *entryB = reinterpret_cast<const LightMapEntry*>(b);
+		if (entryA->height != entryB->height) {
+			return (entryA->height > entryB->height) ? -1 : 1;
+		}
+		if (entryA->width != entryB->width) {
+			return (entryA->width > entryB->width) ? -1 : 1;
+		}
+		return entryA->faceIndex - entryB->faceIndex;
+	}
+
+	// Check every frame of an animation is the size of the first.
+	template <typename ImageType>
+	static bool IsFrameSizeMatched(const ImageType *images, int32_t frameCount)
+	{
+		for (int32_t i = 1; i < frameCount; ++i) {
+			if ((images[i].GetWidth() != images[0].GetWidth()) || (images[i].GetHeight() != images[0].GetHeight())) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	FaceTexture::FaceTexture()
+		: cacheEntry(nullptr),
+		memorySize(0),
+		nextTexture(nullptr),
+		frameOffset(0),
+		frameCount(1)
 	{
 	}
 
 	FaceTexture::~FaceTexture()
 	{
-        delete texture;
+		ReleaseResources();
 	}
 
 	// Copy texture name to entry.
@@ -22,80 +105,187 @@ namespace BSP
 		strncpy(this->name, name, TextureNameLength);
 	}
 
-	// Load this entry's texture resource.
-	bool FaceTexture::LoadResources(Renderer::Resources *resources)
+	// Entries with the same frames share a texture, whatever their offsets or flags.
+	bool FaceTexture::AcquireResources()
 	{
-		// Load the image.
-		Image<PixelRGBA> image;
-		WAL::Parser walParser;
-		if (!walParser.Read(name, &image)) {
-			ErrorStack::Log("Failed to load WAL texture from file.");
+		char key[CacheKeyLength];
+		GetCacheKey(key);
+		TextureCacheEntry *entry = TextureCache::instance->Acquire(key);
+		if (entry == nullptr) {
+			return false;
+		}
+		SetCacheEntry(entry);
+		return true;
+	}
+
+	// Queue each frame of the chain from this entry on, so layers are in animation order.
+	bool FaceTexture::QueueResources(TextureLoadJob *job) const
+	{
+		const FaceTexture *frame = this;
+		for (int32_t i = 0; i < frameCount; ++i, frame = frame->nextTexture) {
+			char frameName[TextureNameLength + 1];
+			memcpy(frameName, frame->name, TextureNameLength);
+			frameName[TextureNameLength] = '\0';
+			if (!job->AddImage(WalFormat, frameName)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Static textures are a single layer array, so every face samples the same way.
+	bool FaceTexture::CreateResources(Renderer::Resources *resources, const TextureLoadJob *job)
+	{
+		if (!MeasureResources(job)) {
 			return false;
 		}
 
 		// Create texture resource.
-		texture = resources->CreateTexture(&image);
+		Renderer::Texture *texture;
+		if (job->GetStorage() == IndexedStorage) {
+			texture = resources->CreateIndexedTextureArray(job->GetIndexedImages(), frameCount);
+		}
+		else if (job->GetStorage() == CompressedStorage) {
+			texture = resources->CreateCompressedTextureArray(job->GetCompressedImages(), frameCount);
+		}
+		else {
+			texture = resources->CreateTextureArray(job->GetImages(), frameCount);
+		}
 		if (texture == nullptr) {
 			ErrorStack::Log("Failed to create renderer texture from WAL file.");
 			return false;
 		}
-
-		// Update texture size to pass to shader.
-		textureSize.x = static_cast<float>(image.GetWidth());
-		textureSize.y = static_cast<float>(image.GetHeight());
+		char key[CacheKeyLength];
+		GetCacheKey(key);
+		TextureCacheEntry *entry = TextureCache::instance->Add(
+			key,
+			texture,
+			static_cast<int>(textureSize.x),
+			static_cast<int>(textureSize.y),
+			memorySize);
+		if (entry == nullptr) {
+			return false;
+		}
+		SetCacheEntry(entry);
 		return true;
 	}
 
-	// Visibility index constants.
-	static const int32_t InvalidVisibilityFrame = -1;
+	// Every frame is the same size, so the cost is the first frame's for each layer.
+	bool FaceTexture::MeasureResources(const TextureLoadJob *job)
+	{
+		int width;
+		int height;
+		int32_t frameSize;
+		bool isSizeMatched;
+		if (job->GetStorage() == IndexedStorage) {
+			const Image<uint8_t> *images = job->GetIndexedImages();
+			isSizeMatched = IsFrameSizeMatched(images, frameCount);
+			width = images[0].GetWidth();
+			height = images[0].GetHeight();
+			frameSize = images[0].GetBufferSize();
+		}
+		else if (job->GetStorage() == CompressedStorage) {
+			const CompressedImage *images = job->GetCompressedImages();
+			isSizeMatched = IsFrameSizeMatched(images, frameCount);
+			width = images[0].GetWidth();
+			height = images[0].GetHeight();
+			frameSize = images[0].GetBufferSize();
+		}
+		else {
+			const Image<PixelRGBA> *images = job->GetImages();
+			isSizeMatched = IsFrameSizeMatched(images, frameCount);
+			width = images[0].GetWidth();
+			height = images[0].GetHeight();
+			frameSize = images[0].GetBufferSize();
+		}
+		if (!isSizeMatched) {
+			ErrorStack::Log("Animation frames of %s don't match its size.", name);
+			return false;
+		}
+		textureSize.x = static_cast<float>(width);
+		textureSize.y = static_cast<float>(height);
+		memorySize = frameSize * frameCount;
+		return true;
+	}
 
-	Face::Face()
-		: vertexBuffer(nullptr),
-		visibilityFrame(InvalidVisibilityFrame)
+	// Frames are checked against each other once they're decoded.
+	bool FaceTexture::ReadSize()
 	{
+		char frameName[TextureNameLength + 1];
+		memcpy(frameName, name, TextureNameLength);
+		frameName[TextureNameLength] = '\0';
+		WAL::Parser walParser;
+		int width;
+		int height;
+		if (!walParser.ReadSize(frameName, &width, &height)) {
+			return false;
+		}
+		textureSize.x = static_cast<float>(width);
+		textureSize.y = static_cast<float>(height);
+		return true;
 	}
 
-	Face::~Face()
+	// The cache deletes the texture once no other entry or map shares it.
+	void FaceTexture::ReleaseResources()
 	{
-        delete vertexBuffer;
+		if (cacheEntry != nullptr) {
+			TextureCache::instance->Release(cacheEntry);
+			cacheEntry = nullptr;
+		}
 	}
 
-	bool Face::Initialize(int vertexCount)
+	// Static textures are keyed by their path, and animations by each frame's path in layer order.
+	void FaceTexture::GetCacheKey(char key[CacheKeyLength]) const
 	{
-		if (!mesh.Initialize(vertexCount)) {
-			ErrorStack::Log("Failed to allocate %d vertices for map face.", vertexCount);
-			return false;
+		const FaceTexture *frame = this;
+		char *out = key;
+		for (int32_t i = 0; i < frameCount; ++i, frame = frame->nextTexture) {
+			char frameName[TextureNameLength + 1];
+			memcpy(frameName, frame->name, TextureNameLength);
+			frameName[TextureNameLength] = '\0';
+			out += sprintf(out, "%s%s%s%s", (i == 0) ? "" : "+", TextureDirectory, frameName, TextureExtension);
 		}
-		return true;
 	}
 
-	// Load face vertices into renderer buffer.
-	bool Face::LoadResources(Renderer::Resources *resources)
+	// Update texture size to pass to shader.
+	void FaceTexture::SetCacheEntry(TextureCacheEntry *cacheEntry)
 	{
-		const void *vertexData = mesh.GetVertexBuffer();
-		unsigned int vertexBufferSize = mesh.GetVertexBufferSize();
-		Renderer::Buffer *buffer = resources->CreateBuffer(vertexData, vertexBufferSize);
-		if (buffer == nullptr) {
-			return false;
+		if (this->cacheEntry != nullptr) {
+			TextureCache::instance->Release(this->cacheEntry);
 		}
-		this->vertexBuffer = buffer;
-		return true;
+		this->cacheEntry = cacheEntry;
+		textureSize.x = static_cast<float>(cacheEntry->width);
+		textureSize.y = static_cast<float>(cacheEntry->height);
+		memorySize = cacheEntry->memorySize;
 	}
 
-	// Draw this face.
-	void Face::Draw(Renderer::Interface *renderer, Renderer::MaterialLayout *layout) const
+	Face::Face()
+		: texture(nullptr),
+		batchTexture(nullptr),
+		flags(0),
+		plane(nullptr),
+		isBackSide(false),
+		firstIndex(0),
+		indexCount(0)
 	{
-		// Bind the texture.
-		Renderer::Texture *renderTexture = texture->GetTexture();
-		const Vector2 *textureSize = texture->GetSize();
-		Painter::instance->SetTexture(renderer, renderTexture, *textureSize);
+		memset(&lightMap, 0, sizeof(lightMap));
+		lightMap.sampleOffset = -1;
+	}
+
+	Face::~Face()
+	{
+	}
 
-		// Make draw call for face vertices.
-		unsigned int vertexCount = static_cast<unsigned int>(mesh.GetVertexCount());
-		Painter::instance->DrawFace(renderer, vertexBuffer, vertexCount);
+	bool Face::Initialize(int vertexCount)
+	{
+		if (!mesh.Initialize(vertexCount)) {
+			ErrorStack::Log("Failed to allocate %d vertices for map face.", vertexCount);
+			return false;
+		}
+		return true;
 	}
 
-	Node::Node() : visibilityFrame(InvalidVisibilityFrame)
+	Node::Node() : parent(nullptr)
 	{
 	}
 
@@ -109,7 +299,7 @@ namespace BSP
 		int32_t backChild,
 		const Vector3 &minimums,
 		const Vector3 &maximums,
-		const BSP::Face *firstFace,
+		uint16_t firstFace,
 		uint16_t faceCount)
 	{
 		this->plane = plane;
@@ -221,7 +411,7 @@ namespace BSP
 		int16_t areaIndex,
 		const Vector3 &minimums,
 		const Vector3 &maximums,
-		BSP::Face **firstFace,
+		const uint16_t *firstFace,
 		uint16_t faceCount,
 		BSP::Brush **firstBrush,
 		uint16_t brushCount)
@@ -237,21 +427,9 @@ namespace BSP
 		this->brushCount = brushCount;
 	}
 
-	// Mark all faces in this leaf as visible for this frame.
-	void Leaf::SetFacesVisible(int32_t currentVisibilityFrame)
-	{
-		int32_t leafFaceCount = this->faceCount;
-		BSP::Face **faceEntry = this->firstFace;
-		for (int32_t i = 0; i < leafFaceCount; ++i, ++faceEntry) {
-			BSP::Face *currentFace = *faceEntry;
-			currentFace->SetVisibilityFrame(currentVisibilityFrame);
-		}
-	}
-
 	// Map-generic renderer resource definitions.
 	Renderer::MaterialLayout *Map::layout = nullptr;
 
-	// Start frame to get incremented to 0 on first frame.
 	Map::Map()
 		: planes(nullptr),
         textures(nullptr),
@@ -261,12 +439,48 @@ namespace BSP
 		brushes(nullptr),
 		clusters(nullptr),
 		clusterData(nullptr),
-		decompressedCluster(nullptr),
+		clusterCount(0),
+		audibleSets(nullptr),
+		clusterSetWordCount(0),
+		clusterLeafStarts(nullptr),
+		clusterLeaves(nullptr),
+		facePlaneX(nullptr),
+		facePlaneY(nullptr),
+		facePlaneZ(nullptr),
+		facePlaneDistances(nullptr),
 		leafFaces(nullptr),
 		leafBrushes(nullptr),
 		leaves(nullptr),
-		visibilityFrame(InvalidVisibilityFrame)
+		lightMapSamples(nullptr),
+		lightMapPages(nullptr),
+		lightMapImages(nullptr),
+		lightMapPageCount(0),
+		lightMapBlend(nullptr),
+		lightStyleFaceStarts(nullptr),
+		lightStyleFaces(nullptr),
+		dirtyLightMaps(nullptr),
+		dirtyLightMapCount(0),
+		batches(nullptr),
+		batchCount(0),
+		batchFaces(nullptr),
+		translucentFaceCount(0),
+		textureFrame(0),
+		isCompressed(false),
+		isLazy(false),
+		textureStorage(RgbaStorage),
+		textureBudget(0),
+		missingTexture(nullptr),
+		skyEntry(nullptr),
+		skyTexelInset(0.0f),
+		vertexBuffer(nullptr),
+		indexBuffer(nullptr)
 	{
+		memset(&worldStatistics, 0, sizeof(worldStatistics));
+		memset(passBatchStarts, 0, sizeof(passBatchStarts));
+		skyName[0] = '\0';
+		for (int32_t i = 0; i < LightStyleCount; ++i) {
+			lightStyleScales[i] = LightStyleScaleOne;
+		}
 	}
 
 	Map::~Map()
@@ -293,15 +507,52 @@ namespace BSP
 		clusters = nullptr;
 		delete[] leaves;
 		leaves = nullptr;
+		delete vertexBuffer;
+		vertexBuffer = nullptr;
+		delete indexBuffer;
+		indexBuffer = nullptr;
+		delete missingTexture;
+		missingTexture = nullptr;
+		if (skyEntry != nullptr) {
+			TextureCache::instance->Release(skyEntry);
+			skyEntry = nullptr;
+		}
+		if (lightMapPages != nullptr) {
+			for (int32_t i = 0; i < lightMapPageCount; ++i) {
+				delete lightMapPages[i];
+			}
+			delete[] lightMapPages;
+			lightMapPages = nullptr;
+		}
+		delete[] lightMapImages;
+		lightMapImages = nullptr;
+		lightMapPageCount = 0;
+		dirtyLightMapFaces.Destroy();
+		dirtyLightMapCount = 0;
 
 		// Free manually allocated data.
 		if (clusterData != nullptr) {
 			MemoryManager::Free(clusterData);
 			clusterData = nullptr;
 		}
-		if (decompressedCluster != nullptr) {
-			MemoryManager::Free(decompressedCluster);
-			decompressedCluster = nullptr;
+		if (audibleSets != nullptr) {
+			MemoryManager::Free(audibleSets);
+			audibleSets = nullptr;
+		}
+		if (clusterLeafStarts != nullptr) {
+			MemoryManager::Free(clusterLeafStarts);
+			clusterLeafStarts = nullptr;
+		}
+		if (clusterLeaves != nullptr) {
+			MemoryManager::Free(clusterLeaves);
+			clusterLeaves = nullptr;
+		}
+		if (facePlaneX != nullptr) {
+			MemoryManager::Free(facePlaneX);
+			facePlaneX = nullptr;
+			facePlaneY = nullptr;
+			facePlaneZ = nullptr;
+			facePlaneDistances = nullptr;
 		}
 		if (leafFaces != nullptr) {
 			MemoryManager::Free(leafFaces);
@@ -311,6 +562,31 @@ namespace BSP
 			MemoryManager::Free(leafBrushes);
 			leafBrushes = nullptr;
 		}
+		if (lightMapSamples != nullptr) {
+			MemoryManager::Free(lightMapSamples);
+			lightMapSamples = nullptr;
+		}
+		if (lightMapBlend != nullptr) {
+			MemoryManager::Free(lightMapBlend);
+			lightMapBlend = nullptr;
+		}
+		if (lightStyleFaceStarts != nullptr) {
+			MemoryManager::Free(lightStyleFaceStarts);
+			lightStyleFaceStarts = nullptr;
+			lightStyleFaces = nullptr;
+			dirtyLightMaps = nullptr;
+		}
+		if (batches != nullptr) {
+			MemoryManager::Free(batches);
+			batches = nullptr;
+		}
+		if (batchFaces != nullptr) {
+			MemoryManager::Free(batchFaces);
+			batchFaces = nullptr;
+		}
+		batchCount = 0;
+		memset(passBatchStarts, 0, sizeof(passBatchStarts));
+		translucentFaceCount = 0;
 	}
 
 	bool Map::InitializePlanes(int32_t planeCount)
@@ -388,26 +664,14 @@ namespace BSP
 			ErrorStack::Log("Failed to allocate %d bytes for cluster data.", dataSize);
 			return false;
 		}
-
-		// Allocate space for decompressed cluster.
-		// Get ceiling of number of elements needed.
-		uint32_t elementCount = (clusterCount + (ClusterBitVector::ClustersPerElement - 1)) / ClusterBitVector::ClustersPerElement;
-		decompressedCluster = reinterpret_cast<uint8_t*>(MemoryManager::Allocate(elementCount));
-		if (decompressedCluster == nullptr) {
-			ErrorStack::Log("Failed to allocate cluster buffer of size %d for %d leaves.", elementCount, leafCount);
-			return false;
-		}
 		this->clusterCount = clusterCount;
-
-		// Start visible cluster to sentinel index past array end.
-		visibleCluster = clusterCount;
 		return true;
 	}
 
 	bool Map::InitializeLeafFaces(int32_t leafFaceCount)
 	{
 		leafFaces = 
-			reinterpret_cast<BSP::Face**>(MemoryManager::Allocate(leafFaceCount * sizeof(BSP::Face*)));
+			reinterpret_cast<uint16_t*>(MemoryManager::Allocate(leafFaceCount * sizeof(uint16_t)));
 		if (leafFaces == nullptr) {
 			ErrorStack::Log("Failed to allocate %d entries for leaf face table.", leafFaceCount);
 			return false;
@@ -437,61 +701,414 @@ namespace BSP
 		return true;
 	}
 
+	bool Map::InitializeLightMapSamples(int32_t sampleSize)
+	{
+		if (sampleSize == 0) {
+			return true;
+		}
+		lightMapSamples = reinterpret_cast<uint8_t*>(MemoryManager::Allocate(sampleSize));
+		if (lightMapSamples == nullptr) {
+			ErrorStack::Log("Failed to allocate %d bytes of light map samples.", sampleSize);
+			return false;
+		}
+		return true;
+	}
+
 	// Build the graph so each node and leaf references its parent.
 	void Map::BuildParentGraph()
 	{
 		BuildParentGraph(HeadIndex, nullptr);
 	}
 
+	// Decompress all audibility sets so that sound queries don't have to.
+	// An extra set with all clusters audible is kept at the end for invalid clusters.
+	bool Map::BuildAudibilitySets()
+	{
+		int32_t clusterCount = this->clusterCount;
+		int32_t wordCount = ClusterBitVector::GetWordCount(clusterCount);
+		int32_t setCount = clusterCount + 1;
+		unsigned int bufferSize = static_cast<unsigned int>(setCount * wordCount) * sizeof(uint32_t);
+		uint32_t *sets = reinterpret_cast<uint32_t*>(MemoryManager::Allocate(bufferSize));
+		if (sets == nullptr) {
+			ErrorStack::Log("Failed to allocate %u bytes for audibility sets.", bufferSize);
+			return false;
+		}
+		memset(sets, 0, bufferSize);
+
+		// Decompress each set into its row; padding past the last cluster stays zeroed.
+		uint32_t *currentSet = sets;
+		const BSP::LeafCluster *cluster = clusters;
+		for (int32_t i = 0; i < clusterCount; ++i, ++cluster, currentSet += wordCount) {
+			const BSP::ClusterBitVector *audibilitySet = cluster->GetAudibilitySet();
+			audibilitySet->Decompress(clusterCount, reinterpret_cast<uint8_t*>(currentSet));
+		}
+		memset(currentSet, 0xFF, wordCount * sizeof(uint32_t));
+
+		this->audibleSets = sets;
+		this->clusterSetWordCount = wordCount;
+		return true;
+	}
+
+	// Group leaf indices by cluster so cluster changes can find leaves directly.
+	bool Map::BuildClusterLeaves()
+	{
+		int32_t clusterCount = this->clusterCount;
+		clusterLeafStarts = reinterpret_cast<int32_t*>(MemoryManager::Allocate((clusterCount + 1) * sizeof(int32_t)));
+		if (clusterLeafStarts == nullptr) {
+			ErrorStack::Log("Failed to allocate leaf table for %d clusters.", clusterCount);
+			return false;
+		}
+		memset(clusterLeafStarts, 0, (clusterCount + 1) * sizeof(int32_t));
+
+		// Count leaves per cluster, then convert counts to starting offsets.
+		const BSP::Leaf *leaf = leaves;
+		for (int32_t i = 0; i < leafCount; ++i, ++leaf) {
+			int32_t leafClusterIndex = leaf->GetClusterIndex();
+			if (leafClusterIndex != InvalidClusterIndex) {
+				++clusterLeafStarts[leafClusterIndex + 1];
+			}
+		}
+		for (int32_t i = 0; i < clusterCount; ++i) {
+			clusterLeafStarts[i + 1] += clusterLeafStarts[i];
+		}
+
+		int32_t tableSize = clusterLeafStarts[clusterCount];
+		clusterLeaves = reinterpret_cast<int32_t*>(MemoryManager::Allocate(tableSize * sizeof(int32_t)));
+		if (clusterLeaves == nullptr) {
+			ErrorStack::Log("Failed to allocate %d entries for cluster leaf table.", tableSize);
+			return false;
+		}
+
+		// Fill by walking each cluster's start forward, then shift the starts back.
+		leaf = leaves;
+		for (int32_t i = 0; i < leafCount; ++i, ++leaf) {
+			int32_t leafClusterIndex = leaf->GetClusterIndex();
+			if (leafClusterIndex != InvalidClusterIndex) {
+				clusterLeaves[clusterLeafStarts[leafClusterIndex]++] = i;
+			}
+		}
+		for (int32_t i = clusterCount; i > 0; --i) {
+			clusterLeafStarts[i] = clusterLeafStarts[i - 1];
+		}
+		clusterLeafStarts[0] = 0;
+		return true;
+	}
+
+	// Store face planes as separate component arrays so four faces can be tested at once.
+	// Back side faces get flipped planes, so a face is front facing exactly when
+	// the view point is in front of its stored plane.
+	bool Map::BuildFacePlanes()
+	{
+		// Pad to whole bit set words; padding planes are zero and never face the view.
+		int32_t paddedCount = (faceCount + (BitSet::BitsPerWord - 1)) & ~(BitSet::BitsPerWord - 1);
+		unsigned int arraySize = paddedCount * sizeof(float);
+		float *planeData = reinterpret_cast<float*>(MemoryManager::Allocate(arraySize * 4));
+		if (planeData == nullptr) {
+			ErrorStack::Log("Failed to allocate planes for %d faces.", faceCount);
+			return false;
+		}
+		memset(planeData, 0, arraySize * 4);
+		facePlaneX = planeData;
+		facePlaneY = facePlaneX + paddedCount;
+		facePlaneZ = facePlaneY + paddedCount;
+		facePlaneDistances = facePlaneZ + paddedCount;
+
+		// Faces that are never drawn keep zero planes, so they never reach a draw list.
+		BSP::Face *face = faces;
+		for (int32_t i = 0; i < faceCount; ++i, ++face) {
+			const BSP::FaceMesh *mesh = face->GetMesh();
+			const BSP::FaceVertex *vertex = mesh->GetVertexBuffer();
+			int vertexCount = mesh->GetVertexCount();
+			Vector3 centre(0.0f, 0.0f, 0.0f);
+			for (int j = 0; j < vertexCount; ++j, ++vertex) {
+				centre.Sum(centre, vertex->position);
+			}
+			if (vertexCount != 0) {
+				centre.ScalarMultiple(centre, 1.0f / static_cast<float>(vertexCount));
+			}
+			face->SetCentre(centre);
+			if (GetFacePass(face->GetFlags()) < 0) {
+				continue;
+			}
+
+			const Geometry::Plane *plane = face->GetPlane();
+			float sign = face->IsBackSide() ? -1.0f : 1.0f;
+			facePlaneX[i] = plane->normal.x * sign;
+			facePlaneY[i] = plane->normal.y * sign;
+			facePlaneZ[i] = plane->normal.z * sign;
+			facePlaneDistances[i] = plane->distance * sign;
+		}
+		return true;
+	}
+
+	// Copy the sky name, truncating it to fit.
+	void Map::SetSkyName(const char *skyName)
+	{
+		strncpy(this->skyName, skyName, SkyNameLength - 1);
+		this->skyName[SkyNameLength - 1] = '\0';
+	}
+
 	// Load the map renderer resources.
 	bool Map::LoadResources(Renderer::Resources *resources)
 	{
-		BSP::FaceTexture *currentTexture = this->textures;
-		int32_t textureCount = this->textureCount;
-		for (int32_t i = 0; i < textureCount; ++i, ++currentTexture) {
-			if (!currentTexture->LoadResources(resources)) {
+		// Batches are split by light map page, so pack light maps first.
+		if (!BuildLightStyleFaces()) {
+			return false;
+		}
+		if (!BuildLightMapAtlas(resources)) {
+			return false;
+		}
+		if (!BuildBatches()) {
+			return false;
+		}
+
+		if (!LoadTextures(resources)) {
+			return false;
+		}
+		return LoadWorldBuffers(resources);
+	}
+
+	// Only the first texture entry of each batch group is loaded and bound.
+	// Batches on different light map pages share it.
+	// Sky faces show the sky box instead of their texture.
+	// Decoding runs ahead on workers while finished textures are created here.
+	// Face textures may be compressed on the workers too; the sky stays RGBA, as its sides are joined here.
+	// Once the budget is spent, the rest are only measured so their faces can still be packed.
+	// Lazily loaded textures only have their sizes read here, so nothing is decoded for them.
+	bool Map::LoadTextures(Renderer::Resources *resources)
+	{
+		textureStorage = RgbaStorage;
+		if (Painter::instance->IsIndexed()) {
+			textureStorage = IndexedStorage;
+		}
+		else if (isCompressed && resources->IsCompressionSupported()) {
+			textureStorage = CompressedStorage;
+		}
+		if (!CreateMissingTexture(resources)) {
+			return false;
+		}
+		TextureLoader loader;
+		BitSet queuedTextures;
+		if (!loader.Initialize(batchCount + 1) || !queuedTextures.Initialize(textureCount)) {
+			ErrorStack::Log("Failed to allocate texture loading for %d batches.", batchCount);
+			return false;
+		}
+		int64_t residentBytes = 0;
+		const BSP::FaceBatch *batch = batches;
+		for (int32_t i = 0; i < batchCount; ++i, ++batch) {
+			int32_t textureIndex = static_cast<int32_t>(batch->texture - textures);
+			if ((batch->pass == SkyPass) || queuedTextures.IsSet(textureIndex)) {
+				continue;
+			}
+			queuedTextures.Set(textureIndex);
+			BSP::FaceTexture *texture = const_cast<BSP::FaceTexture*>(batch->texture);
+			if (texture->AcquireResources()) {
+				residentBytes += texture->GetMemorySize();
+				continue;
+			}
+			if (isLazy) {
+				if (!texture->ReadSize()) {
+					return false;
+				}
+				continue;
+			}
+			TextureLoadJob *job = loader.AddJob();
+			if ((job == nullptr) || !texture->QueueResources(job)) {
 				return false;
 			}
+			job->SetStorage(textureStorage);
+			job->SetOwner(texture);
 		}
-		BSP::Face *currentFace = this->faces;
-		int32_t faceCount = this->faceCount;
-		for (int32_t i = 0; i < faceCount; ++i, ++currentFace) {
-			if (!currentFace->LoadResources(resources)) {
+		TextureLoadJob *skyJob = nullptr;
+		if ((passBatchStarts[SkyPass] != passBatchStarts[SkyPass + 1]) && !AcquireSky()) {
+			skyJob = loader.AddJob();
+			if ((skyJob == nullptr) || !QueueSky(skyJob)) {
 				return false;
 			}
 		}
+
+		// Jobs come back in the order they finish; the loader drains the rest on failure.
+		loader.Start();
+		TextureLoadJob *job;
+		while ((job = loader.WaitNext()) != nullptr) {
+			if (!job->IsDecoded()) {
+				return false;
+			}
+			if (job == skyJob) {
+				if (!CreateSky(resources, job->GetImages())) {
+					return false;
+				}
+			}
+			else {
+				BSP::FaceTexture *texture = reinterpret_cast<BSP::FaceTexture*>(job->GetOwner());
+				if (!texture->MeasureResources(job)) {
+					return false;
+				}
+				if ((textureBudget != 0) && ((residentBytes + texture->GetMemorySize()) > textureBudget)) {
+					continue;
+				}
+				if (!texture->CreateResources(resources, job)) {
+					return false;
+				}
+				residentBytes += texture->GetMemorySize();
+			}
+		}
 		return true;
 	}
 
-	// Draw the map.
-	void Map::Draw(
-		Renderer::Interface *renderer,
-		const Vector3 &viewPoint,
-		const Matrix4x4 &projectionView)
+	// Store the style's brightness in fixed point and queue its faces if it changed.
+	void Map::SetLightStyle(int32_t style, float value)
 	{
-		// Store parameters so we don't have to keep passing them down.
-		this->referencePoint = viewPoint;
-		this->renderer = renderer;
+		float scaled = floorf((value * static_cast<float>(LightStyleScaleOne)) + 0.5f);
+		uint16_t scale;
+		if (scaled <= 0.0f) {
+			scale = 0;
+		}
+		else if (scaled >= static_cast<float>(MaximumLightStyleScale)) {
+			scale = MaximumLightStyleScale;
+		}
+		else {
+			scale = static_cast<uint16_t>(scaled);
+		}
+		if (lightStyleScales[style] == scale) {
+			return;
+		}
+		lightStyleScales[style] = scale;
+
+		// Before resources are loaded, the atlas is built with the new value anyway.
+		if (lightStyleFaceStarts == nullptr) {
+			return;
+		}
+		int32_t end = lightStyleFaceStarts[style + 1];
+		for (int32_t i = lightStyleFaceStarts[style]; i < end; ++i) {
+			int32_t faceIndex = lightStyleFaces[i];
+			if (!dirtyLightMapFaces.IsSet(faceIndex)) {
+				dirtyLightMapFaces.Set(faceIndex);
+				dirtyLightMaps[dirtyLightMapCount++] = faceIndex;
+			}
+		}
+	}
 
+	// Recombine each queued face into its page image and upload just its rectangle.
+	bool Map::UpdateLightMaps(Renderer::Resources *resources)
+	{
+		bool isUpdated = true;
+		for (int32_t i = 0; i < dirtyLightMapCount; ++i) {
+			int32_t faceIndex = dirtyLightMaps[i];
+			dirtyLightMapFaces.Unset(faceIndex);
+			const BSP::FaceLightMap *lightMap = faces[faceIndex].GetLightMap();
+			Image<PixelRGBA> *pageImage = &lightMapImages[lightMap->page];
+			BlendLightStyles(lightMap, lightMapBlend);
+			WriteLightMap(lightMap, lightMapBlend, pageImage->GetBuffer());
+			if (!resources->UpdateTexture(
+				lightMapPages[lightMap->page],
+				pageImage,
+				lightMap->x - LightMapBorder,
+				lightMap->y - LightMapBorder,
+				lightMap->width + (LightMapBorder * 2),
+				lightMap->height + (LightMapBorder * 2))) {
+				ErrorStack::Log("Failed to update light map of face %d.", faceIndex);
+				isUpdated = false;
+			}
+		}
+		dirtyLightMapCount = 0;
+		return isUpdated;
+	}
+
+	// Update the visible set and draw list of a view from its view point.
+	void Map::UpdateVisibility(BSP::ViewContext *view, const Vector3 &viewPoint) const
+	{
+		Matrix4x4 identity;
+		identity.Identity();
+		UpdateVisibility(view, viewPoint, identity, nullptr);
+	}
+
+	// Update the visible set and draw list of a view with occlusion culling.
+	void Map::UpdateVisibility(
+		BSP::ViewContext *view,
+		const Vector3 &viewPoint,
+		const Matrix4x4 &projectionView,
+		BSP::OcclusionCuller *culler) const
+	{
 		// Find the leaf node that camera is in.
-		const BSP::Leaf *viewLeaf = GetLeafByPoint(referencePoint);
+		const BSP::Leaf *viewLeaf = GetLeafByPoint(viewPoint);
 		int16_t viewClusterIndex = viewLeaf->GetClusterIndex();
 
-		// Check if we need to update visibility frame.
-		if (viewClusterIndex != visibleCluster) {
-			++visibilityFrame;
-			visibleCluster = viewClusterIndex;
-			MarkVisibleCluster(viewClusterIndex);
+		// Only re-mark visibility if the view changed clusters.
+		int32_t previousCluster = view->SetView(viewPoint, viewClusterIndex);
+		if (previousCluster != viewClusterIndex) {
+			MarkVisibleCluster(view, previousCluster, viewClusterIndex);
+		}
+
+		// Occluders are picked from the potentially visible set, so render after marking.
+		if (culler != nullptr) {
+			culler->Render(view, projectionView);
 		}
 
+		// Drop back facing faces before they reach the draw list.
+		MarkFrontFaces(view);
+
+		// Order depends on the view point, so always rebuild the draw list.
+		view->ClearDrawFaces();
+		GatherNode(view, culler, HeadIndex);
+		BuildDrawRanges(view);
+	}
+
+	// Draw the map as seen from a view.
+	void Map::Draw(
+		Renderer::Interface *renderer,
+		const BSP::ViewContext *view,
+		const Matrix4x4 &projectionView) const
+	{
 		// Set up painter to draw the map.
-		Painter::instance->PrepareRenderer(renderer, projectionView);
-		
-		// Start drawing from head of tree.
-		DrawNode(HeadIndex);
+		Painter *painter = Painter::instance;
+		painter->PrepareRenderer(renderer, projectionView, textureFrame);
+		painter->BindWorld(renderer, vertexBuffer, indexBuffer);
+
+		// Bind each opaque batch's texture once and draw its ranges from the last visibility
+		// update in one call. Batches are ordered by light map page, so pages change rarely.
+		const uintptr_t *drawRangeOffsets = view->GetDrawRangeOffsets();
+		const int32_t *drawRangeCounts = view->GetDrawRangeCounts();
+		const int32_t *batchRangeStarts = view->GetBatchRangeStarts();
+		const BSP::FaceBatch *batch = &batches[passBatchStarts[OpaquePass]];
+		int32_t lightMapPage = -1;
+		for (int32_t i = passBatchStarts[OpaquePass]; i < passBatchStarts[OpaquePass + 1]; ++i, ++batch) {
+			int32_t rangeStart = batchRangeStarts[i];
+			int32_t rangeEnd = batchRangeStarts[i + 1];
+			if (rangeStart == rangeEnd) {
+				continue;
+			}
+			if (batch->lightMapPage != lightMapPage) {
+				lightMapPage = batch->lightMapPage;
+				painter->SetLightMap(renderer, lightMapPages[lightMapPage]);
+			}
+			const BSP::FaceTexture *batchTexture = batch->texture;
+			painter->SetTexture(renderer, GetDrawTexture(batchTexture), *batchTexture->GetSize(), batchTexture->GetFrameCount());
+			painter->DrawRanges(renderer, &drawRangeOffsets[rangeStart], &drawRangeCounts[rangeStart], rangeEnd - rangeStart);
+		}
+
+		painter->UnbindWorld(renderer, indexBuffer);
+		painter->ClearRenderer(renderer);
+
+		// Every sky face shows the same sky box, so the sky pass's ranges are drawn together.
+		int32_t skyRangeStart = batchRangeStarts[passBatchStarts[SkyPass]];
+		int32_t skyRangeEnd = batchRangeStarts[passBatchStarts[SkyPass + 1]];
+		if (skyRangeStart != skyRangeEnd) {
+			painter->PrepareSky(renderer, projectionView, *view->GetViewPoint(), skyEntry->texture, skyTexelInset);
+			painter->BindSky(renderer, vertexBuffer, indexBuffer);
+			painter->DrawRanges(renderer, &drawRangeOffsets[skyRangeStart], &drawRangeCounts[skyRangeStart], skyRangeEnd - skyRangeStart);
+			painter->UnbindSky(renderer, indexBuffer);
+			painter->ClearSky(renderer);
+		}
 
-		// Clear up renderer.
-		Painter::instance->ClearRenderer(renderer);
+		// Translucent faces go last so they blend over everything behind them.
+		if (view->GetTranslucentFaceCount() != 0) {
+			painter->PrepareRenderer(renderer, projectionView, textureFrame);
+			painter->BindWorld(renderer, vertexBuffer, indexBuffer);
+			DrawTranslucentFaces(renderer, view);
+			painter->UnbindWorld(renderer, indexBuffer);
+			painter->ClearRenderer(renderer);
+		}
 	}
 
 	// Trace a line through the map.
@@ -500,6 +1117,40 @@ namespace BSP
 		return TraceLine(HeadIndex, start, end, timeOut);
 	}
 
+	// Get the cluster that a point is in.
+	int32_t Map::GetClusterByPoint(const Vector3 &point) const
+	{
+		const BSP::Leaf *leaf = GetLeafByPoint(point);
+		return leaf->GetClusterIndex();
+	}
+
+	// Check whether a listener cluster is in the audibility set of a source cluster.
+	bool Map::IsClusterAudible(int32_t sourceCluster, int32_t listenerCluster) const
+	{
+		if (listenerCluster == InvalidClusterIndex) {
+			return true;
+		}
+		const uint32_t *audibleClusters = GetAudibleClusters(sourceCluster);
+		return ClusterBitVector::IsClusterSet(audibleClusters, listenerCluster);
+	}
+
+	// Check whether a listener point can potentially hear a source point.
+	bool Map::IsPointAudible(const Vector3 &source, const Vector3 &listener) const
+	{
+		int32_t sourceCluster = GetClusterByPoint(source);
+		int32_t listenerCluster = GetClusterByPoint(listener);
+		return IsClusterAudible(sourceCluster, listenerCluster);
+	}
+
+	// Get the decompressed audibility set for a cluster.
+	const uint32_t *Map::GetAudibleClusters(int32_t clusterIndex) const
+	{
+		if (clusterIndex == InvalidClusterIndex) {
+			clusterIndex = clusterCount;
+		}
+		return &audibleSets[clusterIndex * clusterSetWordCount];
+	}
+
 	// Build the parent graph from a given node.
 	void Map::BuildParentGraph(int32_t nodeIndex, BSP::Node *parent)
 	{
@@ -519,7 +1170,7 @@ namespace BSP
 	}
 
 	// Get the leaf that a certain point is in.
-	const BSP::Leaf *Map::GetLeafByPoint(const Vector3 &point)
+	const BSP::Leaf *Map::GetLeafByPoint(const Vector3 &point) const
 	{
 		const BSP::Node *node = &nodes[HeadIndex];
 		while (node != nullptr) {
@@ -546,99 +1197,1042 @@ namespace BSP
 		return nullptr;
 	}
 
-	// Mark all leaves in a given cluster for drawing.
-	void Map::MarkVisibleCluster(int32_t clusterIndex)
+	// Update a view's visible leaves for a move between clusters.
+	// Incremental updates only touch leaves in clusters whose visibility changed.
+	void Map::MarkVisibleCluster(BSP::ViewContext *view, int32_t previousCluster, int32_t clusterIndex) const
 	{
-		int32_t leafCount = this->leafCount;
-		BSP::Leaf *leaf = leaves;
+		// Rebuild from an empty set unless both rows are real clusters.
+		bool isIncremental = view->IsIncremental() &&
+			(previousCluster != InvalidClusterIndex) &&
+			(previousCluster != clusterCount) &&
+			(clusterIndex != InvalidClusterIndex);
+		if (!isIncremental) {
+			view->ResetVisibility();
+		}
 
 		// If no cluster, mark all as visible.
+		int32_t changedLeafCount = 0;
 		if (clusterIndex == InvalidClusterIndex) {
+			const BSP::Leaf *leaf = leaves;
 			for (int32_t i = 0; i < leafCount; ++i, ++leaf) {
-				SetParentsVisible(leaf);
+				AddVisibleLeaf(view, leaf);
 			}
+			view->SetChangedLeafCount(leafCount);
+			return;
 		}
-		else {
-			// Decompress the visibility set.
-			const BSP::LeafCluster *cluster = &clusters[clusterIndex];
-			const BSP::ClusterBitVector *visibilitySet = cluster->GetVisibilitySet();
-			visibilitySet->Decompress(clusterCount, decompressedCluster);
-			for (int32_t i = 0; i < leafCount; ++i, ++leaf) {
-				// Check if the leaf's cluster is visible.
-				int32_t leafClusterIndex = leaf->GetClusterIndex();
-				if (leafClusterIndex == InvalidClusterIndex) {
-					continue;
-				}
-				int32_t elementIndex = (leafClusterIndex >> BSP::ClusterBitVector::ElementIndexShift);
-				uint8_t bitIndex = (leafClusterIndex & BSP::ClusterBitVector::BitIndexMask);
-				if ((decompressedCluster[elementIndex] & (1 << bitIndex)) != 0) {
-					SetParentsVisible(leaf);
-				}
+
+		// Decompress the new row and compare it against the current one.
+		BitSet *visibleClusters = view->GetVisibleClusters();
+		BitSet *nextClusters = view->GetNextClusters();
+		BitSet *changedClusters = view->GetChangedClusters();
+		const BSP::LeafCluster *cluster = &clusters[clusterIndex];
+		const BSP::ClusterBitVector *visibilitySet = cluster->GetVisibilitySet();
+		nextClusters->Clear();
+		visibilitySet->Decompress(clusterCount, reinterpret_cast<uint8_t*>(nextClusters->GetWords()));
+		changedClusters->SymmetricDifference(*visibleClusters, *nextClusters);
+
+		// Apply each changed cluster; padding bits past the last cluster are always clear.
+		const uint32_t *changedWords = changedClusters->GetWords();
+		int32_t wordCount = changedClusters->GetWordCount();
+		for (int32_t i = 0; i < wordCount; ++i) {
+			uint32_t word = changedWords[i];
+			while (word != 0) {
+				int32_t changedCluster = (i << BitSet::WordIndexShift) + BitSet::FindFirstSet(word);
+				word &= (word - 1);
+				bool isVisible = nextClusters->IsSet(changedCluster);
+				changedLeafCount += SetClusterVisible(view, changedCluster, isVisible);
+			}
+		}
+		visibleClusters->Swap(nextClusters);
+		view->SetChangedLeafCount(changedLeafCount);
+	}
+
+	// Add or remove all leaves in a cluster, returning how many were touched.
+	int32_t Map::SetClusterVisible(BSP::ViewContext *view, int32_t clusterIndex, bool isVisible) const
+	{
+		int32_t start = clusterLeafStarts[clusterIndex];
+		int32_t end = clusterLeafStarts[clusterIndex + 1];
+		for (int32_t i = start; i < end; ++i) {
+			const BSP::Leaf *leaf = &leaves[clusterLeaves[i]];
+			if (isVisible) {
+				AddVisibleLeaf(view, leaf);
+			}
+			else {
+				RemoveVisibleLeaf(view, leaf);
+			}
+		}
+		return end - start;
+	}
+
+	// Reference a leaf's faces, and its ancestors up to the first already visible.
+	void Map::AddVisibleLeaf(BSP::ViewContext *view, const BSP::Leaf *leaf) const
+	{
+		int32_t leafFaceCount = leaf->GetFaceCount();
+		const uint16_t *faceEntry = leaf->GetFirstFace();
+		for (int32_t i = 0; i < leafFaceCount; ++i, ++faceEntry) {
+			view->AddFaceReference(*faceEntry);
+		}
+
+		const BSP::Node *parent = leaf->GetParent();
+		while (parent != nullptr) {
+			int32_t nodeIndex = static_cast<int32_t>(parent - nodes);
+			if (!view->AddNodeReference(nodeIndex)) {
+				break;
 			}
+			parent = parent->GetParent();
 		}
 	}
 
-	// Mark the ancestors of a given leaf as visible.
-	void Map::SetParentsVisible(BSP::Leaf *leaf)
+	// Release a leaf's faces, and its ancestors up to the first still visible.
+	void Map::RemoveVisibleLeaf(BSP::ViewContext *view, const BSP::Leaf *leaf) const
 	{
-		BSP::Node *parent = leaf->GetParent();
+		int32_t leafFaceCount = leaf->GetFaceCount();
+		const uint16_t *faceEntry = leaf->GetFirstFace();
+		for (int32_t i = 0; i < leafFaceCount; ++i, ++faceEntry) {
+			view->RemoveFaceReference(*faceEntry);
+		}
+
+		const BSP::Node *parent = leaf->GetParent();
 		while (parent != nullptr) {
-			// Check if another leaf has already traversed this ancestor.
-			int32_t currentFrame = parent->GetVisibilityFrame();
-			if (currentFrame == visibilityFrame) {
+			int32_t nodeIndex = static_cast<int32_t>(parent - nodes);
+			if (!view->RemoveNodeReference(nodeIndex)) {
 				break;
 			}
-			parent->SetVisibilityFrame(visibilityFrame);
 			parent = parent->GetParent();
 		}
 	}
 
-	// Draw the map from the given node.
-	void Map::DrawNode(int32_t nodeIndex) const
+	// Mark visible faces whose planes face the view point, four faces at a time.
+	// Words with no visible faces are skipped without any plane tests.
+	void Map::MarkFrontFaces(BSP::ViewContext *view) const
+	{
+		const Vector3 *viewPoint = view->GetViewPoint();
+		const __m128 viewX = _mm_set1_ps(viewPoint->x);
+		const __m128 viewY = _mm_set1_ps(viewPoint->y);
+		const __m128 viewZ = _mm_set1_ps(viewPoint->z);
+		const __m128 zero = _mm_setzero_ps();
+
+		const uint32_t *visibleWords = view->GetVisibleFaces()->GetWords();
+		uint32_t *drawableWords = view->GetDrawableFaces()->GetWords();
+		int32_t wordCount = (faceCount + (BitSet::BitsPerWord - 1)) >> BitSet::WordIndexShift;
+		for (int32_t i = 0; i < wordCount; ++i) {
+			uint32_t visible = visibleWords[i];
+			uint32_t front = 0;
+			if (visible != 0) {
+				int32_t first = i << BitSet::WordIndexShift;
+				for (int32_t j = 0; j < BitSet::BitsPerWord; j += 4) {
+					__m128 distance = _mm_mul_ps(_mm_loadu_ps(&facePlaneX[first + j]), viewX);
+					distance = _mm_add_ps(distance, _mm_mul_ps(_mm_loadu_ps(&facePlaneY[first + j]), viewY));
+					distance = _mm_add_ps(distance, _mm_mul_ps(_mm_loadu_ps(&facePlaneZ[first + j]), viewZ));
+					distance = _mm_sub_ps(distance, _mm_loadu_ps(&facePlaneDistances[first + j]));
+					uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpgt_ps(distance, zero)));
+					front |= (mask << j);
+				}
+			}
+			drawableWords[i] = visible & front;
+		}
+	}
+
+	// Gather visible faces from the given node, front to back.
+	void Map::GatherNode(
+		BSP::ViewContext *view,
+		const BSP::OcclusionCuller *culler,
+		int32_t nodeIndex) const
 	{
-		// Check if this node is a leaf.
+		// Leaf faces are gathered by the nodes that own them.
 		if (nodeIndex < 0) {
-			// Mark all surfaces in leaf as visible.
-			nodeIndex = GetLeafIndex(nodeIndex);
-			BSP::Leaf *leaf = &leaves[nodeIndex];
-			leaf->SetFacesVisible(visibilityFrame);
+			return;
+		}
+
+		// Check if this node is visible.
+		if (!view->IsNodeVisible(nodeIndex)) {
+			return;
+		}
+
+		// Skip subtrees whose bounds are hidden by occluders.
+		const BSP::Node *node = &nodes[nodeIndex];
+		if ((culler != nullptr) && !culler->IsBoxVisible(*node->GetMinimums(), *node->GetMaximums())) {
+			return;
+		}
+
+		// Check which child to gather first.
+		int32_t nearChild;
+		int32_t farChild;
+		const Geometry::Plane *plane = node->GetPlane();
+		if (plane->IsPointInFront(*view->GetViewPoint())) {
+			nearChild = node->GetFrontChild();
+			farChild = node->GetBackChild();
 		}
 		else {
-			BSP::Node *node = &nodes[nodeIndex];
+			nearChild = node->GetBackChild();
+			farChild = node->GetFrontChild();
+		}
+
+		// Recurse into near child.
+		GatherNode(view, culler, nearChild);
+
+		// Scan this node's face range a word at a time.
+		view->AddVisibleFaces(node->GetFirstFace(), node->GetFaceCount());
+
+		// Recurse into far child.
+		GatherNode(view, culler, farChild);
+	}
 
-			// Check if this node is visible.
-			if (!node->IsVisible(visibilityFrame)) {
-				return;
+	// Pack light maps tallest first, starting a new page whenever one doesn't fit.
+	// A white block at the start of the first page lights faces without light maps.
+	bool Map::BuildLightMapAtlas(Renderer::Resources *resources)
+	{
+		LightMapEntry *entries = reinterpret_cast<LightMapEntry*>(MemoryManager::Allocate(faceCount * sizeof(LightMapEntry)));
+		if (entries == nullptr) {
+			ErrorStack::Log("Failed to allocate %d light map entries.", faceCount);
+			return false;
+		}
+		int32_t entryCount = 0;
+		for (int32_t i = 0; i < faceCount; ++i) {
+			const BSP::FaceLightMap *lightMap = faces[i].GetLightMap();
+			if (lightMap->sampleOffset < 0) {
+				continue;
 			}
+			LightMapEntry *entry = &entries[entryCount++];
+			entry->width = lightMap->width + (LightMapBorder * 2);
+			entry->height = lightMap->height + (LightMapBorder * 2);
+			entry->faceIndex = i;
+		}
+		qsort(entries, entryCount, sizeof(LightMapEntry), &CompareLightMaps);
 
-			// Check which child to draw first.
-			int32_t nearChild;
-			int32_t farChild;
-			const Geometry::Plane *plane = node->GetPlane();
-			if (plane->IsPointInFront(referencePoint)) {
-				nearChild = node->GetFrontChild();
-				farChild = node->GetBackChild();
+		SkylinePacker packer;
+		if (!packer.Initialize(LightMapPageSize, LightMapPageSize)) {
+			MemoryManager::Free(entries);
+			return false;
+		}
+		int32_t whiteX;
+		int32_t whiteY;
+		const int32_t whiteSize = 1 + (LightMapBorder * 2);
+		packer.Insert(whiteSize, whiteSize, &whiteX, &whiteY);
+		int32_t page = 0;
+		for (int32_t i = 0; i < entryCount; ++i) {
+			const LightMapEntry *entry = &entries[i];
+			int32_t x;
+			int32_t y;
+			if (!packer.Insert(entry->width, entry->height, &x, &y)) {
+				if (++page == MaximumLightMapPages) {
+					ErrorStack::Log("Light maps don't fit in %d atlas pages.", MaximumLightMapPages);
+					MemoryManager::Free(entries);
+					return false;
+				}
+				packer.Clear();
+				if (!packer.Insert(entry->width, entry->height, &x, &y)) {
+					ErrorStack::Log("Light map of %d by %d luxels is larger than an atlas page.", entry->width, entry->height);
+					MemoryManager::Free(entries);
+					return false;
+				}
 			}
-			else {
-				nearChild = node->GetBackChild();
-				farChild = node->GetFrontChild();
+			BSP::FaceLightMap *lightMap = faces[entry->faceIndex].GetLightMap();
+			lightMap->page = page;
+			lightMap->x = x + LightMapBorder;
+			lightMap->y = y + LightMapBorder;
+		}
+		MemoryManager::Free(entries);
+
+		// Compose and upload each page.
+		int32_t pageCount = page + 1;
+		lightMapPages = new Renderer::Texture*[pageCount];
+		if (lightMapPages == nullptr) {
+			ErrorStack::Log("Failed to allocate %d light map pages.", pageCount);
+			return false;
+		}
+		for (int32_t i = 0; i < pageCount; ++i) {
+			lightMapPages[i] = nullptr;
+		}
+		lightMapPageCount = pageCount;
+		lightMapImages = new Image<PixelRGBA>[pageCount];
+		if (lightMapImages == nullptr) {
+			ErrorStack::Log("Failed to allocate %d light map page images.", pageCount);
+			return false;
+		}
+		for (int32_t i = 0; i < pageCount; ++i) {
+			Image<PixelRGBA> *pageImage = &lightMapImages[i];
+			if (!pageImage->Initialize(LightMapPageSize, LightMapPageSize)) {
+				return false;
+			}
+			PixelRGBA *pagePixels = pageImage->GetBuffer();
+			memset(pagePixels, 0, LightMapPageSize * LightMapPageSize * sizeof(PixelRGBA));
+			if (i == 0) {
+				for (int32_t y = 0; y < whiteSize; ++y) {
+					memset(&pagePixels[((whiteY + y) * LightMapPageSize) + whiteX], 0xFF, whiteSize * sizeof(PixelRGBA));
+				}
+			}
+			for (int32_t j = 0; j < faceCount; ++j) {
+				const BSP::FaceLightMap *lightMap = faces[j].GetLightMap();
+				if ((lightMap->sampleOffset >= 0) && (lightMap->page == i)) {
+					BlendLightStyles(lightMap, lightMapBlend);
+					WriteLightMap(lightMap, lightMapBlend, pagePixels);
+				}
+			}
+			lightMapPages[i] = resources->CreateTexture(pageImage);
+			if (lightMapPages[i] == nullptr) {
+				ErrorStack::Log("Failed to create light map atlas page %d.", i);
+				return false;
+			}
+		}
+
+		// Move face light map coordinates from luxels in the face to the page.
+		const float pageScale = 1.0f / static_cast<float>(LightMapPageSize);
+		Vector2 white(
+			(static_cast<float>(whiteX + LightMapBorder) + 0.5f) * pageScale,
+			(static_cast<float>(whiteY + LightMapBorder) + 0.5f) * pageScale);
+		for (int32_t i = 0; i < faceCount; ++i) {
+			BSP::FaceLightMap *lightMap = faces[i].GetLightMap();
+			BSP::FaceMesh *mesh = faces[i].GetMesh();
+			BSP::FaceVertex *vertex = mesh->GetVertexBuffer();
+			int vertexCount = mesh->GetVertexCount();
+			for (int j = 0; j < vertexCount; ++j, ++vertex) {
+				if (lightMap->sampleOffset < 0) {
+					vertex->lightMap = white;
+				}
+				else {
+					vertex->lightMap.x = (vertex->lightMap.x + static_cast<float>(lightMap->x)) * pageScale;
+					vertex->lightMap.y = (vertex->lightMap.y + static_cast<float>(lightMap->y)) * pageScale;
+				}
+			}
+			if (lightMap->sampleOffset < 0) {
+				lightMap->page = 0;
+			}
+		}
+		return true;
+	}
+
+	// Count each style's faces, then fill the table in face order.
+	// The dirty face queue and blend scratch are sized here too.
+	bool Map::BuildLightStyleFaces()
+	{
+		int32_t referenceCount = 0;
+		int32_t largestSize = 0;
+		for (int32_t i = 0; i < faceCount; ++i) {
+			const BSP::FaceLightMap *lightMap = faces[i].GetLightMap();
+			if (lightMap->sampleOffset < 0) {
+				continue;
+			}
+			referenceCount += lightMap->styleCount;
+			int32_t size = lightMap->width * lightMap->height * 3;
+			if (size > largestSize) {
+				largestSize = size;
+			}
+		}
+
+		int32_t tableSize = (LightStyleCount + 1) + referenceCount + faceCount;
+		lightStyleFaceStarts = reinterpret_cast<int32_t*>(MemoryManager::Allocate(tableSize * sizeof(int32_t)));
+		lightMapBlend = reinterpret_cast<uint8_t*>(MemoryManager::Allocate(largestSize + 1));
+		if ((lightStyleFaceStarts == nullptr) || (lightMapBlend == nullptr)) {
+			ErrorStack::Log("Failed to allocate light style tables for %d face references.", referenceCount);
+			return false;
+		}
+		if (!dirtyLightMapFaces.Initialize(faceCount)) {
+			return false;
+		}
+		lightStyleFaces = lightStyleFaceStarts + (LightStyleCount + 1);
+		dirtyLightMaps = lightStyleFaces + referenceCount;
+		dirtyLightMapCount = 0;
+
+		memset(lightStyleFaceStarts, 0, (LightStyleCount + 1) * sizeof(int32_t));
+		for (int32_t i = 0; i < faceCount; ++i) {
+			const BSP::FaceLightMap *lightMap = faces[i].GetLightMap();
+			if (lightMap->sampleOffset < 0) {
+				continue;
+			}
+			for (int32_t j = 0; j < lightMap->styleCount; ++j) {
+				++lightStyleFaceStarts[lightMap->styles[j] + 1];
+			}
+		}
+		for (int32_t i = 0; i < LightStyleCount; ++i) {
+			lightStyleFaceStarts[i + 1] += lightStyleFaceStarts[i];
+		}
+		for (int32_t i = 0; i < faceCount; ++i) {
+			const BSP::FaceLightMap *lightMap = faces[i].GetLightMap();
+			if (lightMap->sampleOffset < 0) {
+				continue;
+			}
+			for (int32_t j = 0; j < lightMap->styleCount; ++j) {
+				lightStyleFaces[lightStyleFaceStarts[lightMap->styles[j]]++] = i;
+			}
+		}
+
+		// Filling moved each start to the next style's start, so shift them back.
+		for (int32_t i = LightStyleCount; i > 0; --i) {
+			lightStyleFaceStarts[i] = lightStyleFaceStarts[i - 1];
+		}
+		lightStyleFaceStarts[0] = 0;
+		return true;
+	}
+
+	// Sum each style's samples multiplied by its brightness, 16 bytes at a time.
+	// Samples are widened to 16 bits so a full brightness sum can't overflow before the shift.
+	void Map::BlendLightStyles(const BSP::FaceLightMap *lightMap, uint8_t *out) const
+	{
+		int32_t styleSize = lightMap->width * lightMap->height * 3;
+		int32_t styleCount = lightMap->styleCount;
+		const uint8_t *samples = &lightMapSamples[lightMap->sampleOffset];
+		__m128i scales[MaximumLightStyles];
+		for (int32_t i = 0; i < styleCount; ++i) {
+			scales[i] = _mm_set1_epi16(static_cast<int16_t>(lightStyleScales[lightMap->styles[i]]));
+		}
+
+		const __m128i zero = _mm_setzero_si128();
+		int32_t i = 0;
+		for (; (i + 16) <= styleSize; i += 16) {
+			__m128i low = zero;
+			__m128i high = zero;
+			const uint8_t *sample = &samples[i];
+			for (int32_t j = 0; j < styleCount; ++j, sample += styleSize) {
+				__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sample));
+				low = _mm_adds_epu16(low, _mm_mullo_epi16(_mm_unpacklo_epi8(bytes, zero), scales[j]));
+				high = _mm_adds_epu16(high, _mm_mullo_epi16(_mm_unpackhi_epi8(bytes, zero), scales[j]));
+			}
+			low = _mm_srli_epi16(low, LightStyleScaleShift);
+			high = _mm_srli_epi16(high, LightStyleScaleShift);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&out[i]), _mm_packus_epi16(low, high));
+		}
+
+		// Finish the last few bytes the same way, saturating where the vector sums do.
+		for (; i < styleSize; ++i) {
+			int32_t sum = 0;
+			const uint8_t *sample = &samples[i];
+			for (int32_t j = 0; j < styleCount; ++j, sample += styleSize) {
+				sum += static_cast<int32_t>(*sample) * lightStyleScales[lightMap->styles[j]];
+				if (sum > 0xFFFF) {
+					sum = 0xFFFF;
+				}
+			}
+			sum >>= LightStyleScaleShift;
+			out[i] = static_cast<uint8_t>((sum > 255) ? 255 : sum);
+		}
+	}
+
+	// Edge luxels are repeated into the border.
+	void Map::WriteLightMap(const BSP::FaceLightMap *lightMap, const uint8_t *luxels, PixelRGBA *pagePixels)
+	{
+		int32_t width = lightMap->width;
+		int32_t height = lightMap->height;
+		for (int32_t y = -LightMapBorder; y < height + LightMapBorder; ++y) {
+			int32_t sourceY = (y < 0) ? 0 : ((y >= height) ? (height - 1) : y);
+			PixelRGBA *out = &pagePixels[((lightMap->y + y) * LightMapPageSize) + lightMap->x - LightMapBorder];
+			for (int32_t x = -LightMapBorder; x < width + LightMapBorder; ++x, ++out) {
+				int32_t sourceX = (x < 0) ? 0 : ((x >= width) ? (width - 1) : x);
+				const uint8_t *luxel = &luxels[((sourceY * width) + sourceX) * 3];
+				out->r = luxel[0];
+				out->g = luxel[1];
+				out->b = luxel[2];
+				out->a = 255;
+			}
+		}
+	}
+
+	// Group faces by pass, texture and light map page, since several texture entries
+	// can share an image or animation. Batches are ordered by pass, then page, then texture.
+	// Faces that are never drawn get no batch.
+	bool Map::BuildBatches()
+	{
+		// Scratch holds each texture entry's name group and texture group, the first
+		// entry of each name, the entry loaded for each texture group, and the batch
+		// of each texture group on each page in each pass.
+		int32_t passKeyCount = (textureCount * 2) * lightMapPageCount;
+		int32_t keyCount = passKeyCount * FacePassCount;
+		int32_t *scratch = reinterpret_cast<int32_t*>(MemoryManager::Allocate(((textureCount * 5) + keyCount) * sizeof(int32_t)));
+		if (scratch == nullptr) {
+			ErrorStack::Log("Failed to allocate batch tables for %d textures.", textureCount);
+			return false;
+		}
+		int32_t *textureNames = scratch;
+		int32_t *textureGroups = textureNames + textureCount;
+		int32_t *nameTextures = textureGroups + textureCount;
+		int32_t *groupTextures = nameTextures + textureCount;
+		int32_t *keyBatches = groupTextures + (textureCount * 2);
+
+		// Map each texture entry to the group of the first entry with its name.
+		int32_t nameCount = 0;
+		const BSP::FaceTexture *texture = textures;
+		for (int32_t i = 0; i < textureCount; ++i, ++texture) {
+			int32_t nameIndex = 0;
+			while ((nameIndex < nameCount) &&
+				(strncmp(textures[nameTextures[nameIndex]].GetName(), texture->GetName(), FaceTexture::TextureNameLength) != 0)) {
+				++nameIndex;
+			}
+			if (nameIndex == nameCount) {
+				nameTextures[nameCount++] = i;
+			}
+			textureNames[i] = nameIndex;
+		}
+
+		// Static entries are grouped by name. Every frame of an animation joins one group
+		// after the static ones, named for the frame with the lowest name group; that frame's
+		// entry holds the frames as layers starting from itself. Each entry records which
+		// layer it shows first, so the current frame is a single shader uniform.
+		// Chains that don't loop back are drawn static.
+		int32_t groupCount = nameCount * 2;
+		for (int32_t i = 0; i < groupCount; ++i) {
+			groupTextures[i] = -1;
+		}
+		BSP::FaceTexture *chainTexture = textures;
+		for (int32_t i = 0; i < textureCount; ++i, ++chainTexture) {
+			int32_t frameCount = 1;
+			int32_t lowestName = textureNames[i];
+			int32_t lowestFrame = 0;
+			const BSP::FaceTexture *frame = chainTexture->GetNextTexture();
+			while ((frame != nullptr) && (frame != chainTexture) && (frameCount < FaceTexture::MaximumAnimationFrames)) {
+				int32_t frameName = textureNames[frame - textures];
+				if (frameName < lowestName) {
+					lowestName = frameName;
+					lowestFrame = frameCount;
+				}
+				frame = frame->GetNextTexture();
+				++frameCount;
+			}
+			if (frame != chainTexture) {
+				frameCount = 1;
+				lowestName = textureNames[i];
+				lowestFrame = 0;
+			}
+			int32_t frameOffset = (frameCount - lowestFrame) % frameCount;
+			int32_t group = (frameCount == 1) ? lowestName : (nameCount + lowestName);
+			chainTexture->SetAnimation(frameOffset, frameCount);
+			textureGroups[i] = group;
+			if ((frameOffset == 0) && (groupTextures[group] == -1)) {
+				groupTextures[group] = i;
+			}
+		}
+
+		// Count faces per pass, page and texture group.
+		passKeyCount = groupCount * lightMapPageCount;
+		keyCount = passKeyCount * FacePassCount;
+		for (int32_t i = 0; i < keyCount; ++i) {
+			keyBatches[i] = 0;
+		}
+		const BSP::Face *face = faces;
+		for (int32_t i = 0; i < faceCount; ++i, ++face) {
+			int32_t pass = GetFacePass(face->GetFlags());
+			if (pass < 0) {
+				continue;
+			}
+			int32_t textureIndex = static_cast<int32_t>(face->GetTexture() - textures);
+			++keyBatches[(pass * passKeyCount) + (face->GetLightMap()->page * groupCount) + textureGroups[textureIndex]];
+		}
+
+		// Only pairs with faces get a batch.
+		int32_t batchCount = 0;
+		for (int32_t i = 0; i < keyCount; ++i) {
+			if (keyBatches[i] != 0) {
+				++batchCount;
+			}
+		}
+		batches = reinterpret_cast<BSP::FaceBatch*>(MemoryManager::Allocate(batchCount * sizeof(BSP::FaceBatch)));
+		batchFaces = reinterpret_cast<int32_t*>(MemoryManager::Allocate(faceCount * sizeof(int32_t)));
+		if ((batches == nullptr) || (batchFaces == nullptr)) {
+			ErrorStack::Log("Failed to allocate %d face batches of %d faces.", batchCount, faceCount);
+			MemoryManager::Free(scratch);
+			return false;
+		}
+		int32_t firstFace = 0;
+		int32_t batchIndex = 0;
+		for (int32_t i = 0; i < keyCount; ++i) {
+			int32_t pass = i / passKeyCount;
+			if ((i % passKeyCount) == 0) {
+				passBatchStarts[pass] = batchIndex;
+			}
+			int32_t keyFaceCount = keyBatches[i];
+			if (keyFaceCount == 0) {
+				keyBatches[i] = -1;
+				continue;
+			}
+			BSP::FaceBatch *batch = &batches[batchIndex];
+			batch->texture = &textures[groupTextures[i % groupCount]];
+			batch->pass = pass;
+			batch->lightMapPage = (i % passKeyCount) / groupCount;
+			batch->firstFace = firstFace;
+			batch->faceCount = 0;
+			firstFace += keyFaceCount;
+			keyBatches[i] = batchIndex++;
+		}
+		passBatchStarts[FacePassCount] = batchIndex;
+		this->batchCount = batchCount;
+
+		// Fill each batch's faces in face order.
+		translucentFaceCount = 0;
+		face = faces;
+		for (int32_t i = 0; i < faceCount; ++i, ++face) {
+			int32_t pass = GetFacePass(face->GetFlags());
+			if (pass < 0) {
+				continue;
+			}
+			if (pass == TranslucentPass) {
+				++translucentFaceCount;
+			}
+			int32_t textureIndex = static_cast<int32_t>(face->GetTexture() - textures);
+			int32_t key = (pass * passKeyCount) + (face->GetLightMap()->page * groupCount) + textureGroups[textureIndex];
+			BSP::FaceBatch *batch = &batches[keyBatches[key]];
+			batchFaces[batch->firstFace + batch->faceCount++] = i;
+			faces[i].SetBatchTexture(batch->texture);
+		}
+		MemoryManager::Free(scratch);
+		return true;
+	}
+
+	// The placeholder is a single texel, in the same form as the face textures it stands in for.
+	bool Map::CreateMissingTexture(Renderer::Resources *resources)
+	{
+		if (textureStorage == IndexedStorage) {
+			Image<uint8_t> image;
+			if (!image.Initialize(1, 1)) {
+				return false;
+			}
+			*image.GetBuffer() = MissingTextureIndex;
+			missingTexture = resources->CreateIndexedTextureArray(&image, 1);
+		}
+		else {
+			Image<PixelRGBA> image;
+			if (!image.Initialize(1, 1)) {
+				return false;
+			}
+			PixelRGBA *pixel = image.GetBuffer();
+			pixel->r = MissingTextureGrey;
+			pixel->g = MissingTextureGrey;
+			pixel->b = MissingTextureGrey;
+			pixel->a = 255;
+			missingTexture = resources->CreateTextureArray(&image, 1);
+		}
+		if (missingTexture == nullptr) {
+			ErrorStack::Log("Failed to create placeholder texture.");
+			return false;
+		}
+		return true;
+	}
+
+	// The sky is keyed by the path its side names start with.
+	bool Map::AcquireSky()
+	{
+		char key[SkyPathLength];
+		sprintf(key, "%s%s", SkyDirectory, skyName);
+		TextureCacheEntry *entry = TextureCache::instance->Acquire(key);
+		if (entry == nullptr) {
+			return false;
+		}
+		skyEntry = entry;
+		skyTexelInset = 0.5f * static_cast<float>(SkyColumnCount) / static_cast<float>(entry->width);
+		return true;
+	}
+
+	// Queue the sides in the order they're joined.
+	bool Map::QueueSky(TextureLoadJob *job) const
+	{
+		for (int32_t i = 0; i < SkySideCount; ++i) {
+			char filename[SkyPathLength];
+			sprintf(filename, "%s%s%s%s", SkyDirectory, skyName, SkySideSuffixes[i], SkyExtension);
+			if (!job->AddImage(PcxFormat, filename)) {
+				return false;
 			}
+		}
+		return true;
+	}
 
-			// Recurse into near child.
-			DrawNode(nearChild);
+	// Join the six sides side by side into one image, so the sky takes a single texture.
+	// Every side must be the same size.
+	bool Map::CreateSky(Renderer::Resources *resources, const Image<PixelRGBA> *sides)
+	{
+		for (int32_t i = 0; i < SkySideCount; ++i) {
+			if ((sides[i].GetWidth() != sides[0].GetWidth()) || (sides[i].GetHeight() != sides[0].GetHeight())) {
+				ErrorStack::Log("Sky box side %s%s doesn't match the size of the others.", skyName, SkySideSuffixes[i]);
+				return false;
+			}
+		}
 
-			// Draw this node's faces.
-			const BSP::Face *face = node->GetFirstFace();
-			int32_t faceCount = node->GetFaceCount();
-			for (int32_t i = 0; i < faceCount; ++i, ++face) {
-				if (face->IsVisible(visibilityFrame)) {
-					face->Draw(renderer, layout);
+		int32_t sideWidth = sides[0].GetWidth();
+		int32_t sideHeight = sides[0].GetHeight();
+		Image<PixelRGBA> skyImage;
+		if (!skyImage.Initialize(sideWidth * SkyColumnCount, sideHeight * (SkySideCount / SkyColumnCount))) {
+			return false;
+		}
+		PixelRGBA *skyPixels = skyImage.GetBuffer();
+		int32_t skyWidth = skyImage.GetWidth();
+		for (int32_t i = 0; i < SkySideCount; ++i) {
+			const PixelRGBA *sidePixels = sides[i].GetBuffer();
+			PixelRGBA *out = &skyPixels[((i / SkyColumnCount) * sideHeight * skyWidth) + ((i % SkyColumnCount) * sideWidth)];
+			for (int32_t y = 0; y < sideHeight; ++y) {
+				memcpy(&out[y * skyWidth], &sidePixels[y * sideWidth], sideWidth * sizeof(PixelRGBA));
+			}
+		}
+		Renderer::Texture *skyTexture = resources->CreateTexture(&skyImage);
+		if (skyTexture == nullptr) {
+			ErrorStack::Log("Failed to create sky box texture.");
+			return false;
+		}
+		char key[SkyPathLength];
+		sprintf(key, "%s%s", SkyDirectory, skyName);
+		skyEntry = TextureCache::instance->Add(
+			key,
+			skyTexture,
+			skyImage.GetWidth(),
+			skyImage.GetHeight(),
+			skyImage.GetBufferSize());
+		if (skyEntry == nullptr) {
+			return false;
+		}
+		skyTexelInset = 0.5f / static_cast<float>(sideWidth);
+		return true;
+	}
+
+	// Pack every face into one vertex buffer and one index buffer.
+	// Each batch's vertices are welded and its triangles reordered for the vertex
+	// cache, keeping every face's triangles contiguous so faces can still be
+	// drawn as index ranges.
+	bool Map::LoadWorldBuffers(Renderer::Resources *resources)
+	{
+		// Size the buffers for every face, and scratch space for the largest batch.
+		uint32_t vertexCount = 0;
+		uint32_t indexCount = 0;
+		int32_t batchIndexCapacity = 0;
+		int32_t batchFaceCapacity = 0;
+		const BSP::FaceBatch *batch = batches;
+		for (int32_t i = 0; i < batchCount; ++i, ++batch) {
+			int32_t batchIndexCount = 0;
+			const int32_t *faceEntry = &batchFaces[batch->firstFace];
+			for (int32_t j = 0; j < batch->faceCount; ++j, ++faceEntry) {
+				int faceVertexCount = faces[*faceEntry].GetMesh()->GetVertexCount();
+				vertexCount += faceVertexCount;
+				batchIndexCount += GetFanIndexCount(faceVertexCount);
+			}
+			indexCount += batchIndexCount;
+			if (batchIndexCount > batchIndexCapacity) {
+				batchIndexCapacity = batchIndexCount;
+			}
+			if (batch->faceCount > batchFaceCapacity) {
+				batchFaceCapacity = batch->faceCount;
+			}
+		}
+
+		// Scratch holds each triangle's face and output order, the batch's
+		// source indices, and each face's output start and order.
+		int32_t batchTriangleCapacity = batchIndexCapacity / 3;
+		unsigned int scratchSize = ((batchTriangleCapacity * 2) + batchIndexCapacity + (batchFaceCapacity * 2)) * sizeof(int32_t);
+		unsigned int vertexBufferSize = vertexCount * sizeof(BSP::WorldVertex);
+		unsigned int indexBufferSize = indexCount * sizeof(uint32_t);
+		BSP::WorldVertex *vertices = reinterpret_cast<BSP::WorldVertex*>(MemoryManager::Allocate(vertexBufferSize));
+		uint32_t *indices = reinterpret_cast<uint32_t*>(MemoryManager::Allocate(indexBufferSize));
+		int32_t *scratch = reinterpret_cast<int32_t*>(MemoryManager::Allocate(scratchSize));
+		if ((vertices == nullptr) || (indices == nullptr) || (scratch == nullptr)) {
+			ErrorStack::Log("Failed to allocate world geometry of %u vertices and %u indices.", vertexCount, indexCount);
+			FreeWorldScratch(vertices, indices, scratch);
+			return false;
+		}
+		int32_t *triangleFaces = scratch;
+		int32_t *triangleOrder = triangleFaces + batchTriangleCapacity;
+		uint32_t *sourceIndices = reinterpret_cast<uint32_t*>(triangleOrder + batchTriangleCapacity);
+		int32_t *faceStarts = reinterpret_cast<int32_t*>(sourceIndices + batchIndexCapacity);
+		int32_t *orderedFaces = faceStarts + batchFaceCapacity;
+
+		int32_t fanCacheMisses = 0;
+		int32_t optimizedCacheMisses = 0;
+		uint32_t vertexOffset = 0;
+		uint32_t indexOffset = 0;
+		batch = batches;
+		for (int32_t i = 0; i < batchCount; ++i, ++batch) {
+			int32_t *batchFaceEntries = &batchFaces[batch->firstFace];
+			int32_t batchFaceCount = batch->faceCount;
+
+			// Pack the batch's fans as triangle lists with indices local to the batch.
+			const Vector2 *textureSize = batch->texture->GetSize();
+			BSP::WorldVertex *batchVertices = &vertices[vertexOffset];
+			int32_t batchVertexCount = 0;
+			int32_t batchIndexCount = 0;
+			for (int32_t j = 0; j < batchFaceCount; ++j) {
+				const BSP::Face *face = &faces[batchFaceEntries[j]];
+				const BSP::FaceMesh *mesh = face->GetMesh();
+				int faceVertexCount = mesh->GetVertexCount();
+				uint32_t baseVertex = static_cast<uint32_t>(batchVertexCount);
+				if (!PackFaceVertices(mesh, *textureSize, face->GetTexture()->GetFrameOffset(), &batchVertices[batchVertexCount])) {
+					ErrorStack::Log("World face %d is out of range for packed vertices.", batchFaceEntries[j]);
+					FreeWorldScratch(vertices, indices, scratch);
+					return false;
+				}
+				batchVertexCount += faceVertexCount;
+				for (int k = 2; k < faceVertexCount; ++k) {
+					triangleFaces[batchIndexCount / 3] = j;
+					sourceIndices[batchIndexCount++] = baseVertex;
+					sourceIndices[batchIndexCount++] = baseVertex + k - 1;
+					sourceIndices[batchIndexCount++] = baseVertex + k;
+				}
+			}
+			if (batchIndexCount == 0) {
+				for (int32_t j = 0; j < batchFaceCount; ++j) {
+					faces[batchFaceEntries[j]].SetIndexRange(indexOffset, 0);
 				}
+				continue;
 			}
 
-			// Recurse into far child.
-			DrawNode(farChild);
+			// Weld shared vertices and find a cache friendly triangle order.
+			int32_t weldedCount = MeshOptimizer::WeldVertices(
+				batchVertices,
+				batchVertexCount,
+				sizeof(BSP::WorldVertex),
+				sourceIndices,
+				batchIndexCount);
+			if (weldedCount < 0) {
+				FreeWorldScratch(vertices, indices, scratch);
+				return false;
+			}
+			fanCacheMisses += MeshOptimizer::CountCacheMisses(sourceIndices, batchIndexCount, weldedCount);
+			if (!MeshOptimizer::OptimizeVertexCache(sourceIndices, batchIndexCount, weldedCount, triangleOrder)) {
+				FreeWorldScratch(vertices, indices, scratch);
+				return false;
+			}
+
+			// Order faces by where their first triangle lands; faces without triangles go last.
+			int32_t batchTriangleCount = batchIndexCount / 3;
+			int32_t orderedCount = 0;
+			for (int32_t j = 0; j < batchFaceCount; ++j) {
+				faceStarts[j] = -1;
+			}
+			for (int32_t j = 0; j < batchTriangleCount; ++j) {
+				int32_t face = triangleFaces[triangleOrder[j]];
+				if (faceStarts[face] == -1) {
+					faceStarts[face] = 0;
+					orderedFaces[orderedCount++] = face;
+				}
+			}
+			for (int32_t j = 0; j < batchFaceCount; ++j) {
+				if (faceStarts[j] == -1) {
+					orderedFaces[orderedCount++] = j;
+				}
+			}
+			int32_t faceStart = 0;
+			for (int32_t j = 0; j < batchFaceCount; ++j) {
+				int32_t face = orderedFaces[j];
+				faceStarts[face] = faceStart;
+				faceStart += GetFanIndexCount(faces[batchFaceEntries[face]].GetMesh()->GetVertexCount());
+			}
+
+			// Write each face's triangles in optimized order, advancing its start to its end.
+			uint32_t *batchIndices = &indices[indexOffset];
+			for (int32_t j = 0; j < batchTriangleCount; ++j) {
+				int32_t sourceTriangle = triangleOrder[j];
+				const uint32_t *source = &sourceIndices[sourceTriangle * 3];
+				uint32_t *destination = &batchIndices[faceStarts[triangleFaces[sourceTriangle]]];
+				destination[0] = source[0];
+				destination[1] = source[1];
+				destination[2] = source[2];
+				faceStarts[triangleFaces[sourceTriangle]] += 3;
+			}
+			optimizedCacheMisses += MeshOptimizer::CountCacheMisses(batchIndices, batchIndexCount, weldedCount);
+			for (int32_t j = 0; j < batchIndexCount; ++j) {
+				batchIndices[j] += vertexOffset;
+			}
+
+			// Store face ranges and reorder the batch's face table to match.
+			for (int32_t j = 0; j < batchFaceCount; ++j) {
+				int32_t face = orderedFaces[j];
+				BSP::Face *batchFace = &faces[batchFaceEntries[face]];
+				uint32_t faceIndexCount = GetFanIndexCount(batchFace->GetMesh()->GetVertexCount());
+				uint32_t faceEnd = static_cast<uint32_t>(faceStarts[face]);
+				batchFace->SetIndexRange(indexOffset + faceEnd - faceIndexCount, faceIndexCount);
+				orderedFaces[j] = batchFaceEntries[face];
+			}
+			memcpy(batchFaceEntries, orderedFaces, batchFaceCount * sizeof(int32_t));
+
+			vertexOffset += weldedCount;
+			indexOffset += batchIndexCount;
+		}
+
+		// Record statistics; cache miss ratios are per triangle.
+		int32_t triangleCount = static_cast<int32_t>(indexCount / 3);
+		worldStatistics.triangleCount = triangleCount;
+		worldStatistics.faceVertexCount = static_cast<int32_t>(vertexCount);
+		worldStatistics.vertexCount = static_cast<int32_t>(vertexOffset);
+		if (triangleCount != 0) {
+			worldStatistics.fanCacheMissRatio = static_cast<float>(fanCacheMisses) / static_cast<float>(triangleCount);
+			worldStatistics.optimizedCacheMissRatio = static_cast<float>(optimizedCacheMisses) / static_cast<float>(triangleCount);
+		}
+
+		vertexBuffer = resources->CreateBuffer(vertices, vertexOffset * sizeof(BSP::WorldVertex));
+		indexBuffer = resources->CreateIndexBuffer(indices, indexBufferSize, Renderer::UnsignedIntType);
+		FreeWorldScratch(vertices, indices, scratch);
+		if ((vertexBuffer == nullptr) || (indexBuffer == nullptr)) {
+			ErrorStack::Log("Failed to create world vertex and index buffers.");
+			return false;
+		}
+		return true;
+	}
+
+	// Pack a face's vertices into the world vertex format.
+	// Texture coordinates wrap, so each face is shifted by whole texture repeats
+	// to keep its coordinates near zero and within fixed point range.
+	// The position's spare component holds the face's first animation frame.
+	// Returns false rather than clamping if a position or coordinate still doesn't fit.
+	bool Map::PackFaceVertices(
+		const BSP::FaceMesh *mesh,
+		const Vector2 &textureSize,
+		int32_t frameOffset,
+		BSP::WorldVertex *out)
+	{
+		const BSP::FaceVertex *vertices = mesh->GetVertexBuffer();
+		int vertexCount = mesh->GetVertexCount();
+		if (vertexCount == 0) {
+			return true;
+		}
+		Vector2 minimums = vertices[0].uv;
+		for (int i = 1; i < vertexCount; ++i) {
+			minimums.x = (vertices[i].uv.x < minimums.x) ? vertices[i].uv.x : minimums.x;
+			minimums.y = (vertices[i].uv.y < minimums.y) ? vertices[i].uv.y : minimums.y;
+		}
+		Vector2 shift(0.0f, 0.0f);
+		if ((textureSize.x > 0.0f) && (textureSize.y > 0.0f)) {
+			shift.x = floorf(minimums.x / textureSize.x) * textureSize.x;
+			shift.y = floorf(minimums.y / textureSize.y) * textureSize.y;
+		}
+
+		for (int i = 0; i < vertexCount; ++i, ++out) {
+			const BSP::FaceVertex *vertex = &vertices[i];
+			if (!VertexPacking::FitsFixedShort(vertex->position.x, WorldPositionScale) ||
+				!VertexPacking::FitsFixedShort(vertex->position.y, WorldPositionScale) ||
+				!VertexPacking::FitsFixedShort(vertex->position.z, WorldPositionScale) ||
+				!VertexPacking::FitsFixedShort(vertex->uv.x - shift.x, WorldUVScale) ||
+				!VertexPacking::FitsFixedShort(vertex->uv.y - shift.y, WorldUVScale)) {
+				return false;
+			}
+			out->position[0] = VertexPacking::ToFixedShort(vertex->position.x, WorldPositionScale);
+			out->position[1] = VertexPacking::ToFixedShort(vertex->position.y, WorldPositionScale);
+			out->position[2] = VertexPacking::ToFixedShort(vertex->position.z, WorldPositionScale);
+			out->position[3] = static_cast<int16_t>(frameOffset);
+			out->uv[0] = VertexPacking::ToFixedShort(vertex->uv.x - shift.x, WorldUVScale);
+			out->uv[1] = VertexPacking::ToFixedShort(vertex->uv.y - shift.y, WorldUVScale);
+			out->lightMap[0] = VertexPacking::ToUnsignedShortNormalized(vertex->lightMap.x);
+			out->lightMap[1] = VertexPacking::ToUnsignedShortNormalized(vertex->lightMap.y);
+		}
+		return true;
+	}
+
+	// Free temporary world geometry buffers.
+	void Map::FreeWorldScratch(BSP::WorldVertex *vertices, uint32_t *indices, int32_t *scratch)
+	{
+		if (vertices != nullptr) {
+			MemoryManager::Free(vertices);
+		}
+		if (indices != nullptr) {
+			MemoryManager::Free(indices);
+		}
+		if (scratch != nullptr) {
+			MemoryManager::Free(scratch);
+		}
+	}
+
+	// Collect drawn faces into index ranges, merging neighbours in the index buffer.
+	// Translucent faces have no ranges; they're sorted by distance from the view point instead.
+	void Map::BuildDrawRanges(BSP::ViewContext *view) const
+	{
+		uintptr_t *drawRangeOffsets = view->GetDrawRangeOffsets();
+		int32_t *drawRangeCounts = view->GetDrawRangeCounts();
+		int32_t *batchRangeStarts = view->GetBatchRangeStarts();
+		BSP::SortedFace *translucentFaces = view->GetTranslucentFaces();
+		const Vector3 *viewPoint = view->GetViewPoint();
+		int32_t rangeCount = 0;
+		int32_t translucentCount = 0;
+		const BSP::FaceBatch *batch = batches;
+		for (int32_t i = 0; i < batchCount; ++i, ++batch) {
+			batchRangeStarts[i] = rangeCount;
+			uint32_t rangeEnd = 0; // Index after the last range, or zero before the first.
+			const int32_t *faceEntry = &batchFaces[batch->firstFace];
+			for (int32_t j = 0; j < batch->faceCount; ++j, ++faceEntry) {
+				int32_t faceIndex = *faceEntry;
+				if (!view->IsFaceDrawn(faceIndex)) {
+					continue;
+				}
+				const BSP::Face *face = &faces[faceIndex];
+				uint32_t faceIndexCount = face->GetIndexCount();
+				if (faceIndexCount == 0) {
+					continue;
+				}
+				if (batch->pass == TranslucentPass) {
+					Vector3 offset;
+					offset.Difference(*face->GetCentre(), *viewPoint);
+					BSP::SortedFace *sortedFace = &translucentFaces[translucentCount++];
+					sortedFace->depth = offset.DotProduct(offset);
+					sortedFace->faceIndex = faceIndex;
+					continue;
+				}
+
+				// Extend the last range if this face follows it directly.
+				uint32_t firstIndex = face->GetFirstIndex();
+				if ((rangeCount != batchRangeStarts[i]) && (rangeEnd == firstIndex)) {
+					drawRangeCounts[rangeCount - 1] += static_cast<int32_t>(faceIndexCount);
+				}
+				else {
+					drawRangeOffsets[rangeCount] = static_cast<uintptr_t>(firstIndex) * WorldIndexSize;
+					drawRangeCounts[rangeCount] = static_cast<int32_t>(faceIndexCount);
+					++rangeCount;
+				}
+				rangeEnd = firstIndex + faceIndexCount;
+			}
+		}
+		batchRangeStarts[batchCount] = rangeCount;
+		qsort(translucentFaces, translucentCount, sizeof(BSP::SortedFace), &CompareSortedFaces);
+		view->SetTranslucentFaceCount(translucentCount);
+	}
+
+	// Faces are drawn back to front, so state is only set when it changes between neighbours.
+	// Translucent faces are depth tested against the scene but don't write depth.
+	void Map::DrawTranslucentFaces(Renderer::Interface *renderer, const BSP::ViewContext *view) const
+	{
+		Painter *painter = Painter::instance;
+		renderer->SetBlending(true);
+		renderer->SetDepthWrite(false);
+		const BSP::FaceTexture *texture = nullptr;
+		int32_t lightMapPage = -1;
+		float alpha = -1.0f;
+		const BSP::SortedFace *sortedFace = view->GetTranslucentFaces();
+		int32_t translucentCount = view->GetTranslucentFaceCount();
+		for (int32_t i = 0; i < translucentCount; ++i, ++sortedFace) {
+			const BSP::Face *face = &faces[sortedFace->faceIndex];
+			if (face->GetBatchTexture() != texture) {
+				texture = face->GetBatchTexture();
+				painter->SetTexture(renderer, GetDrawTexture(texture), *texture->GetSize(), texture->GetFrameCount());
+			}
+			if (face->GetLightMap()->page != lightMapPage) {
+				lightMapPage = face->GetLightMap()->page;
+				painter->SetLightMap(renderer, lightMapPages[lightMapPage]);
+			}
+			float faceAlpha = GetFaceAlpha(face->GetFlags());
+			if (faceAlpha != alpha) {
+				alpha = faceAlpha;
+				painter->SetAlpha(alpha);
+			}
+			painter->DrawRange(renderer, face->GetFirstIndex(), face->GetIndexCount());
+		}
+		renderer->SetDepthWrite(true);
+		renderer->SetBlending(false);
+	}
+
+	// Undrawn surfaces take priority, since compiler surfaces may carry other flags too.
+	int32_t Map::GetFacePass(int32_t flags)
+	{
+		if ((flags & UndrawnSurfaceFlags) != 0) {
+			return -1;
+		}
+		if ((flags & SkySurface) != 0) {
+			return SkyPass;
+		}
+		if ((flags & (Translucent33Surface | Translucent66Surface)) != 0) {
+			return TranslucentPass;
+		}
+		return OpaquePass;
+	}
+
+	// Get the opacity of a translucent face.
+	float Map::GetFaceAlpha(int32_t flags)
+	{
+		if ((flags & Translucent33Surface) != 0) {
+			return Translucent33Alpha;
+		}
+		if ((flags & Translucent66Surface) != 0) {
+			return Translucent66Alpha;
 		}
+		return 1.0f;
 	}
 
 	// Trace a line through a given BSP node.
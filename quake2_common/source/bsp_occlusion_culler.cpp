@@ -0,0 +1,265 @@
+#include "bsp_map.h"
+#include "bsp_occlusion_culler.h"
+#include "bsp_view_context.h"
+#include <error_stack.h>
+#include <memory_manager.h>
+#include <stdlib.h>
+
+namespace BSP
+{
+
+	// Occluder selection constants.
+	const float OcclusionCuller::MinimumOccluderArea = 64.0f * 64.0f;
+	static const int32_t NonOccluderFlags =
+		SkySurface | WarpSurface | Translucent33Surface | Translucent66Surface | UndrawnSurfaceFlags;
+
+	// Face area entry for sorting occluders.
+	struct OccluderEntry
+	{
+		float area;
+		int32_t faceIndex;
+	};
+
+	// Sort occluders by decreasing area.
+	static int CompareOccluders(const void *a, const void *b)
+	{
+		float areaA = reinterpret_cast<const OccluderEntry*>(a)->area;
+		float areaB = reinterpret_cast<const OccluderEntry*>(b)->area;
+		if (areaA > areaB) {
+			return -1;
+		}
+		return (areaA < areaB) ? 1 : 0;
+	}
+
+	// Get the area of a convex face fan.
+	static float GetFaceArea(const BSP::FaceMesh *mesh)
+	{
+		const BSP::FaceVertex *vertices = mesh->GetVertexBuffer();
+		int vertexCount = mesh->GetVertexCount();
+		Vector3 total(0.0f, 0.0f, 0.0f);
+		for (int i = 2; i < vertexCount; ++i) {
+			Vector3 edge1;
+			Vector3 edge2;
+			Vector3 cross;
+			edge1.Difference(vertices[i - 1].position, vertices[0].position);
+			edge2.Difference(vertices[i].position, vertices[0].position);
+			cross.CrossProduct(edge1, edge2);
+			total.Sum(total, cross);
+		}
+		return total.GetMagnitude() * 0.5f;
+	}
+
+	OcclusionCuller::BandJob::BandJob()
+		: culler(nullptr),
+		rowStart(0),
+		rowEnd(0)
+	{
+	}
+
+	// Rasterize this job's band.
+	void OcclusionCuller::BandJob::Run()
+	{
+		culler->RasterizeBand(rowStart, rowEnd);
+	}
+
+	OcclusionCuller::OcclusionCuller()
+		: map(nullptr),
+		occluderFaces(nullptr),
+		occluderCount(0),
+		clipVertices(nullptr),
+		clipVertexCapacity(0),
+		triangleCount(0),
+		frameOccluderCount(0),
+		bandCount(0)
+	{
+		projectionView.Identity();
+	}
+
+	OcclusionCuller::~OcclusionCuller()
+	{
+		Destroy();
+	}
+
+	// Pick faces large enough to be occluders and size buffers for them.
+	bool OcclusionCuller::Initialize(const BSP::Map *map)
+	{
+		Destroy();
+		this->map = map;
+
+		// Gather candidate faces with their areas.
+		int32_t faceCount = map->GetFaceCount();
+		OccluderEntry *entries = reinterpret_cast<OccluderEntry*>(MemoryManager::Allocate(faceCount * sizeof(OccluderEntry)));
+		if (entries == nullptr) {
+			ErrorStack::Log("Failed to allocate %d occluder candidates.", faceCount);
+			return false;
+		}
+		int32_t candidateCount = 0;
+		int32_t maximumTriangles = 0;
+		const BSP::Face *faces = map->GetFaces();
+		for (int32_t i = 0; i < faceCount; ++i) {
+			const BSP::Face *face = &faces[i];
+			const BSP::FaceMesh *mesh = face->GetMesh();
+			if (((face->GetFlags() & NonOccluderFlags) != 0) || (mesh->GetVertexCount() < 3)) {
+				continue;
+			}
+			float area = GetFaceArea(mesh);
+			if (area < MinimumOccluderArea) {
+				continue;
+			}
+			entries[candidateCount].area = area;
+			entries[candidateCount].faceIndex = i;
+			++candidateCount;
+			int32_t triangles = mesh->GetVertexCount() - 2;
+			if (triangles > maximumTriangles) {
+				maximumTriangles = triangles;
+			}
+		}
+		qsort(entries, candidateCount, sizeof(OccluderEntry), &CompareOccluders);
+
+		// Keep sorted indices only.
+		if (candidateCount != 0) {
+			occluderFaces = reinterpret_cast<int32_t*>(MemoryManager::Allocate(candidateCount * sizeof(int32_t)));
+			if (occluderFaces == nullptr) {
+				ErrorStack::Log("Failed to allocate %d occluder faces.", candidateCount);
+				MemoryManager::Free(entries);
+				return false;
+			}
+			for (int32_t i = 0; i < candidateCount; ++i) {
+				occluderFaces[i] = entries[i].faceIndex;
+			}
+		}
+		occluderCount = candidateCount;
+		MemoryManager::Free(entries);
+
+		// Room for every triangle of the largest occluders in a frame.
+		int32_t capacity = MaximumOccluders * maximumTriangles * 3;
+		if (capacity != 0) {
+			clipVertices = new Vector4[capacity];
+			if (clipVertices == nullptr) {
+				ErrorStack::Log("Failed to allocate %d clip-space occluder vertices.", capacity);
+				return false;
+			}
+		}
+		clipVertexCapacity = capacity;
+
+		if (!depthBuffer.Initialize(BufferWidth, BufferHeight)) {
+			return false;
+		}
+
+		// One band per worker and one for the waiting thread.
+		WorkerPool *pool = WorkerPool::instance;
+		int32_t bandCount = (pool != nullptr) ? (pool->GetWorkerCount() + 1) : 1;
+		if (bandCount > MaximumBands) {
+			bandCount = MaximumBands;
+		}
+		int32_t height = depthBuffer.GetHeight();
+		int32_t rowsPerBand = (height + bandCount - 1) / bandCount;
+		for (int32_t i = 0; i < bandCount; ++i) {
+			BandJob *band = &bands[i];
+			band->culler = this;
+			band->rowStart = i * rowsPerBand;
+			band->rowEnd = (band->rowStart + rowsPerBand < height) ? (band->rowStart + rowsPerBand) : height;
+		}
+		this->bandCount = bandCount;
+		return true;
+	}
+
+	// Free occluder and depth storage.
+	void OcclusionCuller::Destroy()
+	{
+		if (occluderFaces != nullptr) {
+			MemoryManager::Free(occluderFaces);
+			occluderFaces = nullptr;
+		}
+		delete[] clipVertices;
+		clipVertices = nullptr;
+		depthBuffer.Destroy();
+		occluderCount = 0;
+		clipVertexCapacity = 0;
+		triangleCount = 0;
+		frameOccluderCount = 0;
+		bandCount = 0;
+		map = nullptr;
+	}
+
+	// Transform the largest visible occluders and rasterize them across bands.
+	void OcclusionCuller::Render(const BSP::ViewContext *view, const Matrix4x4 &projectionView)
+	{
+		this->projectionView = projectionView;
+
+		// Triangulate fans of occluders in the view's potentially visible set.
+		int32_t occluders = 0;
+		Vector4 *out = clipVertices;
+		const BSP::Face *faces = map->GetFaces();
+		for (int32_t i = 0; (i < occluderCount) && (occluders < MaximumOccluders); ++i) {
+			int32_t faceIndex = occluderFaces[i];
+			if (!view->IsFaceVisible(faceIndex)) {
+				continue;
+			}
+			const BSP::FaceMesh *mesh = faces[faceIndex].GetMesh();
+			const BSP::FaceVertex *vertices = mesh->GetVertexBuffer();
+			int vertexCount = mesh->GetVertexCount();
+			Vector4 first;
+			Vector4 previous;
+			Vector4 point(0.0f, 0.0f, 0.0f, 1.0f);
+			point.FromVector3(&vertices[0].position);
+			projectionView.Transform(&point, &first);
+			point.FromVector3(&vertices[1].position);
+			projectionView.Transform(&point, &previous);
+			for (int j = 2; j < vertexCount; ++j) {
+				Vector4 current;
+				point.FromVector3(&vertices[j].position);
+				projectionView.Transform(&point, &current);
+				out[0] = first;
+				out[1] = previous;
+				out[2] = current;
+				out += 3;
+				previous = current;
+			}
+			++occluders;
+		}
+		frameOccluderCount = occluders;
+		triangleCount = static_cast<int32_t>(out - clipVertices) / 3;
+
+		// Bands touch disjoint rows, so they can rasterize concurrently.
+		WorkerPool *pool = WorkerPool::instance;
+		if ((pool == nullptr) || (bandCount == 1)) {
+			RasterizeBand(0, depthBuffer.GetHeight());
+		}
+		else {
+			for (int32_t i = 0; i < bandCount; ++i) {
+				pool->Submit(&bands[i], &bandCounter);
+			}
+			pool->Wait(&bandCounter);
+		}
+	}
+
+	// Test a world-space box against the last render.
+	bool OcclusionCuller::IsBoxVisible(const Vector3 &corner, const Vector3 &oppositeCorner) const
+	{
+		return depthBuffer.IsBoxVisible(projectionView, corner, oppositeCorner);
+	}
+
+	// Test an object-space box against the last render.
+	bool OcclusionCuller::IsBoxVisible(
+		const Matrix4x4 &objectTransform,
+		const Vector3 &corner,
+		const Vector3 &oppositeCorner) const
+	{
+		Matrix4x4 transform;
+		transform.Product(&projectionView, &objectTransform);
+		return depthBuffer.IsBoxVisible(transform, corner, oppositeCorner);
+	}
+
+	// Clear a band and draw every occluder triangle into it.
+	void OcclusionCuller::RasterizeBand(int32_t rowStart, int32_t rowEnd)
+	{
+		depthBuffer.Clear(rowStart, rowEnd);
+		const Vector4 *triangle = clipVertices;
+		int32_t triangleCount = this->triangleCount;
+		for (int32_t i = 0; i < triangleCount; ++i, triangle += 3) {
+			depthBuffer.DrawTriangle(triangle[0], triangle[1], triangle[2], rowStart, rowEnd);
+		}
+	}
+
+}
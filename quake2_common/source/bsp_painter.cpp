@@ -1,4 +1,5 @@
 #include "bsp_painter.h"
+#include "wal_parser.h"
 #include <error_stack.h>
 
 namespace BSP
@@ -8,9 +9,9 @@ namespace BSP
 	const int FaceAttributeCount = 3;
 	const Renderer::Attribute FaceAttributes[FaceAttributeCount] =
 	{
-		Renderer::Attribute("position", Renderer::PositionType, Renderer::Vector3Type),
-		Renderer::Attribute("uv", Renderer::TextureCoordinateType, Renderer::Vector2Type),
-		Renderer::Attribute("lightMapUV", Renderer::TextureCoordinateType, Renderer::Vector2Type)
+		Renderer::Attribute("position", Renderer::PositionType, Renderer::Short4Type),
+		Renderer::Attribute("uv", Renderer::TextureCoordinateType, Renderer::Short2Type),
+		Renderer::Attribute("lightMapUV", Renderer::TextureCoordinateType, Renderer::UnsignedShort2NormalizedType)
 	};
 	const int QuakeMapBufferCount = 1;
 	const Renderer::BufferLayout QuakeMapBufferLayouts[QuakeMapBufferCount] =
@@ -19,24 +20,40 @@ namespace BSP
 	};
 	const int FaceBufferIndex = 0;
 	const int FaceTextureSlot = 0;
+	const int LightMapTextureSlot = 1;
+	const int PaletteTextureSlot = 2;
+
+	const int SkyTextureSlot = 0;
 
 	// Material parameters.
 	const char *MapVertexShader = "bsp.vert";
 	const char *MapFragmentShader = "bsp.frag";
+	const char *MapIndexedFragmentShader = "bsp_indexed.frag";
+	const char *SkyVertexShader = "sky.vert";
+	const char *SkyFragmentShader = "sky.frag";
 
 	// Material variable names.
 	const char *MapProjectionViewVariable = "projectionView";
 	const char *MapTextureSlotVariable = "texture";
 	const char *MapTextureSizeVariable = "textureSize";
+	const char *MapLightMapSlotVariable = "lightMap";
+	const char *MapAlphaVariable = "alpha";
+	const char *MapFrameCountVariable = "frameCount";
+	const char *MapAnimationFrameVariable = "animationFrame";
+	const char *MapPaletteSlotVariable = "palette";
+	const char *SkyProjectionViewVariable = "projectionView";
+	const char *SkyViewPointVariable = "viewPoint";
+	const char *SkyTextureSlotVariable = "sky";
+	const char *SkyTexelInsetVariable = "texelInset";
 
 	// Singleton instance reference.
 	Painter *Painter::instance = nullptr;
 
 	// Initialize painter singleton instance.
 	// Returns true and fills out singleton pointer on success.
-	bool Painter::Initialize(Renderer::Resources *resources)
+	bool Painter::Initialize(Renderer::Resources *resources, bool isIndexed)
 	{
-		instance = new Painter();
+		instance = new Painter(isIndexed);
 		if (instance == nullptr) {
 			ErrorStack::Log("Failed to allocate BSP painter instance.");
 			return false;
@@ -58,11 +75,19 @@ namespace BSP
 	// Prepare rendering for drawing faces from a given perspective.
 	void Painter::PrepareRenderer(
 		Renderer::Interface *renderer,
-		const Matrix4x4 &projectionView)
+		const Matrix4x4 &projectionView,
+		int32_t animationFrame)
 	{
 		renderer->SetMaterial(material);
 		projectionViewVariable->SetMatrix4x4(&projectionView);
 		textureSlotVariable->SetInteger(FaceTextureSlot);
+		lightMapSlotVariable->SetInteger(LightMapTextureSlot);
+		alphaVariable->SetFloat(1.0f);
+		animationFrameVariable->SetFloat(static_cast<float>(animationFrame));
+		if (isIndexed) {
+			paletteSlotVariable->SetInteger(PaletteTextureSlot);
+			renderer->SetTexture(paletteTexture, PaletteTextureSlot);
+		}
 	}
 
 	// Clear the renderer from drawing faces.
@@ -75,30 +100,128 @@ namespace BSP
 	void Painter::SetTexture(
 		Renderer::Interface *renderer,
 		Renderer::Texture *texture,
-		const Vector2 &textureSize)
+		const Vector2 &textureSize,
+		int32_t frameCount)
 	{
 		renderer->SetTexture(texture, FaceTextureSlot);
 		textureSizeVariable->SetVector2(&textureSize);
+		frameCountVariable->SetFloat(static_cast<float>(frameCount));
+	}
+
+	// Set the light map atlas page to render the faces with.
+	void Painter::SetLightMap(
+		Renderer::Interface *renderer,
+		Renderer::Texture *lightMap)
+	{
+		renderer->SetTexture(lightMap, LightMapTextureSlot);
+	}
+
+	// Set the opacity to draw faces with.
+	void Painter::SetAlpha(float alpha)
+	{
+		alphaVariable->SetFloat(alpha);
+	}
+
+	// Prepare rendering for drawing sky faces.
+	void Painter::PrepareSky(
+		Renderer::Interface *renderer,
+		const Matrix4x4 &projectionView,
+		const Vector3 &viewPoint,
+		Renderer::Texture *skyTexture,
+		float texelInset)
+	{
+		renderer->SetMaterial(skyMaterial);
+		skyProjectionViewVariable->SetMatrix4x4(&projectionView);
+		skyViewPointVariable->SetVector3(&viewPoint);
+		skyTextureSlotVariable->SetInteger(SkyTextureSlot);
+		skyTexelInsetVariable->SetFloat(texelInset);
+		renderer->SetTexture(skyTexture, SkyTextureSlot);
+	}
+
+	// Clear the renderer from drawing sky faces.
+	void Painter::ClearSky(Renderer::Interface *renderer)
+	{
+		renderer->UnsetMaterial(skyMaterial);
+	}
+
+	// Bind the world buffers through the sky layout.
+	void Painter::BindSky(
+		Renderer::Interface *renderer,
+		Renderer::Buffer *vertexBuffer,
+		Renderer::IndexBuffer *indexBuffer)
+	{
+		skyLayout->BindBuffer(FaceBufferIndex, vertexBuffer);
+		renderer->SetMaterialLayout(skyLayout);
+		renderer->SetIndexBuffer(indexBuffer);
 	}
 
-	// Draw a face from a vertex buffer.
-	void Painter::DrawFace(
+	// Unbind the world buffers from the sky layout.
+	void Painter::UnbindSky(
 		Renderer::Interface *renderer,
-		Renderer::Buffer *buffer,
-		unsigned int vertexCount)
+		Renderer::IndexBuffer *indexBuffer)
 	{
-		layout->BindBuffer(FaceBufferIndex, buffer);
+		renderer->UnsetIndexBuffer(indexBuffer);
+		renderer->UnsetMaterialLayout(skyLayout);
+	}
+
+	// Bind the world buffers so face ranges can be drawn without rebinding.
+	void Painter::BindWorld(
+		Renderer::Interface *renderer,
+		Renderer::Buffer *vertexBuffer,
+		Renderer::IndexBuffer *indexBuffer)
+	{
+		layout->BindBuffer(FaceBufferIndex, vertexBuffer);
 		renderer->SetMaterialLayout(layout);
-		renderer->Draw(Renderer::TriangleFan, vertexCount);
+		renderer->SetIndexBuffer(indexBuffer);
+	}
+
+	// Unbind the world buffers.
+	void Painter::UnbindWorld(
+		Renderer::Interface *renderer,
+		Renderer::IndexBuffer *indexBuffer)
+	{
+		renderer->UnsetIndexBuffer(indexBuffer);
 		renderer->UnsetMaterialLayout(layout);
 	}
 
-	Painter::Painter()
+	// Draw a range of triangles from the bound world index buffer.
+	void Painter::DrawRange(
+		Renderer::Interface *renderer,
+		unsigned int firstIndex,
+		unsigned int indexCount)
+	{
+		renderer->DrawIndexedRange(Renderer::Triangles, firstIndex, indexCount);
+	}
+
+	// Draw several ranges of triangles from the bound world index buffer at once.
+	void Painter::DrawRanges(
+		Renderer::Interface *renderer,
+		const uintptr_t *indexOffsets,
+		const int32_t *indexCounts,
+		int32_t rangeCount)
+	{
+		renderer->DrawIndexedRanges(Renderer::Triangles, indexOffsets, indexCounts, rangeCount);
+	}
+
+	Painter::Painter(bool isIndexed)
 		: material(nullptr),
 		layout(nullptr),
 		projectionViewVariable(nullptr),
 		textureSlotVariable(nullptr),
-		textureSizeVariable(nullptr)
+		textureSizeVariable(nullptr),
+		lightMapSlotVariable(nullptr),
+		alphaVariable(nullptr),
+		frameCountVariable(nullptr),
+		animationFrameVariable(nullptr),
+		isIndexed(isIndexed),
+		paletteTexture(nullptr),
+		paletteSlotVariable(nullptr),
+		skyMaterial(nullptr),
+		skyLayout(nullptr),
+		skyProjectionViewVariable(nullptr),
+		skyViewPointVariable(nullptr),
+		skyTextureSlotVariable(nullptr),
+		skyTexelInsetVariable(nullptr)
 	{
 	}
 
@@ -109,12 +232,24 @@ namespace BSP
         delete projectionViewVariable;
         delete textureSlotVariable;
         delete textureSizeVariable;
+        delete lightMapSlotVariable;
+        delete alphaVariable;
+        delete frameCountVariable;
+        delete animationFrameVariable;
+        delete paletteTexture;
+        delete paletteSlotVariable;
+        delete skyMaterial;
+        delete skyLayout;
+        delete skyProjectionViewVariable;
+        delete skyViewPointVariable;
+        delete skyTextureSlotVariable;
+        delete skyTexelInsetVariable;
 	}
 
 	// Load painter resources.
 	bool Painter::LoadResources(Renderer::Resources *resources)
 	{
-		material = resources->CreateMaterial(MapVertexShader, MapFragmentShader);
+		material = resources->CreateMaterial(MapVertexShader, isIndexed ? MapIndexedFragmentShader : MapFragmentShader);
 		if (material == nullptr) {
 			return false;
 		}
@@ -134,6 +269,60 @@ namespace BSP
 		if (textureSizeVariable == nullptr) {
 			return false;
 		}
+		lightMapSlotVariable = material->GetVariable(MapLightMapSlotVariable);
+		if (lightMapSlotVariable == nullptr) {
+			return false;
+		}
+		alphaVariable = material->GetVariable(MapAlphaVariable);
+		if (alphaVariable == nullptr) {
+			return false;
+		}
+		frameCountVariable = material->GetVariable(MapFrameCountVariable);
+		if (frameCountVariable == nullptr) {
+			return false;
+		}
+		animationFrameVariable = material->GetVariable(MapAnimationFrameVariable);
+		if (animationFrameVariable == nullptr) {
+			return false;
+		}
+
+		// Indexed textures share one palette.
+		if (isIndexed) {
+			paletteSlotVariable = material->GetVariable(MapPaletteSlotVariable);
+			if (paletteSlotVariable == nullptr) {
+				return false;
+			}
+			paletteTexture = resources->CreatePaletteTexture(WAL::Parser::GetPalette(), WAL::Parser::GetPaletteSize());
+			if (paletteTexture == nullptr) {
+				return false;
+			}
+		}
+
+		// The sky shares the world buffer layout but only reads positions.
+		skyMaterial = resources->CreateMaterial(SkyVertexShader, SkyFragmentShader);
+		if (skyMaterial == nullptr) {
+			return false;
+		}
+		skyLayout = skyMaterial->GetLayout(QuakeMapBufferLayouts, QuakeMapBufferCount);
+		if (skyLayout == nullptr) {
+			return false;
+		}
+		skyProjectionViewVariable = skyMaterial->GetVariable(SkyProjectionViewVariable);
+		if (skyProjectionViewVariable == nullptr) {
+			return false;
+		}
+		skyViewPointVariable = skyMaterial->GetVariable(SkyViewPointVariable);
+		if (skyViewPointVariable == nullptr) {
+			return false;
+		}
+		skyTextureSlotVariable = skyMaterial->GetVariable(SkyTextureSlotVariable);
+		if (skyTextureSlotVariable == nullptr) {
+			return false;
+		}
+		skyTexelInsetVariable = skyMaterial->GetVariable(SkyTexelInsetVariable);
+		if (skyTexelInsetVariable == nullptr) {
+			return false;
+		}
 		return true;
 	}
 
@@ -1,6 +1,9 @@
 #include "bsp_parser.h"
 #include "quake_file_manager.h"
 #include <error_stack.h>
+#include <math.h>
+#include <memory_manager.h>
+#include <string.h>
 
 namespace BSP
 {
@@ -8,12 +11,263 @@ namespace BSP
 	namespace FileFormat
 	{
 
-		Parser::Parser() : out(nullptr)
+		// Tolerance for treating corners of a merged face as straight.
+		static const float ContinuousEpsilon = 0.005f;
+
+		// Check whether two faces lie on the same surface and can be drawn as one.
+		// Matching light styles keeps their lightmaps combinable.
+		static bool IsSameSurface(const FileFormat::Face *a, const FileFormat::Face *b)
+		{
+			return (a->planeIndex == b->planeIndex) &&
+				((a->side != 0) == (b->side != 0)) &&
+				(a->textureIndex == b->textureIndex) &&
+				(memcmp(a->lightStyles, b->lightStyles, sizeof(a->lightStyles)) == 0);
+		}
+
+		// Join two vertex loops across the edges they share in opposite directions.
+		// Returns the merged loop size, or 0 if they share no edge or the result isn't convex.
+		static int32_t MergeLoops(
+			const int32_t *loop,
+			int32_t loopCount,
+			const int32_t *other,
+			int32_t otherCount,
+			const Vector3 *vertices,
+			const Vector3 &normal,
+			int32_t *out)
+		{
+			// Find a shared edge.
+			int32_t start = -1;
+			int32_t otherEnd = -1;
+			for (int32_t i = 0; (i < loopCount) && (start == -1); ++i) {
+				int32_t startVertex = loop[i];
+				int32_t endVertex = loop[(i + 1) % loopCount];
+				for (int32_t j = 0; j < otherCount; ++j) {
+					if ((other[j] == endVertex) && (other[(j + 1) % otherCount] == startVertex)) {
+						start = i;
+						otherEnd = (j + 1) % otherCount;
+						break;
+					}
+				}
+			}
+			if (start == -1) {
+				return 0;
+			}
+
+			// Extend it to the whole run of shared edges, which split faces have
+			// where a neighbour's vertex sits in the middle of the edge.
+			int32_t end = (start + 1) % loopCount;
+			int32_t otherStart = (otherEnd + otherCount - 1) % otherCount;
+			int32_t sharedCount = 1;
+			int32_t maximumShared = ((loopCount < otherCount) ? loopCount : otherCount) - 1;
+			while ((sharedCount < maximumShared) &&
+				(loop[(start + loopCount - 1) % loopCount] == other[(otherEnd + 1) % otherCount])) {
+				start = (start + loopCount - 1) % loopCount;
+				otherEnd = (otherEnd + 1) % otherCount;
+				++sharedCount;
+			}
+			while ((sharedCount < maximumShared) &&
+				(loop[(end + 1) % loopCount] == other[(otherStart + otherCount - 1) % otherCount])) {
+				end = (end + 1) % loopCount;
+				otherStart = (otherStart + otherCount - 1) % otherCount;
+				++sharedCount;
+			}
+			int32_t mergedCount = loopCount + otherCount - (sharedCount * 2);
+			if ((mergedCount < 3) || (mergedCount > MaximumMergedEdges)) {
+				return 0;
+			}
+
+			// Replace the shared run with the other loop's path around it.
+			int32_t *outVertex = out;
+			for (int32_t i = end; i != start; i = (i + 1) % loopCount) {
+				*outVertex++ = loop[i];
+			}
+			*outVertex++ = loop[start];
+			for (int32_t i = (otherEnd + 1) % otherCount; i != otherStart; i = (i + 1) % otherCount) {
+				*outVertex++ = other[i];
+			}
+
+			// Every corner must turn the same way; straight corners are kept so
+			// neighbouring faces still meet the merged face at shared vertices.
+			bool hasLeftTurn = false;
+			bool hasRightTurn = false;
+			for (int32_t i = 0; i < mergedCount; ++i) {
+				const Vector3 &previous = vertices[out[(i + mergedCount - 1) % mergedCount]];
+				const Vector3 &current = vertices[out[i]];
+				const Vector3 &next = vertices[out[(i + 1) % mergedCount]];
+				Vector3 edge;
+				Vector3 incoming;
+				Vector3 outgoing;
+				edge.Difference(current, previous);
+				float length = edge.GetMagnitude();
+				if (length == 0.0f) {
+					return 0;
+				}
+				incoming.ScalarMultiple(edge, 1.0f / length);
+				edge.Difference(next, current);
+				length = edge.GetMagnitude();
+				if (length == 0.0f) {
+					return 0;
+				}
+				outgoing.ScalarMultiple(edge, 1.0f / length);
+
+				Vector3 cross;
+				cross.CrossProduct(incoming, outgoing);
+				float turn = cross.DotProduct(normal);
+				if (turn > ContinuousEpsilon) {
+					hasLeftTurn = true;
+				}
+				else if (turn < -ContinuousEpsilon) {
+					hasRightTurn = true;
+				}
+				else if (incoming.DotProduct(outgoing) < 0.0f) {
+					// Doubles back on itself.
+					return 0;
+				}
+			}
+			if (hasLeftTurn && hasRightTurn) {
+				return 0;
+			}
+			return mergedCount;
+		}
+
+		// Check that a loop fits the merged face size limit in texture space.
+		static bool IsWithinMergedExtent(
+			const int32_t *loop,
+			int32_t loopCount,
+			const Vector3 *vertices,
+			const FileFormat::Texture *texture)
+		{
+			float minimumS = 0.0f;
+			float maximumS = 0.0f;
+			float minimumT = 0.0f;
+			float maximumT = 0.0f;
+			for (int32_t i = 0; i < loopCount; ++i) {
+				const Vector3 &vertex = vertices[loop[i]];
+				float s = vertex.DotProduct(texture->scaleS);
+				float t = vertex.DotProduct(texture->scaleT);
+				if ((i == 0) || (s < minimumS)) {
+					minimumS = s;
+				}
+				if ((i == 0) || (s > maximumS)) {
+					maximumS = s;
+				}
+				if ((i == 0) || (t < minimumT)) {
+					minimumT = t;
+				}
+				if ((i == 0) || (t > maximumT)) {
+					maximumT = t;
+				}
+			}
+			return ((maximumS - minimumS) <= MaximumMergedExtent) &&
+				((maximumT - minimumT) <= MaximumMergedExtent);
+		}
+
+		// Fill light map luxels no file face covered from the nearest covered luxel,
+		// along the row if it has any and from the nearest such row otherwise.
+		// Only luxels outside the face are filled; they're reached by filtering at its edges.
+		static void FillLightMapGaps(uint8_t *samples, const uint8_t *covered, int32_t width, int32_t height, int32_t styleCount)
+		{
+			const int32_t styleSize = width * height * 3;
+			int32_t nearestRow = -1;
+			for (int32_t y = 0; y < height; ++y) {
+				const uint8_t *rowCovered = &covered[y * width];
+				for (int32_t x = 0; x < width; ++x) {
+					if (rowCovered[x] != 0) {
+						continue;
+					}
+					int32_t source = -1;
+					for (int32_t distance = 1; (source == -1) && (distance < width); ++distance) {
+						if ((x >= distance) && (rowCovered[x - distance] != 0)) {
+							source = x - distance;
+						}
+						else if ((x + distance < width) && (rowCovered[x + distance] != 0)) {
+							source = x + distance;
+						}
+					}
+					if (source == -1) {
+						break;
+					}
+					for (int32_t i = 0; i < styleCount; ++i) {
+						memcpy(&samples[(i * styleSize) + (((y * width) + x) * 3)], &samples[(i * styleSize) + (((y * width) + source) * 3)], 3);
+					}
+				}
+			}
+
+			// Whole rows without samples copy the nearest row that had them.
+			for (int32_t y = 0; y < height; ++y) {
+				bool isRowCovered = false;
+				const uint8_t *rowCovered = &covered[y * width];
+				for (int32_t x = 0; (x < width) && !isRowCovered; ++x) {
+					isRowCovered = (rowCovered[x] != 0);
+				}
+				if (isRowCovered) {
+					nearestRow = y;
+					continue;
+				}
+				int32_t source = nearestRow;
+				for (int32_t next = y + 1; next < height; ++next) {
+					const uint8_t *nextCovered = &covered[next * width];
+					bool isNextCovered = false;
+					for (int32_t x = 0; (x < width) && !isNextCovered; ++x) {
+						isNextCovered = (nextCovered[x] != 0);
+					}
+					if (isNextCovered) {
+						if ((source == -1) || ((next - y) < (y - source))) {
+							source = next;
+						}
+						break;
+					}
+				}
+				if (source == -1) {
+					continue;
+				}
+				for (int32_t i = 0; i < styleCount; ++i) {
+					memcpy(&samples[(i * styleSize) + (y * width * 3)], &samples[(i * styleSize) + (source * width * 3)], width * 3);
+				}
+			}
+		}
+
+		// Remove repeated entries from a leaf's face list, keeping first occurrences.
+		// Returns the new entry count.
+		static int32_t CompactLeafFaces(uint16_t *entries, int32_t entryCount)
+		{
+			int32_t uniqueCount = 0;
+			for (int32_t i = 0; i < entryCount; ++i) {
+				uint16_t entry = entries[i];
+				bool isRepeated = false;
+				for (int32_t j = 0; j < uniqueCount; ++j) {
+					isRepeated = isRepeated || (entries[j] == entry);
+				}
+				if (!isRepeated) {
+					entries[uniqueCount++] = entry;
+				}
+			}
+			return uniqueCount;
+		}
+
+		Parser::Parser()
+			: out(nullptr),
+			mergeFaces(false),
+			mergeTables(nullptr),
+			faceRemap(nullptr),
+			loopStarts(nullptr),
+			loopCounts(nullptr),
+			loopVertices(nullptr),
+			mergedFaceSources(nullptr),
+			mergedSourceStarts(nullptr),
+			loadedFaceCount(0)
 		{
 		}
 
 		Parser::~Parser()
 		{
+			FreeMergeTables();
+		}
+
+		// Set whether faces are merged on load.
+		void Parser::SetMergeFaces(bool mergeFaces)
+		{
+			this->mergeFaces = mergeFaces;
 		}
 
 		// Load the map and fill out the output map.
@@ -39,6 +293,14 @@ namespace BSP
 			if (!PrepareLumps()) {
 				return false;
 			}
+			LoadSkyName();
+
+			// Merged faces replace file faces everywhere faces are referenced.
+			FreeMergeTables();
+			loadedFaceCount = faceCount;
+			if (mergeFaces && !BuildMergedFaces()) {
+				return false;
+			}
 
 			// Load all map segments.
 			// Faces and nodes need planes loaded.
@@ -53,6 +315,10 @@ namespace BSP
 			if (!LoadFaces()) {
 				return false;
 			}
+			// Light maps are sized by the faces.
+			if (!LoadLightMaps()) {
+				return false;
+			}
 			if (!LoadNodes()) {
 				return false;
 			}
@@ -80,8 +346,20 @@ namespace BSP
 				return false;
 			}
 
+			FreeMergeTables();
+
 			// Build leaf/node parent graph.
 			out->BuildParentGraph();
+
+			// Expand audibility sets for sound queries.
+			if (!out->BuildAudibilitySets()) {
+				return false;
+			}
+
+			// Group leaves by cluster for visibility updates.
+			if (!out->BuildClusterLeaves()) {
+				return false;
+			}
 			return true;
 		}
 
@@ -98,6 +376,12 @@ namespace BSP
 				const void **lumpReference; // The pointer to fill out with the lump location.
 				int32_t *lumpElementCount; // The integer, if any, to fill out with lump element size.
 				switch (i) {
+				case EntitiesLump:
+					// Entities are text, so only the length is needed.
+					elementSize = sizeof(char);
+					lumpReference = reinterpret_cast<const void**>(&entities);
+					lumpElementCount = &entitiesLength;
+					break;
 				case PlanesLump:
 					elementSize = sizeof(FileFormat::Plane);
 					lumpReference = reinterpret_cast<const void**>(&planes);
@@ -114,6 +398,12 @@ namespace BSP
 					lumpReference = reinterpret_cast<const void**>(&visibilityStart);
 					lumpElementCount = &visibilityLength;
 					break;
+				case LightMapsLump:
+					// Light maps are addressed by byte offset.
+					elementSize = sizeof(uint8_t);
+					lumpReference = reinterpret_cast<const void**>(&lightMapData);
+					lumpElementCount = &lightMapDataLength;
+					break;
 				case NodesLump:
 					elementSize = sizeof(FileFormat::Node);
 					lumpReference = reinterpret_cast<const void**>(&nodes);
@@ -182,6 +472,336 @@ namespace BSP
 			return true;
 		}
 
+		// The world entity comes first; its keys and values alternate as quoted strings
+		// until its closing brace.
+		void Parser::LoadSkyName()
+		{
+			out->SetSkyName(DefaultSkyName);
+			const char *text = entities;
+			const char *end = entities + entitiesLength;
+			bool isKey = true;
+			bool isSkyKey = false;
+			while ((text < end) && (*text != '}')) {
+				if (*text != '"') {
+					++text;
+					continue;
+				}
+				const char *start = ++text;
+				while ((text < end) && (*text != '"')) {
+					++text;
+				}
+				if (text == end) {
+					return;
+				}
+				int32_t length = static_cast<int32_t>(text - start);
+				++text;
+				if (isKey) {
+					isSkyKey = (length == 3) && (strncmp(start, "sky", 3) == 0);
+				}
+				else if (isSkyKey) {
+					char skyName[BSP::Map::SkyNameLength];
+					if (length >= BSP::Map::SkyNameLength) {
+						length = BSP::Map::SkyNameLength - 1;
+					}
+					memcpy(skyName, start, length);
+					skyName[length] = '\0';
+					out->SetSkyName(skyName);
+					return;
+				}
+				isKey = !isKey;
+			}
+		}
+
+		// Greedily grow each face by its coplanar neighbours in the same node.
+		// A merged face takes the place of its lowest numbered file face, so each
+		// node's faces stay contiguous after renumbering.
+		bool Parser::BuildMergedFaces()
+		{
+			int32_t faceCount = this->faceCount;
+			int32_t loopVertexCount = 0;
+			for (int32_t i = 0; i < faceCount; ++i) {
+				loopVertexCount += faces[i].edgeCount;
+			}
+			int32_t tableSize = (faceCount * 5) + 1 + loopVertexCount;
+			mergeTables = reinterpret_cast<int32_t*>(MemoryManager::Allocate(tableSize * sizeof(int32_t)));
+			if (mergeTables == nullptr) {
+				ErrorStack::Log("Failed to allocate face merging tables for %d faces.", faceCount);
+				return false;
+			}
+			faceRemap = mergeTables;
+			loopStarts = faceRemap + faceCount;
+			loopCounts = loopStarts + faceCount;
+			mergedFaceSources = loopCounts + faceCount;
+			mergedSourceStarts = mergedFaceSources + faceCount;
+			loopVertices = mergedSourceStarts + faceCount + 1;
+
+			// Leading face for each file face; -1 until grouped.
+			int32_t *leaders = faceRemap;
+			for (int32_t i = 0; i < faceCount; ++i) {
+				leaders[i] = -1;
+			}
+
+			// Room for every face of the largest node to grow while merging.
+			int32_t largestNode = 0;
+			const FileFormat::Node *node = nodes;
+			for (int32_t i = 0; i < nodeCount; ++i, ++node) {
+				if ((node->firstFace + node->faceCount) > faceCount) {
+					ErrorStack::Log("Bad map format: node %d references faces past the end.", i);
+					return false;
+				}
+				if (node->faceCount > largestNode) {
+					largestNode = node->faceCount;
+				}
+			}
+			int32_t *nodeLoops = nullptr;
+			int32_t *nodeLoopCounts = nullptr;
+			if (largestNode != 0) {
+				nodeLoops = reinterpret_cast<int32_t*>(MemoryManager::Allocate(largestNode * (MaximumMergedEdges + 1) * sizeof(int32_t)));
+				if (nodeLoops == nullptr) {
+					ErrorStack::Log("Failed to allocate face merging loops for %d faces.", largestNode);
+					return false;
+				}
+				nodeLoopCounts = nodeLoops + (largestNode * MaximumMergedEdges);
+			}
+
+			// Faces only merge within a node, since those all share its plane.
+			int32_t loopEnd = 0;
+			int32_t merged[MaximumMergedEdges];
+			node = nodes;
+			for (int32_t i = 0; i < nodeCount; ++i, ++node) {
+				int32_t first = node->firstFace;
+				int32_t end = first + node->faceCount;
+
+				// Each face starts as its own group. A loop count of 0 marks a face too
+				// large to merge, and -1 one already taken by another node.
+				for (int32_t j = first; j < end; ++j) {
+					int32_t *loopCount = &nodeLoopCounts[j - first];
+					if (leaders[j] != -1) {
+						*loopCount = -1;
+						continue;
+					}
+					leaders[j] = j;
+					const FileFormat::Face *face = &faces[j];
+					*loopCount = (face->edgeCount <= MaximumMergedEdges) ? face->edgeCount : 0;
+					int32_t *loop = &nodeLoops[(j - first) * MaximumMergedEdges];
+					for (int32_t k = 0; k < *loopCount; ++k) {
+						loop[k] = GetEdgeVertex(face->firstEdge + k);
+					}
+				}
+
+				// Join pairs of groups until a full pass finds nothing more to merge.
+				bool isMerging = true;
+				while (isMerging) {
+					isMerging = false;
+					for (int32_t j = first; j < end; ++j) {
+						int32_t *loopCount = &nodeLoopCounts[j - first];
+						if ((leaders[j] != j) || (*loopCount <= 0)) {
+							continue;
+						}
+						int32_t *loop = &nodeLoops[(j - first) * MaximumMergedEdges];
+						const FileFormat::Face *face = &faces[j];
+						Vector3 normal = planes[face->planeIndex].normal;
+						if (face->side != 0) {
+							normal.Negation(normal);
+						}
+						const FileFormat::Texture *texture = &textures[face->textureIndex];
+						for (int32_t k = j + 1; k < end; ++k) {
+							int32_t otherCount = nodeLoopCounts[k - first];
+							if ((leaders[k] != k) || (otherCount <= 0) || !IsSameSurface(face, &faces[k])) {
+								continue;
+							}
+							const int32_t *other = &nodeLoops[(k - first) * MaximumMergedEdges];
+							int32_t mergedCount = MergeLoops(loop, *loopCount, other, otherCount, vertices, normal, merged);
+							if ((mergedCount == 0) || !IsWithinMergedExtent(merged, mergedCount, vertices, texture)) {
+								continue;
+							}
+							memcpy(loop, merged, mergedCount * sizeof(int32_t));
+							*loopCount = mergedCount;
+
+							// The other group's faces all come after its leader.
+							for (int32_t l = k; l < end; ++l) {
+								if (leaders[l] == k) {
+									leaders[l] = j;
+								}
+							}
+							isMerging = true;
+						}
+					}
+				}
+
+				// Keep the loops of the node's remaining groups.
+				for (int32_t j = first; j < end; ++j) {
+					int32_t loopCount = nodeLoopCounts[j - first];
+					if ((leaders[j] != j) || (loopCount < 0)) {
+						continue;
+					}
+					const FileFormat::Face *face = &faces[j];
+					if (loopCount != 0) {
+						memcpy(&loopVertices[loopEnd], &nodeLoops[(j - first) * MaximumMergedEdges], loopCount * sizeof(int32_t));
+					}
+					else {
+						loopCount = face->edgeCount;
+						for (int32_t k = 0; k < loopCount; ++k) {
+							loopVertices[loopEnd + k] = GetEdgeVertex(face->firstEdge + k);
+						}
+					}
+					loopStarts[j] = loopEnd;
+					loopCounts[j] = loopCount;
+					loopEnd += loopCount;
+				}
+			}
+			if (nodeLoops != nullptr) {
+				MemoryManager::Free(nodeLoops);
+			}
+
+			// Faces outside every node are kept as they are.
+			for (int32_t i = 0; i < faceCount; ++i) {
+				if (leaders[i] != -1) {
+					continue;
+				}
+				leaders[i] = i;
+				const FileFormat::Face *face = &faces[i];
+				int32_t loopCount = face->edgeCount;
+				for (int32_t k = 0; k < loopCount; ++k) {
+					loopVertices[loopEnd + k] = GetEdgeVertex(face->firstEdge + k);
+				}
+				loopStarts[i] = loopEnd;
+				loopCounts[i] = loopCount;
+				loopEnd += loopCount;
+			}
+
+			// Number leaders in file order; followers always come after their leader.
+			int32_t loadedFaceCount = 0;
+			for (int32_t i = 0; i < faceCount; ++i) {
+				int32_t leader = leaders[i];
+				faceRemap[i] = (leader == i) ? loadedFaceCount++ : faceRemap[leader];
+			}
+			this->loadedFaceCount = loadedFaceCount;
+
+			// Group file faces by loaded face.
+			for (int32_t i = 0; i <= loadedFaceCount; ++i) {
+				mergedSourceStarts[i] = 0;
+			}
+			for (int32_t i = 0; i < faceCount; ++i) {
+				++mergedSourceStarts[faceRemap[i] + 1];
+			}
+			for (int32_t i = 0; i < loadedFaceCount; ++i) {
+				mergedSourceStarts[i + 1] += mergedSourceStarts[i];
+			}
+			for (int32_t i = faceCount - 1; i >= 0; --i) {
+				int32_t loadedFace = faceRemap[i];
+				int32_t sourceIndex = mergedSourceStarts[loadedFace + 1] - 1;
+				mergedFaceSources[sourceIndex] = i;
+				mergedSourceStarts[loadedFace + 1] = sourceIndex;
+			}
+			for (int32_t i = 0; i < loadedFaceCount; ++i) {
+				mergedSourceStarts[i] = mergedSourceStarts[i + 1];
+			}
+			mergedSourceStarts[loadedFaceCount] = faceCount;
+			return true;
+		}
+
+		// Free face merging tables.
+		void Parser::FreeMergeTables()
+		{
+			if (mergeTables != nullptr) {
+				MemoryManager::Free(mergeTables);
+				mergeTables = nullptr;
+				faceRemap = nullptr;
+				loopStarts = nullptr;
+				loopCounts = nullptr;
+				loopVertices = nullptr;
+				mergedFaceSources = nullptr;
+				mergedSourceStarts = nullptr;
+			}
+		}
+
+		// Bounds are snapped out to whole luxels from the face's texture space extents,
+		// computed the same way as the light tool so sample counts match the file.
+		void Parser::GetLuxelBounds(
+			const FileFormat::Face *face,
+			int32_t *left,
+			int32_t *top,
+			int32_t *right,
+			int32_t *bottom) const
+		{
+			const FileFormat::Texture *texture = &textures[face->textureIndex];
+			float minimumS = 0.0f;
+			float maximumS = 0.0f;
+			float minimumT = 0.0f;
+			float maximumT = 0.0f;
+			for (int32_t i = 0; i < face->edgeCount; ++i) {
+				const Vector3 &vertex = vertices[GetEdgeVertex(face->firstEdge + i)];
+				float s = vertex.DotProduct(texture->scaleS) + texture->offsetS;
+				float t = vertex.DotProduct(texture->scaleT) + texture->offsetT;
+				if ((i == 0) || (s < minimumS)) {
+					minimumS = s;
+				}
+				if ((i == 0) || (s > maximumS)) {
+					maximumS = s;
+				}
+				if ((i == 0) || (t < minimumT)) {
+					minimumT = t;
+				}
+				if ((i == 0) || (t > maximumT)) {
+					maximumT = t;
+				}
+			}
+			const float luxelSize = static_cast<float>(LightMapLuxelSize);
+			*left = static_cast<int32_t>(floorf(minimumS / luxelSize));
+			*top = static_cast<int32_t>(floorf(minimumT / luxelSize));
+			*right = static_cast<int32_t>(ceilf(maximumS / luxelSize));
+			*bottom = static_cast<int32_t>(ceilf(maximumT / luxelSize));
+		}
+
+		// Find the range of sources of a loaded face.
+		void Parser::GetFaceSources(int32_t loadedFace, int32_t *sourceStart, int32_t *sourceEnd) const
+		{
+			if (mergeFaces) {
+				*sourceStart = mergedSourceStarts[loadedFace];
+				*sourceEnd = mergedSourceStarts[loadedFace + 1];
+			}
+			else {
+				*sourceStart = loadedFace;
+				*sourceEnd = loadedFace + 1;
+			}
+		}
+
+		// Merged file faces share texture info, so their luxel grids line up and the bounds are a union.
+		void Parser::GetLoadedLuxelBounds(
+			int32_t loadedFace,
+			int32_t *left,
+			int32_t *top,
+			int32_t *right,
+			int32_t *bottom) const
+		{
+			int32_t sourceStart;
+			int32_t sourceEnd;
+			GetFaceSources(loadedFace, &sourceStart, &sourceEnd);
+			GetLuxelBounds(&faces[GetSourceFace(sourceStart)], left, top, right, bottom);
+			for (int32_t i = sourceStart + 1; i < sourceEnd; ++i) {
+				int32_t sourceLeft;
+				int32_t sourceTop;
+				int32_t sourceRight;
+				int32_t sourceBottom;
+				GetLuxelBounds(&faces[GetSourceFace(i)], &sourceLeft, &sourceTop, &sourceRight, &sourceBottom);
+				*left = (sourceLeft < *left) ? sourceLeft : *left;
+				*top = (sourceTop < *top) ? sourceTop : *top;
+				*right = (sourceRight > *right) ? sourceRight : *right;
+				*bottom = (sourceBottom > *bottom) ? sourceBottom : *bottom;
+			}
+		}
+
+		// Negative edge indices walk the edge backwards, starting from its end.
+		int32_t Parser::GetEdgeVertex(int32_t surfaceEdgeIndex) const
+		{
+			int32_t edgeIndex = surfaceEdges[surfaceEdgeIndex].edgeIndex;
+			if (edgeIndex < 0) {
+				return edges[-edgeIndex].endIndex;
+			}
+			return edges[edgeIndex].startIndex;
+		}
+
 		// Parse and copy the separating planes into the map.
 		bool Parser::LoadPlanes()
 		{
@@ -210,10 +830,17 @@ namespace BSP
 			if (!out->InitializeTextures(textureCount)) {
 				return false;
 			}
-			BSP::FaceTexture *outputTexture = out->GetTextures();
+			BSP::FaceTexture *outputTextures = out->GetTextures();
+			BSP::FaceTexture *outputTexture = outputTextures;
 			const FileFormat::Texture *inputTexture = textures;
 			for (int32_t i = 0; i < textureCount; ++i, ++inputTexture, ++outputTexture) {
 				outputTexture->SetName(inputTexture->name);
+
+				// Animation chains are resolved when batches are built.
+				int32_t nextTextureIndex = inputTexture->nextTextureIndex;
+				if ((nextTextureIndex >= 0) && (nextTextureIndex < textureCount)) {
+					outputTexture->SetNextTexture(&outputTextures[nextTextureIndex]);
+				}
 			}
 			return true;
 		}
@@ -222,18 +849,27 @@ namespace BSP
 		// Returns true on success, false otherwise.
 		bool Parser::LoadFaces()
 		{
-			int32_t faceCount = this->faceCount;
-			if (!out->InitializeFaces(faceCount)) {
+			int32_t loadedFaceCount = this->loadedFaceCount;
+			if (!out->InitializeFaces(loadedFaceCount)) {
 				return false;
 			}
 
 			// Get the surface edges table, edges array, and vertices.
 			BSP::Face *outputFace = out->GetFaces();
-			const FileFormat::Face *inputFace = faces;
 			const FileFormat::Texture *fileTextures = textures;
 			const BSP::FaceTexture *mapTextures = out->GetTextures();
-			for (int32_t i = 0; i < faceCount; ++i, ++inputFace, ++outputFace) {
-				int16_t edgeCount = inputFace->edgeCount;
+			const Geometry::Plane *mapPlanes = out->GetPlanes();
+			for (int32_t i = 0; i < loadedFaceCount; ++i, ++outputFace) {
+				// Merged faces take their surface from the leading file face.
+				const FileFormat::Face *inputFace = &faces[i];
+				const int32_t *loop = nullptr;
+				int32_t edgeCount = inputFace->edgeCount;
+				if (mergeFaces) {
+					int32_t leader = mergedFaceSources[mergedSourceStarts[i]];
+					inputFace = &faces[leader];
+					loop = &loopVertices[loopStarts[leader]];
+					edgeCount = loopCounts[leader];
+				}
 				if (!outputFace->Initialize(edgeCount)) {
 					return false;
 				}
@@ -244,22 +880,33 @@ namespace BSP
 				int16_t textureIndex = inputFace->textureIndex;
 				const FileFormat::Texture *currentTexture = &fileTextures[textureIndex];
 
-				// Build polygon from face edges.
-				const FileFormat::SurfaceEdge *currentEdgeEntry = &surfaceEdges[inputFace->firstEdge];
-				for (int16_t j = 0; j < edgeCount; ++j, ++currentEdgeEntry, ++outputVertex) {
-					int32_t edgeIndex = currentEdgeEntry->edgeIndex;
-
-					// If negative index, it's counter-clockwise order, so get end vertex.
-					const FileFormat::Edge *currentEdge;
-					const Vector3 *currentVertex;
-					if (edgeIndex < 0) {
-						currentEdge = &edges[-edgeIndex];
-						currentVertex = &vertices[currentEdge->endIndex];
-					}
-					else {
-						currentEdge = &edges[edgeIndex];
-						currentVertex = &vertices[currentEdge->startIndex];
+				// Size the light map; samples are copied once every face is sized.
+				// Faces without light maps have no styles.
+				int32_t luxelLeft;
+				int32_t luxelTop;
+				int32_t luxelRight;
+				int32_t luxelBottom;
+				GetLoadedLuxelBounds(i, &luxelLeft, &luxelTop, &luxelRight, &luxelBottom);
+				BSP::FaceLightMap *lightMap = outputFace->GetLightMap();
+				lightMap->sampleOffset = -1;
+				lightMap->width = luxelRight - luxelLeft + 1;
+				lightMap->height = luxelBottom - luxelTop + 1;
+				lightMap->styleCount = 0;
+				for (uint32_t j = 0; j < LightMapStyleCount; ++j) {
+					uint8_t style = static_cast<uint8_t>(inputFace->lightStyles[j]);
+					lightMap->styles[j] = style;
+					if ((style != BSP::NoLightStyle) && (lightMap->styleCount == static_cast<int32_t>(j))) {
+						++lightMap->styleCount;
 					}
+				}
+				if (inputFace->lightStylesOffset < 0) {
+					lightMap->styleCount = 0;
+				}
+
+				// Build polygon from face edges or the merged loop.
+				for (int32_t j = 0; j < edgeCount; ++j, ++outputVertex) {
+					int32_t vertexIndex = (loop != nullptr) ? loop[j] : GetEdgeVertex(inputFace->firstEdge + j);
+					const Vector3 *currentVertex = &vertices[vertexIndex];
 					outputVertex->position.FromQuakeCoordinates(
 						currentVertex->x,
 						currentVertex->y,
@@ -269,15 +916,118 @@ namespace BSP
 					outputVertex->uv.x = (currentVertex->DotProduct(currentTexture->scaleS) + currentTexture->offsetS);
 					outputVertex->uv.y = currentVertex->DotProduct(currentTexture->scaleT) + currentTexture->offsetT;
 					
-					// TODO: These are dummy values.
-					outputVertex->lightMap.x = 0.f;
-					outputVertex->lightMap.y = 0.f;
+					// Light map coordinates are in luxels from the light map's corner, at sample centres.
+					const float luxelSize = static_cast<float>(LightMapLuxelSize);
+					outputVertex->lightMap.x = (outputVertex->uv.x / luxelSize) - static_cast<float>(luxelLeft) + 0.5f;
+					outputVertex->lightMap.y = (outputVertex->uv.y / luxelSize) - static_cast<float>(luxelTop) + 0.5f;
 				}
 				
 				// Assign the texture from the texture table.
 				const BSP::FaceTexture *faceTexture = &mapTextures[textureIndex];
 				outputFace->SetTexture(faceTexture);
+				outputFace->SetFlags(currentTexture->flags);
+				outputFace->SetPlane(&mapPlanes[inputFace->planeIndex], inputFace->side != 0);
 			}
+
+			// Lay out face planes for backface tests.
+			return out->BuildFacePlanes();
+		}
+
+		// Copy each lit face's samples into the map, placing the light maps of merged
+		// file faces at their offsets within the merged face's light map.
+		bool Parser::LoadLightMaps()
+		{
+			// Lay out the samples of every lit face.
+			BSP::Face *mapFaces = out->GetFaces();
+			int32_t loadedFaceCount = this->loadedFaceCount;
+			int32_t sampleSize = 0;
+			int32_t largestLuxelCount = 0;
+			for (int32_t i = 0; i < loadedFaceCount; ++i) {
+				BSP::FaceLightMap *lightMap = mapFaces[i].GetLightMap();
+				if (lightMap->styleCount == 0) {
+					continue;
+				}
+				int32_t luxelCount = lightMap->width * lightMap->height;
+				lightMap->sampleOffset = sampleSize;
+				sampleSize += luxelCount * 3 * lightMap->styleCount;
+				if (luxelCount > largestLuxelCount) {
+					largestLuxelCount = luxelCount;
+				}
+			}
+			if (!out->InitializeLightMapSamples(sampleSize)) {
+				return false;
+			}
+			if (sampleSize == 0) {
+				return true;
+			}
+
+			// Track which luxels file faces cover to fill the rest of merged light maps.
+			uint8_t *covered = reinterpret_cast<uint8_t*>(MemoryManager::Allocate(largestLuxelCount));
+			if (covered == nullptr) {
+				ErrorStack::Log("Failed to allocate light map coverage for %d luxels.", largestLuxelCount);
+				return false;
+			}
+			uint8_t *samples = out->GetLightMapSamples();
+			for (int32_t i = 0; i < loadedFaceCount; ++i) {
+				const BSP::FaceLightMap *lightMap = mapFaces[i].GetLightMap();
+				if (lightMap->styleCount == 0) {
+					continue;
+				}
+				int32_t width = lightMap->width;
+				int32_t height = lightMap->height;
+				int32_t styleSize = width * height * 3;
+				uint8_t *faceSamples = &samples[lightMap->sampleOffset];
+				memset(faceSamples, 0, styleSize * lightMap->styleCount);
+				memset(covered, 0, width * height);
+
+				int32_t left;
+				int32_t top;
+				int32_t right;
+				int32_t bottom;
+				GetLoadedLuxelBounds(i, &left, &top, &right, &bottom);
+				int32_t sourceStart;
+				int32_t sourceEnd;
+				GetFaceSources(i, &sourceStart, &sourceEnd);
+				for (int32_t j = sourceStart; j < sourceEnd; ++j) {
+					const FileFormat::Face *source = &faces[GetSourceFace(j)];
+					if (source->lightStylesOffset < 0) {
+						continue;
+					}
+					int32_t sourceLeft;
+					int32_t sourceTop;
+					int32_t sourceRight;
+					int32_t sourceBottom;
+					GetLuxelBounds(source, &sourceLeft, &sourceTop, &sourceRight, &sourceBottom);
+					int32_t sourceWidth = sourceRight - sourceLeft + 1;
+					int32_t sourceHeight = sourceBottom - sourceTop + 1;
+					int32_t sourceStyleSize = sourceWidth * sourceHeight * 3;
+					if (source->lightStylesOffset + (sourceStyleSize * lightMap->styleCount) > lightMapDataLength) {
+						ErrorStack::Log("Bad map format: light map of face %d runs past the end.", GetSourceFace(j));
+						MemoryManager::Free(covered);
+						return false;
+					}
+
+					// Copy rows of each style into place.
+					int32_t offsetX = sourceLeft - left;
+					int32_t offsetY = sourceTop - top;
+					const uint8_t *sourceSamples = lightMapData + source->lightStylesOffset;
+					for (int32_t k = 0; k < lightMap->styleCount; ++k) {
+						for (int32_t y = 0; y < sourceHeight; ++y) {
+							memcpy(
+								&faceSamples[(k * styleSize) + ((((offsetY + y) * width) + offsetX) * 3)],
+								&sourceSamples[(k * sourceStyleSize) + (y * sourceWidth * 3)],
+								sourceWidth * 3);
+						}
+					}
+					for (int32_t y = 0; y < sourceHeight; ++y) {
+						memset(&covered[((offsetY + y) * width) + offsetX], 1, sourceWidth);
+					}
+				}
+				if ((sourceEnd - sourceStart) > 1) {
+					FillLightMapGaps(faceSamples, covered, width, height, lightMap->styleCount);
+				}
+			}
+			MemoryManager::Free(covered);
 			return true;
 		}
 
@@ -292,10 +1042,26 @@ namespace BSP
 
 			// Convert raw node to map node.
 			const Geometry::Plane *planes = out->GetPlanes();
-			const BSP::Face *faces = out->GetFaces();
 			const FileFormat::Node *inputNode = nodes;
 			BSP::Node *outNode = out->GetNodes();
 			for (int32_t i = 0; i < nodeCount; ++i, ++inputNode, ++outNode) {
+				// Renumber the node's faces if they were merged.
+				// Merging stays within the node, so its loaded faces are still contiguous.
+				uint16_t firstFace = inputNode->firstFace;
+				uint16_t faceCount = inputNode->faceCount;
+				if (mergeFaces && (faceCount != 0)) {
+					int32_t loadedFirst = faceRemap[firstFace];
+					int32_t loadedLast = loadedFirst;
+					for (int32_t j = 1; j < faceCount; ++j) {
+						int32_t loadedFace = faceRemap[firstFace + j];
+						if (loadedFace > loadedLast) {
+							loadedLast = loadedFace;
+						}
+					}
+					firstFace = static_cast<uint16_t>(loadedFirst);
+					faceCount = static_cast<uint16_t>(loadedLast - loadedFirst + 1);
+				}
+
 				// Cast bounds to float vector.
 				Vector3 minimums;
 				Vector3 maximums;
@@ -314,8 +1080,8 @@ namespace BSP
 					inputNode->backChild,
 					minimums,
 					maximums,
-					&faces[inputNode->firstFace],
-					inputNode->faceCount);
+					firstFace,
+					faceCount);
 			}
 			return true;
 		}
@@ -403,13 +1169,16 @@ namespace BSP
 				return false;
 			}
 
-			BSP::Face *mapFaces = out->GetFaces();
-			BSP::Face **outEntry = out->GetLeafFaces();
+			// Keep face indices so visibility can be tracked per face number.
+			// A leaf with any part of a merged face sees all of it.
+			uint16_t *outEntry = out->GetLeafFaces();
 			const int16_t *inputIndex = leafFaces;
 			for (int32_t i = 0; i < leafFaceCount; ++i, ++inputIndex, ++outEntry) {
-				// Map the index to the face address.
-				int16_t currentIndex = *inputIndex;
-				*outEntry = &mapFaces[currentIndex];
+				uint16_t faceIndex = static_cast<uint16_t>(*inputIndex);
+				if (mergeFaces) {
+					faceIndex = static_cast<uint16_t>(faceRemap[faceIndex]);
+				}
+				*outEntry = faceIndex;
 			}
 			return true;
 		}
@@ -441,7 +1210,7 @@ namespace BSP
 				return false;
 			}
 
-			BSP::Face **mapLeafFaces = out->GetLeafFaces();
+			uint16_t *mapLeafFaces = out->GetLeafFaces();
 			BSP::Brush **mapLeafBrushes = out->GetLeafBrushes();
 			BSP::Leaf *outputLeaf = out->GetLeaves();
 			const FileFormat::Leaf *inputLeaf = leaves;
@@ -458,6 +1227,12 @@ namespace BSP
 					static_cast<float>(inputLeaf->maximums.y),
 					static_cast<float>(inputLeaf->maximums.z));
 
+				// Drop the repeats left by merging faces the leaf listed separately.
+				uint16_t faceCount = inputLeaf->faceCount;
+				if (mergeFaces) {
+					faceCount = static_cast<uint16_t>(CompactLeafFaces(&mapLeafFaces[inputLeaf->firstFace], faceCount));
+				}
+
 				// Resolve pointers.
 				outputLeaf->SetParameters(
 					inputLeaf->contents,
@@ -466,7 +1241,7 @@ namespace BSP
 					minimums,
 					maximums,
 					&mapLeafFaces[inputLeaf->firstFace],
-					inputLeaf->faceCount,
+					faceCount,
 					&mapLeafBrushes[inputLeaf->firstBrush],
 					inputLeaf->brushCount);
 			}
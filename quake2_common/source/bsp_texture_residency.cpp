@@ -0,0 +1,361 @@
+#include "bsp_map.h"
+#include "bsp_texture_residency.h"
+#include <error_stack.h>
+#include <memory_manager.h>
+#include <string.h>
+
+namespace BSP
+{
+
+	// Cluster value before the first update, so any view cluster is treated as a change.
+	static const int32_t NoWantedCluster = -2;
+
+	// Write the slots of textures on faces in a cluster's leaves, each once, returning how many there are.
+	// Stamps hold the last cluster each slot was written for; slots are only counted if out is null.
+	static int32_t GatherClusterSlots(
+		BSP::Map *map,
+		const int32_t *textureSlots,
+		int32_t clusterIndex,
+		int32_t *stamps,
+		int32_t *out)
+	{
+		const int32_t *clusterLeafStarts = map->GetClusterLeafStarts();
+		const int32_t *clusterLeaves = map->GetClusterLeaves();
+		const BSP::Leaf *leaves = map->GetLeaves();
+		const BSP::Face *faces = map->GetFaces();
+		const BSP::FaceTexture *mapTextures = map->GetTextures();
+		int32_t slotCount = 0;
+		for (int32_t i = clusterLeafStarts[clusterIndex]; i < clusterLeafStarts[clusterIndex + 1]; ++i) {
+			const BSP::Leaf *leaf = &leaves[clusterLeaves[i]];
+			const uint16_t *leafFaces = leaf->GetFirstFace();
+			for (uint16_t j = 0; j < leaf->GetFaceCount(); ++j) {
+				const BSP::FaceTexture *texture = faces[leafFaces[j]].GetBatchTexture();
+				if (texture == nullptr) {
+					continue;
+				}
+				int32_t slot = textureSlots[texture - mapTextures];
+				if ((slot < 0) || (stamps[slot] == clusterIndex)) {
+					continue;
+				}
+				stamps[slot] = clusterIndex;
+				if (out != nullptr) {
+					out[slotCount] = slot;
+				}
+				++slotCount;
+			}
+		}
+		return slotCount;
+	}
+
+	TextureResidency::TextureResidency()
+		: map(nullptr),
+		loader(nullptr),
+		textures(nullptr),
+		textureCount(0),
+		textureSlots(nullptr),
+		clusterSlotStarts(nullptr),
+		clusterSlots(nullptr),
+		clusterCount(0),
+		lastWantedFrames(nullptr),
+		visibleClusters(nullptr),
+		wantedCluster(NoWantedCluster),
+		frame(0)
+	{
+		memset(&statistics, 0, sizeof(statistics));
+	}
+
+	TextureResidency::~TextureResidency()
+	{
+		Destroy();
+	}
+
+	// Give each batched face texture a slot, then list the slots seen in each cluster.
+	// Sky faces show the sky box, which stays resident.
+	bool TextureResidency::Initialize(BSP::Map *map)
+	{
+		Destroy();
+		this->map = map;
+
+		// Slots follow batch order, so each texture appears once.
+		int32_t mapTextureCount = map->GetTextureCount();
+		textureSlots = reinterpret_cast<int32_t*>(MemoryManager::Allocate(mapTextureCount * sizeof(int32_t)));
+		textures = reinterpret_cast<BSP::FaceTexture**>(MemoryManager::Allocate(mapTextureCount * sizeof(BSP::FaceTexture*)));
+		if ((textureSlots == nullptr) || (textures == nullptr)) {
+			ErrorStack::Log("Failed to allocate residency slots for %d textures.", mapTextureCount);
+			return false;
+		}
+		memset(textureSlots, 0xFF, mapTextureCount * sizeof(int32_t));
+		BSP::FaceTexture *mapTextures = map->GetTextures();
+		const BSP::FaceBatch *batch = map->GetBatches();
+		for (int32_t i = 0; i < map->GetBatchCount(); ++i, ++batch) {
+			int32_t textureIndex = static_cast<int32_t>(batch->texture - mapTextures);
+			if ((batch->pass == SkyPass) || (textureSlots[textureIndex] >= 0)) {
+				continue;
+			}
+			textureSlots[textureIndex] = textureCount;
+			textures[textureCount++] = &mapTextures[textureIndex];
+		}
+
+		// Count each cluster's slots, then fill them in.
+		clusterCount = map->GetClusterCount();
+		clusterSlotStarts = reinterpret_cast<int32_t*>(MemoryManager::Allocate((clusterCount + 1) * sizeof(int32_t)));
+		int32_t *stamps = reinterpret_cast<int32_t*>(MemoryManager::Allocate(textureCount * sizeof(int32_t)));
+		if ((clusterSlotStarts == nullptr) || (stamps == nullptr)) {
+			ErrorStack::Log("Failed to allocate texture table for %d clusters.", clusterCount);
+			if (stamps != nullptr) {
+				MemoryManager::Free(stamps);
+			}
+			return false;
+		}
+		memset(stamps, 0xFF, textureCount * sizeof(int32_t));
+		int32_t totalSlots = 0;
+		for (int32_t i = 0; i < clusterCount; ++i) {
+			clusterSlotStarts[i] = totalSlots;
+			totalSlots += GatherClusterSlots(map, textureSlots, i, stamps, nullptr);
+		}
+		clusterSlotStarts[clusterCount] = totalSlots;
+		clusterSlots = reinterpret_cast<int32_t*>(MemoryManager::Allocate(totalSlots * sizeof(int32_t)));
+		if (clusterSlots == nullptr) {
+			ErrorStack::Log("Failed to allocate %d cluster texture entries.", totalSlots);
+			MemoryManager::Free(stamps);
+			return false;
+		}
+		memset(stamps, 0xFF, textureCount * sizeof(int32_t));
+		for (int32_t i = 0; i < clusterCount; ++i) {
+			GatherClusterSlots(map, textureSlots, i, stamps, &clusterSlots[clusterSlotStarts[i]]);
+		}
+		MemoryManager::Free(stamps);
+
+		// Streaming state; textures loaded with the map count as wanted on the first frame.
+		int32_t wordCount = ClusterBitVector::GetWordCount(clusterCount);
+		lastWantedFrames = reinterpret_cast<int32_t*>(MemoryManager::Allocate(textureCount * sizeof(int32_t)));
+		visibleClusters = reinterpret_cast<uint32_t*>(MemoryManager::Allocate(wordCount * sizeof(uint32_t)));
+		if ((lastWantedFrames == nullptr) || (visibleClusters == nullptr)) {
+			ErrorStack::Log("Failed to allocate streaming state for %d textures.", textureCount);
+			return false;
+		}
+		memset(lastWantedFrames, 0, textureCount * sizeof(int32_t));
+		if (!wantedSlots.Initialize(textureCount) || !loadingSlots.Initialize(textureCount)) {
+			return false;
+		}
+		loader = new TextureLoader();
+		if ((loader == nullptr) || !loader->Initialize(StreamJobCount)) {
+			ErrorStack::Log("Failed to create texture streaming loader.");
+			return false;
+		}
+		wantedCluster = NoWantedCluster;
+		frame = 0;
+		UpdateStatistics();
+		return true;
+	}
+
+	// Wait for any decodes in flight before freeing the tables.
+	void TextureResidency::Destroy()
+	{
+		delete loader;
+		loader = nullptr;
+		if (textures != nullptr) {
+			MemoryManager::Free(textures);
+			textures = nullptr;
+		}
+		if (textureSlots != nullptr) {
+			MemoryManager::Free(textureSlots);
+			textureSlots = nullptr;
+		}
+		if (clusterSlotStarts != nullptr) {
+			MemoryManager::Free(clusterSlotStarts);
+			clusterSlotStarts = nullptr;
+		}
+		if (clusterSlots != nullptr) {
+			MemoryManager::Free(clusterSlots);
+			clusterSlots = nullptr;
+		}
+		if (lastWantedFrames != nullptr) {
+			MemoryManager::Free(lastWantedFrames);
+			lastWantedFrames = nullptr;
+		}
+		if (visibleClusters != nullptr) {
+			MemoryManager::Free(visibleClusters);
+			visibleClusters = nullptr;
+		}
+		wantedSlots.Destroy();
+		loadingSlots.Destroy();
+		textureCount = 0;
+		clusterCount = 0;
+		map = nullptr;
+		memset(&statistics, 0, sizeof(statistics));
+	}
+
+	// Textures stay wanted while the view cluster can see them; the eviction delay keeps
+	// those from recently visited clusters around.
+	bool TextureResidency::Update(Renderer::Resources *resources, int32_t viewCluster)
+	{
+		++frame;
+		if (viewCluster != wantedCluster) {
+			SetWantedCluster(viewCluster);
+			wantedCluster = viewCluster;
+		}
+		const uint32_t *wantedWords = wantedSlots.GetWords();
+		int32_t wordCount = wantedSlots.GetWordCount();
+		for (int32_t i = 0; i < wordCount; ++i) {
+			uint32_t word = wantedWords[i];
+			while (word != 0) {
+				lastWantedFrames[(i << BitSet::WordIndexShift) + BitSet::FindFirstSet(word)] = frame;
+				word &= (word - 1);
+			}
+		}
+
+		if (!CreateCompleted(resources) || !QueueMissing()) {
+			return false;
+		}
+		UpdateStatistics();
+		if ((statistics.budgetBytes != 0) && (statistics.residentBytes > statistics.budgetBytes)) {
+			Evict();
+		}
+		return true;
+	}
+
+	// The visibility set includes neighbouring clusters, so their textures are loaded before the view reaches them.
+	void TextureResidency::SetWantedCluster(int32_t clusterIndex)
+	{
+		wantedSlots.Clear();
+		if ((clusterIndex < 0) || (clusterIndex >= clusterCount)) {
+			for (int32_t i = 0; i < textureCount; ++i) {
+				wantedSlots.Set(i);
+			}
+			return;
+		}
+
+		// Padding past the last cluster stays clear.
+		memset(visibleClusters, 0, ClusterBitVector::GetWordCount(clusterCount) * sizeof(uint32_t));
+		const BSP::ClusterBitVector *visibilitySet = map->GetClusters()[clusterIndex].GetVisibilitySet();
+		visibilitySet->Decompress(clusterCount, reinterpret_cast<uint8_t*>(visibleClusters));
+		for (int32_t i = 0; i < clusterCount; ++i) {
+			if (!ClusterBitVector::IsClusterSet(visibleClusters, i)) {
+				continue;
+			}
+			for (int32_t j = clusterSlotStarts[i]; j < clusterSlotStarts[i + 1]; ++j) {
+				wantedSlots.Set(clusterSlots[j]);
+			}
+		}
+	}
+
+	// Textures are created even if they're no longer wanted; eviction takes care of them.
+	bool TextureResidency::CreateCompleted(Renderer::Resources *resources)
+	{
+		TextureLoadJob *job;
+		while ((job = loader->TakeCompleted()) != nullptr) {
+			BSP::FaceTexture *texture = reinterpret_cast<BSP::FaceTexture*>(job->GetOwner());
+			loadingSlots.Unset(textureSlots[texture - map->GetTextures()]);
+			if (!job->IsDecoded() || !texture->CreateResources(resources, job)) {
+				ErrorStack::Log("Failed to stream in texture %s.", texture->GetName());
+				return false;
+			}
+			++statistics.loadCount;
+		}
+		return true;
+	}
+
+	// Jobs are filled a batch at a time, so their staging memory is reused.
+	bool TextureResidency::QueueMissing()
+	{
+		if (!loader->IsIdle()) {
+			return true;
+		}
+		loader->Reset();
+		int32_t queuedCount = 0;
+
+		// Faces in the view cluster come first, then the rest of what it can see.
+		if ((wantedCluster >= 0) && (wantedCluster < clusterCount)) {
+			int32_t end = clusterSlotStarts[wantedCluster + 1];
+			for (int32_t i = clusterSlotStarts[wantedCluster]; (i < end) && (queuedCount < StreamJobCount); ++i) {
+				if (!QueueSlot(clusterSlots[i], &queuedCount)) {
+					return false;
+				}
+			}
+		}
+		const uint32_t *wantedWords = wantedSlots.GetWords();
+		int32_t wordCount = wantedSlots.GetWordCount();
+		for (int32_t i = 0; (i < wordCount) && (queuedCount < StreamJobCount); ++i) {
+			uint32_t word = wantedWords[i];
+			while ((word != 0) && (queuedCount < StreamJobCount)) {
+				int32_t slot = (i << BitSet::WordIndexShift) + BitSet::FindFirstSet(word);
+				word &= (word - 1);
+				if (!QueueSlot(slot, &queuedCount)) {
+					return false;
+				}
+			}
+		}
+		loader->Start();
+		return true;
+	}
+
+	// Another user may have loaded the same frames, in which case the cache shares them.
+	bool TextureResidency::QueueSlot(int32_t slot, int32_t *queuedCount)
+	{
+		BSP::FaceTexture *texture = textures[slot];
+		if (texture->IsResident() || loadingSlots.IsSet(slot) || texture->AcquireResources()) {
+			return true;
+		}
+		TextureLoadJob *job = loader->AddJob();
+		if ((job == nullptr) || !texture->QueueResources(job)) {
+			return false;
+		}
+		job->SetStorage(map->GetTextureStorage());
+		job->SetOwner(texture);
+		loadingSlots.Set(slot);
+		++*queuedCount;
+		return true;
+	}
+
+	// Only textures the view hasn't wanted for a while are candidates, oldest first.
+	// Wanted textures are never released, so usage may stay over budget while they're in view.
+	void TextureResidency::Evict()
+	{
+		int64_t lowWater = (statistics.budgetBytes * LowWaterNumerator) / LowWaterDenominator;
+		while (statistics.residentBytes > lowWater) {
+			int32_t oldestSlot = -1;
+			for (int32_t i = 0; i < textureCount; ++i) {
+				if (!textures[i]->IsResident() || wantedSlots.IsSet(i) || ((frame - lastWantedFrames[i]) <= EvictionDelayFrames)) {
+					continue;
+				}
+				if ((oldestSlot < 0) || (lastWantedFrames[i] < lastWantedFrames[oldestSlot])) {
+					oldestSlot = i;
+				}
+			}
+			if (oldestSlot < 0) {
+				break;
+			}
+			BSP::FaceTexture *texture = textures[oldestSlot];
+			statistics.residentBytes -= texture->GetMemorySize();
+			--statistics.residentCount;
+			++statistics.evictionCount;
+			texture->ReleaseResources();
+		}
+	}
+
+	// Counts are rebuilt each update, so textures shared or released elsewhere are picked up.
+	void TextureResidency::UpdateStatistics()
+	{
+		statistics.textureCount = textureCount;
+		statistics.residentCount = 0;
+		statistics.residentBytes = 0;
+		statistics.budgetBytes = map->GetTextureBudget();
+		statistics.wantedCount = 0;
+		statistics.missingCount = 0;
+		for (int32_t i = 0; i < textureCount; ++i) {
+			bool isResident = textures[i]->IsResident();
+			if (isResident) {
+				++statistics.residentCount;
+				statistics.residentBytes += textures[i]->GetMemorySize();
+			}
+			if (wantedSlots.IsSet(i)) {
+				++statistics.wantedCount;
+				if (!isResident) {
+					++statistics.missingCount;
+				}
+			}
+		}
+	}
+
+}
@@ -0,0 +1,169 @@
+#include "bsp_map.h"
+#include "bsp_view_context.h"
+#include <error_stack.h>
+#include <memory_manager.h>
+#include <string.h>
+
+namespace BSP
+{
+
+	ViewContext::ViewContext()
+		: visibleCluster(0),
+		incrementalUpdates(true),
+		changedLeafCount(0),
+		nodeCounts(nullptr),
+		nodeCount(0),
+		faceCounts(nullptr),
+		faceCount(0),
+		drawFaces(nullptr),
+		drawFaceCount(0),
+		drawRangeOffsets(nullptr),
+		drawRangeCounts(nullptr),
+		batchRangeStarts(nullptr),
+		batchCount(0),
+		translucentFaces(nullptr),
+		translucentFaceCount(0)
+	{
+		viewPoint.Clear();
+	}
+
+	ViewContext::~ViewContext()
+	{
+		Destroy();
+	}
+
+	// Allocate visibility storage for every node, face and cluster in the map.
+	bool ViewContext::Initialize(const BSP::Map *map)
+	{
+		Destroy();
+
+		int32_t nodeCount = map->GetNodeCount();
+		nodeCounts = reinterpret_cast<uint8_t*>(MemoryManager::Allocate(nodeCount * sizeof(uint8_t)));
+		if (nodeCounts == nullptr) {
+			ErrorStack::Log("Failed to allocate %d node visibility counts for view.", nodeCount);
+			return false;
+		}
+		this->nodeCount = nodeCount;
+
+		int32_t faceCount = map->GetFaceCount();
+		faceCounts = reinterpret_cast<uint16_t*>(MemoryManager::Allocate(faceCount * sizeof(uint16_t)));
+		if (faceCounts == nullptr) {
+			ErrorStack::Log("Failed to allocate %d face visibility counts for view.", faceCount);
+			return false;
+		}
+		this->faceCount = faceCount;
+		if (!visibleFaces.Initialize(faceCount) || !drawableFaces.Initialize(faceCount)) {
+			ErrorStack::Log("Failed to allocate visible face sets for view.");
+			return false;
+		}
+		drawFaces = reinterpret_cast<int32_t*>(MemoryManager::Allocate(faceCount * sizeof(int32_t)));
+		if (drawFaces == nullptr) {
+			ErrorStack::Log("Failed to allocate draw list of %d faces for view.", faceCount);
+			return false;
+		}
+		if (!drawnFaces.Initialize(faceCount)) {
+			ErrorStack::Log("Failed to allocate drawn face set for view.");
+			return false;
+		}
+
+		// Batches come from the map's renderer resources, so those must be loaded first.
+		drawRangeOffsets = reinterpret_cast<uintptr_t*>(MemoryManager::Allocate(faceCount * sizeof(uintptr_t)));
+		drawRangeCounts = reinterpret_cast<int32_t*>(MemoryManager::Allocate(faceCount * sizeof(int32_t)));
+		if ((drawRangeOffsets == nullptr) || (drawRangeCounts == nullptr)) {
+			ErrorStack::Log("Failed to allocate %d draw ranges for view.", faceCount);
+			return false;
+		}
+		int32_t batchCount = map->GetBatchCount();
+		batchRangeStarts = reinterpret_cast<int32_t*>(MemoryManager::Allocate((batchCount + 1) * sizeof(int32_t)));
+		if (batchRangeStarts == nullptr) {
+			ErrorStack::Log("Failed to allocate range table for %d batches.", batchCount);
+			return false;
+		}
+		memset(batchRangeStarts, 0, (batchCount + 1) * sizeof(int32_t));
+		this->batchCount = batchCount;
+		int32_t mapTranslucentCount = map->GetTranslucentFaceCount();
+		translucentFaces = reinterpret_cast<BSP::SortedFace*>(MemoryManager::Allocate((mapTranslucentCount + 1) * sizeof(BSP::SortedFace)));
+		if (translucentFaces == nullptr) {
+			ErrorStack::Log("Failed to allocate %d sorted translucent faces for view.", mapTranslucentCount);
+			return false;
+		}
+		translucentFaceCount = 0;
+
+		// Incoming sets are decompressed in place, so they double as decompression buffers.
+		int32_t clusterCount = map->GetClusterCount();
+		if (!visibleClusters.Initialize(clusterCount) ||
+			!nextClusters.Initialize(clusterCount) ||
+			!changedClusters.Initialize(clusterCount)) {
+			ErrorStack::Log("Failed to allocate visible cluster sets for view.");
+			return false;
+		}
+		ResetVisibility();
+
+		// Start visible cluster to sentinel index past array end.
+		visibleCluster = clusterCount;
+		return true;
+	}
+
+	// Free visibility storage.
+	void ViewContext::Destroy()
+	{
+		if (nodeCounts != nullptr) {
+			MemoryManager::Free(nodeCounts);
+			nodeCounts = nullptr;
+		}
+		if (faceCounts != nullptr) {
+			MemoryManager::Free(faceCounts);
+			faceCounts = nullptr;
+		}
+		if (drawFaces != nullptr) {
+			MemoryManager::Free(drawFaces);
+			drawFaces = nullptr;
+		}
+		if (drawRangeOffsets != nullptr) {
+			MemoryManager::Free(drawRangeOffsets);
+			drawRangeOffsets = nullptr;
+		}
+		if (drawRangeCounts != nullptr) {
+			MemoryManager::Free(drawRangeCounts);
+			drawRangeCounts = nullptr;
+		}
+		if (batchRangeStarts != nullptr) {
+			MemoryManager::Free(batchRangeStarts);
+			batchRangeStarts = nullptr;
+		}
+		if (translucentFaces != nullptr) {
+			MemoryManager::Free(translucentFaces);
+			translucentFaces = nullptr;
+		}
+		visibleFaces.Destroy();
+		drawableFaces.Destroy();
+		drawnFaces.Destroy();
+		visibleClusters.Destroy();
+		nextClusters.Destroy();
+		changedClusters.Destroy();
+		nodeCount = 0;
+		faceCount = 0;
+		drawFaceCount = 0;
+		batchCount = 0;
+		translucentFaceCount = 0;
+	}
+
+	// Store the view point and cluster.
+	int32_t ViewContext::SetView(const Vector3 &viewPoint, int32_t viewCluster)
+	{
+		this->viewPoint = viewPoint;
+		int32_t previousCluster = visibleCluster;
+		visibleCluster = viewCluster;
+		return previousCluster;
+	}
+
+	// Drop all visibility references.
+	void ViewContext::ResetVisibility()
+	{
+		memset(nodeCounts, 0, nodeCount * sizeof(uint8_t));
+		memset(faceCounts, 0, faceCount * sizeof(uint16_t));
+		visibleFaces.Clear();
+		visibleClusters.Clear();
+	}
+
+}
@@ -74,15 +74,22 @@ namespace Pack
 
 	// Read a file from the directory by its directory entry.
 	bool Directory::Read(const Entry *entry, FileData *out)
+	{
+		return Read(entry, entry->size, out);
+	}
+
+	// Read the start of a file, or all of it if it's shorter.
+	bool Directory::Read(const Entry *entry, int32_t size, FileData *out)
 	{
 		// Seek to the entry and read the file.
+		std::lock_guard<std::mutex> lock(fileLock);
 		if (!file.Seek(entry->offset, File::OffsetStart)) {
 			ErrorStack::Log("Failed to seek to offset %d in pack.", entry->offset);
 			return false;
 		}
 
 		// Read the entry into the output buffer.
-		int32_t entrySize = entry->size;
+		int32_t entrySize = (size < entry->size) ? size : entry->size;
 		if (!out->AllocateData(entrySize)) {
 			ErrorStack::Log("Failed to allocate buffer for entry in pack.");
 			return false;
@@ -128,12 +135,18 @@ namespace Pack
 	// Read a file from the pack.
 	// Fills out a file data handle to the file data in the pack.
 	bool Manager::Read(const char *filename, FileData *out)
+	{
+		return Read(filename, INT32_MAX, out);
+	}
+
+	// Read the start of a file from the first pack that has it.
+	bool Manager::Read(const char *filename, int32_t size, FileData *out)
 	{
 		// Check all the directories for the file.
 		for (Directory *directory = head; directory != nullptr; directory = directory->GetNext()) {
 			const Entry *entry = directory->FindEntry(filename);
 			if (entry != nullptr) {
-				if (!directory->Read(entry, out)) {
+				if (!directory->Read(entry, size, out)) {
 					ErrorStack::Log("Failed to read file from packs: %s.", filename);
 					return false;
 				}
@@ -1,5 +1,8 @@
 #include "pcx_parser.h"
 #include <error_stack.h>
+#include <memory_manager.h>
+#include <palette_expander.h>
+#include <string.h>
 
 namespace PCX
 {
@@ -119,41 +122,70 @@ namespace PCX
 	}
 
 	// Load the data to the image using a specific palette.
+	// Runs are decoded to palette indices with memset, then each scanline is expanded
+	// to colour in one pass; scanlines may be padded past the image width.
 	bool Parser::LoadHelper(const PixelRGB *palette, Image<PixelRGBA> *out)
 	{
 		// Size output image.
-		const uint16_t Width = header->endX - header->startX + 1;
-		const uint16_t Height = header->endY - header->startY + 1;
+		const int Width = header->endX - header->startX + 1;
+		const int Height = header->endY - header->startY + 1;
+		const int BytesPerLine = header->bytesPerLine;
+		if (BytesPerLine < Width) {
+			ErrorStack::Log("PCX scanlines of %d bytes are shorter than the image width %d.", BytesPerLine, Width);
+			return false;
+		}
 		if (!out->Initialize(Width, Height)) {
 			return false;
 		}
+		int indexCount = BytesPerLine * Height;
+		uint8_t *indices = reinterpret_cast<uint8_t*>(MemoryManager::Allocate(indexCount));
+		if (indices == nullptr) {
+			ErrorStack::Log("Failed to allocate %d PCX palette indices.", indexCount);
+			return false;
+		}
+
+		// Decode runs, stopping at the palette so a truncated file can't overrun.
 		const uint8_t *pixelData = reinterpret_cast<const uint8_t*>(header + 1);
-		PixelRGBA *outPixel = out->GetBuffer();
-		for (uint32_t i = (Width * Height); i != 0; --i) {
+		const uint8_t *pixelEnd = data + (dataLength - PaletteOffsetEnd);
+		int decodedCount = 0;
+		while ((decodedCount < indexCount) && (pixelData < pixelEnd)) {
 			uint8_t current = *pixelData++;
-			uint8_t runLength;
+			int runLength = 1;
 
 			// If run mask is set, we need to write a repeated value.
 			if ((current & RunMask) == RunMask) {
+				if (pixelData == pixelEnd) {
+					break;
+				}
 				runLength = current & (~RunMask);
 				current = *pixelData++;
 			}
-			else {
-				runLength = 1;
+			if (runLength > (indexCount - decodedCount)) {
+				runLength = indexCount - decodedCount;
 			}
+			memset(&indices[decodedCount], current, runLength);
+			decodedCount += runLength;
+		}
+		if (decodedCount != indexCount) {
+			MemoryManager::Free(indices);
+			ErrorStack::Log("PCX image data ended after %d of %d pixels.", decodedCount, indexCount);
+			return false;
+		}
 
-			// Write the value out.
-			while (runLength != 0) {
-				// Get the colour from the palette.
-				const PixelRGB *colour = &palette[current];
-				outPixel->r = colour->r;
-				outPixel->g = colour->g;
-				outPixel->b = colour->b;
-				outPixel->a = DefaultAlpha;
-				--runLength;
-				++outPixel;
-			}
+		// Widen the palette once so scanlines expand with whole colour lookups.
+		PixelRGBA colours[PaletteColours];
+		for (int i = 0; i < PaletteColours; ++i) {
+			colours[i].r = palette[i].r;
+			colours[i].g = palette[i].g;
+			colours[i].b = palette[i].b;
+			colours[i].a = DefaultAlpha;
+		}
+		PixelRGBA *outRow = out->GetBuffer();
+		const uint8_t *indexRow = indices;
+		for (int i = 0; i < Height; ++i, outRow += Width, indexRow += BytesPerLine) {
+			PaletteExpander::Expand(indexRow, Width, colours, outRow);
 		}
+		MemoryManager::Free(indices);
 		return true;
 	}
 
@@ -43,6 +43,15 @@ bool QuakeFileManager::Read(const char *filename, FileData *out)
 	return true;
 }
 
+// Read the start of a file from the packs.
+bool QuakeFileManager::Read(const char *filename, int32_t size, FileData *out)
+{
+	if (!packs.Read(filename, size, out)) {
+		return false;
+	}
+	return true;
+}
+
 QuakeFileManager::QuakeFileManager()
 {
 }
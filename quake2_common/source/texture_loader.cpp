@@ -0,0 +1,336 @@
+#include "pcx_parser.h"
+#include "quake_file_manager.h"
+#include "texture_loader.h"
+#include "wal_parser.h"
+#include <block_compressor.h>
+#include <compressed_texture_cache.h>
+#include <error_stack.h>
+#include <mip_map_generator.h>
+#include <new>
+#include <string.h>
+
+// Directory compressed textures are cached in.
+static const char CompressedCacheDirectory[] = "cache";
+
+TextureLoadJob::TextureLoadJob()
+	: loader(nullptr),
+	nextCompleted(nullptr),
+	owner(nullptr),
+	imageCount(0),
+	storage(RgbaStorage),
+	isDecoded(false)
+{
+}
+
+TextureLoadJob::~TextureLoadJob()
+{
+}
+
+// Store the image's name for the worker to read.
+bool TextureLoadJob::AddImage(TextureFormat format, const char *name)
+{
+	if (imageCount == MaximumImages) {
+		ErrorStack::Log("Texture load job can't hold more than %d images.", MaximumImages);
+		return false;
+	}
+	formats[imageCount] = format;
+	strncpy(names[imageCount], name, NameLength - 1);
+	names[imageCount][NameLength - 1] = '\0';
+	++imageCount;
+	return true;
+}
+
+// Read and decode each image, then hand the job back to the loader.
+// Compressed images are done together, since they have to agree on a format.
+void TextureLoadJob::Run()
+{
+	if (storage == CompressedStorage) {
+		isDecoded = CompressImages();
+		loader->Complete(this);
+		return;
+	}
+	isDecoded = true;
+	for (int32_t i = 0; (i < imageCount) && isDecoded; ++i) {
+		if ((storage == IndexedStorage) && (formats[i] == WalFormat)) {
+			WAL::Parser walParser;
+			isDecoded = walParser.ReadIndexed(names[i], &indexedImages[i]);
+		}
+		else {
+			isDecoded = DecodeImage(i);
+		}
+		if (!isDecoded) {
+			ErrorStack::Log("Failed to decode texture image %s.", names[i]);
+		}
+	}
+	loader->Complete(this);
+}
+
+// Staging memory for a job can be large, so it isn't kept between fills.
+void TextureLoadJob::Clear()
+{
+	for (int32_t i = 0; i < imageCount; ++i) {
+		images[i].Destroy();
+		indexedImages[i].Destroy();
+		compressedImages[i].Destroy();
+	}
+	owner = nullptr;
+	imageCount = 0;
+	storage = RgbaStorage;
+	isDecoded = false;
+}
+
+// Read the image with the parser for its format.
+bool TextureLoadJob::DecodeImage(int32_t index)
+{
+	if (formats[index] == WalFormat) {
+		WAL::Parser walParser;
+		return walParser.Read(names[index], &images[index]);
+	}
+	PCX::Parser pcxParser;
+	return pcxParser.Load(names[index], &images[index]);
+}
+
+// PCX images have no mip levels of their own, so they're generated from the decoded image.
+bool TextureLoadJob::DecodeMipMapped(int32_t index)
+{
+	if (formats[index] == WalFormat) {
+		return DecodeImage(index);
+	}
+	Image<PixelRGBA> image;
+	PCX::Parser pcxParser;
+	if (!pcxParser.Load(names[index], &image)) {
+		return false;
+	}
+	return MipMapGenerator::Generate(&image, &images[index]);
+}
+
+// The cache is keyed by the source file's contents, so edited files are encoded again.
+// WAL colours come from the shared palette, so it's part of their key too.
+// On a miss the parser reads the file a second time; that's small next to encoding.
+bool TextureLoadJob::HashSource(int32_t index, uint64_t *out)
+{
+	char path[NameLength + WAL::FullPathLength];
+	if (formats[index] == WalFormat) {
+		WAL::Parser::GetFullPath(names[index], path);
+	}
+	else {
+		strcpy(path, names[index]);
+	}
+	FileData source;
+	if (!QuakeFileManager::GetInstance()->Read(path, &source)) {
+		return false;
+	}
+	uint64_t hash = CompressedTextureCache::HashSource(source.GetData(), source.GetSize());
+	if (formats[index] == WalFormat) {
+		const uint8_t *palette = reinterpret_cast<const uint8_t*>(WAL::Parser::GetPalette());
+		int32_t paletteSize = WAL::Parser::GetPaletteSize() * static_cast<int32_t>(sizeof(PixelRGBA));
+		hash = CompressedTextureCache::HashSource(palette, paletteSize, hash);
+	}
+	*out = hash;
+	return true;
+}
+
+// Every layer of a texture array has to share a format, so the job's format is BC3
+// if any image is transparent or was cached as BC3, and BC1 otherwise.
+// Cached images in the other format are encoded again and replace their cache entries,
+// so later loads of the texture hit the cache again.
+bool TextureLoadJob::CompressImages()
+{
+	uint64_t hashes[MaximumImages];
+	bool isCached[MaximumImages];
+	CompressedFormat format = BC1Format;
+	for (int32_t i = 0; i < imageCount; ++i) {
+		if (!HashSource(i, &hashes[i])) {
+			ErrorStack::Log("Failed to read texture image %s.", names[i]);
+			return false;
+		}
+		isCached[i] = CompressedTextureCache::Load(CompressedCacheDirectory, hashes[i], &compressedImages[i]);
+		if (isCached[i]) {
+			if (compressedImages[i].GetFormat() == BC3Format) {
+				format = BC3Format;
+			}
+		}
+		else {
+			if (!DecodeMipMapped(i)) {
+				ErrorStack::Log("Failed to decode texture image %s.", names[i]);
+				return false;
+			}
+			if (BlockCompressor::ChooseFormat(&images[i]) == BC3Format) {
+				format = BC3Format;
+			}
+		}
+	}
+	for (int32_t i = 0; i < imageCount; ++i) {
+		if (isCached[i]) {
+			if (compressedImages[i].GetFormat() == format) {
+				continue;
+			}
+			compressedImages[i].Destroy();
+			if (!DecodeMipMapped(i)) {
+				ErrorStack::Log("Failed to decode texture image %s.", names[i]);
+				return false;
+			}
+		}
+		bool isCompressed = BlockCompressor::Compress(&images[i], format, &compressedImages[i]);
+		images[i].Destroy();
+		if (!isCompressed) {
+			ErrorStack::Log("Failed to compress texture image %s.", names[i]);
+			return false;
+		}
+
+		// Failing to write the cache only costs the next load.
+		CompressedTextureCache::Store(CompressedCacheDirectory, hashes[i], &compressedImages[i]);
+	}
+	return true;
+}
+
+TextureLoader::TextureLoader()
+	: jobs(nullptr),
+	jobCapacity(0),
+	jobCount(0),
+	startedCount(0),
+	returnedCount(0),
+	completedHead(nullptr),
+	completedTail(nullptr)
+{
+}
+
+TextureLoader::~TextureLoader()
+{
+	Finish();
+	delete[] jobs;
+}
+
+// Allocate the job storage.
+bool TextureLoader::Initialize(int32_t jobCapacity)
+{
+	jobs = new (std::nothrow) TextureLoadJob[jobCapacity];
+	if (jobs == nullptr) {
+		ErrorStack::Log("Failed to allocate %d texture load jobs.", jobCapacity);
+		return false;
+	}
+	this->jobCapacity = jobCapacity;
+	return true;
+}
+
+// Hand out the next unused job.
+TextureLoadJob *TextureLoader::AddJob()
+{
+	if (jobCount == jobCapacity) {
+		ErrorStack::Log("Texture loader can't hold more than %d jobs.", jobCapacity);
+		return nullptr;
+	}
+	TextureLoadJob *job = &jobs[jobCount++];
+	job->loader = this;
+	return job;
+}
+
+// Submit jobs added since the last start.
+void TextureLoader::Start()
+{
+	WorkerPool *pool = WorkerPool::instance;
+	if (pool == nullptr) {
+		return;
+	}
+	for (; startedCount < jobCount; ++startedCount) {
+		pool->Submit(&jobs[startedCount], &counter);
+	}
+}
+
+// Pop the oldest completed job, helping with queued decodes until one arrives.
+TextureLoadJob *TextureLoader::WaitNext()
+{
+	if (returnedCount == jobCount) {
+		return nullptr;
+	}
+
+	// Without a pool, decode the next job here.
+	Start();
+	WorkerPool *pool = WorkerPool::instance;
+	if ((pool == nullptr) && (startedCount < jobCount)) {
+		jobs[startedCount++].Run();
+	}
+
+	std::unique_lock<std::mutex> lock(completedLock);
+	while (completedHead == nullptr) {
+		lock.unlock();
+		bool ranJob = (pool != nullptr) && pool->RunQueuedJob();
+		lock.lock();
+
+		// Nothing left to run here, so a worker is decoding; wait for it.
+		if (!ranJob) {
+			while (completedHead == nullptr) {
+				completedSignal.wait(lock);
+			}
+		}
+	}
+	return PopCompleted();
+}
+
+// Poll for a decoded job so the calling thread can keep drawing while workers decode.
+TextureLoadJob *TextureLoader::TakeCompleted()
+{
+	if (returnedCount == jobCount) {
+		return nullptr;
+	}
+	Start();
+	if ((WorkerPool::instance == nullptr) && (startedCount < jobCount)) {
+		jobs[startedCount++].Run();
+	}
+	std::lock_guard<std::mutex> lock(completedLock);
+	if (completedHead == nullptr) {
+		return nullptr;
+	}
+	return PopCompleted();
+}
+
+// Drain the remaining jobs so none outlive the loader.
+// Workers touch the counter after handing a job back, so wait for it too.
+void TextureLoader::Finish()
+{
+	while (WaitNext() != nullptr) {
+	}
+	WorkerPool *pool = WorkerPool::instance;
+	if (pool != nullptr) {
+		pool->Wait(&counter);
+	}
+}
+
+// Jobs are reused from the start once every one has been handed back.
+void TextureLoader::Reset()
+{
+	Finish();
+	for (int32_t i = 0; i < jobCount; ++i) {
+		jobs[i].Clear();
+	}
+	jobCount = 0;
+	startedCount = 0;
+	returnedCount = 0;
+}
+
+// Queue a decoded job for the waiting thread.
+void TextureLoader::Complete(TextureLoadJob *job)
+{
+	std::lock_guard<std::mutex> lock(completedLock);
+	job->nextCompleted = nullptr;
+	if (completedTail != nullptr) {
+		completedTail->nextCompleted = job;
+	}
+	else {
+		completedHead = job;
+	}
+	completedTail = job;
+	completedSignal.notify_one();
+}
+
+// Hand back the head of the completed list.
+TextureLoadJob *TextureLoader::PopCompleted()
+{
+	TextureLoadJob *job = completedHead;
+	completedHead = job->nextCompleted;
+	if (completedHead == nullptr) {
+		completedTail = nullptr;
+	}
+	++returnedCount;
+	return job;
+}
@@ -2,6 +2,7 @@
 #include "pcx_parser.h"
 #include "quake_file_manager.h"
 #include "wal_parser.h"
+#include <palette_expander.h>
 #include <string.h>
 
 namespace WAL
@@ -13,8 +14,9 @@ namespace WAL
 	// WAL string constants.
 	static const char TextureDirectory[] = "textures/";
 	static const char TextureExtension[] = ".wal";
-	static const int FullPathLength =
-		WAL::NameLength + (sizeof(TextureDirectory) - 1) + (sizeof(TextureExtension) - 1);
+	static_assert(
+		FullPathLength > (NameLength + (sizeof(TextureDirectory) - 1) + (sizeof(TextureExtension) - 1)),
+		"WAL path length doesn't fit texture directory and extension.");
 
 	// WAL generic colour map.
 	static Image<PixelRGBA> palette;
@@ -65,6 +67,18 @@ namespace WAL
 		palette.Destroy();
 	}
 
+	// Get the palette's colours.
+	const PixelRGBA *Parser::GetPalette()
+	{
+		return palette.GetBuffer();
+	}
+
+	// Get the number of colours in the palette.
+	int Parser::GetPaletteSize()
+	{
+		return palette.GetWidth() * palette.GetHeight();
+	}
+
 	Parser::Parser()
 	{
 	}
@@ -73,37 +87,109 @@ namespace WAL
 	{
 	}
 
+	// Add the texture directory and extension.
+	void Parser::GetFullPath(const char *filename, char fullPath[FullPathLength])
+	{
+		sprintf(fullPath, "%s%s%s", TextureDirectory, filename, TextureExtension);
+	}
+
 	// Parse a WAL file into an image buffer.
 	bool Parser::Read(const char *filename, Image<PixelRGBA> *out)
 	{
-		// Open the WAL file.
+		FileData walData;
+		const uint8_t *data = ReadLevels(filename, &walData, out);
+		if (data == nullptr) {
+			return false;
+		}
+
+		// Copy each level's data using palette.
+		const Header *header = reinterpret_cast<const Header*>(data);
+		const PixelRGBA *paletteArray = palette.GetBuffer();
+		for (int i = 0; i < out->GetLevelCount(); ++i) {
+			int pixelCount = out->GetLevelWidth(i) * out->GetLevelHeight(i);
+			PaletteExpander::Expand(data + header->offset[i], pixelCount, paletteArray, out->GetLevelBuffer(i));
+		}
+		return true;
+	}
+
+	// Parse a WAL file, keeping its palette indices.
+	bool Parser::ReadIndexed(const char *filename, Image<uint8_t> *out)
+	{
+		FileData walData;
+		const uint8_t *data = ReadLevels(filename, &walData, out);
+		if (data == nullptr) {
+			return false;
+		}
+
+		// Copy each level's data as is.
+		const Header *header = reinterpret_cast<const Header*>(data);
+		for (int i = 0; i < out->GetLevelCount(); ++i) {
+			int pixelCount = out->GetLevelWidth(i) * out->GetLevelHeight(i);
+			memcpy(out->GetLevelBuffer(i), data + header->offset[i], pixelCount);
+		}
+		return true;
+	}
+
+	// Only the header is read, so none of the levels are loaded or decoded.
+	bool Parser::ReadSize(const char *filename, int *width, int *height)
+	{
 		char fullPath[FullPathLength];
-		sprintf(fullPath, "%s%s%s", TextureDirectory, filename, TextureExtension);
-		QuakeFileManager *quakeFiles = QuakeFileManager::GetInstance();
+		GetFullPath(filename, fullPath);
 		FileData walData;
-		if (!quakeFiles->Read(fullPath, &walData)) {
+		if (!QuakeFileManager::GetInstance()->Read(fullPath, sizeof(Header), &walData)) {
+			return false;
+		}
+		if (walData.GetSize() < static_cast<int>(sizeof(Header))) {
+			ErrorStack::Log("WAL texture %s is too small for its header.", filename);
 			return false;
 		}
 		const Header *header = reinterpret_cast<const Header*>(walData.GetData());
+		int headerWidth = static_cast<int>(header->width);
+		int headerHeight = static_cast<int>(header->height);
+		if ((headerWidth <= 0) || (headerHeight <= 0)) {
+			ErrorStack::Log("WAL texture %s has a bad size of %d by %d.", filename, headerWidth, headerHeight);
+			return false;
+		}
+		*width = headerWidth;
+		*height = headerHeight;
+		return true;
+	}
+
+	// Open the WAL file and check every level fits in it.
+	template <typename PixelType>
+	const uint8_t *Parser::ReadLevels(const char *filename, FileData *walData, Image<PixelType> *out)
+	{
+		// Open the WAL file.
+		char fullPath[FullPathLength];
+		GetFullPath(filename, fullPath);
+		QuakeFileManager *quakeFiles = QuakeFileManager::GetInstance();
+		if (!quakeFiles->Read(fullPath, walData)) {
+			return nullptr;
+		}
+		const uint8_t *data = reinterpret_cast<const uint8_t*>(walData->GetData());
+		const Header *header = reinterpret_cast<const Header*>(data);
 
-		// Resize output image for data.
+		// Resize output image for data and its precomputed mip levels.
+		// Small textures stop once a level would go below a pixel.
 		int width = static_cast<int>(header->width);
 		int height = static_cast<int>(header->height);
-		if (!out->Initialize(width, height)) {
+		int levelCount = Image<PixelType>::GetFullLevelCount(width, height);
+		if (levelCount > MipMapLevelCount) {
+			levelCount = MipMapLevelCount;
+		}
+		if (!out->Initialize(width, height, levelCount)) {
 			ErrorStack::Log("Failed to size buffer for WAL image.");	
-			return false;
+			return nullptr;
 		}
-
-		// Copy data using palette.
-		int32_t textureOffset = header->offset[0];
-		int pixelCount = width * height;
-		const uint8_t *inPixel = reinterpret_cast<const uint8_t*>(walData.GetData() + textureOffset);
-		PixelRGBA *outPixel = out->GetBuffer();
-		const PixelRGBA *paletteArray = palette.GetBuffer();
-		for (int i = 0; i < pixelCount; ++i) {
-			*outPixel++ = paletteArray[*inPixel++];
+		for (int i = 0; i < levelCount; ++i) {
+			int32_t textureOffset = header->offset[i];
+			int pixelCount = out->GetLevelWidth(i) * out->GetLevelHeight(i);
+			if ((textureOffset < 0) || ((textureOffset + pixelCount) > walData->GetSize())) {
+				ErrorStack::Log("WAL texture %s has mip level %d outside the file.", filename, i);
+				return nullptr;
+			}
 		}
-		return true;
+		return data;
 	}
 
 }
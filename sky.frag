@@ -0,0 +1,36 @@
+#version 120
+
+varying vec3 psDirection;
+
+// Sky box sides for the +X, -X, +Y, -Y, +Z and -Z Quake axes, three across and two down.
+uniform sampler2D sky;
+
+// Half a texel of a side, to keep filtering off the neighbouring sides.
+uniform float texelInset;
+
+void main(void) {
+	// Sides are laid out along Quake axes, so convert from engine axes.
+	vec3 direction = vec3(-psDirection.z, -psDirection.x, psDirection.y);
+	vec3 size = abs(direction);
+
+	// Project onto the side of the largest axis, as the original sky box does.
+	float side;
+	vec2 st;
+	if ((size.x >= size.y) && (size.x >= size.z)) {
+		side = (direction.x > 0.0) ? 0.0 : 1.0;
+		st = vec2((direction.x > 0.0) ? -direction.y : direction.y, direction.z) / size.x;
+	}
+	else if (size.y >= size.z) {
+		side = (direction.y > 0.0) ? 2.0 : 3.0;
+		st = vec2((direction.y > 0.0) ? direction.x : -direction.x, direction.z) / size.y;
+	}
+	else {
+		side = (direction.z > 0.0) ? 4.0 : 5.0;
+		st = vec2(-direction.y, (direction.z > 0.0) ? -direction.x : direction.x) / size.z;
+	}
+
+	// Image rows run down the side, so flip the vertical coordinate.
+	vec2 uv = clamp(vec2(st.x + 1.0, 1.0 - st.y) * 0.5, texelInset, 1.0 - texelInset);
+	uv = (uv + vec2(mod(side, 3.0), floor(side / 3.0))) / vec2(3.0, 2.0);
+	gl_FragColor = texture2D(sky, uv);
+}
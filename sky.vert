@@ -0,0 +1,19 @@
+#version 120
+
+// Input and output attributes.
+// Positions are in quarters of a unit, as in the world vertex format.
+attribute vec4 position;
+varying vec3 psDirection;
+
+const float positionScale = 1.0 / 4.0;
+
+// Camera view variables.
+uniform mat4 projectionView;
+uniform vec3 viewPoint;
+
+// Pass the direction from the view point to the sky box lookup.
+void main(void) {
+	vec3 worldPosition = position.xyz * positionScale;
+	gl_Position = projectionView * vec4(worldPosition, 1.0);
+	psDirection = worldPosition - viewPoint;
+}